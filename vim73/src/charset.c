@@ -74,6 +74,11 @@ buf_init_chartab(buf, global)
     int		tilde;
     int		do_isalpha;
 
+#ifdef FEAT_SEARCH_EXTRA
+    /* Matches for "\k", "\<", "\i", etc. may differ now. */
+    hl_cache_clear_all();
+#endif
+
     if (global)
     {
 	/*
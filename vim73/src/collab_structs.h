@@ -20,6 +20,7 @@
 #define VIM_COLLAB_STRUCTS_H_
 
 #include <pthread.h>
+#include <semaphore.h>
 #include "vim.h"
 
 /*
@@ -30,9 +31,13 @@ typedef enum {
   COLLAB_APPEND_LINE, /* A new line was added to the document. */
   COLLAB_INSERT_TEXT, /* Text was inserted into an existing line. */
   COLLAB_REMOVE_LINE, /* A line was removed from the document. */
+  COLLAB_REMOVE_LINES, /* A range of lines was removed from the document. */
   COLLAB_DELETE_TEXT, /* Text was deleted from an existing line. */
   COLLAB_BUFFER_SYNC, /* A new document was opened or needs syncing. */
-  COLLAB_REPLACE_LINE /* A line was replaced with new text. */
+  COLLAB_REPLACE_LINE, /* A line was replaced with new text. */
+  COLLAB_BUFFER_OPEN, /* A document is being loaded, show a cached copy. */
+  COLLAB_SNAPSHOT,    /* The buffer may be cached at a model revision. */
+  COLLAB_BUFFER_CLOSE /* The buffer was wiped, its ID may be reused. */
 } collabtype_T;
 
 /*
@@ -60,6 +65,11 @@ typedef struct collabedit_S {
       linenr_T line;  /* The line to remove from the document. */
     } remove_line;
 
+    struct {          /* Type: COLLAB_REMOVE_LINES */
+      linenr_T line;  /* The first line to remove from the document. */
+      long count;     /* The number of lines to remove. */
+    } remove_lines;
+
     struct {          /* Type: COLLAB_DELETE_TEXT */
       linenr_T line;  /* The line to remove text from. */
       colnr_T index;  /* The starting character in the line to remove. */
@@ -74,10 +84,25 @@ typedef struct collabedit_S {
 
     struct {            /* Type: COLLAB_BUFFER_SYNC */
       char_u *filename; /* The local filename. */
-      linenr_T nlines;  /* The number of lines in the document. */
+      char_u *doc_id;   /* The Realtime document ID, or NULL. */
+      char_u *revision; /* Incoming: the model revision 'lines' are from.
+                           Outgoing: the revision of the cached snapshot that
+                           is shown, or NULL if there is none. */
+      linenr_T nlines;  /* The number of lines in the document, or -1 when
+                           the cached snapshot is already at 'revision'. */
       char_u **lines;   /* The initial lines in the document. */
     } buffer_sync;
 
+    struct {            /* Type: COLLAB_BUFFER_OPEN */
+      char_u *doc_id;   /* The Realtime document ID to show a cache of. */
+    } buffer_open;
+
+    struct {            /* Type: COLLAB_SNAPSHOT */
+      char_u *revision; /* Incoming: the model revision that includes every
+                           edit sent before the request, or NULL if the model
+                           has unsaved changes. Outgoing: unused. */
+    } snapshot;
+
     struct {            /* Type: COLLAB_CURSOR_MOVE */
       char_u *user_id;  /* A unique string for each editor's cursor. Must match
                            regex "[a-zA-Z0-9_]*".
@@ -111,5 +136,58 @@ typedef struct editqueue_S {
                               for each event in the queue. */
 } editqueue_T;
 
+/*
+ * The number of slots in an editring_T. Must be a power of two.
+ */
+#define EDITRING_SIZE 1024
+
+/*
+ * The number of bytes for the strings of the edits in an editring_T.
+ */
+#define EDITRING_TEXTSIZE 65536
+
+/*
+ * A ring of edits passed from one producer thread to one consumer thread
+ * without locking. Each side only writes its own index and reads the other one
+ * atomically. The strings of the edits in the ring are copied into 'text'.
+ * When the ring is full, or an edit doesn't fit in 'text', edits are put on
+ * the overflow list instead, which is locked. The producer never waits.
+ */
+typedef struct editring_S {
+  collabedit_T slots[EDITRING_SIZE];
+  unsigned int text_ends[EDITRING_SIZE];
+                          /* For each slot: 'text_tail' after its strings. */
+  char_u text[EDITRING_TEXTSIZE];
+                          /* The strings of the edits in 'slots'. */
+  unsigned int head;      /* The next slot to pop. Only written by the
+                             consumer. */
+  unsigned int tail;      /* The next slot to push to. Only written by the
+                             producer. */
+  unsigned int text_head; /* Bytes of 'text' released. Only written by the
+                             consumer. */
+  unsigned int text_tail; /* Bytes of 'text' used. Only written by the
+                             producer. */
+
+  pthread_mutex_t overflow_mutex;
+                          /* Lock before using the overflow list. */
+  editnode_T *overflow_head;
+                          /* Edits that didn't fit, they own their strings. */
+  editnode_T *overflow_tail;
+  int overflowing;        /* TRUE while the overflow list isn't empty. Only
+                             set by the producer, so that later edits go to
+                             the list too. */
+  editnode_T *spilled;    /* Edits taken from the overflow list and not popped
+                             yet. Only used by the consumer. */
+  int popped_spilled;     /* TRUE when the last popped edit owns its strings.
+                             Only used by the consumer. */
+  unsigned int popped_text_end;
+                          /* 'text_ends' of the last popped edit. Only used by
+                             the consumer. */
+
+  int consumer_waiting;   /* TRUE while the consumer may sleep on 'wakeup'
+                             because the ring was empty. */
+  sem_t wakeup;           /* Posted by the producer to wake the consumer. */
+} editring_T;
+
 #endif // VIM_COLLAB_STRUCTS_H_
 
@@ -28,5 +28,13 @@
  */
 collabedit_T* collab_dequeue(editqueue_T *queue);
 
+#ifdef FEAT_RELTIME
+/*
+ * Returns TRUE when the time slice "tm" of collab_applyedits has run out.
+ * Points to profile_passed_limit, tests replace it to control the clock.
+ */
+extern int (*collab_timeup)(proftime_T *tm);
+#endif
+
 #endif // VIM_COLLAB_UTIL_H_
 
@@ -41,29 +41,61 @@ static const size_t collab_keys_length =
   sizeof(collab_keys) / sizeof(collab_keys[0]);
 /* The next key in the sequence to send to the user input buffer */
 static int next_key_index = -1;
+/* TRUE when the last call to collab_applyedits ran out of its 'collabtime'
+   slice with edits left over. Typed keys are then given the next turn. */
+static int yield_to_input = FALSE;
 
-/* An array of buf_T* to track collaborative events for. */
-static buf_T **collab_bufs;
+#ifdef FEAT_RELTIME
+/* Declaration in collab_util.h */
+int (*collab_timeup)(proftime_T *tm) = profile_passed_limit;
+#endif
+
+/*
+ * The collaboration state of a buffer.
+ */
+struct collabbuf_S {
+  buf_T *buf;         /* The buffer, or NULL if the ID isn't used. */
+  char_u *doc_id;     /* The Realtime document ID, or NULL if unknown. */
+  char_u *revision;   /* The model revision of the cached snapshot of the
+                         buffer, or NULL if there is none. */
+  int synced;         /* TRUE once the buffer was synced with the model. */
+  int showing_cache;  /* TRUE while a cached snapshot is shown, in which case
+                         the buffer is made 'nomodifiable'. */
+  int snapshot_tick;  /* b_changedtick when the cached snapshot was made. */
+  int request_tick;   /* b_changedtick when a snapshot was last requested. */
+  int snapshot_pending; /* TRUE while waiting for a COLLAB_SNAPSHOT reply. */
+  int closed;         /* TRUE when the buffer was wiped. Edits still coming in
+                         for it are dropped until the ID is reused. */
+};
+
+/* An array of buffers to track collaborative events for, indexed by buffer
+   ID. Entries of wiped buffers are cleared so that their ID can be reused. */
+static struct collabbuf_S *collab_bufs;
 /* The length of collab_bufs. */
 static int collab_capacity = 0;
-/* The number of collaborative buf_T's. */
-static int num_bufs = 0;
+
+/* The directory holding cached snapshots of documents, or NULL when
+   snapshots aren't kept. */
+static char *snapshot_dir = NULL;
 
 /*
  * Creates a new default buffer to track collabedit_T events for. The new buffer
  * will be referenced by 'buffer_id'. It is opened with the filename 'fname'.
- * TODO(zpotter): Add a way to close and reclaim buffer ID's.
+ * The ID of a wiped buffer may be passed to reuse it, see
+ * collab_buffer_free().
  */
 void collab_newbuf(int buffer_id, char_u *fname) {
   if (buffer_id >= collab_capacity) {
     // Grow collab_bufs array.
     size_t newlen = MAX(2 * collab_capacity, buffer_id + 1);
-    collab_bufs = realloc(collab_bufs, newlen);
+    collab_bufs = realloc(collab_bufs, newlen * sizeof(struct collabbuf_S));
+    memset(collab_bufs + collab_capacity, 0,
+           (newlen - collab_capacity) * sizeof(struct collabbuf_S));
     collab_capacity = newlen;
   }
-  // Create and store the new buffer.
-  collab_bufs[buffer_id] = buflist_new(fname, NULL, 1, 0);
-  ++num_bufs;
+  // Create and store the new buffer, starting with fresh sync state.
+  collab_bufs[buffer_id].closed = FALSE;
+  collab_bufs[buffer_id].buf = buflist_new(fname, NULL, 1, 0);
 }
 
 /*
@@ -71,11 +103,12 @@ void collab_newbuf(int buffer_id, char_u *fname) {
  * Returns TRUE on a successful switch or FALSE if ID doesn't match a buffer.
  */
 int collab_setbuf(int buffer_id) {
-  if (buffer_id >= num_bufs || !collab_bufs[buffer_id])
+  if (buffer_id < 0 || buffer_id >= collab_capacity ||
+      !collab_bufs[buffer_id].buf)
     return FALSE;
   // Only call set_curbuf if actually switching to a different buffer.
-  if (curbuf != collab_bufs[buffer_id])
-    set_curbuf(collab_bufs[buffer_id], DOBUF_GOTO);
+  if (curbuf != collab_bufs[buffer_id].buf)
+    set_curbuf(collab_bufs[buffer_id].buf, DOBUF_GOTO);
   return TRUE;
 }
 
@@ -84,13 +117,287 @@ int collab_setbuf(int buffer_id) {
  * collaborative buffer.
  */
 int collab_get_id(buf_T *buf) {
-  for (int bid = 0; bid < num_bufs; ++bid) {
-    if (collab_bufs[bid] == buf)
+  for (int bid = 0; bid < collab_capacity; ++bid) {
+    if (collab_bufs[bid].buf == buf)
       return bid;
   }
   return -1;
 }
 
+/*
+ * Stops collaborating on 'buf', which is being wiped out. Tells JS that the
+ * buffer is closed, so that it closes the document and may reuse the buffer
+ * ID for the next document that is opened.
+ */
+void collab_buffer_free(buf_T *buf) {
+  int bid = collab_get_id(buf);
+  if (bid < 0)
+    return;
+  struct collabbuf_S *cbuf = &collab_bufs[bid];
+  free(cbuf->doc_id);
+  free(cbuf->revision);
+  memset(cbuf, 0, sizeof(struct collabbuf_S));
+  cbuf->closed = TRUE;
+
+  collabedit_T close_request = {
+    .type = COLLAB_BUFFER_CLOSE,
+    .buf_id = bid
+  };
+  collab_remoteapply(&close_request);
+}
+
+/*
+ * Sets the directory to keep cached snapshots of documents in. With a
+ * snapshot, a document is shown right away when it is opened again, before
+ * the Realtime model has loaded. Pass NULL to stop keeping snapshots.
+ */
+void collab_set_snapshot_dir(const char *dir) {
+  free(snapshot_dir);
+  snapshot_dir = NULL;
+  if (dir != NULL) {
+    snapshot_dir = malloc(strlen(dir) + 1);
+    strcpy(snapshot_dir, dir);
+  }
+}
+
+/*
+ * Returns the malloc'ed path of the snapshot file for 'doc_id', or NULL if
+ * snapshots aren't kept or 'doc_id' can't be used as a file name.
+ */
+static char *snapshot_path(const char_u *doc_id) {
+  if (snapshot_dir == NULL || doc_id == NULL || *doc_id == NUL ||
+      *doc_id == '.' || vim_strchr((char_u *)doc_id, '/') != NULL)
+    return NULL;
+  char *path = malloc(strlen(snapshot_dir) + STRLEN(doc_id) + 2);
+  sprintf(path, "%s/%s", snapshot_dir, (char *)doc_id);
+  return path;
+}
+
+/*
+ * Snapshot files start with this line. The next line holds the model revision,
+ * which can be of any length, and the one after that the number of lines. Each line of text follows as
+ * its length in bytes, a space, the text and a newline.
+ */
+static const char snapshot_magic[] = "VimCollabSnapshot 1\n";
+
+/*
+ * Writes all lines of the buffer in 'cbuf' to its snapshot file, recording
+ * that they are the model at 'revision'. The file is replaced atomically, so
+ * that an interrupted write leaves the previous snapshot.
+ * Returns OK or FAIL.
+ */
+static int write_snapshot(struct collabbuf_S *cbuf, char_u *revision) {
+  buf_T *buf = cbuf->buf;
+  char *path = snapshot_path(cbuf->doc_id);
+  if (path == NULL || buf->b_ml.ml_mfp == NULL) {
+    free(path);
+    return FAIL;
+  }
+  char *tmp = malloc(strlen(path) + 5);
+  sprintf(tmp, "%s.new", path);
+
+  int ret = FAIL;
+  FILE *fd = mch_fopen(tmp, "w");
+  if (fd != NULL) {
+    fputs(snapshot_magic, fd);
+    fprintf(fd, "%s\n%ld\n", (char *)revision, (long)buf->b_ml.ml_line_count);
+    for (linenr_T lnum = 1; lnum <= buf->b_ml.ml_line_count; ++lnum) {
+      char_u *line = ml_get_buf(buf, lnum, FALSE);
+      size_t len = STRLEN(line);
+      fprintf(fd, "%ld ", (long)len);
+      fwrite(line, 1, len, fd);
+      fputc('\n', fd);
+    }
+    int write_error = ferror(fd);
+    if (fclose(fd) == 0 && !write_error && mch_rename(tmp, path) == 0)
+      ret = OK;
+  }
+  if (ret == FAIL)
+    mch_remove((char_u *)tmp);
+  free(tmp);
+  free(path);
+  return ret;
+}
+
+/*
+ * Reads a line of any length from 'fd' and returns it as a malloc'ed string
+ * without the newline.
+ * Returns NULL at the end of the file, for a read error or when out of memory.
+ */
+static char_u *read_snapshot_line(FILE *fd) {
+  size_t size = 32;
+  size_t len = 0;
+  char_u *line = malloc(size);
+  int c;
+  while (line != NULL && (c = fgetc(fd)) != '\n') {
+    if (c == EOF) {
+      free(line);
+      return NULL;
+    }
+    if (len + 1 == size) {
+      char_u *bigger = realloc(line, size * 2);
+      if (bigger == NULL)
+        free(line);
+      line = bigger;
+      size *= 2;
+      if (line == NULL)
+        break;
+    }
+    line[len++] = c;
+  }
+  if (line != NULL)
+    line[len] = NUL;
+  return line;
+}
+
+/*
+ * Reads the snapshot of document 'doc_id'. On success 'revision' is set to
+ * the model revision of the snapshot, 'nlines' to the number of lines and
+ * 'lines' to an array of the lines. The caller takes ownership of the malloc'ed
+ * strings and the array. The numbers in the file are checked against its size,
+ * so that a damaged file doesn't make us allocate a huge amount of memory.
+ * Returns OK, or FAIL if there is no usable snapshot.
+ */
+static int read_snapshot(const char_u *doc_id, char_u **revision,
+                         linenr_T *nlines, char_u ***lines) {
+  char *path = snapshot_path(doc_id);
+  if (path == NULL)
+    return FAIL;
+  FILE *fd = mch_fopen(path, "r");
+  free(path);
+  if (fd == NULL)
+    return FAIL;
+
+  char header[sizeof(snapshot_magic)];
+  char_u *rev = NULL;
+  long count = 0;
+  long size = 0;
+  long read_lines = 0;
+  char_u **text = NULL;
+  if (fgets(header, sizeof(header), fd) == NULL ||
+      strcmp(header, snapshot_magic) != 0 ||
+      (rev = read_snapshot_line(fd)) == NULL ||
+      fscanf(fd, "%ld", &count) != 1 || count < 1 || fgetc(fd) != '\n')
+    goto theend;
+
+  // Every line takes at least three bytes: "0 \n".
+  long start = ftell(fd);
+  if (start < 0 || fseek(fd, 0L, SEEK_END) != 0 ||
+      (size = ftell(fd)) < start || fseek(fd, start, SEEK_SET) != 0 ||
+      count > (size - start) / 3 || count > (long)MAXLNUM)
+    goto theend;
+
+  text = calloc(count, sizeof(char_u *));
+  if (text == NULL)
+    goto theend;
+  for (; read_lines < count; ++read_lines) {
+    long len;
+    if (fscanf(fd, "%ld", &len) != 1 || len < 0 || len > size ||
+        fgetc(fd) != ' ')
+      break;
+    char_u *line = malloc(len + 1);
+    if (line == NULL || (long)fread(line, 1, len, fd) != len ||
+        fgetc(fd) != '\n') {
+      free(line);
+      break;
+    }
+    line[len] = NUL;
+    text[read_lines] = line;
+  }
+
+theend:
+  fclose(fd);
+  if (text == NULL || read_lines < count) {
+    // Missing or damaged snapshot.
+    for (long i = 0; i < read_lines; ++i)
+      free(text[i]);
+    free(text);
+    free(rev);
+    return FAIL;
+  }
+  *revision = rev;
+  *nlines = count;
+  *lines = text;
+  return OK;
+}
+
+/*
+ * Makes the lines of curbuf equal to the 'nlines' strings in 'lines'. Lines
+ * that already have the right text are left alone, so that bringing a buffer
+ * that is mostly up to date in sync is cheap. Takes ownership of the strings
+ * and of the 'lines' array itself.
+ */
+static void sync_lines(linenr_T nlines, char_u **lines) {
+  linenr_T cur_nlines = curbuf->b_ml.ml_line_count;
+  linenr_T first_changed = 0;
+  if ((curbuf->b_ml.ml_flags & ML_EMPTY) && nlines > 0) {
+    // Load an empty buffer in bulk, then delete its empty line like readfile.
+    ml_bulk_begin(curbuf);
+    for (linenr_T i = 0; i < nlines; ++i) {
+      ml_append_collab(i, lines[i], 0, FALSE, FALSE);
+      free(lines[i]);
+    }
+    ml_bulk_end(curbuf);
+    ml_delete_collab(nlines + 1, FALSE, FALSE);
+    free(lines);
+    changed_lines(1, 0, 2, (long)(nlines - 1));
+    return;
+  }
+  // Replace any lines that differ from lines already in the buffer.
+  for (linenr_T i = 1; i <= cur_nlines && i <= nlines; ++i) {
+    if (STRCMP(ml_get(i), lines[i - 1]) == 0) {
+      free(lines[i - 1]);
+    } else {
+      // ml_replace_collab takes ownership of the line.
+      ml_replace_collab(i, lines[i - 1], FALSE, FALSE);
+      if (first_changed == 0)
+        first_changed = i;
+    }
+  }
+  // Note that only one of the next two loops will execute their bodies.
+  // Append any extra new lines.
+  for (linenr_T i = cur_nlines; i < nlines; ++i) {
+    // The first param of this function is the line number to append after.
+    ml_append_collab(i, lines[i], 0, FALSE, FALSE);
+    free(lines[i]);
+  }
+  // Delete any extra old lines, from the end so no lines are moved.
+  for (linenr_T i = cur_nlines; i > nlines; --i) {
+    ml_delete_collab(i, FALSE, FALSE);
+  }
+  free(lines);
+
+  if (cur_nlines != nlines && first_changed == 0)
+    first_changed = MIN(cur_nlines, nlines) + 1;
+  // Mark lines for redraw.
+  if (first_changed > 0) {
+    if (curwin->w_cursor.lnum > curbuf->b_ml.ml_line_count)
+      curwin->w_cursor.lnum = curbuf->b_ml.ml_line_count;
+    changed_lines(first_changed, 0, cur_nlines + 1, (long)(nlines - cur_nlines));
+  }
+}
+
+/*
+ * Redraw bookkeeping for one buffer while a batch of edits is applied. The
+ * fields work like b_mod_top, b_mod_bot and b_mod_xlines in buf_T.
+ */
+struct collabbatch_S {
+  buf_T *buf;     /* The buffer the changes were made in. */
+  linenr_T top;   /* The first changed line. */
+  colnr_T col;    /* The column of the change in line 'top'. */
+  linenr_T bot;   /* The line below the last changed line, after the change. */
+  long xtra;      /* The net number of lines added. */
+};
+
+/* TRUE while collab_applyedits is collecting changes in 'batches'. */
+static int batching = FALSE;
+/* One entry for each buffer changed in the current batch. */
+static struct collabbatch_S *batches = NULL;
+/* The number of entries in 'batches'. */
+static size_t num_batches = 0;
+/* The number of entries able to be held in 'batches'. */
+static size_t batch_capacity = 0;
+
 /* The last known position of the local user's cursor. */
 static pos_T last_pos;
 
@@ -135,10 +442,9 @@ void collab_init() {
     fcntl(collab_queue.event_read_fd, F_SETFL, O_NONBLOCK);
   }
   // Set up curbuf as first collaborative buffer.
-  collab_bufs = malloc(sizeof(buf_T*));
+  collab_bufs = calloc(1, sizeof(struct collabbuf_S));
   collab_capacity = 1;
-  num_bufs = 1;
-  collab_bufs[0] = curbuf;
+  collab_bufs[0].buf = curbuf;
 }
 
 /*
@@ -173,6 +479,283 @@ void collab_enqueue(editqueue_T *queue, collabedit_T *cedit) {
   write(queue->event_write_fd, "X", 1);
 }
 
+/*
+ * Returns a malloc'ed copy of 'str', or NULL if 'str' is NULL.
+ */
+static char_u *copystr(const char_u *str) {
+  if (str == NULL)
+    return NULL;
+  char_u *copy = malloc(STRLEN(str) + 1);
+  STRCPY(copy, str);
+  return copy;
+}
+
+/*
+ * Frees the strings owned by 'cedit', but not 'cedit' itself.
+ */
+void collab_freestrings(collabedit_T *cedit) {
+  switch (cedit->type) {
+    case COLLAB_CURSOR_MOVE:
+      free(cedit->cursor_move.user_id);
+      break;
+    case COLLAB_APPEND_LINE:
+      free(cedit->append_line.text);
+      break;
+    case COLLAB_INSERT_TEXT:
+      free(cedit->insert_text.text);
+      break;
+    case COLLAB_REPLACE_LINE:
+      free(cedit->replace_line.text);
+      break;
+    case COLLAB_BUFFER_OPEN:
+      free(cedit->buffer_open.doc_id);
+      break;
+    case COLLAB_BUFFER_SYNC:
+      free(cedit->buffer_sync.filename);
+      free(cedit->buffer_sync.doc_id);
+      free(cedit->buffer_sync.revision);
+      for (linenr_T i = 0; i < cedit->buffer_sync.nlines; ++i)
+        free(cedit->buffer_sync.lines[i]);
+      free(cedit->buffer_sync.lines);
+      break;
+    case COLLAB_SNAPSHOT:
+      free(cedit->snapshot.revision);
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+ * Frees 'cedit' and the strings it owns without applying it.
+ */
+static void dropedit(collabedit_T *cedit) {
+  collab_freestrings(cedit);
+  free(cedit);
+}
+
+/*
+ * Prepares an empty editring_T.
+ */
+void collab_ring_init(editring_T *ring) {
+  ring->head = 0;
+  ring->tail = 0;
+  ring->text_head = 0;
+  ring->text_tail = 0;
+  pthread_mutex_init(&ring->overflow_mutex, NULL);
+  ring->overflow_head = NULL;
+  ring->overflow_tail = NULL;
+  ring->overflowing = FALSE;
+  ring->spilled = NULL;
+  ring->popped_spilled = FALSE;
+  ring->popped_text_end = 0;
+  ring->consumer_waiting = FALSE;
+  sem_init(&ring->wakeup, 0, 0);
+}
+
+/*
+ * Stores pointers to the string fields of 'cedit' in 'fields', which must
+ * have room for three. The lines of a COLLAB_BUFFER_SYNC are not included.
+ * Returns the number of fields.
+ */
+static int string_fields(collabedit_T *cedit, char_u ***fields) {
+  switch (cedit->type) {
+    case COLLAB_CURSOR_MOVE:
+      fields[0] = &cedit->cursor_move.user_id;
+      return 1;
+    case COLLAB_APPEND_LINE:
+      fields[0] = &cedit->append_line.text;
+      return 1;
+    case COLLAB_INSERT_TEXT:
+      fields[0] = &cedit->insert_text.text;
+      return 1;
+    case COLLAB_REPLACE_LINE:
+      fields[0] = &cedit->replace_line.text;
+      return 1;
+    case COLLAB_BUFFER_OPEN:
+      fields[0] = &cedit->buffer_open.doc_id;
+      return 1;
+    case COLLAB_BUFFER_SYNC:
+      fields[0] = &cedit->buffer_sync.filename;
+      fields[1] = &cedit->buffer_sync.doc_id;
+      fields[2] = &cedit->buffer_sync.revision;
+      return 3;
+    case COLLAB_SNAPSHOT:
+      fields[0] = &cedit->snapshot.revision;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Copies the strings of 'slot' into the 'text' of 'ring' and makes 'slot'
+ * point to the copies. The strings are kept together, so that they can be
+ * released at once: 'text_end' is set to the 'text_tail' after them.
+ * Returns FALSE, leaving the strings of 'slot' alone, if there isn't enough
+ * room.
+ */
+static int ring_copy_text(editring_T *ring, collabedit_T *slot,
+                          unsigned int *text_end) {
+  char_u **fields[3];
+  int nfields = string_fields(slot, fields);
+  size_t needed = 0;
+  if (slot->type == COLLAB_BUFFER_SYNC && slot->buffer_sync.nlines > 0)
+    return FALSE;
+  for (int i = 0; i < nfields; ++i)
+    if (*fields[i] != NULL)
+      needed += STRLEN(*fields[i]) + 1;
+  // A big edit would leave little room for others, it goes to the overflow
+  // list.
+  if (needed > EDITRING_TEXTSIZE / 4)
+    return FALSE;
+
+  unsigned int tail = ring->text_tail;
+  if (needed == 0) {
+    *text_end = tail;
+    return TRUE;
+  }
+  unsigned int used =
+      tail - __atomic_load_n(&ring->text_head, __ATOMIC_ACQUIRE);
+  unsigned int pos = tail % EDITRING_TEXTSIZE;
+  // Don't wrap around in the middle of the strings, skip to the start.
+  unsigned int skip = 0;
+  if (pos + needed > EDITRING_TEXTSIZE) {
+    skip = EDITRING_TEXTSIZE - pos;
+    pos = 0;
+  }
+  if (used + skip + needed > EDITRING_TEXTSIZE)
+    return FALSE;
+
+  for (int i = 0; i < nfields; ++i) {
+    if (*fields[i] == NULL)
+      continue;
+    size_t len = STRLEN(*fields[i]) + 1;
+    mch_memmove(ring->text + pos, *fields[i], len);
+    *fields[i] = ring->text + pos;
+    pos += len;
+  }
+  *text_end = tail + skip + needed;
+  return TRUE;
+}
+
+/*
+ * Pushes a copy of 'cedit' onto 'ring'. The strings of 'cedit' are copied too,
+ * so the caller keeps ownership of them. Never waits: when the ring is full
+ * the edit goes to the overflow list. Must only be called from the producer
+ * thread.
+ */
+void collab_ring_push(editring_T *ring, const collabedit_T *cedit) {
+  unsigned int tail = ring->tail;
+  collabedit_T *slot = &ring->slots[tail & (EDITRING_SIZE - 1)];
+  unsigned int text_end;
+  int in_ring =
+      !__atomic_load_n(&ring->overflowing, __ATOMIC_ACQUIRE) &&
+      tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) < EDITRING_SIZE;
+
+  if (in_ring) {
+    *slot = *cedit;
+    in_ring = ring_copy_text(ring, slot, &text_end);
+  }
+  if (in_ring) {
+    // Publish the slot and its strings.
+    ring->text_ends[tail & (EDITRING_SIZE - 1)] = text_end;
+    ring->text_tail = text_end;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+  } else {
+    // Spill to the overflow list. Until the consumer takes the list, later
+    // edits go there too, to keep them in order.
+    editnode_T *node = malloc(sizeof(editnode_T));
+    collabedit_T *copy = malloc(sizeof(collabedit_T));
+    char_u **fields[3];
+    *copy = *cedit;
+    for (int i = string_fields(copy, fields) - 1; i >= 0; --i)
+      *fields[i] = copystr(*fields[i]);
+    if (copy->type == COLLAB_BUFFER_SYNC && cedit->buffer_sync.nlines > 0) {
+      copy->buffer_sync.lines =
+          malloc(cedit->buffer_sync.nlines * sizeof(char_u *));
+      for (linenr_T i = 0; i < cedit->buffer_sync.nlines; ++i)
+        copy->buffer_sync.lines[i] = copystr(cedit->buffer_sync.lines[i]);
+    }
+    node->edit = copy;
+    node->next = NULL;
+    pthread_mutex_lock(&ring->overflow_mutex);
+    if (ring->overflow_tail == NULL)
+      ring->overflow_head = node;
+    else
+      ring->overflow_tail->next = node;
+    ring->overflow_tail = node;
+    __atomic_store_n(&ring->overflowing, TRUE, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->overflow_mutex);
+  }
+
+  // Wake the consumer if it went to sleep.
+  if (__atomic_exchange_n(&ring->consumer_waiting, FALSE, __ATOMIC_SEQ_CST))
+    sem_post(&ring->wakeup);
+}
+
+/*
+ * Pops the oldest edit of 'ring' into 'cedit', waiting for one to be pushed if
+ * the ring is empty. The strings of 'cedit' stay valid until
+ * collab_ring_done() is called for it, which must happen before the next pop.
+ * Must only be called from the consumer thread.
+ */
+void collab_ring_pop(editring_T *ring, collabedit_T *cedit) {
+  while (1) {
+    // Edits taken from the overflow list are older than any in the ring.
+    if (ring->spilled != NULL) {
+      editnode_T *node = ring->spilled;
+      ring->spilled = node->next;
+      *cedit = *node->edit;
+      free(node->edit);
+      free(node);
+      ring->popped_spilled = TRUE;
+      return;
+    }
+
+    unsigned int head = ring->head;
+    if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != head) {
+      *cedit = ring->slots[head & (EDITRING_SIZE - 1)];
+      ring->popped_text_end = ring->text_ends[head & (EDITRING_SIZE - 1)];
+      ring->popped_spilled = FALSE;
+      __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+      return;
+    }
+
+    // The ring is empty, so every edit in the overflow list comes next.
+    if (__atomic_load_n(&ring->overflowing, __ATOMIC_ACQUIRE)) {
+      pthread_mutex_lock(&ring->overflow_mutex);
+      ring->spilled = ring->overflow_head;
+      ring->overflow_head = NULL;
+      ring->overflow_tail = NULL;
+      __atomic_store_n(&ring->overflowing, FALSE, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&ring->overflow_mutex);
+      continue;
+    }
+
+    __atomic_store_n(&ring->consumer_waiting, TRUE, __ATOMIC_SEQ_CST);
+    // Check again, a push may have missed the flag.
+    if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) != head ||
+        __atomic_load_n(&ring->overflowing, __ATOMIC_SEQ_CST)) {
+      __atomic_store_n(&ring->consumer_waiting, FALSE, __ATOMIC_SEQ_CST);
+      continue;
+    }
+    sem_wait(&ring->wakeup);
+  }
+}
+
+/*
+ * Releases the strings of 'cedit', which was the last edit popped from
+ * 'ring'. Must only be called from the consumer thread.
+ */
+void collab_ring_done(editring_T *ring, collabedit_T *cedit) {
+  if (ring->popped_spilled)
+    collab_freestrings(cedit);
+  else
+    __atomic_store_n(&ring->text_head, ring->popped_text_end,
+                     __ATOMIC_RELEASE);
+}
+
 /*
  * Applies a single collabedit_T to the collab_buf. Frees cedit when done.
  */
@@ -180,6 +763,13 @@ static void applyedit(collabedit_T *cedit) {
   // First select the right collaborative buffer
   buf_T *oldbuf = curbuf;
   int did_setbuf = collab_setbuf(cedit->buf_id);
+  // Drop edits for a wiped buffer that were sent before JS knew about it. Only
+  // opening a new document reuses the ID.
+  if (!did_setbuf && cedit->buf_id >= 0 && cedit->buf_id < collab_capacity &&
+      collab_bufs[cedit->buf_id].closed && cedit->type != COLLAB_BUFFER_OPEN) {
+    dropedit(cedit);
+    return;
+  }
   // Apply edit depending on type
   switch (cedit->type) {
     case COLLAB_CURSOR_MOVE:
@@ -292,6 +882,28 @@ static void applyedit(collabedit_T *cedit) {
       deleted_lines_mark(cedit->remove_line.line, 1);
       break;
 
+    case COLLAB_REMOVE_LINES:
+    {
+      linenr_T first = cedit->remove_lines.line;
+      long count = cedit->remove_lines.count;
+      ml_delete_range_collab(first, count, FALSE, FALSE);
+      // Adjust cursor position the same way as for a single line.
+      if (curwin->w_cursor.lnum >= first + count) {
+        curwin->w_cursor.lnum -= count;
+      } else if (curwin->w_cursor.lnum >= first) {
+        if (first > curbuf->b_ml.ml_line_count) {
+          curwin->w_cursor.lnum = curbuf->b_ml.ml_line_count;
+          curwin->w_cursor.col = STRLEN(ml_get(curwin->w_cursor.lnum)) - 1;
+        } else {
+          curwin->w_cursor.lnum = first;
+          curwin->w_cursor.col = 0;
+        }
+      }
+      // Mark lines for redraw.
+      deleted_lines_mark(first, count);
+      break;
+    }
+
     case COLLAB_DELETE_TEXT:
     {
       // TODO(zpotter) adjust char index to utf8 byte index
@@ -323,24 +935,82 @@ static void applyedit(collabedit_T *cedit) {
         // Update local file name.
         setfname(curbuf, cedit->buffer_sync.filename, NULL, 0);
       }
-      linenr_T cur_nlines = buflist_findfpos(curbuf)->lnum;
-      linenr_T new_nlines = cedit->buffer_sync.nlines;
-      // Replace any lines that already exist in buffer.
-      for (int i = 1; i <= cur_nlines && i <= new_nlines; ++i) {
-        ml_replace_collab(i, cedit->buffer_sync.lines[i - 1], FALSE, FALSE);
+      free(cedit->buffer_sync.filename);
+      struct collabbuf_S *cbuf = &collab_bufs[cedit->buf_id];
+      if (cedit->buffer_sync.doc_id != NULL) {
+        free(cbuf->doc_id);
+        cbuf->doc_id = cedit->buffer_sync.doc_id;
       }
-      // Note that only one of the next two loops will execute their bodies.
-      // Append any extra new lines.
-      for (int i = cur_nlines; i < new_nlines; ++i) {
-        // The first param of this function is the line number to append after.
-        ml_append_collab(i, cedit->buffer_sync.lines[i], 0, FALSE, FALSE);
+      if (cedit->buffer_sync.nlines >= 0) {
+        sync_lines(cedit->buffer_sync.nlines, cedit->buffer_sync.lines);
+        free(cedit->buffer_sync.revision);
+      } else {
+        // The cached snapshot that is shown is already at this revision.
+        free(cbuf->revision);
+        cbuf->revision = cedit->buffer_sync.revision;
+        cbuf->snapshot_tick = curbuf->b_changedtick;
       }
-      // Delete any extra old lines.
-      for (int i = new_nlines + 1; i <= cur_nlines; ++i) {
-        ml_delete_collab(i, 0, FALSE);
+      if (cbuf->showing_cache) {
+        // Now that the buffer matches the model it may be edited.
+        curbuf->b_p_ma = TRUE;
+        cbuf->showing_cache = FALSE;
+      }
+      cbuf->synced = TRUE;
+      break;
+    }
+
+    case COLLAB_BUFFER_OPEN:
+    {
+      if (!did_setbuf) {
+        collab_newbuf(cedit->buf_id, NULL);
+        did_setbuf = collab_setbuf(cedit->buf_id);
+      }
+      struct collabbuf_S *cbuf = &collab_bufs[cedit->buf_id];
+      free(cbuf->doc_id);
+      cbuf->doc_id = cedit->buffer_open.doc_id;
+      char_u *revision;
+      linenr_T nlines;
+      char_u **lines;
+      // Show the cached snapshot while the Realtime model loads. Until the
+      // buffer is synced local edits can't be sent, so disallow them.
+      if (!cbuf->synced &&
+          read_snapshot(cbuf->doc_id, &revision, &nlines, &lines) == OK) {
+        sync_lines(nlines, lines);
+        free(cbuf->revision);
+        cbuf->revision = revision;
+        cbuf->showing_cache = TRUE;
+        curbuf->b_p_ma = FALSE;
+      }
+      // Ask for the model, telling which revision is shown already.
+      collabedit_T sync_request = {
+        .type = COLLAB_BUFFER_SYNC,
+        .buf_id = cedit->buf_id,
+        .buffer_sync.revision = cbuf->revision
+      };
+      collab_remoteapply(&sync_request);
+      break;
+    }
+
+    case COLLAB_SNAPSHOT:
+    {
+      char_u *revision = cedit->snapshot.revision;
+      if (!did_setbuf) {
+        free(revision);
+        break;
+      }
+      struct collabbuf_S *cbuf = &collab_bufs[cedit->buf_id];
+      cbuf->snapshot_pending = FALSE;
+      // Only write the snapshot when nothing changed since it was requested,
+      // otherwise the buffer may hold edits that aren't in 'revision'.
+      if (revision != NULL &&
+          cbuf->buf->b_changedtick == cbuf->request_tick &&
+          write_snapshot(cbuf, revision) == OK) {
+        free(cbuf->revision);
+        cbuf->revision = revision;
+        cbuf->snapshot_tick = cbuf->request_tick;
+      } else {
+        free(revision);
       }
-      // Mark lines for redraw.
-      changed_lines(0, 0, MAX(cur_nlines, new_nlines), (new_nlines - cur_nlines));
       break;
     }
 
@@ -348,6 +1018,11 @@ static void applyedit(collabedit_T *cedit) {
       // An outgoing event. Should not see this case.
       js_printf("info: applyedit unexpected COLLAB_REPLACE_LINE edit");
       break;
+
+    case COLLAB_BUFFER_CLOSE:
+      // An outgoing event. Should not see this case.
+      js_printf("info: applyedit unexpected COLLAB_BUFFER_CLOSE edit");
+      break;
   }
   // Switch back to old buffer if necessary.
   if (curbuf != oldbuf) set_curbuf(oldbuf, DOBUF_GOTO);
@@ -356,30 +1031,156 @@ static void applyedit(collabedit_T *cedit) {
 }
 
 /*
- * Applies all currently pending collabedit_T mutations to the vim file buffer
+ * Called from changed_lines() for every change to curbuf. While a batch of
+ * edits is being applied, the change is merged into the batch's dirty range
+ * for curbuf and TRUE is returned. Otherwise returns FALSE and the caller
+ * handles the change as usual.
+ */
+int collab_batch_changed(linenr_T lnum, colnr_T col, linenr_T lnume,
+                         long xtra) {
+  if (!batching)
+    return FALSE;
+  // Mark the buffer modified right away, an unmodified buffer would be
+  // unloaded when switching back from it.
+  changed();
+  struct collabbatch_S *batch = NULL;
+  for (size_t i = 0; i < num_batches; ++i) {
+    if (batches[i].buf == curbuf) {
+      batch = &batches[i];
+      break;
+    }
+  }
+  if (!batch) {
+    // First change to curbuf in this batch.
+    if (num_batches >= batch_capacity) {
+      batch_capacity = MAX(2 * batch_capacity, 4);
+      batches = realloc(batches, batch_capacity * sizeof(struct collabbatch_S));
+    }
+    batches[num_batches++] = (struct collabbatch_S) {
+        .buf = curbuf,
+        .top = lnum,
+        .col = col,
+        .bot = lnume + xtra,
+        .xtra = xtra
+    };
+    return TRUE;
+  }
+  // Grow the range the same way changed_lines_buf() grows b_mod_top/bot.
+  if (lnum < batch->top) {
+    batch->top = lnum;
+    batch->col = col;
+  } else if (lnum == batch->top) {
+    batch->col = MIN(batch->col, col);
+  }
+  if (lnum < batch->bot) {
+    // Adjust old bot position for xtra lines.
+    batch->bot += xtra;
+    if (batch->bot < lnum)
+      batch->bot = lnum;
+  }
+  if (lnume + xtra > batch->bot)
+    batch->bot = lnume + xtra;
+  batch->xtra += xtra;
+  return TRUE;
+}
+
+/*
+ * Ends the current batch: does the redraw bookkeeping with one call to
+ * changed_lines_batch() for each buffer that was changed.
+ */
+static void flush_batches() {
+  batching = FALSE;
+  buf_T *oldbuf = curbuf;
+  for (size_t i = 0; i < num_batches; ++i) {
+    struct collabbatch_S *batch = &batches[i];
+    // The buffer may have been wiped out by an autocommand.
+    if (!buf_valid(batch->buf))
+      continue;
+    if (curbuf != batch->buf)
+      set_curbuf(batch->buf, DOBUF_GOTO);
+    // changed_lines() wants the line below the change before the change.
+    changed_lines_batch(batch->top, batch->col, batch->bot - batch->xtra,
+                        batch->xtra);
+  }
+  if (curbuf != oldbuf) set_curbuf(oldbuf, DOBUF_GOTO);
+  num_batches = 0;
+}
+
+/*
+ * Puts the list of nodes from 'head' to 'tail' back at the front of the queue,
+ * ahead of any edits that were enqueued in the meantime. Signals the event
+ * pipe so vim's main loop comes back for them.
+ */
+static void requeue_front(editqueue_T *queue, editnode_T *head,
+                          editnode_T *tail) {
+  pthread_mutex_lock(&(queue->mutex));
+  tail->next = queue->head;
+  queue->head = head;
+  if (queue->tail == NULL)
+    queue->tail = tail;
+  pthread_mutex_unlock(&(queue->mutex));
+  write(queue->event_write_fd, "X", 1);
+}
+
+/*
+ * Applies currently pending collabedit_T mutations to the vim file buffer.
+ * At most 'collabtime' milliseconds are spent applying edits. Edits left over
+ * when the time slice runs out stay queued and are applied on a later call,
+ * after vim had a chance to process typed keys. A 'collabtime' of zero applies
+ * every pending edit.
  * This function should only be called from vim's main thread when it is safe
  * to modify the file buffer.
  */
 void collab_applyedits(editqueue_T *queue) {
   editnode_T *edits_todo = NULL;
+  editnode_T *edits_last = NULL;
   editnode_T *lastedit = NULL;
+#ifdef FEAT_RELTIME
+  proftime_T tm;
+
+  profile_setlimit(p_clt, &tm);
+#endif
   // Dequeue entire edit queue for processing
   // Wait for exclusive access to the queue
   pthread_mutex_lock(&(queue->mutex));
   edits_todo = queue->head;
+  edits_last = queue->tail;
   // Clear queue
   queue->head = NULL;
   queue->tail = NULL;
   pthread_mutex_unlock(&(queue->mutex));
 
-  // Apply all pending edits
+  yield_to_input = FALSE;
+  // Collect the changes of all edits and update windows once per buffer.
+  batching = TRUE;
+  // Apply pending edits
   while (edits_todo) {
     // Process the collabedit_T
     applyedit(edits_todo->edit);
     lastedit = edits_todo;
     edits_todo = edits_todo->next;
     free(lastedit);
+#ifdef FEAT_RELTIME
+    // Out of time: hand the rest back to the queue and let typing go first.
+    if (edits_todo && collab_timeup(&tm)) {
+      requeue_front(queue, edits_todo, edits_last);
+      yield_to_input = TRUE;
+      break;
+    }
+#endif
   }
+  flush_batches();
+}
+
+/*
+ * Returns TRUE if the last batch of edits ran out of time and typed keys
+ * should be read before the next batch starts. Clears the flag, so that at
+ * most one read of typed keys happens between two batches.
+ */
+int collab_takeyield() {
+  int yield = yield_to_input;
+  yield_to_input = FALSE;
+  return yield;
 }
 
 /*
@@ -430,6 +1231,30 @@ int collab_inchar(char_u *buf, int maxlen, editqueue_T *queue) {
   return nkeys;
 }
 
+/*
+ * Called when vim has been waiting for input for 'updatetime'. Asks for the
+ * model revision of buffers that changed since their snapshot was written, so
+ * that a new snapshot can be written when the reply comes in.
+ */
+void collab_idle() {
+  if (snapshot_dir == NULL)
+    return;
+  for (int bid = 0; bid < collab_capacity; ++bid) {
+    struct collabbuf_S *cbuf = &collab_bufs[bid];
+    if (cbuf->buf == NULL || !cbuf->synced || cbuf->doc_id == NULL ||
+        cbuf->snapshot_pending ||
+        cbuf->buf->b_changedtick == cbuf->snapshot_tick)
+      continue;
+    cbuf->snapshot_pending = TRUE;
+    cbuf->request_tick = cbuf->buf->b_changedtick;
+    collabedit_T snapshot_request = {
+      .type = COLLAB_SNAPSHOT,
+      .buf_id = bid
+    };
+    collab_remoteapply(&snapshot_request);
+  }
+}
+
 /*
  * Updates last known position of local user's cursor.
  * If the cursor has moved since the last time this function was called,
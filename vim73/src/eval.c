@@ -636,6 +636,8 @@ static void f_matchend __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_matchlist __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_matchstr __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_max __ARGS((typval_T *argvars, typval_T *rettv));
+static void f_memfileinfo __ARGS((typval_T *argvars, typval_T *rettv));
+static void f_memlinecompact __ARGS((typval_T *argvars, typval_T *rettv));
 static void f_min __ARGS((typval_T *argvars, typval_T *rettv));
 #ifdef vim_mkdir
 static void f_mkdir __ARGS((typval_T *argvars, typval_T *rettv));
@@ -4496,7 +4498,7 @@ eval4(arg, rettv, evaluate)
 			    if (regmatch.regprog != NULL)
 			    {
 				n1 = vim_regexec_nl(&regmatch, s1, (colnr_T)0);
-				vim_free(regmatch.regprog);
+				vim_regfree(regmatch.regprog);
 				if (type == TYPE_NOMATCH)
 				    n1 = !n1;
 			    }
@@ -7812,6 +7814,8 @@ static struct fst
     {"matchlist",	2, 4, f_matchlist},
     {"matchstr",	2, 4, f_matchstr},
     {"max",		1, 1, f_max},
+    {"memfileinfo",	0, 1, f_memfileinfo},
+    {"memlinecompact",	0, 1, f_memlinecompact},
     {"min",		1, 1, f_min},
 #ifdef vim_mkdir
     {"mkdir",		1, 3, f_mkdir},
@@ -11947,12 +11951,21 @@ f_has(argvars, rettv)
 	"lua",
 # endif
 #endif
+#ifdef FEAT_MF_COMPRESS
+	"memfile_compress",
+#endif
+#ifdef FEAT_MF_INCORE
+	"memfile_incore",
+#endif
 #ifdef FEAT_MENU
 	"menu",
 #endif
 #ifdef FEAT_SESSION
 	"mksession",
 #endif
+#ifdef FEAT_MMAP_VIEW
+	"mmap_view",
+#endif
 #ifdef FEAT_MODIFY_FNAME
 	"modify_fname",
 #endif
@@ -12069,9 +12082,15 @@ f_has(argvars, rettv)
 #ifdef FEAT_STL_OPT
 	"statusline",
 #endif
+#ifdef FEAT_SUBST_THREADS
+	"substitute_threads",
+#endif
 #ifdef FEAT_SUN_WORKSHOP
 	"sun_workshop",
 #endif
+#ifdef FEAT_SWAP_ASYNC
+	"swap_async",
+#endif
 #ifdef FEAT_NETBEANS_INTG
 	"netbeans_intg",
 #endif
@@ -12116,6 +12135,9 @@ f_has(argvars, rettv)
 #ifdef FEAT_TOOLBAR
 	"toolbar",
 #endif
+#ifdef FEAT_TRIGRAM_INDEX
+	"trigram_index",
+#endif
 #ifdef FEAT_USR_CMDS
 	"user-commands",    /* was accidentally included in 5.4 */
 	"user_commands",
@@ -12126,6 +12148,9 @@ f_has(argvars, rettv)
 #ifdef FEAT_VERTSPLIT
 	"vertsplit",
 #endif
+#ifdef FEAT_VIMGREP_THREADS
+	"vimgrep_threads",
+#endif
 #ifdef FEAT_VIRTUALEDIT
 	"virtualedit",
 #endif
@@ -13577,7 +13602,7 @@ find_some_match(argvars, rettv, type)
 		rettv->vval.v_number += (varnumber_T)(str - expr);
 	    }
 	}
-	vim_free(regmatch.regprog);
+	vim_regfree(regmatch.regprog);
     }
 
 theend:
@@ -13793,6 +13818,96 @@ f_max(argvars, rettv)
     max_min(argvars, rettv, TRUE);
 }
 
+/*
+ * "memfileinfo([{expr}])" function
+ */
+    static void
+f_memfileinfo(argvars, rettv)
+    typval_T	*argvars;
+    typval_T	*rettv;
+{
+    buf_T	*buf = NULL;
+    buf_T	*bp;
+    memfile_T	*mfp;
+    long	pages = 0;
+    long	comp_pages = 0;
+    long	comp_bytes = 0;
+    long	data_blocks = 0;
+    long	ptr_blocks = 0;
+    long	d, p;
+    int		depth = 0;
+    int		n;
+
+    if (argvars[0].v_type != VAR_UNKNOWN)
+    {
+	(void)get_tv_number(&argvars[0]);	    /* issue errmsg if type error */
+	++emsg_off;
+	buf = get_buf_tv(&argvars[0]);
+	--emsg_off;
+    }
+
+    if (rettv_dict_alloc(rettv) == FAIL)
+	return;
+    /* Without an argument add up the numbers for all buffers. */
+    for (bp = firstbuf; bp != NULL; bp = bp->b_next)
+	if ((argvars[0].v_type == VAR_UNKNOWN || bp == buf)
+					     && (mfp = bp->b_ml.ml_mfp) != NULL)
+	{
+	    pages += mfp->mf_used_count;
+#ifdef FEAT_MF_COMPRESS
+	    comp_pages += mfp->mf_comp_count;
+	    comp_bytes += (long)mfp->mf_comp_bytes;
+#endif
+	    if (ml_tree_info(bp, &d, &p, &n) == OK)
+	    {
+		data_blocks += d;
+		ptr_blocks += p;
+		if (n > depth)
+		    depth = n;
+	    }
+	}
+    dict_add_nr_str(rettv->vval.v_dict, "pages", pages, NULL);
+    dict_add_nr_str(rettv->vval.v_dict, "compressed", comp_pages, NULL);
+    dict_add_nr_str(rettv->vval.v_dict, "compressed_bytes", comp_bytes, NULL);
+    dict_add_nr_str(rettv->vval.v_dict, "data_blocks", data_blocks, NULL);
+    dict_add_nr_str(rettv->vval.v_dict, "pointer_blocks", ptr_blocks, NULL);
+    dict_add_nr_str(rettv->vval.v_dict, "depth", (long)depth, NULL);
+}
+
+/*
+ * "memlinecompact([{expr}])" function
+ */
+    static void
+f_memlinecompact(argvars, rettv)
+    typval_T	*argvars;
+    typval_T	*rettv;
+{
+    buf_T	*buf = NULL;
+    buf_T	*bp;
+    long	n;
+
+    if (argvars[0].v_type != VAR_UNKNOWN)
+    {
+	(void)get_tv_number(&argvars[0]);	    /* issue errmsg if type error */
+	++emsg_off;
+	buf = get_buf_tv(&argvars[0]);
+	--emsg_off;
+    }
+
+    /* Without an argument compact all buffers. */
+    rettv->vval.v_number = 0;
+    for (bp = firstbuf; bp != NULL; bp = bp->b_next)
+	if ((argvars[0].v_type == VAR_UNKNOWN || bp == buf)
+						   && bp->b_ml.ml_mfp != NULL)
+	{
+	    n = ml_compact(bp);
+	    if (n < 0)
+		rettv->vval.v_number = -1;
+	    else if (rettv->vval.v_number >= 0)
+		rettv->vval.v_number += n;
+	}
+}
+
 /*
  * "min()" function
  */
@@ -16622,7 +16737,7 @@ f_split(argvars, rettv)
 	    str = regmatch.endp[0];
 	}
 
-	vim_free(regmatch.regprog);
+	vim_regfree(regmatch.regprog);
     }
 
     p_cpo = save_cpo;
@@ -20380,7 +20495,7 @@ ex_function(eap)
 			    list_func_head(fp, FALSE);
 		    }
 		}
-		vim_free(regmatch.regprog);
+		vim_regfree(regmatch.regprog);
 	    }
 	}
 	if (*p == '/')
@@ -23435,7 +23550,7 @@ do_string_sub(str, pat, sub, flags)
 	if (ga.ga_data != NULL)
 	    STRCPY((char *)ga.ga_data + ga.ga_len, tail);
 
-	vim_free(regmatch.regprog);
+	vim_regfree(regmatch.regprog);
     }
 
     ret = vim_strsave(ga.ga_data == NULL ? str : (char_u *)ga.ga_data);
@@ -564,7 +564,7 @@ sortend:
     vim_free(nrs);
     vim_free(sortbuf1);
     vim_free(sortbuf2);
-    vim_free(regmatch.regprog);
+    vim_regfree(regmatch.regprog);
     if (got_int)
 	EMSG(_(e_interr));
 }
@@ -4225,6 +4225,292 @@ check_secure()
 static char_u	*old_sub = NULL;	/* previous substitute pattern */
 static int	global_need_beginline;	/* call beginline() after ":g" */
 
+#ifdef FEAT_SUBST_THREADS
+# include <pthread.h>
+
+/*
+ * ":substitute" over a large range with 'substitutethreads' set: before the
+ * lines are changed the main thread copies a batch of them and the worker
+ * threads find out which of them match, each worker with its own regexec_T.
+ * do_sub() then skips the lines that don't match, the lines that do match
+ * are handled as before, also to get the submatches.  Only used for a
+ * pattern that is usable for one line, so that the text of the line is all
+ * that matters, and when {string} isn't an expression, which could change
+ * the lines below.  Then changing a line doesn't change whether the lines
+ * below it match, only their line numbers.
+ */
+typedef struct subscan_S subscan_T;
+
+typedef struct subthread_S
+{
+    pthread_t	    st_thread;
+    subscan_T	    *st_scan;
+    regexec_T	    *st_rex;	/* for matching in this thread */
+} subthread_T;
+
+/* Only use ss_count, ss_next, ss_busy and ss_stop while holding ss_mutex.
+ * ss_cancel is only set while holding it, the workers and their regexp
+ * contexts also check it without the mutex to stop halfway a slice. */
+struct subscan_S
+{
+    pthread_mutex_t ss_mutex;
+    pthread_cond_t  ss_todo;	/* ss_count or ss_stop changed */
+    pthread_cond_t  ss_ready;	/* a worker is done with its lines */
+    regprog_T	    *ss_prog;
+    int		    ss_ic;	/* ignore case */
+    linenr_T	    ss_lnum;	/* line number of the first line in the
+				   batch, before changing lines */
+    linenr_T	    ss_line2;	/* "line2" of do_sub() at that time */
+    long	    ss_count;	/* number of lines in the batch */
+    long	    ss_next;	/* next line for a worker */
+    int		    ss_busy;	/* number of workers matching lines */
+    int		    ss_stop;	/* TRUE when the workers must stop */
+    volatile int    ss_cancel;	/* TRUE when interrupted with CTRL-C */
+    garray_T	    ss_text;	/* text of the lines, NUL separated */
+    long	    *ss_offs;	/* offset of each line in ss_text */
+    char_u	    *ss_match;	/* TRUE for each line that may match */
+    int		    ss_nthreads; /* number of items in ss_threads[] */
+    subthread_T	    *ss_threads;
+};
+
+#define SUB_SCAN_MIN	2000	/* smaller ranges are done serially */
+#define SUB_SCAN_BATCH	16384	/* max number of lines in a batch */
+#define SUB_SCAN_SLICE	256	/* number of lines a worker takes */
+#define SUB_SCAN_WAIT_MSEC 100	/* check for CTRL-C this often */
+
+static subscan_T *sub_scan_start __ARGS((regprog_T *prog, int ic));
+static void	sub_scan_stop __ARGS((subscan_T *ss));
+static void	*sub_scan_worker __ARGS((void *arg));
+static void	sub_scan_batch __ARGS((subscan_T *ss, linenr_T lnum, linenr_T line2));
+static int	sub_scan_match __ARGS((subscan_T *ss, linenr_T lnum, linenr_T line2));
+
+/*
+ * Start the worker threads for matching "prog".  Returns NULL when that
+ * fails.
+ */
+    static subscan_T *
+sub_scan_start(prog, ic)
+    regprog_T	*prog;
+    int		ic;
+{
+    subscan_T	*ss;
+    subthread_T	*st;
+    int		i;
+
+    ss = (subscan_T *)alloc_clear((unsigned)sizeof(subscan_T));
+    if (ss == NULL)
+	return NULL;
+    ss->ss_offs = (long *)alloc((unsigned)(SUB_SCAN_BATCH * sizeof(long)));
+    ss->ss_match = alloc((unsigned)SUB_SCAN_BATCH);
+    ss->ss_threads = (subthread_T *)alloc_clear(
+				     (unsigned)(p_stt * sizeof(subthread_T)));
+    if (ss->ss_offs == NULL || ss->ss_match == NULL
+						   || ss->ss_threads == NULL)
+    {
+	vim_free(ss->ss_offs);
+	vim_free(ss->ss_match);
+	vim_free(ss->ss_threads);
+	vim_free(ss);
+	return NULL;
+    }
+
+    pthread_mutex_init(&ss->ss_mutex, NULL);
+    pthread_cond_init(&ss->ss_todo, NULL);
+    pthread_cond_init(&ss->ss_ready, NULL);
+    ga_init2(&ss->ss_text, 1, 65536);
+    ss->ss_prog = prog;
+    ss->ss_ic = ic;
+    for (i = 0; i < p_stt; ++i)
+    {
+	st = &ss->ss_threads[ss->ss_nthreads];
+	st->st_scan = ss;
+	st->st_rex = vim_regexec_alloc(&ss->ss_cancel);
+	if (st->st_rex == NULL)
+	    break;
+	if (pthread_create(&st->st_thread, NULL, sub_scan_worker, st) != 0)
+	{
+	    vim_regexec_free(st->st_rex);
+	    break;
+	}
+	++ss->ss_nthreads;
+    }
+    if (ss->ss_nthreads == 0)
+    {
+	sub_scan_stop(ss);
+	return NULL;
+    }
+    return ss;
+}
+
+/*
+ * Stop the worker threads, wait for them to finish and free "ss".
+ */
+    static void
+sub_scan_stop(ss)
+    subscan_T	*ss;
+{
+    int		i;
+
+    pthread_mutex_lock(&ss->ss_mutex);
+    ss->ss_stop = TRUE;
+    pthread_cond_broadcast(&ss->ss_todo);
+    pthread_mutex_unlock(&ss->ss_mutex);
+    for (i = 0; i < ss->ss_nthreads; ++i)
+    {
+	pthread_join(ss->ss_threads[i].st_thread, NULL);
+	vim_regexec_free(ss->ss_threads[i].st_rex);
+    }
+
+    pthread_cond_destroy(&ss->ss_ready);
+    pthread_cond_destroy(&ss->ss_todo);
+    pthread_mutex_destroy(&ss->ss_mutex);
+    ga_clear(&ss->ss_text);
+    vim_free(ss->ss_offs);
+    vim_free(ss->ss_match);
+    vim_free(ss->ss_threads);
+    vim_free(ss);
+}
+
+/*
+ * A worker thread: match SUB_SCAN_SLICE lines of the batch at a time.
+ */
+    static void *
+sub_scan_worker(arg)
+    void	*arg;
+{
+    subthread_T	*st = (subthread_T *)arg;
+    subscan_T	*ss = st->st_scan;
+    regmatch_T	regmatch;
+    long	i;
+    long	end;
+    int		failed;
+
+    regmatch.regprog = ss->ss_prog;
+    regmatch.rm_ic = ss->ss_ic;
+    pthread_mutex_lock(&ss->ss_mutex);
+    for (;;)
+    {
+	while (!ss->ss_stop && ss->ss_next >= ss->ss_count)
+	    pthread_cond_wait(&ss->ss_todo, &ss->ss_mutex);
+	if (ss->ss_stop)
+	    break;
+	i = ss->ss_next;
+	end = i + SUB_SCAN_SLICE < ss->ss_count ? i + SUB_SCAN_SLICE
+							      : ss->ss_count;
+	ss->ss_next = end;
+	++ss->ss_busy;
+	pthread_mutex_unlock(&ss->ss_mutex);
+
+	/* When matching fails or was interrupted the line is handled by
+	 * do_sub(), that gives the error message or finds out about the
+	 * interrupt. */
+	for ( ; i < end; ++i)
+	{
+	    failed = FALSE;
+	    ss->ss_match[i] = ss->ss_cancel
+		    || vim_regexec_rex(st->st_rex, &regmatch,
+			 (char_u *)ss->ss_text.ga_data + ss->ss_offs[i],
+						       (colnr_T)0, &failed)
+		    || failed;
+	}
+
+	pthread_mutex_lock(&ss->ss_mutex);
+	--ss->ss_busy;
+	pthread_cond_broadcast(&ss->ss_ready);
+    }
+    pthread_mutex_unlock(&ss->ss_mutex);
+    return NULL;
+}
+
+/*
+ * Copy lines "lnum" to "line2", at most SUB_SCAN_BATCH of them, and let the
+ * workers find the lines that may match.  Returns when they are done.  When
+ * CTRL-C is typed while waiting the workers are cancelled.
+ */
+    static void
+sub_scan_batch(ss, lnum, line2)
+    subscan_T	*ss;
+    linenr_T	lnum;
+    linenr_T	line2;
+{
+    char_u	*p;
+    long	count = 0;
+    int		len;
+    struct timeval  tv;
+    struct timespec ts;
+    long	usec;
+
+    ss->ss_text.ga_len = 0;
+    while (count < SUB_SCAN_BATCH && lnum + count <= line2)
+    {
+	p = ml_get(lnum + count);
+	len = (int)STRLEN(p) + 1;
+	if (ga_grow(&ss->ss_text, len) == FAIL)
+	    break;
+	mch_memmove((char_u *)ss->ss_text.ga_data + ss->ss_text.ga_len,
+							      p, (size_t)len);
+	ss->ss_offs[count++] = ss->ss_text.ga_len;
+	ss->ss_text.ga_len += len;
+    }
+    ss->ss_lnum = lnum;
+    ss->ss_line2 = line2;
+    pthread_mutex_lock(&ss->ss_mutex);
+    if (count == 0)
+    {
+	/* Out of memory: let do_sub() match the line. */
+	ss->ss_match[0] = TRUE;
+	ss->ss_count = ss->ss_next = 1;
+    }
+    else
+    {
+	ss->ss_count = count;
+	ss->ss_next = 0;
+	pthread_cond_broadcast(&ss->ss_todo);
+    }
+    while (ss->ss_next < ss->ss_count || ss->ss_busy > 0)
+    {
+	gettimeofday(&tv, NULL);
+	usec = tv.tv_usec + SUB_SCAN_WAIT_MSEC * 1000L;
+	ts.tv_sec = tv.tv_sec + usec / 1000000L;
+	ts.tv_nsec = (usec % 1000000L) * 1000L;
+	if (pthread_cond_timedwait(&ss->ss_ready, &ss->ss_mutex, &ts) == 0
+							     || ss->ss_cancel)
+	    continue;
+	pthread_mutex_unlock(&ss->ss_mutex);
+	ui_breakcheck();
+	pthread_mutex_lock(&ss->ss_mutex);
+	if (got_int)
+	    ss->ss_cancel = TRUE;
+    }
+    pthread_mutex_unlock(&ss->ss_mutex);
+}
+
+/*
+ * Return TRUE when line "lnum" may match.  "line2" is the last line of the
+ * range, the lines above "lnum" may have been changed since the batch was
+ * made, and lines may have been inserted, which also moves "line2".
+ */
+    static int
+sub_scan_match(ss, lnum, line2)
+    subscan_T	*ss;
+    linenr_T	lnum;
+    linenr_T	line2;
+{
+    long	i;
+
+    /* After CTRL-C matching in do_sub() fails right away. */
+    if (ss->ss_cancel)
+	return TRUE;
+    i = (long)(lnum - ss->ss_lnum) - (long)(line2 - ss->ss_line2);
+    if (ss->ss_count == 0 || i < 0 || i >= ss->ss_count)
+    {
+	sub_scan_batch(ss, lnum, line2);
+	i = 0;
+    }
+    return ss->ss_match[i];
+}
+#endif
+
 /* do_sub()
  *
  * Perform a substitution from line eap->line1 to line eap->line2 using the
@@ -4268,6 +4554,9 @@ do_sub(eap)
     int		endcolumn = FALSE;	/* cursor in last column when done */
     pos_T	old_cursor = curwin->w_cursor;
     int		start_nsubs;
+#ifdef FEAT_SUBST_THREADS
+    subscan_T	*scan = NULL;		/* finds lines that may match */
+#endif
 
     cmd = eap->arg;
     if (!global_busy)
@@ -4506,12 +4795,23 @@ do_sub(eap)
      * Check for a match on each line.
      */
     line2 = eap->line2;
+#ifdef FEAT_SUBST_THREADS
+    if (p_stt > 0 && line2 - eap->line1 >= SUB_SCAN_MIN
+	    && !(sub[0] == '\\' && sub[1] == '=')
+	    && re_linelocal(regmatch.regprog, TRUE))
+	scan = sub_scan_start(regmatch.regprog, regmatch.rmm_ic);
+#endif
     for (lnum = eap->line1; lnum <= line2 && !(got_quit
 #if defined(FEAT_EVAL) && defined(FEAT_AUTOCMD)
 		|| aborting()
 #endif
 		); ++lnum)
     {
+#ifdef FEAT_SUBST_THREADS
+	if (scan != NULL && !sub_scan_match(scan, lnum, line2))
+	    nmatch = 0;
+	else
+#endif
 	nmatch = vim_regexec_multi(&regmatch, curwin, curbuf, lnum,
 							    (colnr_T)0, NULL);
 	if (nmatch)
@@ -5132,6 +5432,10 @@ skip:
 
 outofmem:
     vim_free(sub_firstline); /* may have to free allocated copy of the line */
+#ifdef FEAT_SUBST_THREADS
+    if (scan != NULL)
+	sub_scan_stop(scan);
+#endif
 
     /* ":s/pat//n" doesn't move the cursor */
     if (do_count)
@@ -5168,7 +5472,7 @@ outofmem:
 	    EMSG2(_(e_patnotf2), get_search_pat());
     }
 
-    vim_free(regmatch.regprog);
+    vim_regfree(regmatch.regprog);
 }
 
 /*
@@ -5250,6 +5554,11 @@ ex_global(eap)
     regmmatch_T	regmatch;
     int		match;
     int		which_pat;
+#ifdef FEAT_TRIGRAM_INDEX
+    triquery_T	tq;
+    int		use_tri;
+    linenr_T	next;
+#endif
 
     if (global_busy)
     {
@@ -5311,11 +5620,32 @@ ex_global(eap)
 	return;
     }
 
+#ifdef FEAT_TRIGRAM_INDEX
+    use_tri = ml_tri_prepare(curbuf, regmatch.regprog, regmatch.rmm_ic, &tq);
+#endif
+
     /*
      * pass 1: set marks for each (not) matching line
      */
     for (lnum = eap->line1; lnum <= eap->line2 && !got_int; ++lnum)
     {
+#ifdef FEAT_TRIGRAM_INDEX
+	/* the lines that the trigram index excludes don't match */
+	if (use_tri)
+	{
+	    next = ml_tri_skip(curbuf, lnum, FORWARD, &tq);
+	    if (type == 'v')
+		for ( ; lnum < next && lnum <= eap->line2; ++lnum)
+		{
+		    ml_setmarked(lnum);
+		    ndone++;
+		}
+	    else
+		lnum = next;
+	    if (lnum > eap->line2)
+		break;
+	}
+#endif
 	/* a match on this line? */
 	match = vim_regexec_multi(&regmatch, curwin, curbuf, lnum,
 							    (colnr_T)0, NULL);
@@ -5343,7 +5673,7 @@ ex_global(eap)
 	global_exe(cmd);
 
     ml_clearmarked();	   /* clear rest of the marks */
-    vim_free(regmatch.regprog);
+    vim_regfree(regmatch.regprog);
 }
 
 /*
@@ -767,6 +767,10 @@ EX(CMD_redrawstatus,	"redrawstatus",	ex_redrawstatus,
 			BANG|TRLBAR|CMDWIN),
 EX(CMD_registers,	"registers",	ex_display,
 			EXTRA|NOTRLCOM|TRLBAR|CMDWIN),
+EX(CMD_regexpstats,	"regexpstats",	ex_regexpstats,
+			EXTRA|TRLBAR|CMDWIN),
+EX(CMD_regexptime,	"regexptime",	ex_regexptime,
+			BANG|EXTRA|TRLBAR|CMDWIN),
 EX(CMD_resize,		"resize",	ex_resize,
 			RANGE|NOTADR|TRLBAR|WORD1),
 EX(CMD_retab,		"retab",	ex_retab,
@@ -1171,6 +1175,9 @@ struct exarg
     int		regname;	/* register name (NUL if none) */
     int		force_bin;	/* 0, FORCE_BIN or FORCE_NOBIN */
     int		read_edit;	/* ++edit argument */
+#ifdef FEAT_MMAP_VIEW
+    int		read_mmap;	/* ++mmap argument */
+#endif
     int		force_ff;	/* ++ff= argument (index in cmd[]) */
 #ifdef FEAT_MBYTE
     int		force_enc;	/* ++enc= argument (index in cmd[]) */
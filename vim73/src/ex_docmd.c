@@ -484,6 +484,7 @@ static void	ex_folddo __ARGS((exarg_T *eap));
 
 #ifndef FEAT_PROFILE
 # define ex_profile		ex_ni
+# define ex_regexptime		ex_ni
 #endif
 
 /*
@@ -4764,6 +4765,16 @@ getargopt(eap)
 	return OK;
     }
 
+#ifdef FEAT_MMAP_VIEW
+    /* ":view ++mmap file" */
+    if (STRNCMP(arg, "mmap", 4) == 0)
+    {
+	eap->read_mmap = TRUE;
+	eap->arg = skipwhite(arg + 4);
+	return OK;
+    }
+#endif
+
     if (STRNCMP(arg, "ff", 2) == 0)
     {
 	arg += 2;
@@ -7535,7 +7546,7 @@ ex_open(eap)
 		curwin->w_cursor.col = (colnr_T)(regmatch.startp[0] - p);
 	    else
 		EMSG(_(e_nomatch));
-	    vim_free(regmatch.regprog);
+	    vim_regfree(regmatch.regprog);
 	}
 	/* Move to the NUL, ignore any other arguments. */
 	eap->arg += STRLEN(eap->arg);
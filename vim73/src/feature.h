@@ -1312,3 +1312,64 @@
 #ifdef FEAT_NORMAL
 # define FEAT_PERSISTENT_UNDO
 #endif
+
+/*
+ * +swap_async		'swapasync' option: write the swap file in a separate
+ *			thread.  Needs pthreads.
+ */
+#if defined(UNIX) && defined(FEAT_NORMAL) && defined(HAVE_PTHREAD)
+# define FEAT_SWAP_ASYNC
+#endif
+
+/*
+ * +mmap_view		":edit ++mmap file": take the lines from the file mapped
+ *			in memory until the buffer is changed.
+ */
+#if defined(UNIX) && defined(FEAT_NORMAL)
+# define FEAT_MMAP_VIEW
+#endif
+
+/*
+ * +vimgrep_threads	'vimgrepthreads' option: ":vimgrep" reads plain files
+ *			in worker threads.  Needs pthreads.
+ */
+#if defined(UNIX) && defined(FEAT_QUICKFIX) && defined(FEAT_NORMAL) \
+	&& defined(HAVE_PTHREAD)
+# define FEAT_VIMGREP_THREADS
+#endif
+
+/*
+ * +substitute_threads	'substitutethreads' option: ":substitute" finds the
+ *			matching lines of a large range in worker threads.
+ *			Needs pthreads.
+ */
+#if defined(UNIX) && defined(FEAT_NORMAL) && defined(HAVE_PTHREAD)
+# define FEAT_SUBST_THREADS
+#endif
+
+/*
+ * +trigram_index	'trigramindex' option: a per-buffer index of the
+ *			trigrams in each chunk of lines, used to skip lines
+ *			that can't match when searching.
+ */
+#ifdef FEAT_NORMAL
+# define FEAT_TRIGRAM_INDEX
+#endif
+
+/*
+ * +memfile_compress	Compress the least recently used blocks of a memfile
+ *			that has no swap file, instead of keeping them all in
+ *			memory when going over 'maxmem'.
+ */
+#ifdef FEAT_NORMAL
+# define FEAT_MF_COMPRESS
+#endif
+
+/*
+ * +memfile_incore	Keep the blocks of a buffer in pages of memory only,
+ *			never write a swap file.  Used for the browser build,
+ *			where the file system is in memory already.
+ */
+#if defined(__native_client__) && !defined(FEAT_MF_INCORE)
+# define FEAT_MF_INCORE
+#endif
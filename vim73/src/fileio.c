@@ -288,6 +288,10 @@ readfile(fname, sfname, from, lines_to_skip, lines_to_read, eap, flags)
     int		try_dos = (vim_strchr(p_ffs, 'd') != NULL);
     int		try_unix = (vim_strchr(p_ffs, 'x') != NULL);
     int		file_rewind = FALSE;
+#ifdef FEAT_MMAP_VIEW
+    int		use_mmap;		/* ":edit ++mmap file" */
+    int		mmap_noeol;
+#endif
 #ifdef FEAT_MBYTE
     int		can_retry;
     linenr_T	conv_error = 0;		/* line nr with conversion error */
@@ -839,6 +843,34 @@ readfile(fname, sfname, from, lines_to_skip, lines_to_read, eap, flags)
     /* Autocommands may add lines to the file, need to check if it is empty */
     wasempty = (curbuf->b_ml.ml_flags & ML_EMPTY);
 
+#ifdef FEAT_MMAP_VIEW
+    /* With "++mmap" the lines are taken from the file mapped in memory when
+     * they are used, only until the buffer is changed. */
+    use_mmap = (eap != NULL && eap->read_mmap && newfile && wasempty
+		 && !recoverymode && !read_stdin && !read_buffer && !filtering);
+# ifdef FEAT_CRYPT
+    if (use_mmap)
+    {
+	char_u	magic[CRYPT_MAGIC_LEN];
+
+	/* An encrypted file is decrypted while reading it. */
+	len = vim_read(fd, magic, CRYPT_MAGIC_LEN);
+	lseek(fd, (off_t)0L, SEEK_SET);
+	if (len >= (int)STRLEN(crypt_magic_head)
+		&& memcmp(magic, crypt_magic_head, STRLEN(crypt_magic_head)) == 0)
+	    use_mmap = FALSE;
+    }
+# endif
+#endif
+
+    /* Lines read into an empty buffer are packed into data blocks in bulk. */
+    if (newfile && wasempty && !recoverymode
+#ifdef FEAT_MMAP_VIEW
+	    && !use_mmap
+#endif
+	    )
+	ml_bulk_begin(curbuf);
+
     if (!recoverymode && !filtering && !(flags & READ_DUMMY))
     {
 	/*
@@ -955,6 +987,48 @@ readfile(fname, sfname, from, lines_to_skip, lines_to_read, eap, flags)
     }
 #endif
 
+#ifdef FEAT_MMAP_VIEW
+    if (use_mmap)
+    {
+	if (eap->force_ff != 0)
+	    fileformat = get_fileformat_force(curbuf, eap);
+	else if (curbuf->b_p_bin)
+	    fileformat = EOL_UNIX;
+	else if (*p_ffs == NUL)
+	    fileformat = get_fileformat(curbuf);
+	else if (try_dos)
+	    fileformat = EOL_UNKNOWN;	/* check the first line */
+	else
+	    fileformat = EOL_UNIX;
+	if (ml_mmap_open(curbuf, fd, &fileformat, &filesize, &mmap_noeol)
+									 == OK)
+	{
+	    if (set_options)
+		set_fileformat(fileformat, OPT_LOCAL);
+	    if (mmap_noeol)
+	    {
+		if (set_options)
+		    curbuf->b_p_eol = FALSE;
+		read_no_eol_lnum = curbuf->b_ml.ml_line_count;
+	    }
+# ifdef FEAT_MBYTE
+	    /* The lines are used as they are, without conversion. */
+	    if (fenc_alloced)
+		vim_free(fenc);
+	    fenc = (char_u *)"";
+	    fenc_alloced = FALSE;
+# endif
+	    /* The empty line was replaced, don't delete a line below. */
+	    wasempty = FALSE;
+	    linecnt = 0;
+	    goto failed;
+	}
+
+	/* Can't map the file, read it like without "++mmap". */
+	ml_bulk_begin(curbuf);
+    }
+#endif
+
     /*
      * Jump back here to retry reading the file in different ways.
      * Reasons to retry:
@@ -2354,6 +2428,9 @@ failed:
 #endif
     --no_wait_return;			/* may wait for return now */
 
+    /* Build the memline tree for the lines read in bulk. */
+    ml_bulk_end(curbuf);
+
     /*
      * In recovery mode everything but autocommands is skipped.
      */
@@ -3283,6 +3360,14 @@ buf_write(buf, fname, sfname, start, end, eap, append, forceit,
     else
 	overwriting = FALSE;
 
+#ifdef FEAT_MMAP_VIEW
+    /* The lines can't be taken from the mapped file while it is being
+     * overwritten. */
+    if (overwriting && buf->b_ml.ml_mmap != NULL
+					     && ml_mmap_promote(buf) == FAIL)
+	return FAIL;
+#endif
+
     if (exiting)
 	settmode(TMODE_COOK);	    /* when exiting allow typahead now */
 
@@ -6849,6 +6934,9 @@ buf_check_timestamp(buf, focus)
     char_u	*s;
 #endif
     char	*reason;
+#ifdef FEAT_MMAP_VIEW
+    int		mmap_changed = FALSE;
+#endif
 
     /* If there is no file name, the buffer is not loaded, 'buftype' is
      * set, we are in the middle of a save or being called recursively: ignore
@@ -6876,10 +6964,17 @@ buf_check_timestamp(buf, focus)
 		|| (int)st.st_mode != buf->b_orig_mode
 #else
 		|| mch_getperm(buf->b_ffname) != buf->b_orig_mode
+#endif
+#ifdef FEAT_MMAP_VIEW
+		|| ml_mmap_changed(buf, &st)
 #endif
 		))
     {
 	retval = 1;
+#ifdef FEAT_MMAP_VIEW
+	if (stat_res >= 0)
+	    mmap_changed = ml_mmap_changed(buf, &st);
+#endif
 
 	/* set b_mtime to stop further warnings (e.g., when executing
 	 * FileChangedShell autocmd) */
@@ -6897,6 +6992,16 @@ buf_check_timestamp(buf, focus)
 	if (mch_isdir(buf->b_fname))
 	    ;
 
+#ifdef FEAT_MMAP_VIEW
+	/* The lines were taken from the file mapped in memory and it was
+	 * changed in place, they can't be kept.  Always reload. */
+	else if (mmap_changed)
+	{
+	    ml_mmap_drop(buf);
+	    reload = TRUE;
+	}
+#endif
+
 	/*
 	 * If 'autoread' is set, the buffer has no changes and the file still
 	 * exists, reload the buffer.  Use the buffer-local option value if it
@@ -7911,7 +8016,7 @@ au_cleanup()
 	    if (ap->pat == NULL)
 	    {
 		*prev_ap = ap->next;
-		vim_free(ap->reg_prog);
+		vim_regfree(ap->reg_prog);
 		vim_free(ap);
 	    }
 	    else
@@ -9632,12 +9737,32 @@ has_autocmd(event, sfname, buf)
     event_T	event;
     char_u	*sfname;
     buf_T       *buf;
+{
+    return has_autocmd_except(event, sfname, buf, NULL);
+}
+
+/*
+ * Like has_autocmd(), but ignore the autocommands in group "group_name" when
+ * it is not NULL.
+ */
+    int
+has_autocmd_except(event, sfname, buf, group_name)
+    event_T	event;
+    char_u	*sfname;
+    buf_T       *buf;
+    char_u	*group_name;
 {
     AutoPat	*ap;
     char_u	*fname;
     char_u	*tail = gettail(sfname);
+    int		group = AUGROUP_ERROR;
     int		retval = FALSE;
 
+    if (first_autopat[(int)event] == NULL)
+	return FALSE;
+    if (group_name != NULL)
+	group = au_find_group(group_name);
+
     fname = FullName_save(sfname, FALSE);
     if (fname == NULL)
 	return FALSE;
@@ -9654,7 +9779,7 @@ has_autocmd(event, sfname, buf)
 #endif
 
     for (ap = first_autopat[(int)event]; ap != NULL; ap = ap->next)
-	if (ap->pat != NULL && ap->cmds != NULL
+	if (ap->pat != NULL && ap->cmds != NULL && ap->group != group
 	      && (ap->buflocal_nr == 0
 		? match_file_pat(NULL, ap->reg_prog,
 					  fname, sfname, tail, ap->allow_dirs)
@@ -10004,7 +10129,7 @@ match_file_pat(pattern, prog, fname, sfname, tail, allow_dirs)
 	result = TRUE;
 
     if (prog == NULL)
-	vim_free(regmatch.regprog);
+	vim_regfree(regmatch.regprog);
     return result;
 }
 #endif
@@ -1477,7 +1477,11 @@ using_script()
     void
 before_blocking()
 {
+    /* Compact memlines before syncing, so that the result is written. */
+    ml_compact_idle();
     updatescript(0);
+    /* Keep cached snapshots of collaborative documents up to date. */
+    collab_idle();
 #ifdef FEAT_EVAL
     if (may_garbage_collect)
 	garbage_collect();
@@ -30,6 +30,20 @@
  * Under normal operation the file is created when opening the memory file and
  * deleted when closing the memory file. Only with recovery an existing memory
  * file is opened.
+ *
+ * With 'swapasync' set, mf_sync() only copies the dirty blocks and a writer
+ * thread writes the copies to the file.  See mf_sync_async().
+ *
+ * A memfile without a file can't release blocks.  With the +memfile_compress
+ * feature the least recently used blocks are compressed instead when going
+ * over 'maxmem'.  They are then kept in a separate list, not the used list,
+ * and are uncompressed by mf_get().  When a file is opened for the memfile
+ * all blocks are uncompressed, a memfile with a file never has compressed
+ * blocks.
+ *
+ * With the +memfile_incore feature a memfile without a file never gets one.
+ * Its single page blocks are then taken from chunks of pages, which are only
+ * freed when the memfile is closed.
  */
 
 #if defined(MSDOS) || defined(WIN16) || defined(WIN32) || defined(_WIN64)
@@ -71,6 +85,72 @@ extern int dos2;			/* this is in os_amiga.c */
 
 #define MEMFILE_PAGE_SIZE 4096		/* default page size */
 
+#ifdef FEAT_MF_INCORE
+# define MF_CORE_PAGES 64		/* pages in a chunk of an in-core memfile */
+#endif
+
+#ifdef FEAT_SWAP_ASYNC
+# include <pthread.h>
+
+/*
+ * A job for the writer thread: copies of the dirty blocks of a memfile, in
+ * the order they are to be written.
+ */
+typedef struct mf_asyncblock_S
+{
+    blocknr_T	ma_bnum;	/* block number */
+    unsigned	ma_size;	/* number of bytes in ma_data */
+    char_u	*ma_data;	/* copy of the block, encrypted if needed */
+} mf_asyncblock_T;
+
+typedef struct mf_asyncjob_S mf_asyncjob_T;
+struct mf_asyncjob_S
+{
+    mf_asyncjob_T   *mj_next;
+    memfile_T	    *mj_mfp;	    /* memfile the blocks are for */
+    int		    mj_fd;	    /* file descriptor to write to */
+    unsigned	    mj_page_size;   /* page size of the memfile */
+    int		    mj_flush;	    /* 'f' for fsync(), 's' for sync(), or 0 */
+    int		    mj_count;	    /* number of items in mj_blocks */
+    mf_asyncblock_T *mj_blocks;
+    int		    mj_status;	    /* OK or FAIL, set by the writer */
+};
+
+/* The lists of jobs are shared with the writer thread, only use them while
+ * holding mf_async_mutex.  The writer keeps a job at the head of
+ * mf_async_first while writing it, then moves it to mf_async_written. */
+static pthread_mutex_t	mf_async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	mf_async_todo = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	mf_async_done = PTHREAD_COND_INITIALIZER;
+static mf_asyncjob_T	*mf_async_first = NULL;	  /* jobs to be written */
+static mf_asyncjob_T	*mf_async_last = NULL;
+static mf_asyncjob_T	*mf_async_written = NULL; /* written, not handled */
+static int		mf_async_started = FALSE;
+
+/* When exiting on a deadly signal the mutex can't be used, it may be held by
+ * the code that was interrupted.  These are only set and tested. */
+static volatile int	mf_async_stop = FALSE;	  /* writer must not write */
+static volatile int	mf_async_writing = FALSE; /* writer is writing */
+
+static int mf_sync_async __ARGS((memfile_T *, int));
+static void *mf_async_writer __ARGS((void *));
+static void mf_async_handle __ARGS((memfile_T *));
+static void mf_async_free __ARGS((mf_asyncjob_T *));
+static void mf_async_abandon __ARGS((void));
+#endif
+
+#ifdef FEAT_MF_COMPRESS
+# define MF_LZ_HASH_BITS 12		/* size of the match finder table */
+# define MF_LZ_MINMATCH	4		/* shortest match that is encoded */
+
+static int mf_compress __ARGS((memfile_T *, bhdr_T *));
+static int mf_uncompress __ARGS((memfile_T *, bhdr_T *));
+static int mf_uncompress_all __ARGS((memfile_T *));
+static unsigned mf_lz_compress __ARGS((char_u *, unsigned, char_u *, unsigned));
+static int mf_lz_put_len __ARGS((char_u *, unsigned *, unsigned, unsigned));
+static int mf_lz_decompress __ARGS((char_u *, unsigned, char_u *, unsigned));
+#endif
+
 static long_u	total_mem_used = 0;	/* total memory used for memfiles */
 
 static void mf_ins_hash __ARGS((memfile_T *, bhdr_T *));
@@ -80,7 +160,9 @@ static void mf_ins_used __ARGS((memfile_T *, bhdr_T *));
 static void mf_rem_used __ARGS((memfile_T *, bhdr_T *));
 static bhdr_T *mf_release __ARGS((memfile_T *, int));
 static bhdr_T *mf_alloc_bhdr __ARGS((memfile_T *, int));
-static void mf_free_bhdr __ARGS((bhdr_T *));
+static void mf_free_bhdr __ARGS((memfile_T *, bhdr_T *));
+static char_u *mf_alloc_data __ARGS((memfile_T *, int));
+static void mf_free_data __ARGS((memfile_T *, bhdr_T *));
 static void mf_ins_free __ARGS((memfile_T *, bhdr_T *));
 static bhdr_T *mf_rem_free __ARGS((memfile_T *));
 static int  mf_read __ARGS((memfile_T *, bhdr_T *));
@@ -88,6 +170,13 @@ static int  mf_write __ARGS((memfile_T *, bhdr_T *));
 static int  mf_write_block __ARGS((memfile_T *mfp, bhdr_T *hp, off_t offset, unsigned size));
 static int  mf_trans_add __ARGS((memfile_T *, bhdr_T *));
 static void mf_do_open __ARGS((memfile_T *, char_u *, int));
+static void mf_hash_init __ARGS((mf_hashtab_T *));
+static void mf_hash_free __ARGS((mf_hashtab_T *));
+static void mf_hash_free_all __ARGS((mf_hashtab_T *));
+static mf_hashitem_T *mf_hash_find __ARGS((mf_hashtab_T *, blocknr_T));
+static void mf_hash_add_item __ARGS((mf_hashtab_T *, mf_hashitem_T *));
+static void mf_hash_rem_item __ARGS((mf_hashtab_T *, mf_hashitem_T *));
+static int mf_hash_grow __ARGS((mf_hashtab_T *));
 
 /*
  * The functions for using a memfile:
@@ -123,7 +212,6 @@ mf_open(fname, flags)
     int		flags;
 {
     memfile_T		*mfp;
-    int			i;
     off_t		size;
 #if defined(STATFS) && defined(UNIX) && !defined(__QNX__)
 # define USE_FSTATFS
@@ -155,13 +243,23 @@ mf_open(fname, flags)
     mfp->mf_used_first = NULL;		/* used list is empty */
     mfp->mf_used_last = NULL;
     mfp->mf_dirty = FALSE;
+#ifdef FEAT_SWAP_ASYNC
+    mfp->mf_async_count = 0;
+#endif
+#ifdef FEAT_MF_COMPRESS
+    mfp->mf_comp_first = NULL;
+    mfp->mf_comp_count = 0;
+    mfp->mf_comp_bytes = 0;
+#endif
     mfp->mf_used_count = 0;
-    for (i = 0; i < MEMHASHSIZE; ++i)
-    {
-	mfp->mf_hash[i] = NULL;		/* hash lists are empty */
-	mfp->mf_trans[i] = NULL;	/* trans lists are empty */
-    }
+    mf_hash_init(&mfp->mf_hash);
+    mf_hash_init(&mfp->mf_trans);
     mfp->mf_page_size = MEMFILE_PAGE_SIZE;
+#ifdef FEAT_MF_INCORE
+    mfp->mf_incore = (fname == NULL);
+    ga_init2(&mfp->mf_core_chunks, (int)sizeof(char_u *), 10);
+    mfp->mf_core_free = NULL;
+#endif
 #ifdef FEAT_CRYPT
     mfp->mf_old_key = NULL;
 #endif
@@ -228,6 +326,21 @@ mf_open_file(mfp, fname)
     memfile_T	*mfp;
     char_u	*fname;
 {
+#ifdef FEAT_MF_INCORE
+    if (mfp->mf_incore)		    /* blocks are never put in a file */
+    {
+	vim_free(fname);
+	return FAIL;
+    }
+#endif
+#ifdef FEAT_MF_COMPRESS
+    /* Blocks will be written to the file, they must not be compressed. */
+    if (mf_uncompress_all(mfp) == FAIL)
+    {
+	vim_free(fname);
+	return FAIL;
+    }
+#endif
     mf_do_open(mfp, fname, O_RDWR|O_CREAT|O_EXCL); /* try to open the file */
 
     if (mfp->mf_fd < 0)
@@ -246,11 +359,10 @@ mf_close(mfp, del_file)
     int		del_file;
 {
     bhdr_T	*hp, *nextp;
-    NR_TRANS	*tp, *tpnext;
-    int		i;
 
     if (mfp == NULL)		    /* safety check */
 	return;
+    mf_sync_wait(mfp);
     if (mfp->mf_fd >= 0)
     {
 	if (close(mfp->mf_fd) < 0)
@@ -263,16 +375,27 @@ mf_close(mfp, del_file)
     {
 	total_mem_used -= hp->bh_page_count * mfp->mf_page_size;
 	nextp = hp->bh_next;
-	mf_free_bhdr(hp);
+	mf_free_bhdr(mfp, hp);
+    }
+#ifdef FEAT_MF_COMPRESS
+    for (hp = mfp->mf_comp_first; hp != NULL; hp = nextp)
+    {
+	nextp = hp->bh_next;
+	vim_free(hp->bh_data);
+	vim_free(hp);
     }
+    total_mem_used -= mfp->mf_comp_bytes;
+#endif
     while (mfp->mf_free_first != NULL)	    /* free entries in free list */
 	vim_free(mf_rem_free(mfp));
-    for (i = 0; i < MEMHASHSIZE; ++i)	    /* free entries in trans lists */
-	for (tp = mfp->mf_trans[i]; tp != NULL; tp = tpnext)
-	{
-	    tpnext = tp->nt_next;
-	    vim_free(tp);
-	}
+#ifdef FEAT_MF_INCORE
+    while (mfp->mf_core_chunks.ga_len > 0)  /* free the chunks of pages */
+	vim_free(((char_u **)mfp->mf_core_chunks.ga_data)
+					     [--mfp->mf_core_chunks.ga_len]);
+    ga_clear(&mfp->mf_core_chunks);
+#endif
+    mf_hash_free(&mfp->mf_hash);
+    mf_hash_free_all(&mfp->mf_trans);	    /* free hashtable and its items */
     vim_free(mfp->mf_fname);
     vim_free(mfp->mf_ffname);
     vim_free(mfp);
@@ -303,6 +426,7 @@ mf_close_file(buf, getlines)
 	/* TODO: should check if all blocks are really in core */
     }
 
+    mf_sync_wait(mfp);
     if (close(mfp->mf_fd) < 0)			/* close the file */
 	EMSG(_(e_swapclose));
     mfp->mf_fd = -1;
@@ -382,7 +506,7 @@ mf_new(mfp, negative, page_count)
 	}
 	else if (hp == NULL)	    /* need to allocate memory for this block */
 	{
-	    if ((p = (char_u *)alloc(mfp->mf_page_size * page_count)) == NULL)
+	    if ((p = mf_alloc_data(mfp, page_count)) == NULL)
 		return NULL;
 	    hp = mf_rem_free(mfp);
 	    hp->bh_data = p;
@@ -466,10 +590,23 @@ mf_get(mfp, nr, page_count)
 	hp->bh_page_count = page_count;
 	if (mf_read(mfp, hp) == FAIL)	    /* cannot read the block! */
 	{
-	    mf_free_bhdr(hp);
+	    mf_free_bhdr(mfp, hp);
 	    return NULL;
 	}
     }
+#ifdef FEAT_MF_COMPRESS
+    else if (hp->bh_flags & BH_COMPRESSED)
+    {
+	bhdr_T	*hp2;
+
+	if (mf_uncompress(mfp, hp) == FAIL)
+	    return NULL;
+	mf_rem_hash(mfp, hp);
+	/* Make room for it, like for a block that is read. */
+	if ((hp2 = mf_release(mfp, hp->bh_page_count)) != NULL)
+	    mf_free_bhdr(mfp, hp2);
+    }
+#endif
     else
     {
 	mf_rem_used(mfp, hp);	/* remove from list, insert in front below */
@@ -508,6 +645,12 @@ mf_put(mfp, hp, dirty, infile)
     if (dirty)
     {
 	flags |= BH_DIRTY;
+#ifdef FEAT_SWAP_ASYNC
+	flags &= ~BH_ASYNC;	    /* the copy being written is outdated */
+#endif
+#ifdef FEAT_MF_COMPRESS
+	flags &= ~BH_NOCOMP;	    /* may compress now */
+#endif
 	mfp->mf_dirty = TRUE;
     }
     hp->bh_flags = flags;
@@ -523,7 +666,7 @@ mf_free(mfp, hp)
     memfile_T	*mfp;
     bhdr_T	*hp;
 {
-    vim_free(hp->bh_data);	/* free the memory */
+    mf_free_data(mfp, hp);	/* free the memory */
     mf_rem_hash(mfp, hp);	/* get *hp out of the hash list */
     mf_rem_used(mfp, hp);	/* get *hp out of the used list */
     if (hp->bh_bnum < 0)
@@ -535,6 +678,50 @@ mf_free(mfp, hp)
 	mf_ins_free(mfp, hp);	/* put *hp in the free list */
 }
 
+/*
+ * Drop the blocks in the free list that are at the end of memfile "mfp" and
+ * make the swap file shorter.  Used after many blocks were freed.
+ * Returns the number of pages dropped.
+ */
+    long
+mf_trim(mfp)
+    memfile_T	*mfp;
+{
+    bhdr_T	**hpp;
+    bhdr_T	*hp;
+    long	count = 0;
+    int		found = TRUE;
+
+    while (found)
+    {
+	found = FALSE;
+	for (hpp = &mfp->mf_free_first; *hpp != NULL; hpp = &(*hpp)->bh_next)
+	    if ((*hpp)->bh_bnum + (*hpp)->bh_page_count == mfp->mf_blocknr_max)
+	    {
+		hp = *hpp;
+		*hpp = hp->bh_next;
+		mfp->mf_blocknr_max = hp->bh_bnum;
+		count += hp->bh_page_count;
+		vim_free(hp);
+		found = TRUE;
+		break;
+	    }
+    }
+
+    if (count > 0 && mfp->mf_infile_count > mfp->mf_blocknr_max)
+    {
+	/* The writer thread must not extend the file again. */
+	mf_sync_wait(mfp);
+	mfp->mf_infile_count = mfp->mf_blocknr_max;
+#ifdef UNIX
+	if (mfp->mf_fd >= 0)
+	    ignored = ftruncate(mfp->mf_fd,
+			      (off_t)mfp->mf_page_size * mfp->mf_blocknr_max);
+#endif
+    }
+    return count;
+}
+
 #if defined(__MORPHOS__) && defined(__libnix__)
 /* function is missing in MorphOS libnix version */
 extern unsigned long *__stdfiledes;
@@ -577,6 +764,12 @@ mf_sync(mfp, flags)
 	return FAIL;
     }
 
+#ifdef FEAT_SWAP_ASYNC
+    if ((flags & MFS_ASYNC) && p_swa)
+	return mf_sync_async(mfp, flags);
+    mf_sync_wait(mfp);
+#endif
+
     /* Only a CTRL-C while writing will break us here, not one typed
      * previously. */
     got_int = FALSE;
@@ -723,6 +916,319 @@ mf_sync(mfp, flags)
     return status;
 }
 
+#ifdef FEAT_SWAP_ASYNC
+/*
+ * mf_sync() for 'swapasync': copy the dirty blocks with a positive number
+ * and let the writer thread write them, including the flush.
+ * The blocks stay dirty until mf_async_handle() finds that the job was
+ * written, thus they are not released before they are in the file and a
+ * failed write is tried again.  Blocks that are changed in the meantime
+ * lose BH_ASYNC in mf_put() and stay dirty.
+ * A memfile has at most one job, so that BH_ASYNC always refers to it.
+ * When the previous job was not written yet nothing is done, the next sync
+ * will include the changes.
+ * Only returns FAIL when out of memory, a write error is reported later.
+ */
+    static int
+mf_sync_async(mfp, flags)
+    memfile_T	*mfp;
+    int		flags;
+{
+    mf_asyncjob_T   *job;
+    mf_asyncblock_T *bp;
+    bhdr_T	    *hp;
+    char_u	    *data;
+    off_t	    offset;
+    unsigned	    size;
+    int		    count = 0;
+
+    mf_async_handle(mfp);	    /* take care of a written job first */
+    if (mfp->mf_async_count > 0)
+	return OK;
+
+    for (hp = mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
+	if (hp->bh_bnum >= 0
+		&& (hp->bh_flags & (BH_DIRTY | BH_ASYNC)) == BH_DIRTY)
+	    ++count;
+    if (count == 0 && !(flags & MFS_FLUSH))
+    {
+	mfp->mf_dirty = FALSE;
+	return OK;
+    }
+
+    job = (mf_asyncjob_T *)alloc_clear((unsigned)sizeof(mf_asyncjob_T));
+    if (job == NULL)
+	return FAIL;
+    if (count > 0)
+    {
+	job->mj_blocks = (mf_asyncblock_T *)alloc_clear(
+				  (unsigned)(count * sizeof(mf_asyncblock_T)));
+	if (job->mj_blocks == NULL)
+	{
+	    vim_free(job);
+	    return FAIL;
+	}
+    }
+
+    /* Same order as mf_sync(): from last to first. */
+    for (hp = mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
+	if (hp->bh_bnum >= 0
+		&& (hp->bh_flags & (BH_DIRTY | BH_ASYNC)) == BH_DIRTY)
+	{
+	    bp = &job->mj_blocks[job->mj_count];
+	    offset = (off_t)mfp->mf_page_size * hp->bh_bnum;
+	    size = mfp->mf_page_size * hp->bh_page_count;
+	    data = hp->bh_data;
+#ifdef FEAT_CRYPT
+	    /* Returns a copy for a data block, other blocks as they are. */
+	    if (*mfp->mf_buffer->b_p_key != NUL)
+		data = ml_encrypt_data(mfp, data, offset, size);
+#endif
+	    if (data == hp->bh_data && (data = alloc(size)) != NULL)
+		mch_memmove(data, hp->bh_data, (size_t)size);
+	    bp->ma_data = data;
+	    if (data == NULL)
+	    {
+		mf_async_free(job);	/* blocks stay dirty */
+		return FAIL;
+	    }
+	    bp->ma_bnum = hp->bh_bnum;
+	    bp->ma_size = size;
+	    ++job->mj_count;
+	}
+    for (hp = mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
+	if (hp->bh_bnum >= 0 && (hp->bh_flags & BH_DIRTY))
+	    hp->bh_flags |= BH_ASYNC;
+
+    job->mj_mfp = mfp;
+    job->mj_fd = mfp->mf_fd;
+    job->mj_page_size = mfp->mf_page_size;
+    if ((flags & MFS_FLUSH) && *p_sws != NUL)
+	job->mj_flush = STRCMP(p_sws, "fsync") == 0 ? 'f' : 's';
+
+    pthread_mutex_lock(&mf_async_mutex);
+    if (!mf_async_started)
+    {
+	pthread_t	thread;
+
+	if (pthread_create(&thread, NULL, mf_async_writer, NULL) != 0)
+	{
+	    pthread_mutex_unlock(&mf_async_mutex);
+	    for (hp = mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
+		hp->bh_flags &= ~BH_ASYNC;
+	    mf_async_free(job);
+	    return mf_sync(mfp, flags & ~MFS_ASYNC);
+	}
+	pthread_detach(thread);
+	mf_async_started = TRUE;
+    }
+    if (mf_async_last == NULL)
+	mf_async_first = job;
+    else
+	mf_async_last->mj_next = job;
+    mf_async_last = job;
+    pthread_cond_signal(&mf_async_todo);
+    pthread_mutex_unlock(&mf_async_mutex);
+
+    ++mfp->mf_async_count;
+    mfp->mf_dirty = FALSE;
+    return OK;
+}
+
+/*
+ * The writer thread: write the jobs in mf_async_first in order.
+ * Only uses the job, never the memfile, the main thread waits for the jobs
+ * of a memfile before it uses the file itself or closes it.
+ */
+    static void *
+mf_async_writer(arg)
+    void	*arg UNUSED;
+{
+    mf_asyncjob_T   *job;
+    mf_asyncjob_T   **pp;
+    mf_asyncblock_T *bp;
+    off_t	    offset;
+    int		    status;
+    int		    i;
+
+    pthread_mutex_lock(&mf_async_mutex);
+    for (;;)
+    {
+	while (mf_async_first == NULL)
+	    pthread_cond_wait(&mf_async_todo, &mf_async_mutex);
+	job = mf_async_first;
+	pthread_mutex_unlock(&mf_async_mutex);
+
+	status = OK;
+	for (i = 0; i < job->mj_count && status == OK; ++i)
+	{
+	    bp = &job->mj_blocks[i];
+	    offset = (off_t)job->mj_page_size * bp->ma_bnum;
+	    mf_async_writing = TRUE;
+	    if (mf_async_stop
+		    || lseek(job->mj_fd, offset, SEEK_SET) != offset
+		    || (unsigned)vim_write(job->mj_fd, bp->ma_data, bp->ma_size)
+								 != bp->ma_size)
+		status = FAIL;
+	    mf_async_writing = FALSE;
+	}
+	if (status == OK && job->mj_flush != 0 && !mf_async_stop)
+	{
+#ifdef HAVE_FSYNC
+	    if (job->mj_flush == 'f')
+	    {
+		if (fsync(job->mj_fd))
+		    status = FAIL;
+	    }
+	    else
+#endif
+#if defined(__OPENNT) || defined(__TANDEM) || defined(__native_client__)
+		fflush(NULL);
+#else
+		sync();
+#endif
+	}
+	job->mj_status = status;
+
+	pthread_mutex_lock(&mf_async_mutex);
+	mf_async_first = job->mj_next;
+	if (mf_async_first == NULL)
+	    mf_async_last = NULL;
+	job->mj_next = NULL;
+	for (pp = &mf_async_written; *pp != NULL; pp = &(*pp)->mj_next)
+	    ;
+	*pp = job;
+	pthread_cond_broadcast(&mf_async_done);
+    }
+    /*NOTREACHED*/
+    return NULL;
+}
+
+/*
+ * Handle the written job of memfile "mfp", if there is one: blocks that are
+ * still the same as the copy that was written are no longer dirty.  A failed
+ * job leaves its blocks dirty, they are written again later.
+ */
+    static void
+mf_async_handle(mfp)
+    memfile_T	*mfp;
+{
+    mf_asyncjob_T   **pp;
+    mf_asyncjob_T   *job = NULL;
+    mf_asyncblock_T *bp;
+    bhdr_T	    *hp;
+    blocknr_T	    end;
+    int		    i;
+
+    if (mfp->mf_async_count == 0)
+	return;
+
+    pthread_mutex_lock(&mf_async_mutex);
+    for (pp = &mf_async_written; *pp != NULL; pp = &(*pp)->mj_next)
+	if ((*pp)->mj_mfp == mfp)
+	{
+	    job = *pp;
+	    *pp = job->mj_next;
+	    break;
+	}
+    pthread_mutex_unlock(&mf_async_mutex);
+
+    if (job != NULL)
+    {
+	for (i = 0; i < job->mj_count; ++i)
+	{
+	    bp = &job->mj_blocks[i];
+	    hp = mf_find_hash(mfp, bp->ma_bnum);
+	    if (hp != NULL && (hp->bh_flags & BH_ASYNC))
+	    {
+		hp->bh_flags &= ~BH_ASYNC;
+		if (job->mj_status == OK)
+		    hp->bh_flags &= ~BH_DIRTY;
+		else
+		    mfp->mf_dirty = TRUE;
+	    }
+	    end = bp->ma_bnum + bp->ma_size / job->mj_page_size;
+	    if (job->mj_status == OK && end > mfp->mf_infile_count)
+		mfp->mf_infile_count = end;
+	}
+	if (job->mj_status == FAIL)
+	{
+	    if (!did_swapwrite_msg)
+		EMSG(_("E297: Write error in swap file"));
+	    did_swapwrite_msg = TRUE;
+	}
+	--mfp->mf_async_count;
+	mf_async_free(job);
+    }
+}
+
+/*
+ * Free a job and the copies of the blocks in it.
+ */
+    static void
+mf_async_free(job)
+    mf_asyncjob_T   *job;
+{
+    int		i;
+
+    for (i = 0; i < job->mj_count; ++i)
+	vim_free(job->mj_blocks[i].ma_data);
+    vim_free(job->mj_blocks);
+    vim_free(job);
+}
+
+/*
+ * Used when exiting on a deadly signal: tell the writer thread to stop and
+ * give it a moment to finish the block it is writing, so that the main thread
+ * can write the swap files itself.  Doesn't use the mutex or free anything.
+ */
+    static void
+mf_async_abandon()
+{
+    int		i;
+
+    mf_async_stop = TRUE;
+    for (i = 0; i < 100 && mf_async_writing; ++i)
+	mch_delay(10L, TRUE);
+}
+#endif
+
+/*
+ * Wait for the writer thread to finish the job of memfile "mfp" and handle
+ * it.  Must be done before using the file of "mfp" in any other way.
+ */
+    void
+mf_sync_wait(mfp)
+    memfile_T	*mfp UNUSED;
+{
+#ifdef FEAT_SWAP_ASYNC
+    mf_asyncjob_T   *job;
+
+    if (mfp->mf_async_count == 0)
+	return;
+    if (really_exiting)
+    {
+	/* Called from preserve_exit(), possibly in a signal handler.  The
+	 * blocks of the job are still dirty, mf_sync() writes them again. */
+	mf_async_abandon();
+	mfp->mf_dirty = TRUE;
+	return;
+    }
+    pthread_mutex_lock(&mf_async_mutex);
+    for (;;)
+    {
+	for (job = mf_async_first; job != NULL; job = job->mj_next)
+	    if (job->mj_mfp == mfp)
+		break;
+	if (job == NULL)
+	    break;
+	pthread_cond_wait(&mf_async_done, &mf_async_mutex);
+    }
+    pthread_mutex_unlock(&mf_async_mutex);
+    mf_async_handle(mfp);
+#endif
+}
+
 /*
  * For all blocks in memory file *mfp that have a positive block number set
  * the dirty flag.  These are blocks that need to be written to a newly
@@ -748,16 +1254,7 @@ mf_ins_hash(mfp, hp)
     memfile_T	*mfp;
     bhdr_T	*hp;
 {
-    bhdr_T	*hhp;
-    int		hash;
-
-    hash = MEMHASH(hp->bh_bnum);
-    hhp = mfp->mf_hash[hash];
-    hp->bh_hash_next = hhp;
-    hp->bh_hash_prev = NULL;
-    if (hhp != NULL)
-	hhp->bh_hash_prev = hp;
-    mfp->mf_hash[hash] = hp;
+    mf_hash_add_item(&mfp->mf_hash, (mf_hashitem_T *)hp);
 }
 
 /*
@@ -768,13 +1265,7 @@ mf_rem_hash(mfp, hp)
     memfile_T	*mfp;
     bhdr_T	*hp;
 {
-    if (hp->bh_hash_prev == NULL)
-	mfp->mf_hash[MEMHASH(hp->bh_bnum)] = hp->bh_hash_next;
-    else
-	hp->bh_hash_prev->bh_hash_next = hp->bh_hash_next;
-
-    if (hp->bh_hash_next)
-	hp->bh_hash_next->bh_hash_prev = hp->bh_hash_prev;
+    mf_hash_rem_item(&mfp->mf_hash, (mf_hashitem_T *)hp);
 }
 
 /*
@@ -785,12 +1276,7 @@ mf_find_hash(mfp, nr)
     memfile_T	*mfp;
     blocknr_T	nr;
 {
-    bhdr_T	*hp;
-
-    for (hp = mfp->mf_hash[MEMHASH(nr)]; hp != NULL; hp = hp->bh_hash_next)
-	if (hp->bh_bnum == nr)
-	    break;
-    return hp;
+    return (bhdr_T *)mf_hash_find(&mfp->mf_hash, nr);
 }
 
 /*
@@ -873,6 +1359,26 @@ mf_release(mfp, page_count)
 	    ml_open_file(buf);
     }
 
+#ifdef FEAT_MF_COMPRESS
+    /* Without a file the least recently used block is compressed.  When
+     * that doesn't work it is moved to the front of the used list, so that
+     * another block is tried next time.  A block that didn't compress isn't
+     * tried again until it is changed. */
+    if (mfp->mf_fd < 0 && need_release)
+    {
+	for (hp = mfp->mf_used_last; hp != NULL; hp = hp->bh_prev)
+	    if (!(hp->bh_flags & BH_LOCKED))
+		break;
+	if (hp != NULL && ((hp->bh_flags & BH_NOCOMP)
+					       || mf_compress(mfp, hp) == FAIL))
+	{
+	    mf_rem_used(mfp, hp);
+	    mf_ins_used(mfp, hp);
+	}
+	return NULL;
+    }
+#endif
+
     /*
      * don't release a block if
      *	there is no file for this memfile
@@ -906,8 +1412,8 @@ mf_release(mfp, page_count)
      */
     if (hp->bh_page_count != page_count)
     {
-	vim_free(hp->bh_data);
-	if ((hp->bh_data = alloc(mfp->mf_page_size * page_count)) == NULL)
+	mf_free_data(mfp, hp);
+	if ((hp->bh_data = mf_alloc_data(mfp, page_count)) == NULL)
 	{
 	    vim_free(hp);
 	    return NULL;
@@ -940,6 +1446,26 @@ mf_release_all()
 	    if (mfp->mf_fd < 0 && buf->b_may_swap)
 		ml_open_file(buf);
 
+#ifdef FEAT_MF_COMPRESS
+	    /* Without a swap file, compress what can be compressed.  A block
+	     * that fails stays where it is, only one that is compressed is
+	     * removed from the used list. */
+	    if (mfp->mf_fd < 0)
+	    {
+		unsigned	comp_count = mfp->mf_comp_count;
+		bhdr_T		*prev;
+
+		for (hp = mfp->mf_used_last; hp != NULL; hp = prev)
+		{
+		    prev = hp->bh_prev;
+		    if (!(hp->bh_flags & (BH_LOCKED | BH_NOCOMP)))
+			(void)mf_compress(mfp, hp);
+		}
+		if (mfp->mf_comp_count != comp_count)
+		    retval = TRUE;
+	    }
+#endif
+
 	    /* only if there is a swapfile */
 	    if (mfp->mf_fd >= 0)
 	    {
@@ -951,7 +1477,7 @@ mf_release_all()
 		    {
 			mf_rem_used(mfp, hp);
 			mf_rem_hash(mfp, hp);
-			mf_free_bhdr(hp);
+			mf_free_bhdr(mfp, hp);
 			hp = mfp->mf_used_last;	/* re-start, list was changed */
 			retval = TRUE;
 		    }
@@ -976,8 +1502,7 @@ mf_alloc_bhdr(mfp, page_count)
 
     if ((hp = (bhdr_T *)alloc((unsigned)sizeof(bhdr_T))) != NULL)
     {
-	if ((hp->bh_data = (char_u *)alloc(mfp->mf_page_size * page_count))
-								      == NULL)
+	if ((hp->bh_data = mf_alloc_data(mfp, page_count)) == NULL)
 	{
 	    vim_free(hp);	    /* not enough memory */
 	    return NULL;
@@ -991,16 +1516,336 @@ mf_alloc_bhdr(mfp, page_count)
  * Free a block header and the block of memory for it
  */
     static void
-mf_free_bhdr(hp)
+mf_free_bhdr(mfp, hp)
+    memfile_T	*mfp;
     bhdr_T	*hp;
 {
-    vim_free(hp->bh_data);
+    mf_free_data(mfp, hp);
     vim_free(hp);
 }
 
 /*
- * insert entry *hp in the free list
+ * Allocate the memory for a block of "page_count" pages.
+ * For an in-core memfile a single page is taken from the chunks of pages,
+ * a new chunk is added when there is no unused page.
+ */
+    static char_u *
+mf_alloc_data(mfp, page_count)
+    memfile_T	*mfp;
+    int		page_count;
+{
+#ifdef FEAT_MF_INCORE
+    char_u	*p;
+    int		i;
+
+    if (mfp->mf_incore && page_count == 1)
+    {
+	if (mfp->mf_core_free == NULL)
+	{
+	    if (ga_grow(&mfp->mf_core_chunks, 1) == FAIL
+		    || (p = alloc(mfp->mf_page_size * MF_CORE_PAGES)) == NULL)
+		return NULL;
+	    ((char_u **)mfp->mf_core_chunks.ga_data)
+					   [mfp->mf_core_chunks.ga_len++] = p;
+	    /* Link the pages in the free list, the first one at the head. */
+	    for (i = MF_CORE_PAGES - 1; i >= 0; --i)
+	    {
+		*(char_u **)(p + i * mfp->mf_page_size) = mfp->mf_core_free;
+		mfp->mf_core_free = p + i * mfp->mf_page_size;
+	    }
+	}
+	p = mfp->mf_core_free;
+	mfp->mf_core_free = *(char_u **)p;
+	return p;
+    }
+#endif
+    return (char_u *)alloc(mfp->mf_page_size * page_count);
+}
+
+/*
+ * Free the memory of block "hp", allocated with mf_alloc_data().
  */
+    static void
+mf_free_data(mfp, hp)
+    memfile_T	*mfp;
+    bhdr_T	*hp;
+{
+#ifdef FEAT_MF_INCORE
+    if (mfp->mf_incore && hp->bh_page_count == 1)
+    {
+	*(char_u **)hp->bh_data = mfp->mf_core_free;
+	mfp->mf_core_free = hp->bh_data;
+	return;
+    }
+#endif
+    vim_free(hp->bh_data);
+}
+
+#ifdef FEAT_MF_COMPRESS
+/*
+ * Compress block "hp", which is in the used list and not locked.
+ * When that saves at least a quarter the block is moved to the list of
+ * compressed blocks and OK is returned.  Otherwise FAIL is returned and the
+ * block is left where it is.  When it doesn't compress well enough it gets
+ * BH_NOCOMP, until it is changed.
+ */
+    static int
+mf_compress(mfp, hp)
+    memfile_T	*mfp;
+    bhdr_T	*hp;
+{
+    unsigned	size = hp->bh_page_count * mfp->mf_page_size;
+    unsigned	maxlen = size - size / 4;
+    unsigned	len = 0;
+    char_u	*p;
+
+    /* The compressed data is preceded by its length. */
+    p = alloc(sizeof(unsigned) + maxlen);
+    if (p != NULL)
+	len = mf_lz_compress(hp->bh_data, size, p + sizeof(unsigned), maxlen);
+    if (len == 0)
+    {
+	if (p != NULL)
+	    hp->bh_flags |= BH_NOCOMP;
+	vim_free(p);
+	return FAIL;
+    }
+    mch_memmove(p, &len, sizeof(unsigned));
+    len += sizeof(unsigned);
+
+    mf_rem_used(mfp, hp);
+    mf_free_data(mfp, hp);
+    hp->bh_data = (char_u *)vim_realloc(p, len);    /* give back the rest */
+    if (hp->bh_data == NULL)
+	hp->bh_data = p;
+    hp->bh_flags |= BH_COMPRESSED;
+
+    hp->bh_prev = NULL;
+    hp->bh_next = mfp->mf_comp_first;
+    if (hp->bh_next != NULL)
+	hp->bh_next->bh_prev = hp;
+    mfp->mf_comp_first = hp;
+    mfp->mf_comp_count += hp->bh_page_count;
+    mfp->mf_comp_bytes += len;
+    total_mem_used += len;
+    return OK;
+}
+
+/*
+ * Uncompress block "hp" and remove it from the list of compressed blocks.
+ * The caller must put it in the used list.
+ * Return FAIL when out of memory, the block is then still compressed.
+ */
+    static int
+mf_uncompress(mfp, hp)
+    memfile_T	*mfp;
+    bhdr_T	*hp;
+{
+    char_u	*data;
+    unsigned	len;
+
+    if ((data = mf_alloc_data(mfp, hp->bh_page_count)) == NULL)
+	return FAIL;
+    mch_memmove(&len, hp->bh_data, sizeof(unsigned));
+    if (mf_lz_decompress(hp->bh_data + sizeof(unsigned), len, data,
+			  hp->bh_page_count * mfp->mf_page_size) == FAIL)
+	EMSG2(_(e_intern2), "mf_uncompress()");
+
+    if (hp->bh_prev == NULL)
+	mfp->mf_comp_first = hp->bh_next;
+    else
+	hp->bh_prev->bh_next = hp->bh_next;
+    if (hp->bh_next != NULL)
+	hp->bh_next->bh_prev = hp->bh_prev;
+    len += sizeof(unsigned);
+    mfp->mf_comp_count -= hp->bh_page_count;
+    mfp->mf_comp_bytes -= len;
+    total_mem_used -= len;
+
+    vim_free(hp->bh_data);
+    hp->bh_data = data;
+    hp->bh_flags &= ~BH_COMPRESSED;
+    return OK;
+}
+
+/*
+ * Uncompress all compressed blocks of "mfp" and put them in the used list.
+ * Return FAIL when out of memory.
+ */
+    static int
+mf_uncompress_all(mfp)
+    memfile_T	*mfp;
+{
+    bhdr_T	*hp;
+
+    while ((hp = mfp->mf_comp_first) != NULL)
+    {
+	if (mf_uncompress(mfp, hp) == FAIL)
+	    return FAIL;
+	mf_ins_used(mfp, hp);
+    }
+    return OK;
+}
+
+/*
+ * Compress "len" bytes at "src" into "dst", which has room for "maxlen"
+ * bytes.  This is a simple LZ77 variant that is fast enough to be used when
+ * going over 'maxmem'.  Each sequence starts with a byte that has the number
+ * of literal bytes in the high nibble and the match length minus
+ * MF_LZ_MINMATCH in the low nibble.  When a nibble is 15 the rest of the
+ * number follows in bytes, 255 meaning another byte follows.  Then come the
+ * literal bytes, the two byte offset of the match and the rest of the match
+ * length.  The last sequence only has literal bytes.
+ * Returns the compressed length, zero when it doesn't fit.
+ */
+    static unsigned
+mf_lz_compress(src, len, dst, maxlen)
+    char_u	*src;
+    unsigned	len;
+    char_u	*dst;
+    unsigned	maxlen;
+{
+    static unsigned table[1 << MF_LZ_HASH_BITS];  /* position + 1 */
+    unsigned	ip = 0;
+    unsigned	op = 0;
+    unsigned	anchor = 0;
+    unsigned	ref;
+    unsigned	lit;
+    unsigned	mlen;
+    int		h;
+
+    vim_memset(table, 0, sizeof(table));
+    while (ip + MF_LZ_MINMATCH <= len)
+    {
+	h = (int)(((long_u)(src[ip] | (src[ip + 1] << 8) | (src[ip + 2] << 16)
+			    | ((long_u)src[ip + 3] << 24)) * 2654435761UL >> 16)
+					       & ((1 << MF_LZ_HASH_BITS) - 1));
+	ref = table[h];
+	table[h] = ip + 1;
+	if (ref == 0 || ip - --ref > 0xffff
+		|| memcmp(src + ref, src + ip, MF_LZ_MINMATCH) != 0)
+	{
+	    ++ip;
+	    continue;
+	}
+	mlen = MF_LZ_MINMATCH;
+	while (ip + mlen < len && src[ref + mlen] == src[ip + mlen])
+	    ++mlen;
+
+	lit = ip - anchor;
+	if (op >= maxlen)
+	    return 0;
+	dst[op++] = ((lit < 15 ? lit : 15) << 4)
+	     | (mlen - MF_LZ_MINMATCH < 15 ? mlen - MF_LZ_MINMATCH : 15);
+	if ((lit >= 15 && mf_lz_put_len(dst, &op, maxlen, lit - 15) == FAIL)
+		|| lit + 2 > maxlen - op)
+	    return 0;
+	mch_memmove(dst + op, src + anchor, (size_t)lit);
+	op += lit;
+	dst[op++] = (ip - ref) & 0xff;
+	dst[op++] = (ip - ref) >> 8;
+	if (mlen - MF_LZ_MINMATCH >= 15 && mf_lz_put_len(dst, &op, maxlen,
+					 mlen - MF_LZ_MINMATCH - 15) == FAIL)
+	    return 0;
+	ip += mlen;
+	anchor = ip;
+    }
+
+    lit = len - anchor;
+    if (op >= maxlen)
+	return 0;
+    dst[op++] = (lit < 15 ? lit : 15) << 4;
+    if ((lit >= 15 && mf_lz_put_len(dst, &op, maxlen, lit - 15) == FAIL)
+	    || lit > maxlen - op)
+	return 0;
+    mch_memmove(dst + op, src + anchor, (size_t)lit);
+    return op + lit;
+}
+
+/*
+ * Put the rest "n" of a length at "dst[*op]" for mf_lz_compress().
+ */
+    static int
+mf_lz_put_len(dst, op, maxlen, n)
+    char_u	*dst;
+    unsigned	*op;
+    unsigned	maxlen;
+    unsigned	n;
+{
+    for (;;)
+    {
+	if (*op >= maxlen)
+	    return FAIL;
+	dst[(*op)++] = n < 255 ? n : 255;
+	if (n < 255)
+	    return OK;
+	n -= 255;
+    }
+}
+
+/*
+ * Uncompress "len" bytes at "src", compressed with mf_lz_compress(), into
+ * "dst", which must become exactly "dstlen" bytes.
+ * Returns FAIL when the data is invalid.
+ */
+    static int
+mf_lz_decompress(src, len, dst, dstlen)
+    char_u	*src;
+    unsigned	len;
+    char_u	*dst;
+    unsigned	dstlen;
+{
+    unsigned	ip = 0;
+    unsigned	op = 0;
+    unsigned	lit;
+    unsigned	mlen;
+    unsigned	off;
+    int		token;
+    int		n;
+
+    while (ip < len)
+    {
+	token = src[ip++];
+	lit = token >> 4;
+	if (lit == 15)
+	    do
+	    {
+		if (ip >= len)
+		    return FAIL;
+		n = src[ip++];
+		lit += n;
+	    } while (n == 255);
+	if (lit > len - ip || lit > dstlen - op)
+	    return FAIL;
+	mch_memmove(dst + op, src + ip, (size_t)lit);
+	ip += lit;
+	op += lit;
+	if (ip == len)		/* the last sequence has no match */
+	    break;
+
+	if (len - ip < 2)
+	    return FAIL;
+	off = src[ip] | (src[ip + 1] << 8);
+	ip += 2;
+	mlen = (token & 15) + MF_LZ_MINMATCH;
+	if ((token & 15) == 15)
+	    do
+	    {
+		if (ip >= len)
+		    return FAIL;
+		n = src[ip++];
+		mlen += n;
+	    } while (n == 255);
+	if (off == 0 || off > op || mlen > dstlen - op)
+	    return FAIL;
+	/* The match may overlap with what is being copied. */
+	for ( ; mlen > 0; --mlen, ++op)
+	    dst[op] = dst[op - off];
+    }
+    return op == dstlen ? OK : FAIL;
+}
+#endif
+
     static void
 mf_ins_free(mfp, hp)
     memfile_T	*mfp;
@@ -1041,6 +1886,7 @@ mf_read(mfp, hp)
 
     if (mfp->mf_fd < 0)	    /* there is no file, can't read */
 	return FAIL;
+    mf_sync_wait(mfp);
 
     page_size = mfp->mf_page_size;
     offset = (off_t)page_size * hp->bh_bnum;
@@ -1084,6 +1930,7 @@ mf_write(mfp, hp)
 
     if (mfp->mf_fd < 0)	    /* there is no file, can't write */
 	return FAIL;
+    mf_sync_wait(mfp);
 
     if (hp->bh_bnum < 0)	/* must assign file block number */
 	if (mf_trans_add(mfp, hp) == FAIL)
@@ -1192,7 +2039,6 @@ mf_trans_add(mfp, hp)
 {
     bhdr_T	*freep;
     blocknr_T	new_bnum;
-    int		hash;
     NR_TRANS	*np;
     int		page_count;
 
@@ -1240,12 +2086,7 @@ mf_trans_add(mfp, hp)
     hp->bh_bnum = new_bnum;
     mf_ins_hash(mfp, hp);		    /* insert in new hash list */
 
-    hash = MEMHASH(np->nt_old_bnum);	    /* insert in trans list */
-    np->nt_next = mfp->mf_trans[hash];
-    mfp->mf_trans[hash] = np;
-    if (np->nt_next != NULL)
-	np->nt_next->nt_prev = np;
-    np->nt_prev = NULL;
+    mf_hash_add_item(&mfp->mf_trans, (mf_hashitem_T *)np);
 
     return OK;
 }
@@ -1260,25 +2101,20 @@ mf_trans_del(mfp, old_nr)
     memfile_T	*mfp;
     blocknr_T	old_nr;
 {
-    int		hash;
     NR_TRANS	*np;
     blocknr_T	new_bnum;
 
-    hash = MEMHASH(old_nr);
-    for (np = mfp->mf_trans[hash]; np != NULL; np = np->nt_next)
-	if (np->nt_old_bnum == old_nr)
-	    break;
+    np = (NR_TRANS *)mf_hash_find(&mfp->mf_trans, old_nr);
+
     if (np == NULL)		/* not found */
 	return old_nr;
 
     mfp->mf_neg_count--;
     new_bnum = np->nt_new_bnum;
-    if (np->nt_prev != NULL)		/* remove entry from the trans list */
-	np->nt_prev->nt_next = np->nt_next;
-    else
-	mfp->mf_trans[hash] = np->nt_next;
-    if (np->nt_next != NULL)
-	np->nt_next->nt_prev = np->nt_prev;
+
+    /* remove entry from the trans list */
+    mf_hash_rem_item(&mfp->mf_trans, (mf_hashitem_T *)np);
+
     vim_free(np);
 
     return new_bnum;
@@ -1402,3 +2238,207 @@ mf_do_open(mfp, fname, flags)
 	mch_hide(mfp->mf_fname);    /* try setting the 'hidden' flag */
     }
 }
+
+/*
+ * Implementation of mf_hashtab_T follows.
+ */
+
+/*
+ * The number of buckets in the hashtable is increased by a factor of
+ * MHT_GROWTH_FACTOR when the average number of items per bucket
+ * exceeds 2 ^ MHT_LOG_LOAD_FACTOR.
+ */
+#define MHT_LOG_LOAD_FACTOR 1
+#define MHT_GROWTH_FACTOR   4   /* must be a power of two */
+
+/*
+ * Initialize an empty hash table.
+ */
+    static void
+mf_hash_init(mht)
+    mf_hashtab_T *mht;
+{
+    vim_memset(mht, 0, sizeof(mf_hashtab_T));
+    mht->mht_buckets = mht->mht_small_buckets;
+    mht->mht_mask = MHT_INIT_SIZE - 1;
+}
+
+/*
+ * Free the array of a hash table.  Does not free the items it contains!
+ * The hash table must not be used again without another mf_hash_init() call.
+ */
+    static void
+mf_hash_free(mht)
+    mf_hashtab_T *mht;
+{
+    if (mht->mht_buckets != mht->mht_small_buckets)
+	vim_free(mht->mht_buckets);
+}
+
+/*
+ * Free the array of a hash table and all the items it contains.
+ */
+    static void
+mf_hash_free_all(mht)
+    mf_hashtab_T    *mht;
+{
+    long_u	    idx;
+    mf_hashitem_T   *mhi;
+    mf_hashitem_T   *next;
+
+    for (idx = 0; idx <= mht->mht_mask; idx++)
+	for (mhi = mht->mht_buckets[idx]; mhi != NULL; mhi = next)
+	{
+	    next = mhi->mhi_next;
+	    vim_free(mhi);
+	}
+
+    mf_hash_free(mht);
+}
+
+/*
+ * Find "key" in hashtable "mht".
+ * Returns a pointer to a mf_hashitem_T or NULL if the item was not found.
+ */
+    static mf_hashitem_T *
+mf_hash_find(mht, key)
+    mf_hashtab_T    *mht;
+    blocknr_T	    key;
+{
+    mf_hashitem_T   *mhi;
+
+    mhi = mht->mht_buckets[key & mht->mht_mask];
+    while (mhi != NULL && mhi->mhi_key != key)
+	mhi = mhi->mhi_next;
+
+    return mhi;
+}
+
+/*
+ * Add item "mhi" to hashtable "mht".
+ * "mhi" must not be NULL.
+ */
+    static void
+mf_hash_add_item(mht, mhi)
+    mf_hashtab_T    *mht;
+    mf_hashitem_T   *mhi;
+{
+    long_u	    idx;
+
+    idx = mhi->mhi_key & mht->mht_mask;
+    mhi->mhi_next = mht->mht_buckets[idx];
+    mhi->mhi_prev = NULL;
+    if (mhi->mhi_next != NULL)
+	mhi->mhi_next->mhi_prev = mhi;
+    mht->mht_buckets[idx] = mhi;
+
+    mht->mht_count++;
+
+    /*
+     * Grow hashtable when we have more than 2^MHT_LOG_LOAD_FACTOR
+     * items per bucket on average
+     */
+    if (mht->mht_fixed == 0
+	&& (mht->mht_count >> MHT_LOG_LOAD_FACTOR) > mht->mht_mask)
+    {
+	if (mf_hash_grow(mht) == FAIL)
+	{
+	    /* stop trying to grow after first failure to allocate memory */
+	    mht->mht_fixed = 1;
+	}
+    }
+}
+
+/*
+ * Remove item "mhi" from hashtable "mht".
+ * "mhi" must not be NULL and must have been inserted into "mht".
+ */
+    static void
+mf_hash_rem_item(mht, mhi)
+    mf_hashtab_T    *mht;
+    mf_hashitem_T   *mhi;
+{
+    if (mhi->mhi_prev == NULL)
+	mht->mht_buckets[mhi->mhi_key & mht->mht_mask] = mhi->mhi_next;
+    else
+	mhi->mhi_prev->mhi_next = mhi->mhi_next;
+
+    if (mhi->mhi_next != NULL)
+	mhi->mhi_next->mhi_prev = mhi->mhi_prev;
+
+    mht->mht_count--;
+
+    /* We could shrink the table here, but it typically takes little memory,
+     * so why bother?  */
+}
+
+/*
+ * Increase number of buckets in the hashtable by MHT_GROWTH_FACTOR and
+ * rehash items.
+ * Returns FAIL when out of memory.
+ */
+    static int
+mf_hash_grow(mht)
+    mf_hashtab_T    *mht;
+{
+    long_u	    i, j;
+    int		    shift;
+    mf_hashitem_T   *mhi;
+    mf_hashitem_T   *tails[MHT_GROWTH_FACTOR];
+    mf_hashitem_T   **buckets;
+    size_t	    size;
+
+    size = (mht->mht_mask + 1) * MHT_GROWTH_FACTOR * sizeof(void *);
+    buckets = (mf_hashitem_T **)lalloc_clear(size, FALSE);
+    if (buckets == NULL)
+	return FAIL;
+
+    shift = 0;
+    while ((mht->mht_mask >> shift) != 0)
+	shift++;
+
+    for (i = 0; i <= mht->mht_mask; i++)
+    {
+	/*
+	 * Traverse the items in the i-th original bucket and move them into
+	 * MHT_GROWTH_FACTOR new buckets, preserving their relative order
+	 * within each new bucket.  Preserving the order is important because
+	 * mf_get() tries to keep most recently used items at the front of
+	 * each bucket.
+	 *
+	 * Here we strongly rely on the fact the hashes are computed modulo
+	 * a power of two.
+	 */
+
+	vim_memset(tails, 0, sizeof(tails));
+
+	for (mhi = mht->mht_buckets[i]; mhi != NULL; mhi = mhi->mhi_next)
+	{
+	    j = (mhi->mhi_key >> shift) & (MHT_GROWTH_FACTOR - 1);
+	    if (tails[j] == NULL)
+	    {
+		buckets[i + (j << shift)] = mhi;
+		tails[j] = mhi;
+		mhi->mhi_prev = NULL;
+	    }
+	    else
+	    {
+		tails[j]->mhi_next = mhi;
+		mhi->mhi_prev = tails[j];
+		tails[j] = mhi;
+	    }
+	}
+
+	for (j = 0; j < MHT_GROWTH_FACTOR; j++)
+	    if (tails[j] != NULL)
+		tails[j]->mhi_next = NULL;
+    }
+
+    if (mht->mht_buckets != mht->mht_small_buckets)
+	vim_free(mht->mht_buckets);
+
+    mht->mht_buckets = buckets;
+    mht->mht_mask = (mht->mht_mask + 1) * MHT_GROWTH_FACTOR - 1;
+
+    return OK;
+}
@@ -61,6 +61,10 @@
 # include <errno.h>
 #endif
 
+#ifdef FEAT_MMAP_VIEW
+# include <sys/mman.h>
+#endif
+
 typedef struct block0		ZERO_BL;    /* contents of the first block */
 typedef struct pointer_block	PTR_BL;	    /* contents of a pointer block */
 typedef struct data_block	DATA_BL;    /* contents of a data block */
@@ -210,6 +214,16 @@ struct block0
 
 #define STACK_INCR	5	/* nr of entries added to ml_stack at a time */
 
+/*
+ * A data block is sparse when less than a quarter of it is used.  The
+ * memline is compacted when waiting for the user to type after this many
+ * blocks became sparse.
+ */
+#define ML_IS_SPARSE(dp, free) \
+		    ((free) * 4 > ((dp)->db_txt_end - HEADER_SIZE) * 3)
+#define ML_SPARSE_COMPACT	50
+#define ML_COMPACT_BLOCKS	100	/* data blocks read per idle call */
+
 /*
  * The line number where the first mark may be is remembered.
  * If it is 0 there are no marks at all.
@@ -218,6 +232,108 @@ struct block0
  */
 static linenr_T	lowest_marked = 0;
 
+/*
+ * State of a bulk load into an empty buffer, see ml_bulk_begin().
+ * Only one buffer can be loaded in bulk at a time.
+ */
+static struct
+{
+    buf_T	*bl_buf;	/* buffer being loaded, NULL when not active */
+    bhdr_T	*bl_hp;		/* data block being filled, locked */
+    PTR_EN	bl_last;	/* pointer to the block with the empty line */
+    garray_T	bl_blocks;	/* PTR_EN for each filled data block */
+#ifdef FEAT_BYTEOFF
+    garray_T	bl_chunks;	/* chunksize_T for the loaded lines */
+#endif
+} ml_bulk;
+
+#ifdef FEAT_MMAP_VIEW
+/*
+ * A file mapped in memory for ":edit ++mmap file", see ml_mmap_open().
+ * The line breaks in each chunk of the file are counted when it is mapped.
+ * Where they are in a chunk is only found when a line in the chunk is used.
+ * When another process truncates the file, using the part that is gone gives
+ * SIGBUS.  That is caught with mch_startjmp(), the text is then lost and the
+ * buffer is reloaded by buf_check_timestamp(), see ml_mmap_changed().
+ */
+# define MM_CHUNK_SIZE	0x10000L    /* offsets in a chunk fit in a short_u */
+
+typedef struct mlmmap_S
+{
+    char_u	*mm_base;	/* the mapped file */
+    size_t	mm_size;	/* size of the mapped file */
+    int		mm_dos;		/* remove a CR before a NL */
+    long	mm_chunk_count;	/* number of chunks */
+    linenr_T	*mm_nl_before;	/* number of NLs before each chunk, plus
+				   the total number at the end */
+    short_u	**mm_nl_index;	/* offsets of the NLs in each chunk, NULL
+				   when not found yet */
+    char_u	*mm_line;	/* copy of the line returned by ml_get() */
+    size_t	mm_line_size;	/* allocated size of mm_line */
+    dev_t	mm_dev;		/* device and inode of the file */
+    ino_t	mm_ino;
+    time_t	mm_mtime;	/* modification time when mapped */
+    int		mm_lost;	/* got SIGBUS, the file was truncated */
+} mlmmap_T;
+#endif
+
+#ifdef FEAT_TRIGRAM_INDEX
+/*
+ * Trigram index of a buffer for 'trigramindex', see ml_tri_skip().
+ * The lines are split into chunks of about MLTRI_LINES lines.  Each chunk has
+ * a bitmap with a bit set for the hash of every trigram in its lines, with
+ * ASCII letters made lower case.  A changed line only adds bits, after many
+ * changes the bitmap is rebuilt when it is used next.
+ */
+# define MLTRI_LINES	128		/* lines in a new chunk */
+# define MLTRI_MAXL	(2 * MLTRI_LINES) /* chunk is split above this */
+# define MLTRI_MINBUF	(4 * MLTRI_LINES) /* smaller buffers are not indexed */
+# define MLTRI_SHIFT	14
+# define MLTRI_BITS	(1 << MLTRI_SHIFT) /* bits in the bitmap of a chunk */
+
+typedef struct
+{
+    int		tc_numlines;	/* number of lines in the chunk */
+    int		tc_changed;	/* lines changed since the bitmap was
+				   built */
+    char_u	*tc_bits;	/* bitmap of MLTRI_BITS bits, NULL when not
+				   built yet */
+} trichunk_T;
+
+/* The bitmap must be (re)built before it is used. */
+# define MLTRI_STALE(tc) ((tc)->tc_bits == NULL \
+				   || (tc)->tc_changed > (tc)->tc_numlines)
+
+typedef struct mltri_S
+{
+    trichunk_T	*mt_chunks;
+    int		mt_count;	/* number of chunks used */
+    int		mt_max;		/* number of chunks allocated */
+    linenr_T	mt_lines;	/* total of tc_numlines */
+    int		mt_lastix;	/* chunk found last by ml_tri_find() */
+    linenr_T	mt_lastline;	/* first line in chunk mt_lastix */
+} mltri_T;
+#endif
+
+/*
+ * Position in the chunks while deleting a range of lines, see
+ * ml_delete_range().  Line numbers are from before the delete.
+ */
+typedef struct
+{
+    int		dr_curix;	/* current chunk, -1 when not used */
+    linenr_T	dr_curline;	/* first line in chunk dr_curix */
+    linenr_T	dr_curend;	/* last line in chunk dr_curix */
+} delrange_T;
+
+#ifdef FEAT_BYTEOFF
+#define MLCS_MAXL 800	/* max no of lines in chunk */
+#define MLCS_MINL 400   /* should be half of MLCS_MAXL */
+
+/* Buffer cached by ml_updatechunk(), reset when the chunks are replaced. */
+static buf_T	*ml_upd_lastbuf = NULL;
+#endif
+
 /*
  * arguments for ml_find_line()
  */
@@ -247,12 +363,48 @@ static void add_b0_fenc __ARGS((ZERO_BL *b0p, buf_T *buf));
 static time_t swapfile_info __ARGS((char_u *));
 static int recov_file_names __ARGS((char_u **, char_u *, int prepend_dot));
 static int ml_append_int __ARGS((buf_T *, linenr_T, char_u *, colnr_T, int, int, int));
+static int ml_bulk_add __ARGS((buf_T *, char_u *, colnr_T, int));
+static void ml_bulk_put_block __ARGS((buf_T *));
+static void ml_bulk_free __ARGS((void));
+static int ml_put_ptrs __ARGS((buf_T *buf, PTR_EN *level, int *countp, garray_T *pool));
+static int ml_ptrs_needed __ARGS((memfile_T *mfp, int count));
+static int ml_collect_tree __ARGS((buf_T *buf, bhdr_T *hp, int depth, garray_T *leaves, garray_T *ptrs, int *depthp));
+static bhdr_T *ml_collect __ARGS((buf_T *buf, garray_T *leaves, garray_T *ptrs, int *depthp));
+static void ml_put_pool __ARGS((buf_T *buf, garray_T *pool, int do_free));
+static int ml_compact_part __ARGS((buf_T *buf, int count));
+#ifdef FEAT_MMAP_VIEW
+static void ml_mmap_free __ARGS((mlmmap_T *));
+static void ml_mmap_lost __ARGS((mlmmap_T *));
+static short_u *ml_mmap_index __ARGS((mlmmap_T *, long));
+static off_t ml_mmap_nl __ARGS((mlmmap_T *, linenr_T));
+static char_u *ml_mmap_get __ARGS((mlmmap_T *, linenr_T, long *));
+static long ml_mmap_offset __ARGS((buf_T *, linenr_T, long *));
+#endif
+#ifdef FEAT_TRIGRAM_INDEX
+static void ml_tri_free __ARGS((buf_T *buf));
+static mltri_T *ml_tri_get __ARGS((buf_T *buf));
+static int ml_tri_find __ARGS((mltri_T *mt, linenr_T lnum, linenr_T *firstp));
+static int ml_tri_hash __ARGS((long_u h));
+static void ml_tri_add __ARGS((char_u *bits, char_u *line));
+static int ml_tri_maymatch __ARGS((buf_T *buf, trichunk_T *tc, linenr_T first, triquery_T *tq));
+static void ml_tri_append __ARGS((buf_T *buf, linenr_T lnum, char_u *line));
+static void ml_tri_change __ARGS((buf_T *buf, linenr_T lnum, char_u *line));
+static void ml_tri_delete __ARGS((buf_T *buf, linenr_T lnum, long count));
+#endif
 static int ml_delete_int __ARGS((buf_T *, linenr_T, int, int));
+static int ml_delete_range_int __ARGS((buf_T *, linenr_T, long, int, int));
+static int ml_delete_tree __ARGS((buf_T *, blocknr_T *, int, linenr_T, linenr_T, linenr_T, delrange_T *, int *));
+#ifdef FEAT_BYTEOFF
+static void ml_delete_chunks __ARGS((buf_T *, delrange_T *, DATA_BL *, linenr_T, int, int));
+#endif
 static char_u *findswapname __ARGS((buf_T *, char_u **, char_u *));
 static void ml_flush_line __ARGS((buf_T *));
 static bhdr_T *ml_new_data __ARGS((memfile_T *, int, int));
 static bhdr_T *ml_new_ptr __ARGS((memfile_T *));
 static bhdr_T *ml_find_line __ARGS((buf_T *, linenr_T, int));
+static void ml_park __ARGS((buf_T *));
+static void ml_unpark __ARGS((buf_T *));
+static bhdr_T *ml_unpark_line __ARGS((buf_T *, linenr_T));
 static int ml_add_stack __ARGS((buf_T *));
 static void ml_lineadd __ARGS((buf_T *, int));
 static int b0_magic_wrong __ARGS((ZERO_BL *));
@@ -268,6 +420,9 @@ static char_u *make_percent_swname __ARGS((char_u *dir, char_u *name));
 static void ml_crypt_prepare __ARGS((memfile_T *mfp, off_t offset, int reading));
 #endif
 #ifdef FEAT_BYTEOFF
+static int ml_chunk_tree __ARGS((buf_T *buf));
+static void ml_chunk_tree_add __ARGS((buf_T *buf, int ix, int lines, long size));
+static int ml_chunk_find __ARGS((buf_T *buf, linenr_T lnum, long offset, int ffdos, linenr_T *linep, long *sizep));
 static void ml_updatechunk __ARGS((buf_T *buf, long line, long len, int updtype));
 #endif
 
@@ -293,9 +448,21 @@ ml_open(buf)
     buf->b_ml.ml_stack = NULL;	/* no stack yet */
     buf->b_ml.ml_stack_top = 0;	/* nothing in the stack */
     buf->b_ml.ml_locked = NULL;	/* no cached block */
+    buf->b_ml.ml_parked_count = 0; /* no parked blocks */
     buf->b_ml.ml_line_lnum = 0;	/* no cached line */
+    buf->b_ml.ml_sparse_count = 0; /* no sparse blocks */
+    buf->b_ml.ml_compact_lnum = 0; /* not compacting */
+#ifdef FEAT_MMAP_VIEW
+    buf->b_ml.ml_mmap = NULL;	/* no mapped file */
+#endif
+#ifdef FEAT_TRIGRAM_INDEX
+    buf->b_ml.ml_tri = NULL;	/* no trigram index */
+#endif
 #ifdef FEAT_BYTEOFF
     buf->b_ml.ml_chunksize = NULL;
+    buf->b_ml.ml_chunktree = NULL;
+    buf->b_ml.ml_chunktree_len = 0;
+    buf->b_ml.ml_chunktree_max = 0;
 #endif
 
     /*
@@ -617,6 +784,9 @@ ml_setname(buf)
 	return;
     }
 
+    /* The swap file may be closed and renamed below. */
+    mf_sync_wait(mfp);
+
     /*
      * Try all directories in the 'directory' option.
      */
@@ -726,6 +896,22 @@ ml_open_file(buf)
     if (mfp == NULL || mfp->mf_fd >= 0 || !buf->b_p_swf)
 	return;		/* nothing to do */
 
+#ifdef FEAT_MF_INCORE
+    /* The blocks are kept in memory, there never is a swap file. */
+    if (mfp->mf_incore)
+    {
+	buf->b_may_swap = FALSE;
+	return;
+    }
+#endif
+
+#ifdef FEAT_MMAP_VIEW
+    /* The lines are still in the mapped file, there is nothing to recover.
+     * ml_mmap_promote() opens the swap file. */
+    if (buf->b_ml.ml_mmap != NULL)
+	return;
+#endif
+
 #ifdef FEAT_SPELL
     /* For a spell buffer use a temp file name. */
     if (buf->b_spell)
@@ -815,13 +1001,32 @@ ml_close(buf, del_file)
 {
     if (buf->b_ml.ml_mfp == NULL)		/* not open */
 	return;
+    if (ml_bulk.bl_buf == buf)
+    {
+	/* Abandon the bulk load, the memfile goes away with the lines. */
+	if (ml_bulk.bl_hp != NULL)
+	    mf_put(buf->b_ml.ml_mfp, ml_bulk.bl_hp, FALSE, FALSE);
+	ml_bulk_free();
+    }
+#ifdef FEAT_MMAP_VIEW
+    ml_mmap_free(buf->b_ml.ml_mmap);
+    buf->b_ml.ml_mmap = NULL;
+#endif
+#ifdef FEAT_TRIGRAM_INDEX
+    ml_tri_free(buf);
+#endif
     mf_close(buf->b_ml.ml_mfp, del_file);	/* close the .swp file */
+    buf->b_ml.ml_parked_count = 0;	/* blocks were freed with the memfile */
     if (buf->b_ml.ml_line_lnum != 0 && (buf->b_ml.ml_flags & ML_LINE_DIRTY))
 	vim_free(buf->b_ml.ml_line_ptr);
     vim_free(buf->b_ml.ml_stack);
 #ifdef FEAT_BYTEOFF
     vim_free(buf->b_ml.ml_chunksize);
     buf->b_ml.ml_chunksize = NULL;
+    vim_free(buf->b_ml.ml_chunktree);
+    buf->b_ml.ml_chunktree = NULL;
+    buf->b_ml.ml_chunktree_len = 0;
+    buf->b_ml.ml_chunktree_max = 0;
 #endif
     buf->b_ml.ml_mfp = NULL;
 
@@ -1170,6 +1375,13 @@ ml_recover()
     buf->b_ml.ml_stack_top = 0;		/* nothing in the stack */
     buf->b_ml.ml_line_lnum = 0;		/* no cached line */
     buf->b_ml.ml_locked = NULL;		/* no locked block */
+    buf->b_ml.ml_parked_count = 0;	/* no parked blocks */
+#ifdef FEAT_MMAP_VIEW
+    buf->b_ml.ml_mmap = NULL;		/* no mapped file */
+#endif
+#ifdef FEAT_TRIGRAM_INDEX
+    buf->b_ml.ml_tri = NULL;		/* no trigram index */
+#endif
     buf->b_ml.ml_flags = 0;
 #ifdef FEAT_CRYPT
     buf->b_p_key = empty_option;
@@ -1513,6 +1725,7 @@ ml_recover()
 		    bnum = pp->pb_pointer[idx].pe_bnum;
 		    line_count = pp->pb_pointer[idx].pe_line_count;
 		    page_count = pp->pb_pointer[idx].pe_page_count;
+		    idx = 0;
 		    continue;
 		}
 	    }
@@ -2284,9 +2497,13 @@ ml_sync_all(check_file, check_char)
 		need_check_timestamps = TRUE;	/* give message later */
 	    }
 	}
+	if (really_exiting)
+	    /* A job of 'swapasync' that was not written makes it dirty. */
+	    mf_sync_wait(buf->b_ml.ml_mfp);
 	if (buf->b_ml.ml_mfp->mf_dirty)
 	{
-	    (void)mf_sync(buf->b_ml.ml_mfp, (check_char ? MFS_STOP : 0)
+	    (void)mf_sync(buf->b_ml.ml_mfp,
+				       (check_char ? MFS_STOP | MFS_ASYNC : 0)
 					| (bufIsChanged(buf) ? MFS_FLUSH : 0));
 	    if (check_char && ui_char_avail())	/* character available now */
 		break;
@@ -2469,6 +2686,16 @@ errorret:
     if (buf->b_ml.ml_mfp == NULL)	/* there are no lines */
 	return (char_u *)"";
 
+#ifdef FEAT_MMAP_VIEW
+    /* Take the line from the mapped file. */
+    if (buf->b_ml.ml_mmap != NULL)
+    {
+	if ((ptr = ml_mmap_get(buf->b_ml.ml_mmap, lnum, NULL)) == NULL)
+	    goto errorret;
+	return ptr;
+    }
+#endif
+
     /*
      * See if it is the same line as requested last time.
      * Otherwise may need to flush last used line.
@@ -2616,6 +2843,11 @@ ml_append_int(buf, lnum, line, len, newfile, mark, fire_event)
     if (lnum > buf->b_ml.ml_line_count || buf->b_ml.ml_mfp == NULL)
 	return FAIL;
 
+#ifdef FEAT_MMAP_VIEW
+    if (buf->b_ml.ml_mmap != NULL && ml_mmap_promote(buf) == FAIL)
+	return FAIL;
+#endif
+
     if (lowest_marked && lowest_marked > lnum)
 	lowest_marked = lnum + 1;
 
@@ -2626,6 +2858,19 @@ ml_append_int(buf, lnum, line, len, newfile, mark, fire_event)
     mfp = buf->b_ml.ml_mfp;
     page_size = mfp->mf_page_size;
 
+    /*
+     * While loading in bulk, a line appended after the last loaded line goes
+     * straight into the data block being filled.  Anything else goes through
+     * ml_find_line(), which finishes the bulk load first.
+     */
+    if (ml_bulk.bl_buf == buf && !mark
+				     && lnum == buf->b_ml.ml_line_count - 1)
+    {
+	if (ml_bulk_add(buf, line, len, newfile) == FAIL)
+	    return FAIL;
+	goto appended;
+    }
+
 /*
  * find the data block containing the previous line
  * This also fills the stack with the blocks from the root to the data block
@@ -3075,6 +3320,11 @@ ml_append_int(buf, lnum, line, len, newfile, mark, fire_event)
     /* The line was inserted below 'lnum' */
     ml_updatechunk(buf, lnum + 1, (long)len, ML_CHNK_ADDLINE);
 #endif
+appended:
+#ifdef FEAT_TRIGRAM_INDEX
+    if (buf->b_ml.ml_tri != NULL)
+	ml_tri_append(buf, lnum, line);
+#endif
 #ifdef FEAT_NETBEANS_INTG
     if (netbeans_active())
     {
@@ -3102,402 +3352,2387 @@ ml_append_int(buf, lnum, line, len, newfile, mark, fire_event)
 }
 
 /*
- * Replace line lnum, with buffering, in current buffer.
- *
- * If "copy" is TRUE, make a copy of the line, otherwise the line has been
- * copied to allocated memory already.
- *
- * Automatically sends local edits to remote collaborators.
- *
- * Check: The caller of this function should probably also call
- * changed_lines(), unless update_screen(NOT_VALID) is used.
- *
- * return FAIL for failure, OK otherwise
+ * Start loading lines into empty buffer "buf" in bulk.
+ * Lines appended after the last loaded line with ml_append() are packed into
+ * full data blocks without walking the tree for each line.  The pointer
+ * blocks and the chunk sizes are built once by ml_bulk_end(), which is also
+ * called as soon as the lines are used in any other way.
+ * The empty line of the buffer stays at the end, like with ml_append().
  */
-    int
-ml_replace(lnum, line, copy)
-    linenr_T	lnum;
-    char_u	*line;
-    int		copy;
+    void
+ml_bulk_begin(buf)
+    buf_T	*buf;
 {
-    return ml_replace_collab(lnum, line, copy, TRUE);
+    bhdr_T	*hp;
+    PTR_BL	*pp;
+    int		ok;
+
+    if (ml_bulk.bl_buf != NULL)
+	ml_bulk_end(ml_bulk.bl_buf);
+    if (buf->b_ml.ml_mfp == NULL || !(buf->b_ml.ml_flags & ML_EMPTY))
+	return;
+
+    /* Release the cached line and block, they are not used while loading. */
+    if (buf->b_ml.ml_line_lnum != 0)
+	ml_flush_line(buf);
+    (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+
+    /* Only a tree with a single data block is rebuilt. */
+    if ((hp = mf_get(buf->b_ml.ml_mfp, (blocknr_T)1, 1)) == NULL)
+	return;
+    pp = (PTR_BL *)(hp->bh_data);
+    ok = (pp->pb_id == PTR_ID && pp->pb_count == 1);
+    if (ok)
+	ml_bulk.bl_last = pp->pb_pointer[0];
+    mf_put(buf->b_ml.ml_mfp, hp, FALSE, FALSE);
+    if (!ok)
+	return;
+
+    ml_bulk.bl_buf = buf;
+    ml_bulk.bl_hp = NULL;
+    ga_init2(&ml_bulk.bl_blocks, (int)sizeof(PTR_EN), 100);
+#ifdef FEAT_BYTEOFF
+    ga_init2(&ml_bulk.bl_chunks, (int)sizeof(chunksize_T), 100);
+#endif
 }
 
 /*
- * Same as ml_replace, but with the option to fire a collaborative event.
- *
- *   fire_event: TRUE to send remote collaborators a local edit event.
+ * Add a line at the end of a bulk load.
  */
-
-    int
-ml_replace_collab(lnum, line, copy, fire_event)
-    linenr_T	lnum;
+    static int
+ml_bulk_add(buf, line, len, newfile)
+    buf_T	*buf;
     char_u	*line;
-    int		copy;
-    int		fire_event;
+    colnr_T	len;		/* length of line, including NUL */
+    int		newfile;	/* flag, see ml_append() */
 {
-    if (line == NULL)		/* just checking... */
-	return FAIL;
-
-    /* When starting up, we might still need to create the memfile */
-    if (curbuf->b_ml.ml_mfp == NULL && open_buffer(FALSE, NULL, 0) == FAIL)
-	return FAIL;
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    int		space_needed = len + INDEX_SIZE;
+    int		page_count;
+    DATA_BL	*dp;
+#ifdef FEAT_BYTEOFF
+    chunksize_T	*cs;
+#endif
 
-    if (copy && (line = vim_strsave(line)) == NULL) /* allocate memory */
-	return FAIL;
-#ifdef FEAT_NETBEANS_INTG
-    if (netbeans_active())
+    if (ml_bulk.bl_hp != NULL
+	    && (int)((DATA_BL *)(ml_bulk.bl_hp->bh_data))->db_free
+								< space_needed)
+	ml_bulk_put_block(buf);
+    if (ml_bulk.bl_hp == NULL)
     {
-	netbeans_removed(curbuf, lnum, 0, (long)STRLEN(ml_get(lnum)));
-	netbeans_inserted(curbuf, lnum, 0, line, (int)STRLEN(line));
+	/* Make room for the pointer now, putting the block can't fail then. */
+	if (ga_grow(&ml_bulk.bl_blocks, 1) == FAIL)
+	    return FAIL;
+	page_count = (space_needed + HEADER_SIZE + mfp->mf_page_size - 1)
+							  / mfp->mf_page_size;
+	if ((ml_bulk.bl_hp = ml_new_data(mfp, newfile, page_count)) == NULL)
+	    return FAIL;
     }
-#endif
-    if (curbuf->b_ml.ml_line_lnum != lnum)	    /* other line buffered */
-	ml_flush_line(curbuf);			    /* flush it */
-    else if (curbuf->b_ml.ml_flags & ML_LINE_DIRTY) /* same line allocated */
-	vim_free(curbuf->b_ml.ml_line_ptr);	    /* free it */
-    curbuf->b_ml.ml_line_ptr = line;
-    curbuf->b_ml.ml_line_lnum = lnum;
-    curbuf->b_ml.ml_flags = (curbuf->b_ml.ml_flags | ML_LINE_DIRTY) & ~ML_EMPTY;
 
-    if (fire_event) {
-        int bid = collab_get_id(curbuf);
-        /* If bid < 0, buf is not actually collaborative. */
-        if (bid >= 0) {
-            /* Send the local edit to the remote collaborators. */
-            collabedit_T replace_edit = {
-                .type = COLLAB_REPLACE_LINE,
-                .buf_id = bid,
-                .replace_line.line = lnum,
-                .replace_line.text = line
-            };
-            collab_remoteapply(&replace_edit);
-        }
+    dp = (DATA_BL *)(ml_bulk.bl_hp->bh_data);
+    dp->db_txt_start -= len;
+    dp->db_free -= space_needed;
+    dp->db_index[dp->db_line_count++] = dp->db_txt_start;
+    mch_memmove((char *)dp + dp->db_txt_start, line, (size_t)len);
+
+    ++buf->b_ml.ml_line_count;
+    buf->b_ml.ml_flags &= ~ML_EMPTY;
+
+#ifdef FEAT_BYTEOFF
+    if (buf->b_ml.ml_usedchunks != -1)
+    {
+	cs = (chunksize_T *)ml_bulk.bl_chunks.ga_data
+					      + ml_bulk.bl_chunks.ga_len - 1;
+	if (ml_bulk.bl_chunks.ga_len == 0 || cs->mlcs_numlines >= MLCS_MINL)
+	{
+	    if (ga_grow(&ml_bulk.bl_chunks, 1) == FAIL)
+	    {
+		/* No memory for the chunks, do without offsets. */
+		buf->b_ml.ml_usedchunks = -1;
+		return OK;
+	    }
+	    cs = (chunksize_T *)ml_bulk.bl_chunks.ga_data
+						  + ml_bulk.bl_chunks.ga_len++;
+	    cs->mlcs_numlines = 0;
+	    cs->mlcs_totalsize = 0;
+	}
+	++cs->mlcs_numlines;
+	cs->mlcs_totalsize += len;
     }
+#endif
     return OK;
 }
 
 /*
- * Delete line 'lnum' in the current buffer.
- *
- * Automatically sends local edits to remote collaborators.
- * 
- * Check: The caller of this function should probably also call
- * deleted_lines() after this.
- *
- * return FAIL for failure, OK otherwise
+ * Release the data block being filled by a bulk load and remember where it
+ * is.  Room for the pointer was made by ml_bulk_add().
  */
-    int
-ml_delete(lnum, message)
-    linenr_T	lnum;
-    int		message;
+    static void
+ml_bulk_put_block(buf)
+    buf_T	*buf;
 {
-    return ml_delete_collab(lnum, message, TRUE);
+    bhdr_T	*hp = ml_bulk.bl_hp;
+    DATA_BL	*dp = (DATA_BL *)(hp->bh_data);
+    PTR_EN	*pe;
+
+    pe = (PTR_EN *)ml_bulk.bl_blocks.ga_data + ml_bulk.bl_blocks.ga_len++;
+    pe->pe_bnum = hp->bh_bnum;
+    pe->pe_line_count = dp->db_line_count;
+    pe->pe_old_lnum = buf->b_ml.ml_line_count - dp->db_line_count;
+    pe->pe_page_count = hp->bh_page_count;
+    mf_put(buf->b_ml.ml_mfp, hp, TRUE, FALSE);
+    ml_bulk.bl_hp = NULL;
 }
 
 /*
- * Same as ml_delete, but with the option to fire a collaborative event.
- *
- *   fire_event: TRUE to send remote collaborators a local edit event.
+ * Finish a bulk load into "buf": build the pointer blocks from the bottom
+ * up and set the chunk sizes.  Does nothing when "buf" is not being loaded.
  */
-    int
-ml_delete_collab(lnum, message, fire_event)
-    linenr_T	lnum;
-    int		message;
-    int		fire_event;
-{
-    ml_flush_line(curbuf);
-    return ml_delete_int(curbuf, lnum, message, fire_event);
-}
-
-    static int
-ml_delete_int(buf, lnum, message, fire_event)
+    void
+ml_bulk_end(buf)
     buf_T	*buf;
-    linenr_T	lnum;
-    int		message;
-    int		fire_event;
 {
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    PTR_EN	*level;
+    int		count;
     bhdr_T	*hp;
-    memfile_T	*mfp;
-    DATA_BL	*dp;
     PTR_BL	*pp;
-    infoptr_T	*ip;
-    int		count;	    /* number of entries in block */
-    int		idx;
-    int		stack_idx;
-    int		text_start;
-    int		line_start;
-    long	line_size;
-    int		i;
+#ifdef FEAT_BYTEOFF
+    chunksize_T	*cs;
+#endif
 
-    if (lnum < 1 || lnum > buf->b_ml.ml_line_count)
-	return FAIL;
+    if (ml_bulk.bl_buf != buf)
+	return;
+    ml_bulk.bl_buf = NULL;
 
-    if (lowest_marked && lowest_marked > lnum)
-	lowest_marked--;
+    if (ml_bulk.bl_hp != NULL)
+	ml_bulk_put_block(buf);
+    if (ml_bulk.bl_blocks.ga_len == 0)
+    {
+	ml_bulk_free();
+	return;
+    }
 
-/*
- * If the file becomes empty the last line is replaced by an empty line.
- */
-    if (buf->b_ml.ml_line_count == 1)	    /* file becomes empty */
+    /* The block with the empty line comes last. */
+    if (ga_grow(&ml_bulk.bl_blocks, 1) == FAIL)
+	goto fail;
+    level = (PTR_EN *)ml_bulk.bl_blocks.ga_data;
+    count = ml_bulk.bl_blocks.ga_len;
+    level[count] = ml_bulk.bl_last;
+    level[count].pe_old_lnum = buf->b_ml.ml_line_count;
+    ++count;
+
+    if (ml_put_ptrs(buf, level, &count, NULL) == FAIL
+	    || (hp = mf_get(mfp, (blocknr_T)1, 1)) == NULL)
+	goto fail;
+    pp = (PTR_BL *)(hp->bh_data);
+    mch_memmove(pp->pb_pointer, level, (size_t)count * sizeof(PTR_EN));
+    pp->pb_count = count;
+    mf_put(mfp, hp, TRUE, FALSE);
+    buf->b_ml.ml_stack_top = 0;		/* the stack is invalid now */
+
+#ifdef FEAT_BYTEOFF
+    if (buf->b_ml.ml_usedchunks != -1 && ml_bulk.bl_chunks.ga_len > 0)
     {
-	if (message
-#ifdef FEAT_NETBEANS_INTG
-		&& !netbeansSuppressNoLines
+	/* The empty line belongs to the last chunk. */
+	cs = (chunksize_T *)ml_bulk.bl_chunks.ga_data
+					      + ml_bulk.bl_chunks.ga_len - 1;
+	++cs->mlcs_numlines;
+	++cs->mlcs_totalsize;
+
+	vim_free(buf->b_ml.ml_chunksize);
+	buf->b_ml.ml_chunksize = (chunksize_T *)ml_bulk.bl_chunks.ga_data;
+	buf->b_ml.ml_numchunks = ml_bulk.bl_chunks.ga_maxlen;
+	buf->b_ml.ml_usedchunks = ml_bulk.bl_chunks.ga_len;
+	buf->b_ml.ml_chunktree_len = 0;
+	ml_bulk.bl_chunks.ga_data = NULL;
+	ml_upd_lastbuf = NULL;
+    }
 #endif
-	   )
-	    set_keep_msg((char_u *)_(no_lines_msg), 0);
+    ml_bulk_free();
+    return;
 
-	/* FEAT_BYTEOFF already handled in there, dont worry 'bout it below */
-	i = ml_replace((linenr_T)1, (char_u *)"", TRUE);
-	buf->b_ml.ml_flags |= ML_EMPTY;
+fail:
+    /* Out of memory: the tree still only has the empty line. */
+    buf->b_ml.ml_line_count = 1;
+    buf->b_ml.ml_flags |= ML_EMPTY;
+    ml_bulk_free();
+}
 
-	return i;
-    }
+    static void
+ml_bulk_free()
+{
+    ml_bulk.bl_buf = NULL;
+    ml_bulk.bl_hp = NULL;
+    ga_clear(&ml_bulk.bl_blocks);
+#ifdef FEAT_BYTEOFF
+    ga_clear(&ml_bulk.bl_chunks);
+#endif
+}
 
 /*
- * find the data block containing the line
- * This also fills the stack with the blocks from the root to the data block
- * This also releases any locked block.
+ * Put the "*countp" entries in "level" in pointer blocks, one level of the
+ * tree at a time, until they fit in block 1.  Each level is replaced in
+ * place by the pointers to the blocks holding it, "*countp" is set to the
+ * number of entries for block 1.
+ * The pointer blocks are taken from "pool", locked blocks that can be
+ * reused, taken entries are set to NULL.  More are made with ml_new_ptr().
+ * Return FAIL when out of memory.
  */
-    mfp = buf->b_ml.ml_mfp;
-    if (mfp == NULL)
-	return FAIL;
+    static int
+ml_put_ptrs(buf, level, countp, pool)
+    buf_T	*buf;
+    PTR_EN	*level;
+    int		*countp;
+    garray_T	*pool;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    int		count = *countp;
+    int		count_max;
+    int		from, to;
+    int		n;
+    int		i;
+    int		used = 0;
+    linenr_T	line_count;
+    bhdr_T	*hp;
+    PTR_BL	*pp;
 
-    if ((hp = ml_find_line(buf, lnum, ML_DELETE)) == NULL)
+    count_max = (int)((mfp->mf_page_size - sizeof(PTR_BL))
+							/ sizeof(PTR_EN) + 1);
+    while (count > count_max)
+    {
+	for (from = 0, to = 0; from < count; from += n, ++to)
+	{
+	    if (pool != NULL && used < pool->ga_len)
+	    {
+		hp = ((bhdr_T **)pool->ga_data)[used];
+		((bhdr_T **)pool->ga_data)[used++] = NULL;
+	    }
+	    else if ((hp = ml_new_ptr(mfp)) == NULL)
+		return FAIL;
+	    pp = (PTR_BL *)(hp->bh_data);
+	    n = count - from < count_max ? count - from : count_max;
+	    mch_memmove(pp->pb_pointer, level + from,
+						     (size_t)n * sizeof(PTR_EN));
+	    pp->pb_count = n;
+
+	    line_count = 0;
+	    for (i = 0; i < n; ++i)
+		line_count += pp->pb_pointer[i].pe_line_count;
+
+	    level[to].pe_bnum = hp->bh_bnum;
+	    level[to].pe_line_count = line_count;
+	    level[to].pe_old_lnum = pp->pb_pointer[0].pe_old_lnum;
+	    level[to].pe_page_count = 1;
+	    mf_put(mfp, hp, TRUE, FALSE);
+	}
+	count = to;
+    }
+    *countp = count;
+    return OK;
+}
+
+/*
+ * Number of pointer blocks below block 1 needed for a tree with "count"
+ * data blocks, as built by ml_put_ptrs().
+ */
+    static int
+ml_ptrs_needed(mfp, count)
+    memfile_T	*mfp;
+    int		count;
+{
+    int		count_max;
+    int		needed = 0;
+
+    count_max = (int)((mfp->mf_page_size - sizeof(PTR_BL))
+							/ sizeof(PTR_EN) + 1);
+    while (count > count_max)
+    {
+	count = (count + count_max - 1) / count_max;
+	needed += count;
+    }
+    return needed;
+}
+
+/*
+ * Add the entries for the data blocks in the tree below pointer block "hp",
+ * which is at level "depth", to "leaves" in line order.  They keep their
+ * pe_old_lnum, recovery reads the lines of a block with a negative number
+ * from the original file.  The pointer blocks below "hp" are added to "ptrs"
+ * and stay locked.  "*depthp" is set to the level of the deepest data block,
+ * the number of blocks ml_find_line() goes through to find a line in it.
+ * Return FAIL when a block can't be read or out of memory.
+ */
+    static int
+ml_collect_tree(buf, hp, depth, leaves, ptrs, depthp)
+    buf_T	*buf;
+    bhdr_T	*hp;
+    int		depth;
+    garray_T	*leaves;
+    garray_T	*ptrs;
+    int		*depthp;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    PTR_BL	*pp = (PTR_BL *)(hp->bh_data);
+    PTR_EN	*pe;
+    bhdr_T	*chp;
+    blocknr_T	bnum;
+    int		dirty = FALSE;
+    int		idx;
+
+    if (pp->pb_id != PTR_ID)
+    {
+	EMSG(_("E317: pointer block id wrong"));
 	return FAIL;
+    }
+    for (idx = 0; idx < (int)pp->pb_count; ++idx)
+    {
+	pe = &pp->pb_pointer[idx];
+	/* a negative block number may have been changed */
+	if (pe->pe_bnum < 0)
+	{
+	    bnum = mf_trans_del(mfp, pe->pe_bnum);
+	    if (bnum != pe->pe_bnum)
+	    {
+		pe->pe_bnum = bnum;
+		dirty = TRUE;
+	    }
+	}
+	if ((chp = mf_get(mfp, pe->pe_bnum, pe->pe_page_count)) == NULL)
+	    break;
+	if (((DATA_BL *)(chp->bh_data))->db_id == DATA_ID)
+	{
+	    mf_put(mfp, chp, FALSE, FALSE);
+	    if (ga_grow(leaves, 1) == FAIL)
+		break;
+	    ((PTR_EN *)leaves->ga_data)[leaves->ga_len++] = *pe;
+	    if (depth + 1 > *depthp)
+		*depthp = depth + 1;
+	}
+	else
+	{
+	    if (ga_grow(ptrs, 1) == FAIL)
+	    {
+		mf_put(mfp, chp, FALSE, FALSE);
+		break;
+	    }
+	    ((bhdr_T **)ptrs->ga_data)[ptrs->ga_len++] = chp;
+	    if (ml_collect_tree(buf, chp, depth + 1, leaves, ptrs, depthp)
+								       == FAIL)
+		break;
+	}
+    }
 
-    dp = (DATA_BL *)(hp->bh_data);
-    /* compute line count before the delete */
-    count = (long)(buf->b_ml.ml_locked_high)
-					- (long)(buf->b_ml.ml_locked_low) + 2;
-    idx = lnum - buf->b_ml.ml_locked_low;
+    /* Store the translated block numbers, the block stays locked. */
+    if (dirty)
+    {
+	mf_put(mfp, hp, TRUE, FALSE);
+	(void)mf_get(mfp, hp->bh_bnum, 1);
+    }
+    return idx < (int)pp->pb_count ? FAIL : OK;
+}
 
-    --buf->b_ml.ml_line_count;
+/*
+ * Get the data blocks of "buf" in "leaves" and its pointer blocks, other
+ * than block 1, in "ptrs".  Returns block 1, locked, or NULL for failure.
+ * The blocks in "ptrs" must be released with ml_put_pool().
+ */
+    static bhdr_T *
+ml_collect(buf, leaves, ptrs, depthp)
+    buf_T	*buf;
+    garray_T	*leaves;
+    garray_T	*ptrs;
+    int		*depthp;
+{
+    bhdr_T	*hp;
 
-    line_start = ((dp->db_index[idx]) & DB_INDEX_MASK);
-    if (idx == 0)		/* first line in block, text at the end */
-	line_size = dp->db_txt_end - line_start;
-    else
-	line_size = ((dp->db_index[idx - 1]) & DB_INDEX_MASK) - line_start;
+    ga_init2(leaves, (int)sizeof(PTR_EN), 100);
+    ga_init2(ptrs, (int)sizeof(bhdr_T *), 10);
+    *depthp = 0;
+    if (buf->b_ml.ml_mfp == NULL)
+	return NULL;
 
-#ifdef FEAT_NETBEANS_INTG
-    if (netbeans_active())
-	netbeans_removed(buf, lnum, 0, (long)line_size);
+    /* flush the cached line and the locked block */
+    ml_flush_line(buf);
+    (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+
+    if ((hp = mf_get(buf->b_ml.ml_mfp, (blocknr_T)1, 1)) == NULL)
+	return NULL;
+    if (ml_collect_tree(buf, hp, 1, leaves, ptrs, depthp) == FAIL)
+    {
+	mf_put(buf->b_ml.ml_mfp, hp, FALSE, FALSE);
+	ml_put_pool(buf, ptrs, FALSE);
+	ga_clear(leaves);
+	return NULL;
+    }
+    return hp;
+}
+
+/*
+ * Release the blocks in "pool" and clear it.  Blocks are freed when
+ * "do_free" is TRUE.
+ */
+    static void
+ml_put_pool(buf, pool, do_free)
+    buf_T	*buf;
+    garray_T	*pool;
+    int		do_free;
+{
+    bhdr_T	*hp;
+    int		i;
+
+    for (i = 0; i < pool->ga_len; ++i)
+	if ((hp = ((bhdr_T **)pool->ga_data)[i]) != NULL)
+	{
+	    if (do_free)
+		mf_free(buf->b_ml.ml_mfp, hp);
+	    else
+		mf_put(buf->b_ml.ml_mfp, hp, FALSE, FALSE);
+	}
+    ga_clear(pool);
+}
+
+/*
+ * Compact the memline of "buf" after much editing.  The lines of a data
+ * block are moved into the block before it when they fit, and the pointer
+ * blocks are rebuilt like after reading a file, so that the tree is as
+ * shallow as it can be.  Free blocks at the end of the swap file are
+ * dropped.  Line numbers and text don't change.
+ * Returns the number of data blocks freed, -1 for failure.
+ */
+    long
+ml_compact(buf)
+    buf_T	*buf;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    garray_T	leaves;
+    garray_T	ptrs;
+    PTR_EN	*le;
+    bhdr_T	*rhp;		/* block 1 */
+    bhdr_T	*thp = NULL;	/* block the lines are moved into */
+    bhdr_T	*shp;
+    DATA_BL	*tdp;
+    DATA_BL	*sdp;
+    PTR_BL	*pp;
+    int		tdirty = FALSE;
+    int		depth;
+    int		count;
+    int		old_len;
+    int		r, w;
+    int		i;
+    unsigned	size;
+    long	freed = 0;
+
+#ifdef FEAT_MMAP_VIEW
+    if (buf->b_ml.ml_mmap != NULL)	/* lines are not in the tree */
+	return 0;
 #endif
+    if ((rhp = ml_collect(buf, &leaves, &ptrs, &depth)) == NULL)
+	return -1;
+    le = (PTR_EN *)leaves.ga_data;
+
+    /* Get all the pointer blocks needed before changing anything. */
+    old_len = ptrs.ga_len;
+    count = ml_ptrs_needed(mfp, leaves.ga_len);
+    while (ptrs.ga_len < count)
+    {
+	if (ga_grow(&ptrs, 1) == FAIL || (shp = ml_new_ptr(mfp)) == NULL)
+	{
+	    for (i = old_len; i < ptrs.ga_len; ++i)
+		mf_free(mfp, ((bhdr_T **)ptrs.ga_data)[i]);
+	    ptrs.ga_len = old_len;
+	    mf_put(mfp, rhp, FALSE, FALSE);
+	    ml_put_pool(buf, &ptrs, FALSE);
+	    ga_clear(&leaves);
+	    return -1;
+	}
+	((bhdr_T **)ptrs.ga_data)[ptrs.ga_len++] = shp;
+    }
+
+    /*
+     * Move the lines of each data block to the end of the block before it
+     * when there is room.  When a block can't be read the blocks after it
+     * are kept as they are.  Nothing is moved into a block with a negative
+     * number: it is not in the swap file yet and recovery reads its
+     * pe_line_count lines from the original file, starting at pe_old_lnum.
+     */
+    w = 0;
+    for (r = 1; r < leaves.ga_len; ++r)
+    {
+	if (thp == NULL && (thp = mf_get(mfp, le[w].pe_bnum,
+						  le[w].pe_page_count)) == NULL)
+	    break;
+	if ((shp = mf_get(mfp, le[r].pe_bnum, le[r].pe_page_count)) == NULL)
+	    break;
+	tdp = (DATA_BL *)(thp->bh_data);
+	sdp = (DATA_BL *)(shp->bh_data);
+	size = sdp->db_txt_end - sdp->db_txt_start;
+	if (le[w].pe_bnum >= 0
+		&& tdp->db_free >= size + sdp->db_line_count * INDEX_SIZE)
+	{
+	    tdp->db_txt_start -= size;
+	    mch_memmove((char *)tdp + tdp->db_txt_start,
+				  (char *)sdp + sdp->db_txt_start, (size_t)size);
+	    for (i = 0; i < sdp->db_line_count; ++i)
+		tdp->db_index[tdp->db_line_count + i] = sdp->db_index[i]
+				     - sdp->db_txt_start + tdp->db_txt_start;
+	    tdp->db_line_count += sdp->db_line_count;
+	    tdp->db_free -= size + sdp->db_line_count * INDEX_SIZE;
+	    le[w].pe_line_count += le[r].pe_line_count;
+	    mf_free(mfp, shp);
+	    tdirty = TRUE;
+	    ++freed;
+	}
+	else
+	{
+	    mf_put(mfp, thp, tdirty, FALSE);
+	    thp = shp;
+	    tdirty = FALSE;
+	    le[++w] = le[r];
+	}
+    }
+    if (thp != NULL)
+	mf_put(mfp, thp, tdirty, FALSE);
+    while (r < leaves.ga_len)
+	le[++w] = le[r++];
+
+    /* There are enough blocks in the pool, this can't fail. */
+    count = w + 1;
+    (void)ml_put_ptrs(buf, le, &count, &ptrs);
+    pp = (PTR_BL *)(rhp->bh_data);
+    mch_memmove(pp->pb_pointer, le, (size_t)count * sizeof(PTR_EN));
+    pp->pb_count = count;
+    mf_put(mfp, rhp, TRUE, FALSE);
+
+    /* Free the pointer blocks that are not used now. */
+    ml_put_pool(buf, &ptrs, TRUE);
+    ga_clear(&leaves);
+    buf->b_ml.ml_stack_top = 0;		/* the stack is invalid now */
+    buf->b_ml.ml_sparse_count = 0;
+    buf->b_ml.ml_compact_lnum = 0;
+    (void)mf_trim(mfp);
+    return freed;
+}
 
 /*
- * special case: If there is only one line in the data block it becomes empty.
- * Then we have to remove the entry, pointing to this data block, from the
- * pointer block. If this pointer block also becomes empty, we go up another
- * block, and so on, up to the root if necessary.
- * The line counts in the pointer blocks have already been adjusted by
- * ml_find_line().
+ * Compact a part of the memline of "buf", for when waiting for the user to
+ * type.  Like ml_compact(), but the lines of a data block are only moved
+ * into the block before it when both are in the same pointer block, so that
+ * only that pointer block changes, and at most "count" data blocks are read.
+ * Starts at ml_compact_lnum and sets it to where the next call continues.
+ * Returns TRUE when the end of the buffer was reached or something failed.
  */
-    if (count == 1)
+    static int
+ml_compact_part(buf, count)
+    buf_T	*buf;
+    int		count;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    infoptr_T	*ip;
+    bhdr_T	*hp;		/* pointer block */
+    bhdr_T	*thp;		/* block the lines are moved into */
+    bhdr_T	*shp;
+    PTR_BL	*pp;
+    PTR_EN	*pe;
+    DATA_BL	*tdp;
+    DATA_BL	*sdp;
+    linenr_T	lnum;
+    linenr_T	next;
+    blocknr_T	bnum;
+    int		dirty;
+    int		tdirty;
+    int		failed = FALSE;
+    int		idx;
+    int		i;
+    unsigned	size;
+
+    lnum = buf->b_ml.ml_compact_lnum > 0 ? buf->b_ml.ml_compact_lnum : 1;
+    ml_flush_line(buf);
+    while (count > 0)
     {
-	mf_free(mfp, hp);	/* free the data block */
-	buf->b_ml.ml_locked = NULL;
+	if (lnum > buf->b_ml.ml_line_count)
+	    return TRUE;
 
-	for (stack_idx = buf->b_ml.ml_stack_top - 1; stack_idx >= 0; --stack_idx)
+	/* Find the pointer block with the data block that contains "lnum". */
+	(void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+	if (ml_find_line(buf, lnum, ML_FIND) == NULL
+					       || buf->b_ml.ml_stack_top == 0)
+	    return TRUE;
+	ip = &(buf->b_ml.ml_stack[buf->b_ml.ml_stack_top - 1]);
+	bnum = ip->ip_bnum;
+	idx = ip->ip_index;
+	lnum = buf->b_ml.ml_locked_low;
+	next = ip->ip_high + 1;
+	(void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+	if ((hp = mf_get(mfp, bnum, 1)) == NULL)
+	    return TRUE;
+	pp = (PTR_BL *)(hp->bh_data);
+	pe = pp->pb_pointer;
+	dirty = FALSE;
+	thp = NULL;
+	tdirty = FALSE;
+	for (i = idx; i < (int)pp->pb_count; ++i)
+	    if (pe[i].pe_bnum < 0)	/* may have been changed */
+	    {
+		bnum = mf_trans_del(mfp, pe[i].pe_bnum);
+		if (bnum != pe[i].pe_bnum)
+		{
+		    pe[i].pe_bnum = bnum;
+		    dirty = TRUE;
+		}
+	    }
+
+	/* A block with a negative number is not in the swap file yet, lines
+	 * are not moved into it, see ml_compact(). */
+	while (idx + 1 < (int)pp->pb_count && count > 0)
 	{
-	    buf->b_ml.ml_stack_top = 0;	    /* stack is invalid when failing */
-	    ip = &(buf->b_ml.ml_stack[stack_idx]);
-	    idx = ip->ip_index;
-	    if ((hp = mf_get(mfp, ip->ip_bnum, 1)) == NULL)
-		return FAIL;
-	    pp = (PTR_BL *)(hp->bh_data);   /* must be pointer block */
-	    if (pp->pb_id != PTR_ID)
+	    if (thp == NULL)
 	    {
-		EMSG(_("E317: pointer block id wrong 4"));
-		mf_put(mfp, hp, FALSE, FALSE);
-		return FAIL;
+		if (pe[idx].pe_bnum < 0)
+		{
+		    lnum += pe[idx++].pe_line_count;
+		    continue;
+		}
+		--count;
+		if ((thp = mf_get(mfp, pe[idx].pe_bnum,
+					       pe[idx].pe_page_count)) == NULL)
+		{
+		    failed = TRUE;
+		    break;
+		}
+		if (((DATA_BL *)(thp->bh_data))->db_id != DATA_ID)
+		{
+		    mf_put(mfp, thp, FALSE, FALSE);
+		    thp = NULL;
+		    failed = TRUE;
+		    break;
+		}
+	    }
+	    --count;
+	    if ((shp = mf_get(mfp, pe[idx + 1].pe_bnum,
+					   pe[idx + 1].pe_page_count)) == NULL)
+	    {
+		failed = TRUE;
+		break;
+	    }
+	    tdp = (DATA_BL *)(thp->bh_data);
+	    sdp = (DATA_BL *)(shp->bh_data);
+	    if (sdp->db_id != DATA_ID)
+	    {
+		mf_put(mfp, shp, FALSE, FALSE);
+		failed = TRUE;
+		break;
+	    }
+	    size = sdp->db_txt_end - sdp->db_txt_start;
+	    if (tdp->db_free >= size + sdp->db_line_count * INDEX_SIZE)
+	    {
+		tdp->db_txt_start -= size;
+		mch_memmove((char *)tdp + tdp->db_txt_start,
+				  (char *)sdp + sdp->db_txt_start, (size_t)size);
+		for (i = 0; i < sdp->db_line_count; ++i)
+		    tdp->db_index[tdp->db_line_count + i] = sdp->db_index[i]
+				     - sdp->db_txt_start + tdp->db_txt_start;
+		tdp->db_line_count += sdp->db_line_count;
+		tdp->db_free -= size + sdp->db_line_count * INDEX_SIZE;
+		pe[idx].pe_line_count += pe[idx + 1].pe_line_count;
+		mch_memmove(pe + idx + 1, pe + idx + 2,
+		       (size_t)(pp->pb_count - idx - 2) * sizeof(PTR_EN));
+		--pp->pb_count;
+		mf_free(mfp, shp);
+		tdirty = TRUE;
+		dirty = TRUE;
 	    }
-	    count = --(pp->pb_count);
-	    if (count == 0)	    /* the pointer block becomes empty! */
-		mf_free(mfp, hp);
 	    else
 	    {
-		if (count != idx)	/* move entries after the deleted one */
-		    mch_memmove(&pp->pb_pointer[idx], &pp->pb_pointer[idx + 1],
-				      (size_t)(count - idx) * sizeof(PTR_EN));
-		mf_put(mfp, hp, TRUE, FALSE);
-
-		buf->b_ml.ml_stack_top = stack_idx;	/* truncate stack */
-		/* fix line count for rest of blocks in the stack */
-		if (buf->b_ml.ml_locked_lineadd != 0)
+		mf_put(mfp, thp, tdirty, FALSE);
+		thp = shp;
+		tdirty = FALSE;
+		lnum += pe[idx++].pe_line_count;
+		if (pe[idx].pe_bnum < 0)
 		{
-		    ml_lineadd(buf, buf->b_ml.ml_locked_lineadd);
-		    buf->b_ml.ml_stack[buf->b_ml.ml_stack_top].ip_high +=
-						  buf->b_ml.ml_locked_lineadd;
+		    mf_put(mfp, thp, FALSE, FALSE);
+		    thp = NULL;
 		}
-		++(buf->b_ml.ml_stack_top);
-
-		break;
 	    }
 	}
-	CHECK(stack_idx < 0, _("deleted block 1?"));
+	if (thp != NULL)
+	    mf_put(mfp, thp, tdirty, FALSE);
+	if (idx + 1 >= (int)pp->pb_count)
+	    lnum = next;	    /* done with this pointer block */
+	mf_put(mfp, hp, dirty, FALSE);
+	if (dirty)
+	    buf->b_ml.ml_stack_top = 0;	/* the stack may be invalid now */
+	if (failed)
+	    return TRUE;
     }
-    else
-    {
-	/*
-	 * delete the text by moving the next lines forwards
-	 */
-	text_start = dp->db_txt_start;
-	mch_memmove((char *)dp + text_start + line_size,
-		  (char *)dp + text_start, (size_t)(line_start - text_start));
-
-	/*
-	 * delete the index by moving the next indexes backwards
-	 * Adjust the indexes for the text movement.
-	 */
-	for (i = idx; i < count - 1; ++i)
-	    dp->db_index[i] = dp->db_index[i + 1] + line_size;
-
-	dp->db_free += line_size + INDEX_SIZE;
-	dp->db_txt_start += line_size;
-	--(dp->db_line_count);
+    buf->b_ml.ml_compact_lnum = lnum;
+    return FALSE;
+}
 
-	/*
-	 * mark the block dirty and make sure it is in the file (for recovery)
-	 */
-	buf->b_ml.ml_flags |= (ML_LOCKED_DIRTY | ML_LOCKED_POS);
-    }
+/*
+ * Compact a part of the memline of a buffer where many data blocks became
+ * sparse, see ml_compact_part().  Called when waiting for the user to type.
+ * Reads at most ML_COMPACT_BLOCKS data blocks, a swapped out buffer is
+ * compacted over several calls.
+ */
+    void
+ml_compact_idle()
+{
+    buf_T	*buf;
 
-#ifdef FEAT_BYTEOFF
-    ml_updatechunk(buf, lnum, line_size, ML_CHNK_DELLINE);
+    for (buf = firstbuf; buf != NULL; buf = buf->b_next)
+	if (buf->b_ml.ml_mfp != NULL
+		&& (buf->b_ml.ml_compact_lnum > 0
+			 || buf->b_ml.ml_sparse_count >= ML_SPARSE_COMPACT))
+	{
+	    buf->b_ml.ml_sparse_count = 0;
+#ifdef FEAT_MMAP_VIEW
+	    if (buf->b_ml.ml_mmap != NULL)	/* lines are not in the tree */
+		continue;
 #endif
+	    if (ml_compact_part(buf, ML_COMPACT_BLOCKS))
+		buf->b_ml.ml_compact_lnum = 0;
+	    break;
+	}
+}
+
+/*
+ * Get the number of data blocks and pointer blocks in the memline of "buf"
+ * and the depth of the tree: the number of blocks ml_find_line() goes
+ * through to find a line.
+ * Returns FAIL when the tree can't be read.
+ */
+    int
+ml_tree_info(buf, datap, ptrp, depthp)
+    buf_T	*buf;
+    long	*datap;
+    long	*ptrp;
+    int		*depthp;
+{
+    garray_T	leaves;
+    garray_T	ptrs;
+    bhdr_T	*hp;
+
+    if ((hp = ml_collect(buf, &leaves, &ptrs, depthp)) == NULL)
+	return FAIL;
+    *datap = leaves.ga_len;
+    *ptrp = ptrs.ga_len + 1;
+    mf_put(buf->b_ml.ml_mfp, hp, FALSE, FALSE);
+    ml_put_pool(buf, &ptrs, FALSE);
+    ga_clear(&leaves);
+    return OK;
+}
+
+#if defined(FEAT_MMAP_VIEW) || defined(PROTO)
+/*
+ * Use the lines of the file opened as "fd" for the empty buffer "buf",
+ * without reading them into the memline.  The file is mapped in memory and
+ * only the line breaks are counted.
+ * "*ffp" is EOL_UNIX, EOL_DOS or EOL_UNKNOWN to check the first line, it is
+ * set to the format used.  "*sizep" is set to the size of the file and
+ * "*noeolp" to TRUE when the last line has no line break.
+ * Return FAIL when the file can't be mapped, it must be read then.
+ */
+    int
+ml_mmap_open(buf, fd, ffp, sizep, noeolp)
+    buf_T	*buf;
+    int		fd;
+    int		*ffp;
+    off_t	*sizep;
+    int		*noeolp;
+{
+    struct stat	st;
+    mlmmap_T	*mm;
+    char_u	*p;
+    char_u	*end;
+    long	c;
+    linenr_T	nl = 0;
+
+    if (*ffp == EOL_MAC || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)
+	    || st.st_size == 0 || (off_t)(size_t)st.st_size != st.st_size)
+	return FAIL;
+    mm = (mlmmap_T *)alloc_clear((unsigned)sizeof(mlmmap_T));
+    if (mm == NULL)
+	return FAIL;
+    mm->mm_size = (size_t)st.st_size;
+    mm->mm_chunk_count = (long)((mm->mm_size + MM_CHUNK_SIZE - 1)
+							     / MM_CHUNK_SIZE);
+    mm->mm_nl_before = (linenr_T *)alloc((unsigned)
+			      ((mm->mm_chunk_count + 1) * sizeof(linenr_T)));
+    mm->mm_nl_index = (short_u **)alloc_clear((unsigned)
+				    (mm->mm_chunk_count * sizeof(short_u *)));
+    if (mm->mm_nl_before == NULL || mm->mm_nl_index == NULL)
+	goto fail;
+    mm->mm_dev = st.st_dev;
+    mm->mm_ino = st.st_ino;
+    mm->mm_mtime = st.st_mtime;
+    mm->mm_base = (char_u *)mmap(NULL, mm->mm_size, PROT_READ, MAP_PRIVATE,
+								fd, (off_t)0);
+    if (mm->mm_base == (char_u *)MAP_FAILED)
+    {
+	mm->mm_base = NULL;
+	goto fail;
+    }
+
+#ifdef HAVE_SETJMP_H
+    /* The file may be truncated while counting. */
+    mch_startjmp();
+    if (SETJMP(lc_jump_env) != 0)
+    {
+	mch_didjmp();
+	goto fail;
+    }
+#endif
+
+    /* Count the line breaks in each chunk. */
+    for (c = 0; c < mm->mm_chunk_count; ++c)
+    {
+	mm->mm_nl_before[c] = nl;
+	p = mm->mm_base + c * MM_CHUNK_SIZE;
+	end = c == mm->mm_chunk_count - 1 ? mm->mm_base + mm->mm_size
+							 : p + MM_CHUNK_SIZE;
+	while ((p = (char_u *)memchr(p, NL, (size_t)(end - p))) != NULL)
+	{
+	    ++nl;
+	    ++p;
+	}
+    }
+    mm->mm_nl_before[c] = nl;
+
+    if (*ffp == EOL_UNKNOWN)
+    {
+	p = (char_u *)memchr(mm->mm_base, NL, mm->mm_size);
+	*ffp = (p != NULL && p > mm->mm_base && p[-1] == CAR)
+							? EOL_DOS : EOL_UNIX;
+    }
+    mm->mm_dos = (*ffp == EOL_DOS);
+    *noeolp = (mm->mm_base[mm->mm_size - 1] != NL);
+    *sizep = st.st_size;
+#ifdef HAVE_SETJMP_H
+    mch_endjmp();
+#endif
+
+    buf->b_ml.ml_mmap = mm;
+    buf->b_ml.ml_line_count = nl + (*noeolp ? 1 : 0);
+    buf->b_ml.ml_flags &= ~ML_EMPTY;
+    return OK;
+
+fail:
+    ml_mmap_free(mm);
+    return FAIL;
+}
+
+/*
+ * Read all lines of the mapped file into the memline of "buf", because the
+ * buffer is going to be changed.  After this "buf" is a normal buffer.
+ * Return FAIL when not all lines could be stored.
+ */
+    int
+ml_mmap_promote(buf)
+    buf_T	*buf;
+{
+    mlmmap_T	*mm = buf->b_ml.ml_mmap;
+    linenr_T	line_count = buf->b_ml.ml_line_count;
+    linenr_T	lnum;
+    char_u	*line;
+    long	len;
+    int		retval = OK;
+
+    if (mm == NULL)
+	return OK;
+    buf->b_ml.ml_mmap = NULL;
+    buf->b_ml.ml_line_count = 1;
+    buf->b_ml.ml_flags |= ML_EMPTY;
+
+    /* Lines that don't fit in memory can go to the swap file now. */
+    if (buf->b_may_swap)
+	ml_open_file(buf);
+
+    ml_bulk_begin(buf);
+    for (lnum = 1; lnum <= line_count; ++lnum)
+	if ((line = ml_mmap_get(mm, lnum, &len)) == NULL
+		|| ml_append_int(buf, lnum - 1, line, (colnr_T)len + 1,
+						 TRUE, FALSE, FALSE) == FAIL)
+	{
+	    retval = FAIL;
+	    break;
+	}
+    ml_bulk_end(buf);
+
+    /* Delete the empty line, it comes from the empty memline. */
+    if (!(buf->b_ml.ml_flags & ML_EMPTY))
+	ml_delete_int(buf, buf->b_ml.ml_line_count, FALSE, FALSE);
+    ml_mmap_free(mm);
+    return retval;
+}
+
+    static void
+ml_mmap_free(mm)
+    mlmmap_T	*mm;
+{
+    long	c;
+
+    if (mm == NULL)
+	return;
+    if (mm->mm_base != NULL)
+	munmap((void *)mm->mm_base, mm->mm_size);
+    if (mm->mm_nl_index != NULL)
+	for (c = 0; c < mm->mm_chunk_count; ++c)
+	    vim_free(mm->mm_nl_index[c]);
+    vim_free(mm->mm_nl_index);
+    vim_free(mm->mm_nl_before);
+    vim_free(mm->mm_line);
+    vim_free(mm);
+}
+
+/*
+ * Called when using the mapped file gave SIGBUS: the file was truncated.
+ * The mapping isn't used again, the buffer is reloaded when the timestamps
+ * are checked.
+ */
+    static void
+ml_mmap_lost(mm)
+    mlmmap_T	*mm;
+{
+    mm->mm_lost = TRUE;
+    need_check_timestamps = TRUE;
+}
+
+/*
+ * Return TRUE when the file that "buf" takes its lines from was changed in
+ * place by another process after it was mapped, "stp" is the result of
+ * stat() for the file.  The text of the buffer is then unreliable, a part
+ * of it may be gone.  A file that was replaced or deleted is still mapped
+ * as it was.
+ */
+    int
+ml_mmap_changed(buf, stp)
+    buf_T	*buf;
+    struct stat	*stp;
+{
+    mlmmap_T	*mm = buf->b_ml.ml_mmap;
+
+    if (mm == NULL)
+	return FALSE;
+    if (mm->mm_lost)
+	return TRUE;
+    return stp->st_dev == mm->mm_dev && stp->st_ino == mm->mm_ino
+	    && ((size_t)stp->st_size != mm->mm_size
+					       || stp->st_mtime != mm->mm_mtime);
+}
+
+/*
+ * Stop using the mapped file for "buf" without reading its lines, they are
+ * lost.  "buf" is empty after this.
+ */
+    void
+ml_mmap_drop(buf)
+    buf_T	*buf;
+{
+    if (buf->b_ml.ml_mmap == NULL)
+	return;
+    ml_mmap_free(buf->b_ml.ml_mmap);
+    buf->b_ml.ml_mmap = NULL;
+    buf->b_ml.ml_line_count = 1;
+    buf->b_ml.ml_flags |= ML_EMPTY;
+}
+
+/*
+ * Return the offsets of the line breaks in chunk "c" of the mapped file,
+ * finding them when the chunk wasn't used before.  The chunk must contain a
+ * line break.
+ * Return NULL when out of memory or the file was truncated.
+ */
+    static short_u *
+ml_mmap_index(mm, c)
+    mlmmap_T	*mm;
+    long	c;
+{
+    short_u	*idx = mm->mm_nl_index[c];
+    char_u	*start;
+    char_u	*end;
+    char_u	*p;
+    int		i = 0;
+
+    if (idx == NULL)
+    {
+	if (mm->mm_lost)
+	    return NULL;
+	idx = (short_u *)alloc((unsigned)((mm->mm_nl_before[c + 1]
+				 - mm->mm_nl_before[c]) * sizeof(short_u)));
+	if (idx == NULL)
+	    return NULL;
+	start = mm->mm_base + c * MM_CHUNK_SIZE;
+	end = c == mm->mm_chunk_count - 1 ? mm->mm_base + mm->mm_size
+						     : start + MM_CHUNK_SIZE;
+#ifdef HAVE_SETJMP_H
+	mch_startjmp();
+	if (SETJMP(lc_jump_env) != 0)
+	{
+	    mch_didjmp();
+	    vim_free(idx);
+	    ml_mmap_lost(mm);
+	    return NULL;
+	}
+#endif
+	for (p = start; (p = (char_u *)memchr(p, NL, (size_t)(end - p)))
+							       != NULL; ++p)
+	    idx[i++] = (short_u)(p - start);
+#ifdef HAVE_SETJMP_H
+	mch_endjmp();
+#endif
+	mm->mm_nl_index[c] = idx;
+    }
+    return idx;
+}
+
+/*
+ * Return the offset of line break "nr" in the mapped file, counting from
+ * one.  Return -1 when out of memory or the file was truncated.
+ */
+    static off_t
+ml_mmap_nl(mm, nr)
+    mlmmap_T	*mm;
+    linenr_T	nr;
+{
+    long	lo = 0;
+    long	hi = mm->mm_chunk_count - 1;
+    long	mid;
+    short_u	*idx;
+
+    /* Find the last chunk with fewer than "nr" line breaks before it. */
+    while (lo < hi)
+    {
+	mid = (lo + hi + 1) / 2;
+	if (mm->mm_nl_before[mid] < nr)
+	    lo = mid;
+	else
+	    hi = mid - 1;
+    }
+    if ((idx = ml_mmap_index(mm, lo)) == NULL)
+	return (off_t)-1;
+    return (off_t)lo * MM_CHUNK_SIZE + idx[nr - mm->mm_nl_before[lo] - 1];
+}
+
+/*
+ * Get line "lnum" of the mapped file, in memory that is used again for the
+ * next line.  When "lenp" is not NULL set "*lenp" to the length of the line.
+ * Return NULL when out of memory or the file was truncated.
+ */
+    static char_u *
+ml_mmap_get(mm, lnum, lenp)
+    mlmmap_T	*mm;
+    linenr_T	lnum;
+    long	*lenp;
+{
+    off_t	start = 0;
+    off_t	end = (off_t)mm->mm_size;
+    long	len;
+    char_u	*p;
+
+    if (lnum > 1 && (start = ml_mmap_nl(mm, lnum - 1) + 1) == 0)
+	return NULL;
+    if (lnum <= mm->mm_nl_before[mm->mm_chunk_count])
+    {
+	if ((end = ml_mmap_nl(mm, lnum)) < 0)
+	    return NULL;
+	if (mm->mm_dos && end > start && mm->mm_base[end - 1] == CAR)
+	    --end;
+    }
+    len = (long)(end - start);
+
+    if ((size_t)len >= mm->mm_line_size)
+    {
+	vim_free(mm->mm_line);
+	mm->mm_line_size = len + 100;
+	mm->mm_line = alloc((unsigned)mm->mm_line_size);
+	if (mm->mm_line == NULL)
+	{
+	    mm->mm_line_size = 0;
+	    return NULL;
+	}
+    }
+    if (mm->mm_lost)
+	return NULL;
+#ifdef HAVE_SETJMP_H
+    mch_startjmp();
+    if (SETJMP(lc_jump_env) != 0)
+    {
+	mch_didjmp();
+	ml_mmap_lost(mm);
+	return NULL;
+    }
+#endif
+    mch_memmove(mm->mm_line, mm->mm_base + start, (size_t)len);
+#ifdef HAVE_SETJMP_H
+    mch_endjmp();
+#endif
+    mm->mm_line[len] = NUL;
+    /* A NUL is stored as a NL, like when reading the file. */
+    for (p = mm->mm_line; (p = (char_u *)memchr(p, NUL,
+				 (size_t)(mm->mm_line + len - p))) != NULL; )
+	*p++ = NL;
+    if (lenp != NULL)
+	*lenp = len;
+    return mm->mm_line;
+}
+
+/*
+ * ml_find_line_or_offset() for a buffer with a mapped file.
+ */
+    static long
+ml_mmap_offset(buf, lnum, offp)
+    buf_T	*buf;
+    linenr_T	lnum;
+    long	*offp;
+{
+    mlmmap_T	*mm = buf->b_ml.ml_mmap;
+    off_t	offset;
+    off_t	start;
+    linenr_T	n;
+    long	c;
+    short_u	*idx;
+    int		lo, hi, mid;
+
+    if (lnum > 0)
+    {
+	if (lnum > buf->b_ml.ml_line_count + 1)
+	    return -1;
+	if (lnum == 1)
+	    return 0;
+	if (lnum - 1 <= mm->mm_nl_before[mm->mm_chunk_count])
+	{
+	    start = ml_mmap_nl(mm, lnum - 1);
+	    return start < 0 ? -1 : (long)start + 1;
+	}
+	/* After the last line, which has no line break in the file. */
+	if (buf->b_p_bin && !buf->b_p_eol)
+	    return (long)mm->mm_size;
+	return (long)mm->mm_size + 1 + mm->mm_dos;
+    }
+
+    offset = offp == NULL ? 0 : *offp;
+    if (offset <= 0)
+	return 1;
+    if (offset >= (off_t)mm->mm_size)
+	return -1;
+
+    /* Count the line breaks before "offset". */
+    c = (long)(offset / MM_CHUNK_SIZE);
+    n = mm->mm_nl_before[c];
+    if (mm->mm_nl_before[c + 1] > n)
+    {
+	if ((idx = ml_mmap_index(mm, c)) == NULL)
+	    return -1;
+	lo = 0;
+	hi = (int)(mm->mm_nl_before[c + 1] - n);
+	while (lo < hi)
+	{
+	    mid = (lo + hi) / 2;
+	    if ((off_t)c * MM_CHUNK_SIZE + idx[mid] < offset)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	n += lo;
+    }
+    if (n == 0)
+	start = 0;
+    else if ((start = ml_mmap_nl(mm, n)) < 0)
+	return -1;
+    else
+	++start;
+    *offp = (long)(offset - start);
+    return n + 1;
+}
+#endif
+
+/*
+ * Replace line lnum, with buffering, in current buffer.
+ *
+ * If "copy" is TRUE, make a copy of the line, otherwise the line has been
+ * copied to allocated memory already.
+ *
+ * Automatically sends local edits to remote collaborators.
+ *
+ * Check: The caller of this function should probably also call
+ * changed_lines(), unless update_screen(NOT_VALID) is used.
+ *
+ * return FAIL for failure, OK otherwise
+ */
+    int
+ml_replace(lnum, line, copy)
+    linenr_T	lnum;
+    char_u	*line;
+    int		copy;
+{
+    return ml_replace_collab(lnum, line, copy, TRUE);
+}
+
+/*
+ * Same as ml_replace, but with the option to fire a collaborative event.
+ *
+ *   fire_event: TRUE to send remote collaborators a local edit event.
+ */
+
+    int
+ml_replace_collab(lnum, line, copy, fire_event)
+    linenr_T	lnum;
+    char_u	*line;
+    int		copy;
+    int		fire_event;
+{
+    if (line == NULL)		/* just checking... */
+	return FAIL;
+
+    /* When starting up, we might still need to create the memfile */
+    if (curbuf->b_ml.ml_mfp == NULL && open_buffer(FALSE, NULL, 0) == FAIL)
+	return FAIL;
+
+    if (copy && (line = vim_strsave(line)) == NULL) /* allocate memory */
+	return FAIL;
+#ifdef FEAT_MMAP_VIEW
+    /* Only after making the copy, "line" may be in the mapped file. */
+    if (curbuf->b_ml.ml_mmap != NULL && ml_mmap_promote(curbuf) == FAIL)
+    {
+	if (copy)
+	    vim_free(line);
+	return FAIL;
+    }
+#endif
+#ifdef FEAT_NETBEANS_INTG
+    if (netbeans_active())
+    {
+	netbeans_removed(curbuf, lnum, 0, (long)STRLEN(ml_get(lnum)));
+	netbeans_inserted(curbuf, lnum, 0, line, (int)STRLEN(line));
+    }
+#endif
+    if (curbuf->b_ml.ml_line_lnum != lnum)	    /* other line buffered */
+	ml_flush_line(curbuf);			    /* flush it */
+    else if (curbuf->b_ml.ml_flags & ML_LINE_DIRTY) /* same line allocated */
+	vim_free(curbuf->b_ml.ml_line_ptr);	    /* free it */
+    curbuf->b_ml.ml_line_ptr = line;
+    curbuf->b_ml.ml_line_lnum = lnum;
+    curbuf->b_ml.ml_flags = (curbuf->b_ml.ml_flags | ML_LINE_DIRTY) & ~ML_EMPTY;
+
+    if (fire_event) {
+        int bid = collab_get_id(curbuf);
+        /* If bid < 0, buf is not actually collaborative. */
+        if (bid >= 0) {
+            /* Send the local edit to the remote collaborators. */
+            collabedit_T replace_edit = {
+                .type = COLLAB_REPLACE_LINE,
+                .buf_id = bid,
+                .replace_line.line = lnum,
+                .replace_line.text = line
+            };
+            collab_remoteapply(&replace_edit);
+        }
+    }
+    return OK;
+}
+
+/*
+ * Delete line 'lnum' in the current buffer.
+ *
+ * Automatically sends local edits to remote collaborators.
+ * 
+ * Check: The caller of this function should probably also call
+ * deleted_lines() after this.
+ *
+ * return FAIL for failure, OK otherwise
+ */
+    int
+ml_delete(lnum, message)
+    linenr_T	lnum;
+    int		message;
+{
+    return ml_delete_collab(lnum, message, TRUE);
+}
+
+/*
+ * Same as ml_delete, but with the option to fire a collaborative event.
+ *
+ *   fire_event: TRUE to send remote collaborators a local edit event.
+ */
+    int
+ml_delete_collab(lnum, message, fire_event)
+    linenr_T	lnum;
+    int		message;
+    int		fire_event;
+{
+    ml_flush_line(curbuf);
+    return ml_delete_int(curbuf, lnum, message, fire_event);
+}
+
+    static int
+ml_delete_int(buf, lnum, message, fire_event)
+    buf_T	*buf;
+    linenr_T	lnum;
+    int		message;
+    int		fire_event;
+{
+    bhdr_T	*hp;
+    memfile_T	*mfp;
+    DATA_BL	*dp;
+    PTR_BL	*pp;
+    infoptr_T	*ip;
+    int		count;	    /* number of entries in block */
+    int		idx;
+    int		stack_idx;
+    int		text_start;
+    int		line_start;
+    long	line_size;
+    int		i;
+
+    if (lnum < 1 || lnum > buf->b_ml.ml_line_count)
+	return FAIL;
+
+#ifdef FEAT_MMAP_VIEW
+    if (buf->b_ml.ml_mmap != NULL && ml_mmap_promote(buf) == FAIL)
+	return FAIL;
+#endif
+
+    if (lowest_marked && lowest_marked > lnum)
+	lowest_marked--;
+
+/*
+ * If the file becomes empty the last line is replaced by an empty line.
+ */
+    if (buf->b_ml.ml_line_count == 1)	    /* file becomes empty */
+    {
+	if (message
+#ifdef FEAT_NETBEANS_INTG
+		&& !netbeansSuppressNoLines
+#endif
+	   )
+	    set_keep_msg((char_u *)_(no_lines_msg), 0);
+
+	/* FEAT_BYTEOFF already handled in there, dont worry 'bout it below */
+	i = ml_replace((linenr_T)1, (char_u *)"", TRUE);
+	buf->b_ml.ml_flags |= ML_EMPTY;
+
+	return i;
+    }
+
+/*
+ * find the data block containing the line
+ * This also fills the stack with the blocks from the root to the data block
+ * This also releases any locked block.
+ */
+    mfp = buf->b_ml.ml_mfp;
+    if (mfp == NULL)
+	return FAIL;
+
+    if ((hp = ml_find_line(buf, lnum, ML_DELETE)) == NULL)
+	return FAIL;
+
+    dp = (DATA_BL *)(hp->bh_data);
+    /* compute line count before the delete */
+    count = (long)(buf->b_ml.ml_locked_high)
+					- (long)(buf->b_ml.ml_locked_low) + 2;
+    idx = lnum - buf->b_ml.ml_locked_low;
+
+    --buf->b_ml.ml_line_count;
+
+    line_start = ((dp->db_index[idx]) & DB_INDEX_MASK);
+    if (idx == 0)		/* first line in block, text at the end */
+	line_size = dp->db_txt_end - line_start;
+    else
+	line_size = ((dp->db_index[idx - 1]) & DB_INDEX_MASK) - line_start;
+
+#ifdef FEAT_NETBEANS_INTG
+    if (netbeans_active())
+	netbeans_removed(buf, lnum, 0, (long)line_size);
+#endif
+
+/*
+ * special case: If there is only one line in the data block it becomes empty.
+ * Then we have to remove the entry, pointing to this data block, from the
+ * pointer block. If this pointer block also becomes empty, we go up another
+ * block, and so on, up to the root if necessary.
+ * The line counts in the pointer blocks have already been adjusted by
+ * ml_find_line().
+ */
+    if (count == 1)
+    {
+	mf_free(mfp, hp);	/* free the data block */
+	buf->b_ml.ml_locked = NULL;
+
+	for (stack_idx = buf->b_ml.ml_stack_top - 1; stack_idx >= 0; --stack_idx)
+	{
+	    buf->b_ml.ml_stack_top = 0;	    /* stack is invalid when failing */
+	    ip = &(buf->b_ml.ml_stack[stack_idx]);
+	    idx = ip->ip_index;
+	    if ((hp = mf_get(mfp, ip->ip_bnum, 1)) == NULL)
+		return FAIL;
+	    pp = (PTR_BL *)(hp->bh_data);   /* must be pointer block */
+	    if (pp->pb_id != PTR_ID)
+	    {
+		EMSG(_("E317: pointer block id wrong 4"));
+		mf_put(mfp, hp, FALSE, FALSE);
+		return FAIL;
+	    }
+	    count = --(pp->pb_count);
+	    if (count == 0)	    /* the pointer block becomes empty! */
+		mf_free(mfp, hp);
+	    else
+	    {
+		if (count != idx)	/* move entries after the deleted one */
+		    mch_memmove(&pp->pb_pointer[idx], &pp->pb_pointer[idx + 1],
+				      (size_t)(count - idx) * sizeof(PTR_EN));
+		mf_put(mfp, hp, TRUE, FALSE);
+
+		buf->b_ml.ml_stack_top = stack_idx;	/* truncate stack */
+		/* fix line count for rest of blocks in the stack */
+		if (buf->b_ml.ml_locked_lineadd != 0)
+		{
+		    ml_lineadd(buf, buf->b_ml.ml_locked_lineadd);
+		    buf->b_ml.ml_stack[buf->b_ml.ml_stack_top].ip_high +=
+						  buf->b_ml.ml_locked_lineadd;
+		}
+		++(buf->b_ml.ml_stack_top);
+
+		break;
+	    }
+	}
+	CHECK(stack_idx < 0, _("deleted block 1?"));
+    }
+    else
+    {
+	/*
+	 * delete the text by moving the next lines forwards
+	 */
+	text_start = dp->db_txt_start;
+	mch_memmove((char *)dp + text_start + line_size,
+		  (char *)dp + text_start, (size_t)(line_start - text_start));
+
+	/*
+	 * delete the index by moving the next indexes backwards
+	 * Adjust the indexes for the text movement.
+	 */
+	for (i = idx; i < count - 1; ++i)
+	    dp->db_index[i] = dp->db_index[i + 1] + line_size;
+
+	if (!ML_IS_SPARSE(dp, dp->db_free)
+		&& ML_IS_SPARSE(dp, dp->db_free + line_size + INDEX_SIZE))
+	    ++buf->b_ml.ml_sparse_count;
+	dp->db_free += line_size + INDEX_SIZE;
+	dp->db_txt_start += line_size;
+	--(dp->db_line_count);
+
+	/*
+	 * mark the block dirty and make sure it is in the file (for recovery)
+	 */
+	buf->b_ml.ml_flags |= (ML_LOCKED_DIRTY | ML_LOCKED_POS);
+    }
+
+#ifdef FEAT_BYTEOFF
+    ml_updatechunk(buf, lnum, line_size, ML_CHNK_DELLINE);
+#endif
+#ifdef FEAT_TRIGRAM_INDEX
+    if (buf->b_ml.ml_tri != NULL)
+	ml_tri_delete(buf, lnum, 1L);
+#endif
+    if (fire_event) {
+        int bid = collab_get_id(buf);
+        /* If bid < 0, buf is not actually collaborative. */
+        if (bid >= 0) {
+            /* Send the local edit to the remote collaborators. */
+            collabedit_T remove_edit = {
+                .type = COLLAB_REMOVE_LINE,
+                .buf_id = bid,
+                .remove_line.line = lnum,
+            };
+            collab_remoteapply(&remove_edit);
+        }
+    }
+    return OK;
+}
+
+/*
+ * Delete "count" lines starting at line "lnum" in the current buffer.
+ * Whole data blocks in the range are dropped and only the blocks at its ends
+ * are changed, so this is much faster than calling ml_delete() "count" times.
+ * When all lines are deleted the buffer becomes empty, like with ml_delete().
+ *
+ * return FAIL for failure, OK otherwise
+ */
+    int
+ml_delete_range(lnum, count, message)
+    linenr_T	lnum;
+    long	count;
+    int		message;
+{
+    return ml_delete_range_collab(lnum, count, message, TRUE);
+}
+
+/*
+ * Same as ml_delete_range, but with the option to fire a collaborative event.
+ *
+ *   fire_event: TRUE to send remote collaborators a local edit event.
+ */
+    int
+ml_delete_range_collab(lnum, count, message, fire_event)
+    linenr_T	lnum;
+    long	count;
+    int		message;
+    int		fire_event;
+{
+    ml_flush_line(curbuf);
+    return ml_delete_range_int(curbuf, lnum, count, message, fire_event);
+}
+
+    static int
+ml_delete_range_int(buf, lnum, count, message, fire_event)
+    buf_T	*buf;
+    linenr_T	lnum;
+    long	count;
+    int		message;
+    int		fire_event;
+{
+    linenr_T	last;
+    int		empty;
+    int		ret;
+#ifdef FEAT_BYTEOFF
+    delrange_T	dr;
+    chunksize_T	*cs;
+    int		first_ix;
+    int		from, to;
+    int		r, w;
+#endif
+#ifdef FEAT_NETBEANS_INTG
+    long	size;
+    linenr_T	l;
+#endif
+
+    if (lnum < 1 || lnum > buf->b_ml.ml_line_count || buf->b_ml.ml_mfp == NULL)
+	return FAIL;
+#ifdef FEAT_MMAP_VIEW
+    if (buf->b_ml.ml_mmap != NULL && ml_mmap_promote(buf) == FAIL)
+	return FAIL;
+#endif
+    if (count > buf->b_ml.ml_line_count - lnum + 1)
+	count = buf->b_ml.ml_line_count - lnum + 1;
+    if (count <= 1)
+	return ml_delete_int(buf, lnum, message, fire_event);
+
+    /*
+     * Deleting all lines: keep the first line in the tree and let
+     * ml_delete_int() replace it with an empty line.
+     */
+    if (count == buf->b_ml.ml_line_count)
+    {
+	if (ml_delete_range_int(buf, (linenr_T)2, count - 1, message,
+							  fire_event) == FAIL)
+	    return FAIL;
+	return ml_delete_int(buf, (linenr_T)1, message, fire_event);
+    }
+    last = lnum + count - 1;
+
+    if (lowest_marked && lowest_marked > lnum)
+	lowest_marked = lowest_marked - count > lnum
+					      ? lowest_marked - count : lnum;
+
+#ifdef FEAT_NETBEANS_INTG
+    if (netbeans_active())
+    {
+	/* One event for all the text, it starts at the same offset. */
+	size = 0;
+	for (l = lnum; l <= last; ++l)
+	    size += (long)STRLEN(ml_get_buf(buf, l, FALSE)) + 1;
+	netbeans_removed(buf, lnum, 0, size);
+    }
+#endif
+
+    /* flush a locked block, the stack is rebuilt by the next search */
+    (void)ml_find_line(buf, (linenr_T)0, ML_FLUSH);
+
+#ifdef FEAT_BYTEOFF
+    dr.dr_curix = -1;
+    if (buf->b_ml.ml_usedchunks != -1 && buf->b_ml.ml_chunksize != NULL)
+    {
+	/* Find the chunk with the first line to delete. */
+	dr.dr_curix = ml_chunk_find(buf, lnum, 0L, FALSE, &dr.dr_curline,
+									NULL);
+	if (dr.dr_curix < 0)
+	    buf->b_ml.ml_usedchunks = -1;
+	else
+	    dr.dr_curend = dr.dr_curline
+		  + buf->b_ml.ml_chunksize[dr.dr_curix].mlcs_numlines - 1;
+    }
+    first_ix = dr.dr_curix;
+    ret = ml_delete_tree(buf, (blocknr_T *)NULL, 1, (linenr_T)1, lnum, last,
+								&dr, &empty);
+#else
+    ret = ml_delete_tree(buf, (blocknr_T *)NULL, 1, (linenr_T)1, lnum, last,
+								NULL, &empty);
+#endif
+    buf->b_ml.ml_stack_top = 0;	    /* the stack is invalid now */
+    buf->b_ml.ml_line_count -= count;
+#ifdef FEAT_TRIGRAM_INDEX
+    if (buf->b_ml.ml_tri != NULL)
+	ml_tri_delete(buf, lnum, count);
+#endif
+
+#ifdef FEAT_BYTEOFF
+    if (first_ix >= 0)
+    {
+	/*
+	 * Drop the chunks that became empty and merge small neighbours, from
+	 * the chunk before the first deleted line to the one after the last.
+	 */
+	cs = buf->b_ml.ml_chunksize;
+	from = first_ix > 0 ? first_ix - 1 : 0;
+	to = dr.dr_curix < buf->b_ml.ml_usedchunks - 1
+				  ? dr.dr_curix + 1 : buf->b_ml.ml_usedchunks - 1;
+	w = from - 1;
+	for (r = from; r <= to; ++r)
+	{
+	    if (cs[r].mlcs_numlines <= 0)
+		continue;
+	    if (w >= from
+		    && cs[w].mlcs_numlines + cs[r].mlcs_numlines <= MLCS_MINL)
+	    {
+		cs[w].mlcs_numlines += cs[r].mlcs_numlines;
+		cs[w].mlcs_totalsize += cs[r].mlcs_totalsize;
+	    }
+	    else
+		cs[++w] = cs[r];
+	}
+	mch_memmove(cs + w + 1, cs + to + 1,
+		    (buf->b_ml.ml_usedchunks - to - 1) * sizeof(chunksize_T));
+	buf->b_ml.ml_usedchunks -= to - w;
+	buf->b_ml.ml_chunktree_len = 0;
+	ml_upd_lastbuf = NULL;
+    }
+#endif
+    if (ret == FAIL)
+	return FAIL;
+
     if (fire_event) {
         int bid = collab_get_id(buf);
         /* If bid < 0, buf is not actually collaborative. */
         if (bid >= 0) {
             /* Send the local edit to the remote collaborators. */
             collabedit_T remove_edit = {
-                .type = COLLAB_REMOVE_LINE,
+                .type = COLLAB_REMOVE_LINES,
                 .buf_id = bid,
-                .remove_line.line = lnum,
+                .remove_lines.line = lnum,
+                .remove_lines.count = count,
             };
             collab_remoteapply(&remove_edit);
         }
     }
-    return OK;
+    return OK;
+}
+
+/*
+ * Delete lines "first" to "last" from the tree below block "*bnump", which
+ * starts with line "low".  A NULL "bnump" is block 1, the root.
+ * Data blocks in the range are freed, the others are trimmed.  Pointer
+ * blocks drop the entries for freed blocks and get their line counts fixed.
+ * "*emptyp" is set to TRUE when the block itself was freed.
+ */
+    static int
+ml_delete_tree(buf, bnump, page_count, low, first, last, drp, emptyp)
+    buf_T	*buf;
+    blocknr_T	*bnump;
+    int		page_count;
+    linenr_T	low;
+    linenr_T	first;
+    linenr_T	last;
+    delrange_T	*drp;
+    int		*emptyp;
+{
+    memfile_T	*mfp = buf->b_ml.ml_mfp;
+    bhdr_T	*hp;
+    DATA_BL	*dp;
+    PTR_BL	*pp;
+    PTR_EN	pe;
+    blocknr_T	bnum;
+    linenr_T	clow;
+    int		count;
+    int		from, to;
+    int		n;
+    int		line_start;
+    int		text_end;
+    long	size;
+    int		i;
+    int		r, w;
+    int		empty;
+    int		ret = OK;
+
+    *emptyp = FALSE;
+    bnum = bnump == NULL ? 1 : *bnump;
+    if (bnum < 0)
+	*bnump = bnum = mf_trans_del(mfp, bnum);
+    if ((hp = mf_get(mfp, bnum, page_count)) == NULL)
+	return FAIL;
+
+    dp = (DATA_BL *)(hp->bh_data);
+    if (dp->db_id == DATA_ID)
+    {
+	count = dp->db_line_count;
+	from = (first > low ? first : low) - low;
+	to = (last < low + count - 1 ? last : low + count - 1) - low;
+	n = to - from + 1;
+#ifdef FEAT_BYTEOFF
+	if (drp != NULL && drp->dr_curix >= 0)
+	    ml_delete_chunks(buf, drp, dp, low, from, to);
+#endif
+	if (n == count)
+	{
+	    mf_free(mfp, hp);
+	    *emptyp = TRUE;
+	    return OK;
+	}
+
+	/*
+	 * Remove the text of the lines by moving the text of the lines after
+	 * them forwards, then remove their indexes.
+	 */
+	text_end = from == 0 ? dp->db_txt_end
+			     : ((dp->db_index[from - 1]) & DB_INDEX_MASK);
+	line_start = ((dp->db_index[to]) & DB_INDEX_MASK);
+	size = text_end - line_start;
+	mch_memmove((char *)dp + dp->db_txt_start + size,
+			(char *)dp + dp->db_txt_start,
+			(size_t)(line_start - dp->db_txt_start));
+	for (i = to + 1; i < count; ++i)
+	    dp->db_index[i - n] = dp->db_index[i] + size;
+	if (!ML_IS_SPARSE(dp, dp->db_free)
+		&& ML_IS_SPARSE(dp, dp->db_free + size + n * INDEX_SIZE))
+	    ++buf->b_ml.ml_sparse_count;
+	dp->db_free += size + n * INDEX_SIZE;
+	dp->db_txt_start += size;
+	dp->db_line_count -= n;
+
+	/* make sure it is in the file (for recovery) */
+	mf_put(mfp, hp, TRUE, TRUE);
+	return OK;
+    }
+
+    pp = (PTR_BL *)(hp->bh_data);
+    if (pp->pb_id != PTR_ID)
+    {
+	EMSG(_("E317: pointer block id wrong"));
+	mf_put(mfp, hp, FALSE, FALSE);
+	return FAIL;
+    }
+
+    /* Walk the entries, keeping the ones that still have lines. */
+    w = 0;
+    for (r = 0; r < (int)pp->pb_count; ++r)
+    {
+	pe = pp->pb_pointer[r];
+	clow = low;
+	low += pe.pe_line_count;
+	if (ret == OK && low > first && clow <= last)
+	{
+	    ret = ml_delete_tree(buf, &pe.pe_bnum, pe.pe_page_count, clow,
+						 first, last, drp, &empty);
+	    pe.pe_line_count -= (last < low - 1 ? last : low - 1)
+					 - (first > clow ? first : clow) + 1;
+	    if (empty)
+		continue;
+	}
+	pp->pb_pointer[w++] = pe;
+    }
+    pp->pb_count = w;
+
+    if (w == 0 && bnump != NULL)
+    {
+	mf_free(mfp, hp);
+	*emptyp = TRUE;
+    }
+    else
+	mf_put(mfp, hp, TRUE, FALSE);
+    return ret;
+}
+
+#ifdef FEAT_BYTEOFF
+/*
+ * Subtract lines "from" to "to" of data block "dp", which starts with line
+ * "low", from the chunks they are in.  Lines are passed in ascending order,
+ * so the chunk of the previous call is the place to start looking.
+ */
+    static void
+ml_delete_chunks(buf, drp, dp, low, from, to)
+    buf_T	*buf;
+    delrange_T	*drp;
+    DATA_BL	*dp;
+    linenr_T	low;
+    int		from;
+    int		to;
+{
+    chunksize_T	*cs = buf->b_ml.ml_chunksize;
+    int		end;
+    int		text_end;
+
+    while (from <= to)
+    {
+	while (low + from > drp->dr_curend
+			       && drp->dr_curix < buf->b_ml.ml_usedchunks - 1)
+	{
+	    drp->dr_curline = drp->dr_curend + 1;
+	    ++drp->dr_curix;
+	    drp->dr_curend = drp->dr_curline
+				       + cs[drp->dr_curix].mlcs_numlines - 1;
+	}
+	end = drp->dr_curend - low;
+	if (end > to || drp->dr_curix == buf->b_ml.ml_usedchunks - 1)
+	    end = to;
+	text_end = from == 0 ? dp->db_txt_end
+			     : ((dp->db_index[from - 1]) & DB_INDEX_MASK);
+	cs[drp->dr_curix].mlcs_numlines -= end - from + 1;
+	cs[drp->dr_curix].mlcs_totalsize -=
+			      text_end - ((dp->db_index[end]) & DB_INDEX_MASK);
+	from = end + 1;
+    }
+}
+#endif
+
+/*
+ * set the B_MARKED flag for line 'lnum'
+ */
+    void
+ml_setmarked(lnum)
+    linenr_T lnum;
+{
+    bhdr_T    *hp;
+    DATA_BL *dp;
+				    /* invalid line number */
+    if (lnum < 1 || lnum > curbuf->b_ml.ml_line_count
+					       || curbuf->b_ml.ml_mfp == NULL)
+	return;			    /* give error message? */
+#ifdef FEAT_MMAP_VIEW
+    /* Marks are kept in the data blocks. */
+    if (curbuf->b_ml.ml_mmap != NULL && ml_mmap_promote(curbuf) == FAIL)
+	return;
+#endif
+
+    if (lowest_marked == 0 || lowest_marked > lnum)
+	lowest_marked = lnum;
+
+    /*
+     * find the data block containing the line
+     * This also fills the stack with the blocks from the root to the data block
+     * This also releases any locked block.
+     */
+    if ((hp = ml_find_line(curbuf, lnum, ML_FIND)) == NULL)
+	return;		    /* give error message? */
+
+    dp = (DATA_BL *)(hp->bh_data);
+    dp->db_index[lnum - curbuf->b_ml.ml_locked_low] |= DB_MARKED;
+    curbuf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
+}
+
+/*
+ * find the first line with its B_MARKED flag set
+ */
+    linenr_T
+ml_firstmarked()
+{
+    bhdr_T	*hp;
+    DATA_BL	*dp;
+    linenr_T	lnum;
+    int		i;
+
+    if (curbuf->b_ml.ml_mfp == NULL)
+	return (linenr_T) 0;
+
+    /*
+     * The search starts with lowest_marked line. This is the last line where
+     * a mark was found, adjusted by inserting/deleting lines.
+     */
+    for (lnum = lowest_marked; lnum <= curbuf->b_ml.ml_line_count; )
+    {
+	/*
+	 * Find the data block containing the line.
+	 * This also fills the stack with the blocks from the root to the data
+	 * block This also releases any locked block.
+	 */
+	if ((hp = ml_find_line(curbuf, lnum, ML_FIND)) == NULL)
+	    return (linenr_T)0;		    /* give error message? */
+
+	dp = (DATA_BL *)(hp->bh_data);
+
+	for (i = lnum - curbuf->b_ml.ml_locked_low;
+			    lnum <= curbuf->b_ml.ml_locked_high; ++i, ++lnum)
+	    if ((dp->db_index[i]) & DB_MARKED)
+	    {
+		(dp->db_index[i]) &= DB_INDEX_MASK;
+		curbuf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
+		lowest_marked = lnum + 1;
+		return lnum;
+	    }
+    }
+
+    return (linenr_T) 0;
+}
+
+/*
+ * clear all DB_MARKED flags
+ */
+    void
+ml_clearmarked()
+{
+    bhdr_T	*hp;
+    DATA_BL	*dp;
+    linenr_T	lnum;
+    int		i;
+
+    if (curbuf->b_ml.ml_mfp == NULL)	    /* nothing to do */
+	return;
+
+    /*
+     * The search starts with line lowest_marked.
+     */
+    for (lnum = lowest_marked; lnum <= curbuf->b_ml.ml_line_count; )
+    {
+	/*
+	 * Find the data block containing the line.
+	 * This also fills the stack with the blocks from the root to the data
+	 * block and releases any locked block.
+	 */
+	if ((hp = ml_find_line(curbuf, lnum, ML_FIND)) == NULL)
+	    return;		/* give error message? */
+
+	dp = (DATA_BL *)(hp->bh_data);
+
+	for (i = lnum - curbuf->b_ml.ml_locked_low;
+			    lnum <= curbuf->b_ml.ml_locked_high; ++i, ++lnum)
+	    if ((dp->db_index[i]) & DB_MARKED)
+	    {
+		(dp->db_index[i]) &= DB_INDEX_MASK;
+		curbuf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
+	    }
+    }
+
+    lowest_marked = 0;
+    return;
+}
+
+#if defined(FEAT_TRIGRAM_INDEX) || defined(PROTO)
+/*
+ * Free the trigram index of "buf".
+ */
+    static void
+ml_tri_free(buf)
+    buf_T	*buf;
+{
+    mltri_T	*mt = buf->b_ml.ml_tri;
+    int		ix;
+
+    if (mt == NULL)
+	return;
+    for (ix = 0; ix < mt->mt_count; ++ix)
+	vim_free(mt->mt_chunks[ix].tc_bits);
+    vim_free(mt->mt_chunks);
+    vim_free(mt);
+    buf->b_ml.ml_tri = NULL;
+}
+
+/*
+ * Free the trigram index of all buffers.  Used when 'trigramindex' is reset.
+ */
+    void
+ml_tri_free_all()
+{
+    buf_T	*buf;
+
+    for (buf = firstbuf; buf != NULL; buf = buf->b_next)
+	ml_tri_free(buf);
+}
+
+/*
+ * Get the trigram index of "buf", create it when there is none.  The
+ * bitmaps are only built when a chunk is used.
+ * Returns NULL when out of memory.
+ */
+    static mltri_T *
+ml_tri_get(buf)
+    buf_T	*buf;
+{
+    mltri_T	*mt = buf->b_ml.ml_tri;
+    linenr_T	lnum;
+    int		ix;
+
+    /* Just in case the line counts got out of sync: start all over. */
+    if (mt != NULL && mt->mt_lines != buf->b_ml.ml_line_count)
+	ml_tri_free(buf);
+    if (buf->b_ml.ml_tri != NULL)
+	return buf->b_ml.ml_tri;
+
+    mt = (mltri_T *)alloc((unsigned)sizeof(mltri_T));
+    if (mt == NULL)
+	return NULL;
+    mt->mt_count = (buf->b_ml.ml_line_count + MLTRI_LINES - 1) / MLTRI_LINES;
+    mt->mt_max = mt->mt_count + mt->mt_count / 4 + 16;
+    mt->mt_chunks = (trichunk_T *)alloc(
+				(unsigned)(mt->mt_max * sizeof(trichunk_T)));
+    if (mt->mt_chunks == NULL)
+    {
+	vim_free(mt);
+	return NULL;
+    }
+    for (ix = 0, lnum = buf->b_ml.ml_line_count; ix < mt->mt_count;
+						   ++ix, lnum -= MLTRI_LINES)
+    {
+	mt->mt_chunks[ix].tc_numlines = lnum < MLTRI_LINES
+							 ? lnum : MLTRI_LINES;
+	mt->mt_chunks[ix].tc_changed = 0;
+	mt->mt_chunks[ix].tc_bits = NULL;
+    }
+    mt->mt_lines = buf->b_ml.ml_line_count;
+    mt->mt_lastix = 0;
+    mt->mt_lastline = 1;
+    buf->b_ml.ml_tri = mt;
+    return mt;
+}
+
+/*
+ * Find the chunk in "mt" that contains line "lnum", starting at the chunk
+ * found last.  Its first line is stored in "*firstp".
+ * A line past the end is taken to be in the last chunk.
+ */
+    static int
+ml_tri_find(mt, lnum, firstp)
+    mltri_T	*mt;
+    linenr_T	lnum;
+    linenr_T	*firstp;
+{
+    int		ix = mt->mt_lastix;
+    linenr_T	first = mt->mt_lastline;
+
+    if (ix >= mt->mt_count)
+    {
+	ix = 0;
+	first = 1;
+    }
+    while (ix > 0 && lnum < first)
+	first -= mt->mt_chunks[--ix].tc_numlines;
+    while (ix < mt->mt_count - 1
+			  && lnum >= first + mt->mt_chunks[ix].tc_numlines)
+	first += mt->mt_chunks[ix++].tc_numlines;
+    mt->mt_lastix = ix;
+    mt->mt_lastline = first;
+    *firstp = first;
+    return ix;
+}
+
+/*
+ * Return the bit number for trigram "h", its three bytes in the low 24 bits.
+ */
+    static int
+ml_tri_hash(h)
+    long_u	h;
+{
+    return (int)(((h * 2654435761UL) & 0xffffffffUL) >> (32 - MLTRI_SHIFT));
+}
+
+/*
+ * Set the bits in bitmap "bits" for the trigrams in "line".
+ */
+    static void
+ml_tri_add(bits, line)
+    char_u	*bits;
+    char_u	*line;
+{
+    char_u	*p;
+    long_u	h = 0;
+    int		n;
+
+    for (p = line; *p != NUL; ++p)
+    {
+	h = ((h << 8) | TOLOWER_ASC(*p)) & 0xffffffUL;
+	if (p - line >= 2)
+	{
+	    n = ml_tri_hash(h);
+	    bits[n >> 3] |= 1 << (n & 7);
+	}
+    }
 }
 
 /*
- * set the B_MARKED flag for line 'lnum'
+ * Return TRUE when the lines of chunk "tc", starting at line "first" of
+ * "buf", may contain all the trigrams of "tq".  Builds the bitmap of the
+ * chunk when needed.
  */
-    void
-ml_setmarked(lnum)
-    linenr_T lnum;
+    static int
+ml_tri_maymatch(buf, tc, first, tq)
+    buf_T	*buf;
+    trichunk_T	*tc;
+    linenr_T	first;
+    triquery_T	*tq;
 {
-    bhdr_T    *hp;
-    DATA_BL *dp;
-				    /* invalid line number */
-    if (lnum < 1 || lnum > curbuf->b_ml.ml_line_count
-					       || curbuf->b_ml.ml_mfp == NULL)
-	return;			    /* give error message? */
-
-    if (lowest_marked == 0 || lowest_marked > lnum)
-	lowest_marked = lnum;
-
-    /*
-     * find the data block containing the line
-     * This also fills the stack with the blocks from the root to the data block
-     * This also releases any locked block.
-     */
-    if ((hp = ml_find_line(curbuf, lnum, ML_FIND)) == NULL)
-	return;		    /* give error message? */
+    linenr_T	lnum;
+    int		i;
 
-    dp = (DATA_BL *)(hp->bh_data);
-    dp->db_index[lnum - curbuf->b_ml.ml_locked_low] |= DB_MARKED;
-    curbuf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
+    if (MLTRI_STALE(tc))
+    {
+	if (tc->tc_bits == NULL)
+	{
+	    tc->tc_bits = alloc((unsigned)(MLTRI_BITS / 8));
+	    if (tc->tc_bits == NULL)
+		return TRUE;
+	}
+	vim_memset(tc->tc_bits, 0, (size_t)(MLTRI_BITS / 8));
+	for (lnum = first; lnum < first + tc->tc_numlines; ++lnum)
+	    ml_tri_add(tc->tc_bits, ml_get_buf(buf, lnum, FALSE));
+	tc->tc_changed = 0;
+    }
+    for (i = 0; i < tq->tq_count; ++i)
+	if ((tc->tc_bits[tq->tq_hash[i] >> 3] & (1 << (tq->tq_hash[i] & 7)))
+									  == 0)
+	    return FALSE;
+    return TRUE;
 }
 
 /*
- * find the first line with its B_MARKED flag set
+ * Line "line" was appended below line "lnum" of "buf": add it to the chunk
+ * of "lnum".  Split the chunk when it gets too big.
  */
-    linenr_T
-ml_firstmarked()
-{
-    bhdr_T	*hp;
-    DATA_BL	*dp;
+    static void
+ml_tri_append(buf, lnum, line)
+    buf_T	*buf;
     linenr_T	lnum;
-    int		i;
-
-    if (curbuf->b_ml.ml_mfp == NULL)
-	return (linenr_T) 0;
+    char_u	*line;
+{
+    mltri_T	*mt = buf->b_ml.ml_tri;
+    trichunk_T	*tc;
+    trichunk_T	*chunks;
+    linenr_T	first;
+    int		ix;
+
+    ix = ml_tri_find(mt, lnum == 0 ? (linenr_T)1 : lnum, &first);
+    tc = &mt->mt_chunks[ix];
+    ++tc->tc_numlines;
+    ++tc->tc_changed;
+    ++mt->mt_lines;
+    if (tc->tc_bits != NULL)
+	ml_tri_add(tc->tc_bits, line);
+    if (tc->tc_numlines <= MLTRI_MAXL)
+	return;
 
-    /*
-     * The search starts with lowest_marked line. This is the last line where
-     * a mark was found, adjusted by inserting/deleting lines.
-     */
-    for (lnum = lowest_marked; lnum <= curbuf->b_ml.ml_line_count; )
+    /* Split the chunk in two halves, their bitmaps are built again. */
+    if (mt->mt_count == mt->mt_max)
     {
-	/*
-	 * Find the data block containing the line.
-	 * This also fills the stack with the blocks from the root to the data
-	 * block This also releases any locked block.
-	 */
-	if ((hp = ml_find_line(curbuf, lnum, ML_FIND)) == NULL)
-	    return (linenr_T)0;		    /* give error message? */
+	chunks = (trichunk_T *)alloc(
+			    (unsigned)(mt->mt_max * 2 * sizeof(trichunk_T)));
+	if (chunks == NULL)
+	    return;	/* the chunk stays big, that's OK */
+	mch_memmove(chunks, mt->mt_chunks, mt->mt_count * sizeof(trichunk_T));
+	vim_free(mt->mt_chunks);
+	mt->mt_chunks = chunks;
+	mt->mt_max *= 2;
+	tc = &mt->mt_chunks[ix];
+    }
+    mch_memmove(tc + 2, tc + 1,
+			     (mt->mt_count - ix - 1) * sizeof(trichunk_T));
+    ++mt->mt_count;
+    tc[1].tc_numlines = tc->tc_numlines - tc->tc_numlines / 2;
+    tc[1].tc_changed = 0;
+    tc[1].tc_bits = NULL;
+    tc->tc_numlines /= 2;
+    tc->tc_changed = tc->tc_numlines + 1;
+}
 
-	dp = (DATA_BL *)(hp->bh_data);
+/*
+ * Line "lnum" of "buf" was changed to "line".  The trigrams of the old text
+ * are kept until the bitmap is built again.
+ */
+    static void
+ml_tri_change(buf, lnum, line)
+    buf_T	*buf;
+    linenr_T	lnum;
+    char_u	*line;
+{
+    mltri_T	*mt = buf->b_ml.ml_tri;
+    trichunk_T	*tc;
+    linenr_T	first;
+
+    tc = &mt->mt_chunks[ml_tri_find(mt, lnum, &first)];
+    ++tc->tc_changed;
+    if (tc->tc_bits != NULL)
+	ml_tri_add(tc->tc_bits, line);
+}
 
-	for (i = lnum - curbuf->b_ml.ml_locked_low;
-			    lnum <= curbuf->b_ml.ml_locked_high; ++i, ++lnum)
-	    if ((dp->db_index[i]) & DB_MARKED)
-	    {
-		(dp->db_index[i]) &= DB_INDEX_MASK;
-		curbuf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
-		lowest_marked = lnum + 1;
-		return lnum;
-	    }
+/*
+ * "count" lines starting at line "lnum" were deleted from "buf": remove them
+ * from their chunks and drop the chunks that become empty.
+ */
+    static void
+ml_tri_delete(buf, lnum, count)
+    buf_T	*buf;
+    linenr_T	lnum;
+    long	count;
+{
+    mltri_T	*mt = buf->b_ml.ml_tri;
+    trichunk_T	*tc;
+    linenr_T	first;
+    long	n;
+    int		from, ix, r, w;
+
+    /* Line numbers are from before the delete. */
+    from = ix = ml_tri_find(mt, lnum, &first);
+    for ( ; count > 0 && ix < mt->mt_count; ++ix)
+    {
+	tc = &mt->mt_chunks[ix];
+	n = first + tc->tc_numlines - lnum;
+	if (n > count)
+	    n = count;
+	first += tc->tc_numlines;
+	tc->tc_numlines -= n;
+	tc->tc_changed += n;
+	mt->mt_lines -= n;
+	lnum += n;
+	count -= n;
     }
 
-    return (linenr_T) 0;
+    /* The chunk found last, "from", still starts at the same line. */
+    w = from;
+    for (r = from; r < ix; ++r)
+    {
+	if (mt->mt_chunks[r].tc_numlines > 0)
+	    mt->mt_chunks[w++] = mt->mt_chunks[r];
+	else
+	    vim_free(mt->mt_chunks[r].tc_bits);
+    }
+    if (w < ix)
+    {
+	mch_memmove(mt->mt_chunks + w, mt->mt_chunks + ix,
+			       (mt->mt_count - ix) * sizeof(trichunk_T));
+	mt->mt_count -= ix - w;
+	if (mt->mt_count == 0)
+	    ml_tri_free(buf);
+    }
 }
 
 /*
- * clear all DB_MARKED flags
+ * Prepare "tq" for finding the lines of "buf" that may have a match for
+ * "prog" with ml_tri_skip().  "ic" is TRUE when ignoring case.
+ * Returns FALSE when the index can't be used: 'trigramindex' is off, the
+ * buffer is small or the pattern has no text that a match must contain.
  */
-    void
-ml_clearmarked()
+    int
+ml_tri_prepare(buf, prog, ic, tq)
+    buf_T	*buf;
+    regprog_T	*prog;
+    int		ic;
+    triquery_T	*tq;
 {
-    bhdr_T	*hp;
-    DATA_BL	*dp;
-    linenr_T	lnum;
-    int		i;
+    char_u	*must;
+    int		len;
+    int		i, j;
+    int		c;
+    int		n;
+    long_u	h;
 
-    if (curbuf->b_ml.ml_mfp == NULL)	    /* nothing to do */
-	return;
+    tq->tq_count = 0;
+    tq->tq_low = 1;
+    tq->tq_high = 0;
+    if (!p_tgi || prog == NULL || buf->b_ml.ml_mfp == NULL
+				 || buf->b_ml.ml_line_count < MLTRI_MINBUF)
+	return FALSE;
+    must = re_musttext(prog, &ic, &len);
+    if (must == NULL)
+	return FALSE;
+#ifdef FEAT_MBYTE
+    /* Ignoring case may also apply to the trail byte of a double-byte
+     * character. */
+    if (ic && enc_dbcs != 0)
+	return FALSE;
+#endif
 
-    /*
-     * The search starts with line lowest_marked.
-     */
-    for (lnum = lowest_marked; lnum <= curbuf->b_ml.ml_line_count; )
+    for (i = 0; i + 2 < len && tq->tq_count < TRIQ_MAX; ++i)
     {
-	/*
-	 * Find the data block containing the line.
-	 * This also fills the stack with the blocks from the root to the data
-	 * block and releases any locked block.
-	 */
-	if ((hp = ml_find_line(curbuf, lnum, ML_FIND)) == NULL)
-	    return;		/* give error message? */
+	h = 0;
+	for (j = i; j < i + 3; ++j)
+	{
+	    c = TOLOWER_ASC(must[j]);
+	    /* When ignoring case a non-ASCII character may match other bytes.
+	     * So may "k" and "s", the Kelvin sign and the long s fold to
+	     * them. */
+	    if (ic && (c >= 0x80
+#ifdef FEAT_MBYTE
+			|| (enc_utf8 && (c == 'k' || c == 's'))
+#endif
+			))
+		break;
+	    h = (h << 8) | c;
+	}
+	if (j < i + 3)
+	    continue;
+	n = ml_tri_hash(h);
+	for (j = 0; j < tq->tq_count; ++j)
+	    if (tq->tq_hash[j] == n)
+		break;
+	if (j == tq->tq_count)
+	    tq->tq_hash[tq->tq_count++] = n;
+    }
+    return tq->tq_count > 0;
+}
 
-	dp = (DATA_BL *)(hp->bh_data);
+/*
+ * Return the first line of "buf" from "lnum" in direction "dir" that is in a
+ * chunk which may contain all the trigrams of "tq", prepared with
+ * ml_tri_prepare().  Returns the line after the last line or zero when there
+ * is none.
+ * The lines that can't match are skipped a chunk at a time; whether the
+ * other lines match must still be checked.
+ */
+    linenr_T
+ml_tri_skip(buf, lnum, dir, tq)
+    buf_T	*buf;
+    linenr_T	lnum;
+    int		dir;
+    triquery_T	*tq;
+{
+    mltri_T	*mt;
+    trichunk_T	*tc;
+    linenr_T	first;
+    int		ix;
 
-	for (i = lnum - curbuf->b_ml.ml_locked_low;
-			    lnum <= curbuf->b_ml.ml_locked_high; ++i, ++lnum)
-	    if ((dp->db_index[i]) & DB_MARKED)
-	    {
-		(dp->db_index[i]) &= DB_INDEX_MASK;
-		curbuf->b_ml.ml_flags |= ML_LOCKED_DIRTY;
-	    }
-    }
+    if (lnum >= tq->tq_low && lnum <= tq->tq_high)
+	return lnum;
+    if (lnum < 1 || lnum > buf->b_ml.ml_line_count)
+	return lnum;
 
-    lowest_marked = 0;
-    return;
+    /* A changed line must be in the index. */
+    ml_flush_line(buf);
+    if ((mt = ml_tri_get(buf)) == NULL)
+	return lnum;
+
+    ix = ml_tri_find(mt, lnum, &first);
+    for (;;)
+    {
+	tc = &mt->mt_chunks[ix];
+	if (ml_tri_maymatch(buf, tc, first, tq))
+	    break;
+	if (dir == FORWARD)
+	{
+	    first += tc->tc_numlines;
+	    if (++ix == mt->mt_count)
+		return buf->b_ml.ml_line_count + 1;
+	    lnum = first;
+	}
+	else
+	{
+	    if (ix-- == 0)
+		return 0;
+	    first -= mt->mt_chunks[ix].tc_numlines;
+	    lnum = first + mt->mt_chunks[ix].tc_numlines - 1;
+	}
+    }
+    mt->mt_lastix = ix;
+    mt->mt_lastline = first;
+    tq->tq_low = first;
+    tq->tq_high = first + tc->tc_numlines - 1;
+    return lnum;
 }
+#endif
 
 /*
  * flush ml_line if necessary
@@ -3580,6 +5815,10 @@ ml_flush_line(buf)
 #ifdef FEAT_BYTEOFF
 		/* The else case is already covered by the insert and delete */
 		ml_updatechunk(buf, lnum, (long)extra, ML_CHNK_UPDLINE);
+#endif
+#ifdef FEAT_TRIGRAM_INDEX
+		if (buf->b_ml.ml_tri != NULL)
+		    ml_tri_change(buf, lnum, new_line);
 #endif
 	    }
 	    else
@@ -3685,8 +5924,19 @@ ml_find_line(buf, lnum, action)
     int		page_count;
     int		idx;
 
+    /* The tree is only complete after a bulk load has finished. */
+    if (ml_bulk.bl_buf == buf)
+	ml_bulk_end(buf);
+
     mfp = buf->b_ml.ml_mfp;
 
+    /*
+     * Inserting or deleting lines changes the line numbers of the parked
+     * blocks, release them.
+     */
+    if (action != ML_FIND || mf_dont_release)
+	ml_unpark(buf);
+
     /*
      * If there is a locked block check if the wanted line is in it.
      * If not, flush and release the locked block.
@@ -3696,9 +5946,12 @@ ml_find_line(buf, lnum, action)
      */
     if (buf->b_ml.ml_locked)
     {
+	/* For ML_INSERT and ML_DELETE the stack must lead to the locked
+	 * block, it doesn't after a parked block was taken back. */
 	if (ML_SIMPLE(action)
 		&& buf->b_ml.ml_locked_low <= lnum
 		&& buf->b_ml.ml_locked_high >= lnum
+		&& (action == ML_FIND || buf->b_ml.ml_stack_top > 0)
 		&& !mf_dont_release)
 	{
 	    /* remember to update pointer blocks and stack later */
@@ -3715,8 +5968,18 @@ ml_find_line(buf, lnum, action)
 	    return (buf->b_ml.ml_locked);
 	}
 
-	mf_put(mfp, buf->b_ml.ml_locked, buf->b_ml.ml_flags & ML_LOCKED_DIRTY,
-					    buf->b_ml.ml_flags & ML_LOCKED_POS);
+	/* An unchanged block is kept locked, it is likely to be used again
+	 * soon.  Not when 'swapfile' is reset, we want to load all the
+	 * blocks. */
+	if (action == ML_FIND
+		&& !(buf->b_ml.ml_flags & (ML_LOCKED_DIRTY | ML_LOCKED_POS))
+		&& buf->b_ml.ml_locked_lineadd == 0
+		&& !mf_dont_release)
+	    ml_park(buf);
+	else
+	    mf_put(mfp, buf->b_ml.ml_locked,
+				    buf->b_ml.ml_flags & ML_LOCKED_DIRTY,
+				    buf->b_ml.ml_flags & ML_LOCKED_POS);
 	buf->b_ml.ml_locked = NULL;
 
 	/*
@@ -3727,6 +5990,10 @@ ml_find_line(buf, lnum, action)
 	    ml_lineadd(buf, buf->b_ml.ml_locked_lineadd);
     }
 
+    /* When finding a line, check if it is in one of the parked blocks. */
+    if (action == ML_FIND && (hp = ml_unpark_line(buf, lnum)) != NULL)
+	return hp;
+
     if (action == ML_FLUSH)	    /* nothing else to do */
 	return NULL;
 
@@ -3866,6 +6133,71 @@ error_noblock:
     return NULL;
 }
 
+/*
+ * Move the locked block "buf->b_ml.ml_locked" to the front of the list of
+ * parked blocks.  It stays locked, thus pointers into it remain valid.  When
+ * the list is full the least recently used block is released.
+ */
+    static void
+ml_park(buf)
+    buf_T	*buf;
+{
+    mlparked_T	*mp = buf->b_ml.ml_parked;
+
+    if (buf->b_ml.ml_parked_count == ML_PARKED_MAX)
+	mf_put(buf->b_ml.ml_mfp, mp[--buf->b_ml.ml_parked_count].mp_hp,
+								 FALSE, FALSE);
+    mch_memmove(mp + 1, mp, buf->b_ml.ml_parked_count * sizeof(mlparked_T));
+    mp->mp_hp = buf->b_ml.ml_locked;
+    mp->mp_low = buf->b_ml.ml_locked_low;
+    mp->mp_high = buf->b_ml.ml_locked_high;
+    ++buf->b_ml.ml_parked_count;
+}
+
+/*
+ * Release all parked blocks of "buf".  Must be done before line numbers
+ * change or blocks are accessed without ml_find_line().
+ */
+    static void
+ml_unpark(buf)
+    buf_T	*buf;
+{
+    while (buf->b_ml.ml_parked_count > 0)
+	mf_put(buf->b_ml.ml_mfp,
+		 buf->b_ml.ml_parked[--buf->b_ml.ml_parked_count].mp_hp,
+								 FALSE, FALSE);
+}
+
+/*
+ * If line "lnum" is in one of the parked blocks make it the locked block
+ * again and return it.  The stack is not valid for it then.
+ * Returns NULL when "lnum" is not in a parked block.
+ */
+    static bhdr_T *
+ml_unpark_line(buf, lnum)
+    buf_T	*buf;
+    linenr_T	lnum;
+{
+    mlparked_T	*mp = buf->b_ml.ml_parked;
+    int		i;
+
+    for (i = 0; i < buf->b_ml.ml_parked_count; ++i)
+	if (mp[i].mp_low <= lnum && mp[i].mp_high >= lnum)
+	{
+	    buf->b_ml.ml_locked = mp[i].mp_hp;
+	    buf->b_ml.ml_locked_low = mp[i].mp_low;
+	    buf->b_ml.ml_locked_high = mp[i].mp_high;
+	    buf->b_ml.ml_locked_lineadd = 0;
+	    buf->b_ml.ml_flags &= ~(ML_LOCKED_DIRTY | ML_LOCKED_POS);
+	    buf->b_ml.ml_stack_top = 0;
+	    --buf->b_ml.ml_parked_count;
+	    mch_memmove(mp + i, mp + i + 1,
+		       (buf->b_ml.ml_parked_count - i) * sizeof(mlparked_T));
+	    return buf->b_ml.ml_locked;
+	}
+    return NULL;
+}
+
 /*
  * add an entry to the info pointer stack
  *
@@ -5021,8 +7353,128 @@ ml_crypt_prepare(mfp, offset, reading)
 
 #if defined(FEAT_BYTEOFF) || defined(PROTO)
 
-#define MLCS_MAXL 800	/* max no of lines in chunk */
-#define MLCS_MINL 400   /* should be half of MLCS_MAXL */
+/*
+ * The chunks are summed up in a Fenwick tree, so that the chunk with a line
+ * or a byte offset is found in O(log n) steps instead of walking over all
+ * chunks before it.  Entry "i" of ml_chunktree holds the sum of chunk
+ * "i - (i & -i)" up to chunk "i - 1".  A line that is added, deleted or
+ * changed updates O(log n) entries.  Splitting, merging and dropping chunks
+ * only clears ml_chunktree_len, the tree is rebuilt in O(n) by the next
+ * search.
+ */
+
+/*
+ * Make sure ml_chunktree matches the chunks of "buf".
+ * Returns FAIL when out of memory.
+ */
+    static int
+ml_chunk_tree(buf)
+    buf_T	*buf;
+{
+    chunksize_T	*tree;
+    int		n = buf->b_ml.ml_usedchunks;
+    int		i, j;
+
+    if (buf->b_ml.ml_chunktree_len == n && n > 0)
+	return OK;
+    buf->b_ml.ml_chunktree_len = 0;
+    if (buf->b_ml.ml_chunktree_max < n + 1)
+    {
+	vim_free(buf->b_ml.ml_chunktree);
+	buf->b_ml.ml_chunktree_max = 0;
+	buf->b_ml.ml_chunktree = (chunksize_T *)alloc((unsigned)
+			      sizeof(chunksize_T) * (buf->b_ml.ml_numchunks + 1));
+	if (buf->b_ml.ml_chunktree == NULL)
+	    return FAIL;
+	buf->b_ml.ml_chunktree_max = buf->b_ml.ml_numchunks + 1;
+    }
+    tree = buf->b_ml.ml_chunktree;
+    mch_memmove(tree + 1, buf->b_ml.ml_chunksize, n * sizeof(chunksize_T));
+    for (i = 1; i <= n; ++i)
+    {
+	j = i + (i & -i);
+	if (j <= n)
+	{
+	    tree[j].mlcs_numlines += tree[i].mlcs_numlines;
+	    tree[j].mlcs_totalsize += tree[i].mlcs_totalsize;
+	}
+    }
+    buf->b_ml.ml_chunktree_len = n;
+    return OK;
+}
+
+/*
+ * Add "lines" and "size" to chunk "ix" in the tree, if it is valid.
+ */
+    static void
+ml_chunk_tree_add(buf, ix, lines, size)
+    buf_T	*buf;
+    int		ix;
+    int		lines;
+    long	size;
+{
+    chunksize_T	*tree = buf->b_ml.ml_chunktree;
+    int		n = buf->b_ml.ml_chunktree_len;
+    int		i;
+
+    if (n != buf->b_ml.ml_usedchunks)
+	return;
+    for (i = ix + 1; i <= n; i += i & -i)
+    {
+	tree[i].mlcs_numlines += lines;
+	tree[i].mlcs_totalsize += size;
+    }
+}
+
+/*
+ * Find the chunk with line "lnum", or the chunk with byte "offset" when
+ * "lnum" is zero.  When "ffdos" is TRUE each line counts one extra byte.
+ * The last chunk is used for anything beyond the end.
+ * Sets "*linep" to the first line of the chunk and "*sizep" (if not NULL) to
+ * the number of bytes before it.
+ * Returns the index of the chunk, -1 when out of memory.
+ */
+    static int
+ml_chunk_find(buf, lnum, offset, ffdos, linep, sizep)
+    buf_T	*buf;
+    linenr_T	lnum;
+    long	offset;
+    int		ffdos;
+    linenr_T	*linep;
+    long	*sizep;
+{
+    chunksize_T	*tp;
+    int		n;
+    int		ix = 0;
+    int		step;
+    linenr_T	curline = 1;
+    long	size = 0;
+
+    if (ml_chunk_tree(buf) == FAIL)
+	return -1;
+    n = buf->b_ml.ml_usedchunks;
+    for (step = 1; step * 2 < n; step *= 2)
+	;
+    for ( ; step > 0; step /= 2)
+    {
+	/* Entry "ix + step" covers the chunks from "ix" to "ix + step - 1". */
+	if (ix + step >= n)
+	    continue;
+	tp = buf->b_ml.ml_chunktree + ix + step;
+	if (lnum != 0 ? lnum >= curline + tp->mlcs_numlines
+		      : offset > size + tp->mlcs_totalsize
+					       + ffdos * tp->mlcs_numlines)
+	{
+	    ix += step;
+	    curline += tp->mlcs_numlines;
+	    size += tp->mlcs_totalsize + ffdos * tp->mlcs_numlines;
+	}
+    }
+    *linep = curline;
+    if (sizep != NULL)
+	*sizep = size;
+    return ix;
+}
 
 /*
  * Keep information for finding byte offset of a line, updtype may be one of:
@@ -5038,7 +7490,6 @@ ml_updatechunk(buf, line, len, updtype)
     long	len;
     int		updtype;
 {
-    static buf_T	*ml_upd_lastbuf = NULL;
     static linenr_T	ml_upd_lastline;
     static linenr_T	ml_upd_lastcurline;
     static int		ml_upd_lastcurix;
@@ -5066,6 +7517,7 @@ ml_updatechunk(buf, line, len, updtype)
 	buf->b_ml.ml_usedchunks = 1;
 	buf->b_ml.ml_chunksize[0].mlcs_numlines = 1;
 	buf->b_ml.ml_chunksize[0].mlcs_totalsize = 1;
+	buf->b_ml.ml_chunktree_len = 0;
     }
 
     if (updtype == ML_CHNK_UPDLINE && buf->b_ml.ml_line_count == 1)
@@ -5077,6 +7529,7 @@ ml_updatechunk(buf, line, len, updtype)
 	buf->b_ml.ml_chunksize[0].mlcs_numlines = 1;
 	buf->b_ml.ml_chunksize[0].mlcs_totalsize =
 				  (long)STRLEN(buf->b_ml.ml_line_ptr) + 1;
+	buf->b_ml.ml_chunktree_len = 0;
 	return;
     }
 
@@ -5087,12 +7540,11 @@ ml_updatechunk(buf, line, len, updtype)
     if (buf != ml_upd_lastbuf || line != ml_upd_lastline + 1
 	    || updtype != ML_CHNK_ADDLINE)
     {
-	for (curline = 1, curix = 0;
-	     curix < buf->b_ml.ml_usedchunks - 1
-	     && line >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	     curix++)
+	curix = ml_chunk_find(buf, line, 0L, FALSE, &curline, NULL);
+	if (curix < 0)
 	{
-	    curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
+	    buf->b_ml.ml_usedchunks = -1;
+	    return;
 	}
     }
     else if (line >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines
@@ -5107,6 +7559,8 @@ ml_updatechunk(buf, line, len, updtype)
     if (updtype == ML_CHNK_DELLINE)
 	len = -len;
     curchnk->mlcs_totalsize += len;
+    ml_chunk_tree_add(buf, curix, updtype == ML_CHNK_ADDLINE ? 1
+				  : updtype == ML_CHNK_DELLINE ? -1 : 0, len);
     if (updtype == ML_CHNK_ADDLINE)
     {
 	curchnk->mlcs_numlines++;
@@ -5176,6 +7630,7 @@ ml_updatechunk(buf, line, len, updtype)
 	    buf->b_ml.ml_chunksize[curix].mlcs_totalsize = size;
 	    buf->b_ml.ml_chunksize[curix + 1].mlcs_totalsize -= size;
 	    buf->b_ml.ml_usedchunks++;
+	    buf->b_ml.ml_chunktree_len = 0;
 	    ml_upd_lastbuf = NULL;   /* Force recalc of curix & curline */
 	    return;
 	}
@@ -5189,6 +7644,7 @@ ml_updatechunk(buf, line, len, updtype)
 	     */
 	    curchnk = buf->b_ml.ml_chunksize + curix + 1;
 	    buf->b_ml.ml_usedchunks++;
+	    buf->b_ml.ml_chunktree_len = 0;
 	    if (line == buf->b_ml.ml_line_count)
 	    {
 		curchnk->mlcs_numlines = 0;
@@ -5234,6 +7690,7 @@ ml_updatechunk(buf, line, len, updtype)
 	else if (curix == 0 && curchnk->mlcs_numlines <= 0)
 	{
 	    buf->b_ml.ml_usedchunks--;
+	    buf->b_ml.ml_chunktree_len = 0;
 	    mch_memmove(buf->b_ml.ml_chunksize, buf->b_ml.ml_chunksize + 1,
 			buf->b_ml.ml_usedchunks * sizeof(chunksize_T));
 	    return;
@@ -5249,6 +7706,7 @@ ml_updatechunk(buf, line, len, updtype)
 	curchnk[-1].mlcs_numlines += curchnk->mlcs_numlines;
 	curchnk[-1].mlcs_totalsize += curchnk->mlcs_totalsize;
 	buf->b_ml.ml_usedchunks--;
+	buf->b_ml.ml_chunktree_len = 0;
 	if (curix < buf->b_ml.ml_usedchunks)
 	{
 	    mch_memmove(buf->b_ml.ml_chunksize + curix,
@@ -5277,7 +7735,6 @@ ml_find_line_or_offset(buf, lnum, offp)
     long	*offp;
 {
     linenr_T	curline;
-    int		curix;
     long	size;
     bhdr_T	*hp;
     DATA_BL	*dp;
@@ -5292,6 +7749,13 @@ ml_find_line_or_offset(buf, lnum, offp)
 
     /* take care of cached line first */
     ml_flush_line(curbuf);
+    if (ml_bulk.bl_buf == buf)
+	ml_bulk_end(buf);
+
+#ifdef FEAT_MMAP_VIEW
+    if (buf->b_ml.ml_mmap != NULL)
+	return ml_mmap_offset(buf, lnum, offp);
+#endif
 
     if (buf->b_ml.ml_usedchunks == -1
 	    || buf->b_ml.ml_chunksize == NULL
@@ -5305,24 +7769,12 @@ ml_find_line_or_offset(buf, lnum, offp)
     if (lnum == 0 && offset <= 0)
 	return 1;   /* Not a "find offset" and offset 0 _must_ be in line 1 */
     /*
-     * Find the last chunk before the one containing our line. Last chunk is
-     * special because it will never qualify
+     * Find the chunk containing our line or offset.  Extra CR characters are
+     * only included in "size" when searching for an offset.
      */
-    curline = 1;
-    curix = size = 0;
-    while (curix < buf->b_ml.ml_usedchunks - 1
-	    && ((lnum != 0
-	     && lnum >= curline + buf->b_ml.ml_chunksize[curix].mlcs_numlines)
-		|| (offset != 0
-	       && offset > size + buf->b_ml.ml_chunksize[curix].mlcs_totalsize
-		      + ffdos * buf->b_ml.ml_chunksize[curix].mlcs_numlines)))
-    {
-	curline += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	size += buf->b_ml.ml_chunksize[curix].mlcs_totalsize;
-	if (offset && ffdos)
-	    size += buf->b_ml.ml_chunksize[curix].mlcs_numlines;
-	curix++;
-    }
+    if (ml_chunk_find(buf, lnum, offset, lnum == 0 && ffdos,
+							&curline, &size) < 0)
+	return -1;
 
     while ((lnum != 0 && curline < lnum) || (offset != 0 && size < offset))
     {
@@ -442,7 +442,7 @@ get_number_indent(lnum)
 	    pos.coladd = 0;
 #endif
 	}
-	vim_free(regmatch.regprog);
+	vim_regfree(regmatch.regprog);
     }
 
     if (pos.lnum == 0 || *ml_get_pos(&pos) == NUL)
@@ -2378,17 +2378,14 @@ del_lines(nlines, undo)
     if (undo && u_savedel(first, nlines) == FAIL)
 	return;
 
-    for (n = 0; n < nlines; )
+    n = 0;
+    if (!(curbuf->b_ml.ml_flags & ML_EMPTY))	    /* nothing to delete */
     {
-	if (curbuf->b_ml.ml_flags & ML_EMPTY)	    /* nothing to delete */
-	    break;
-
-	ml_delete(first, TRUE);
-	++n;
-
 	/* If we delete the last line in the file, stop */
-	if (first > curbuf->b_ml.ml_line_count)
-	    break;
+	n = curbuf->b_ml.ml_line_count - first + 1;
+	if (n > nlines)
+	    n = nlines;
+	ml_delete_range(first, n, TRUE);
     }
 
     /* Correct the cursor position before calling deleted_lines_mark(), it may
@@ -2426,6 +2423,7 @@ gchar_cursor()
 static void changedOneline __ARGS((buf_T *buf, linenr_T lnum));
 static void changed_lines_buf __ARGS((buf_T *buf, linenr_T lnum, linenr_T lnume, long xtra));
 static void changed_common __ARGS((linenr_T lnum, colnr_T col, linenr_T lnume, long xtra));
+static void changed_last_change __ARGS((linenr_T lnum, colnr_T col));
 
 /*
  * Put character 'c' at position 'lp' in the current buffer.
@@ -2689,6 +2687,11 @@ changed_lines(lnum, col, lnume, xtra)
     linenr_T	lnume;	    /* line below last changed line */
     long	xtra;	    /* number of extra lines (negative when deleting) */
 {
+    /* While applying remote edits the change is only remembered, the batch
+     * is passed to changed_lines_batch() when done. */
+    if (collab_batch_changed(lnum, col, lnume, xtra))
+	return;
+
     changed_lines_buf(curbuf, lnum, lnume, xtra);
 
 #ifdef FEAT_DIFF
@@ -2715,6 +2718,50 @@ changed_lines(lnum, col, lnume, xtra)
     changed_common(lnum, col, lnume, xtra);
 }
 
+/*
+ * Like changed_lines(), for a range that covers a whole batch of changes, as
+ * collected while applying edits from remote collaborators.
+ * When the changed lines are all below what the windows on the current buffer
+ * show, no window has its cursor at or below them and none uses folding, only
+ * the buffer is updated: the windows redraw those lines when scrolling there.
+ */
+    void
+changed_lines_batch(lnum, col, lnume, xtra)
+    linenr_T	lnum;	    /* first line with change */
+    colnr_T	col;	    /* column in first line with change */
+    linenr_T	lnume;	    /* line below last changed line */
+    long	xtra;	    /* number of extra lines (negative when deleting) */
+{
+    win_T	*wp;
+#ifdef FEAT_WINDOWS
+    tabpage_T	*tp;
+#endif
+
+    FOR_ALL_TAB_WINDOWS(tp, wp)
+	if (wp->w_buffer == curbuf
+		&& (!(wp->w_valid & VALID_BOTLINE)
+		    || lnum <= wp->w_botline
+		    || wp->w_cursor.lnum >= lnum
+#ifdef FEAT_FOLDING
+		    || hasAnyFolding(wp)
+#endif
+#ifdef FEAT_DIFF
+		    || wp->w_p_diff
+#endif
+		    ))
+	{
+	    changed_lines(lnum, col, lnume, xtra);
+	    return;
+	}
+
+    /* Off-screen in every window: skip the w_lines[] and fold updates. */
+    changed_lines_buf(curbuf, lnum, lnume, xtra);
+    changed_last_change(lnum, col);
+#ifdef FEAT_SEARCH_EXTRA
+    hl_cache_changed(curbuf, lnum, lnume, xtra);
+#endif
+}
+
     static void
 changed_lines_buf(buf, lnum, lnume, xtra)
     buf_T	*buf;
@@ -2765,83 +2812,12 @@ changed_common(lnum, col, lnume, xtra)
     tabpage_T	*tp;
 #endif
     int		i;
-#ifdef FEAT_JUMPLIST
-    int		cols;
-    pos_T	*p;
-    int		add;
-#endif
-
-    /* mark the buffer as modified */
-    changed();
-
-    /* set the '. mark */
-    if (!cmdmod.keepjumps)
-    {
-	curbuf->b_last_change.lnum = lnum;
-	curbuf->b_last_change.col = col;
-
-#ifdef FEAT_JUMPLIST
-	/* Create a new entry if a new undo-able change was started or we
-	 * don't have an entry yet. */
-	if (curbuf->b_new_change || curbuf->b_changelistlen == 0)
-	{
-	    if (curbuf->b_changelistlen == 0)
-		add = TRUE;
-	    else
-	    {
-		/* Don't create a new entry when the line number is the same
-		 * as the last one and the column is not too far away.  Avoids
-		 * creating many entries for typing "xxxxx". */
-		p = &curbuf->b_changelist[curbuf->b_changelistlen - 1];
-		if (p->lnum != lnum)
-		    add = TRUE;
-		else
-		{
-		    cols = comp_textwidth(FALSE);
-		    if (cols == 0)
-			cols = 79;
-		    add = (p->col + cols < col || col + cols < p->col);
-		}
-	    }
-	    if (add)
-	    {
-		/* This is the first of a new sequence of undo-able changes
-		 * and it's at some distance of the last change.  Use a new
-		 * position in the changelist. */
-		curbuf->b_new_change = FALSE;
 
-		if (curbuf->b_changelistlen == JUMPLISTSIZE)
-		{
-		    /* changelist is full: remove oldest entry */
-		    curbuf->b_changelistlen = JUMPLISTSIZE - 1;
-		    mch_memmove(curbuf->b_changelist, curbuf->b_changelist + 1,
-					  sizeof(pos_T) * (JUMPLISTSIZE - 1));
-		    FOR_ALL_TAB_WINDOWS(tp, wp)
-		    {
-			/* Correct position in changelist for other windows on
-			 * this buffer. */
-			if (wp->w_buffer == curbuf && wp->w_changelistidx > 0)
-			    --wp->w_changelistidx;
-		    }
-		}
-		FOR_ALL_TAB_WINDOWS(tp, wp)
-		{
-		    /* For other windows, if the position in the changelist is
-		     * at the end it stays at the end. */
-		    if (wp->w_buffer == curbuf
-			    && wp->w_changelistidx == curbuf->b_changelistlen)
-			++wp->w_changelistidx;
-		}
-		++curbuf->b_changelistlen;
-	    }
-	}
-	curbuf->b_changelist[curbuf->b_changelistlen - 1] =
-							curbuf->b_last_change;
-	/* The current window is always after the last change, so that "g,"
-	 * takes you back to it. */
-	curwin->w_changelistidx = curbuf->b_changelistlen;
+    changed_last_change(lnum, col);
+#ifdef FEAT_SEARCH_EXTRA
+    /* Matches found for highlighting other lines remain valid. */
+    hl_cache_changed(curbuf, lnum, lnume, xtra);
 #endif
-    }
 
     FOR_ALL_TAB_WINDOWS(tp, wp)
     {
@@ -2948,6 +2924,98 @@ changed_common(lnum, col, lnume, xtra)
 #endif
 }
 
+/*
+ * Mark the current buffer as modified and set the '. mark and the changelist
+ * for a change at "lnum", "col".
+ */
+    static void
+changed_last_change(lnum, col)
+    linenr_T	lnum;
+    colnr_T	col;
+{
+#if defined(FEAT_JUMPLIST) && defined(FEAT_WINDOWS)
+    tabpage_T	*tp;
+#endif
+#ifdef FEAT_JUMPLIST
+    win_T	*wp;
+    int		cols;
+    pos_T	*p;
+    int		add;
+#endif
+
+    /* mark the buffer as modified */
+    changed();
+
+    /* set the '. mark */
+    if (!cmdmod.keepjumps)
+    {
+	curbuf->b_last_change.lnum = lnum;
+	curbuf->b_last_change.col = col;
+
+#ifdef FEAT_JUMPLIST
+	/* Create a new entry if a new undo-able change was started or we
+	 * don't have an entry yet. */
+	if (curbuf->b_new_change || curbuf->b_changelistlen == 0)
+	{
+	    if (curbuf->b_changelistlen == 0)
+		add = TRUE;
+	    else
+	    {
+		/* Don't create a new entry when the line number is the same
+		 * as the last one and the column is not too far away.  Avoids
+		 * creating many entries for typing "xxxxx". */
+		p = &curbuf->b_changelist[curbuf->b_changelistlen - 1];
+		if (p->lnum != lnum)
+		    add = TRUE;
+		else
+		{
+		    cols = comp_textwidth(FALSE);
+		    if (cols == 0)
+			cols = 79;
+		    add = (p->col + cols < col || col + cols < p->col);
+		}
+	    }
+	    if (add)
+	    {
+		/* This is the first of a new sequence of undo-able changes
+		 * and it's at some distance of the last change.  Use a new
+		 * position in the changelist. */
+		curbuf->b_new_change = FALSE;
+
+		if (curbuf->b_changelistlen == JUMPLISTSIZE)
+		{
+		    /* changelist is full: remove oldest entry */
+		    curbuf->b_changelistlen = JUMPLISTSIZE - 1;
+		    mch_memmove(curbuf->b_changelist, curbuf->b_changelist + 1,
+					  sizeof(pos_T) * (JUMPLISTSIZE - 1));
+		    FOR_ALL_TAB_WINDOWS(tp, wp)
+		    {
+			/* Correct position in changelist for other windows on
+			 * this buffer. */
+			if (wp->w_buffer == curbuf && wp->w_changelistidx > 0)
+			    --wp->w_changelistidx;
+		    }
+		}
+		FOR_ALL_TAB_WINDOWS(tp, wp)
+		{
+		    /* For other windows, if the position in the changelist is
+		     * at the end it stays at the end. */
+		    if (wp->w_buffer == curbuf
+			    && wp->w_changelistidx == curbuf->b_changelistlen)
+			++wp->w_changelistidx;
+		}
+		++curbuf->b_changelistlen;
+	    }
+	}
+	curbuf->b_changelist[curbuf->b_changelistlen - 1] =
+							curbuf->b_last_change;
+	/* The current window is always after the last change, so that "g,"
+	 * takes you back to it. */
+	curwin->w_changelistidx = curbuf->b_changelistlen;
+#endif
+    }
+}
+
 /*
  * unchanged() is called when the changed flag must be reset for buffer 'buf'
  */
@@ -9052,7 +9120,7 @@ dos_expandpath(
 # endif
 #endif
     vim_free(buf);
-    vim_free(regmatch.regprog);
+    vim_regfree(regmatch.regprog);
     vim_free(matchname);
 
     matches = gap->ga_len - start_len;
@@ -9285,7 +9353,7 @@ unix_expandpath(gap, path, wildoff, flags, didstar)
     }
 
     vim_free(buf);
-    vim_free(regmatch.regprog);
+    vim_regfree(regmatch.regprog);
 
     matches = gap->ga_len - start_len;
     if (matches > 0)
@@ -9640,7 +9708,7 @@ theend:
 	vim_free(in_curdir);
     }
     ga_clear_strings(&path_ga);
-    vim_free(regmatch.regprog);
+    vim_regfree(regmatch.regprog);
 
     if (sort_again)
 	remove_duplicates(gap);
@@ -12,6 +12,23 @@
  */
 #include "vim.h"
 
+/* On x86 SSE2 is used to look for a byte 16 bytes at a time.  Other systems,
+ * including Native Client, use the plain loop.  So does a build with
+ * AddressSanitizer, it reports the loads that go past the NUL. */
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(PROTO)
+# if defined(__SANITIZE_ADDRESS__)
+#  define NO_SSE2_STRBYTE
+# elif defined(__has_feature)
+#  if __has_feature(address_sanitizer)
+#   define NO_SSE2_STRBYTE
+#  endif
+# endif
+# ifndef NO_SSE2_STRBYTE
+#  include <emmintrin.h>	/* for _mm_cmpeq_epi8() */
+#  define USE_SSE2_STRBYTE
+# endif
+#endif
+
 static char_u	*username = NULL; /* cached result of mch_get_user_name() */
 
 static char_u	*ff_expand_buffer = NULL; /* used for expanding filenames */
@@ -1117,7 +1134,7 @@ free_all_mem()
     /* Free some global vars. */
     vim_free(username);
 # ifdef FEAT_CLIPBOARD
-    vim_free(clip_exclude_prog);
+    vim_regfree(clip_exclude_prog);
 # endif
     vim_free(last_cmdline);
 # ifdef FEAT_CMDHIST
@@ -1892,15 +1909,59 @@ vim_strbyte(string, c)
     char_u	*string;
     int		c;
 {
-    char_u	*p = string;
+    return vim_strbyte2(string, c, c);
+}
 
+/*
+ * Like vim_strbyte(), but find the first of two bytes "c1" and "c2".  Used to
+ * find a character ignoring case.
+ * This is used a lot by searching, with SSE2 16 bytes are checked at once.
+ * The loads are aligned, thus they don't cross a page boundary even though
+ * they may read past the NUL.
+ */
+    char_u  *
+vim_strbyte2(string, c1, c2)
+    char_u	*string;
+    int		c1;
+    int		c2;
+{
+    char_u	*p = string;
+#ifdef USE_SSE2_STRBYTE
+    __m128i	v1 = _mm_set1_epi8((char)c1);
+    __m128i	v2 = _mm_set1_epi8((char)c2);
+    __m128i	zero = _mm_setzero_si128();
+    __m128i	x;
+    int		off = (int)((long_u)p & 15);
+    unsigned	mask;
+
+    p -= off;
+    for (;;)
+    {
+	/* This reads the whole aligned block with the NUL, up to 15 bytes
+	 * past the end of the allocated memory.  That is only safe because an
+	 * aligned 16 byte load never crosses a page boundary, thus it can't
+	 * touch a page that isn't mapped. */
+	x = _mm_load_si128((__m128i *)p);
+	mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, zero),
+		     _mm_or_si128(_mm_cmpeq_epi8(x, v1), _mm_cmpeq_epi8(x, v2))));
+	/* Ignore the bytes before the start of the string. */
+	mask &= 0xffffU << off;
+	if (mask != 0)
+	    break;
+	p += 16;
+	off = 0;
+    }
+    p += __builtin_ctz(mask);
+    return *p == NUL ? NULL : p;
+#else
     while (*p != NUL)
     {
-	if (*p == c)
+	if (*p == c1 || *p == c2)
 	    return p;
 	++p;
     }
     return NULL;
+#endif
 }
 
 /*
@@ -774,6 +774,13 @@ static struct vimoption
 			    (char_u *)NULL, PV_NONE,
 #endif
 			    {(char_u *)7L, (char_u *)0L} SCRIPTID_INIT},
+    {"collabtime",  "clt",  P_NUM|P_VI_DEF,
+#ifdef FEAT_RELTIME
+			    (char_u *)&p_clt, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)20L, (char_u *)0L} SCRIPTID_INIT},
     {"colorcolumn", "cc",   P_STRING|P_VI_DEF|P_COMMA|P_NODUP|P_RWIN,
 #ifdef FEAT_SYN_HL
 			    (char_u *)VAR_WIN, PV_CC,
@@ -2071,6 +2078,9 @@ static struct vimoption
 			    (char_u *)NULL, PV_NONE,
 #endif
 			    {(char_u *)2000L, (char_u *)0L} SCRIPTID_INIT},
+    {"regexpengine", "re",  P_NUM|P_VI_DEF,
+			    (char_u *)&p_re, PV_NONE,
+			    {(char_u *)0L, (char_u *)0L} SCRIPTID_INIT},
     {"relativenumber", "rnu", P_BOOL|P_VI_DEF|P_RWIN,
 			    (char_u *)VAR_WIN, PV_RNU,
 			    {(char_u *)FALSE, (char_u *)0L} SCRIPTID_INIT},
@@ -2426,6 +2436,13 @@ static struct vimoption
 			    (char_u *)NULL, PV_NONE,
 #endif
 			    {(char_u *)"", (char_u *)0L} SCRIPTID_INIT},
+    {"substitutethreads", "stt", P_NUM|P_VI_DEF,
+#ifdef FEAT_SUBST_THREADS
+			    (char_u *)&p_stt, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)4L, (char_u *)0L} SCRIPTID_INIT},
     {"suffixes",    "su",   P_STRING|P_VI_DEF|P_COMMA|P_NODUP,
 			    (char_u *)&p_su, PV_NONE,
 			    {(char_u *)".bak,~,.o,.h,.info,.swp,.obj",
@@ -2439,6 +2456,13 @@ static struct vimoption
 			    {(char_u *)0L, (char_u *)0L}
 #endif
 			    SCRIPTID_INIT},
+    {"swapasync",   "swa",  P_BOOL|P_VI_DEF,
+#ifdef FEAT_SWAP_ASYNC
+			    (char_u *)&p_swa, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)FALSE, (char_u *)0L} SCRIPTID_INIT},
     {"swapfile",    "swf",  P_BOOL|P_VI_DEF|P_RSTAT,
 			    (char_u *)&p_swf, PV_SWF,
 			    {(char_u *)TRUE, (char_u *)0L} SCRIPTID_INIT},
@@ -2605,6 +2629,13 @@ static struct vimoption
 			    (char_u *)&p_tbis, PV_NONE,
 			    {(char_u *)"small", (char_u *)0L} SCRIPTID_INIT},
 #endif
+    {"trigramindex", "tgi", P_BOOL|P_VI_DEF,
+#ifdef FEAT_TRIGRAM_INDEX
+			    (char_u *)&p_tgi, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)FALSE, (char_u *)0L} SCRIPTID_INIT},
     {"ttimeout",    NULL,   P_BOOL|P_VI_DEF|P_VIM,
 			    (char_u *)&p_ttimeout, PV_NONE,
 			    {(char_u *)FALSE, (char_u *)0L} SCRIPTID_INIT},
@@ -2688,6 +2719,13 @@ static struct vimoption
 			    {(char_u *)0L, (char_u *)0L}
 #endif
 			    SCRIPTID_INIT},
+    {"vimgrepthreads", "vgt", P_NUM|P_VI_DEF,
+#ifdef FEAT_VIMGREP_THREADS
+			    (char_u *)&p_vgt, PV_NONE,
+#else
+			    (char_u *)NULL, PV_NONE,
+#endif
+			    {(char_u *)4L, (char_u *)0L} SCRIPTID_INIT},
     {"viminfo",	    "vi",   P_STRING|P_COMMA|P_NODUP|P_SECURE,
 #ifdef FEAT_VIMINFO
 			    (char_u *)&p_viminfo, PV_NONE,
@@ -7358,7 +7396,7 @@ check_clipboard_option()
 	clip_autoselect = new_autoselect;
 	clip_autoselectml = new_autoselectml;
 	clip_html = new_html;
-	vim_free(clip_exclude_prog);
+	vim_regfree(clip_exclude_prog);
 	clip_exclude_prog = new_exclude_prog;
 #ifdef FEAT_GUI_GTK
 	if (gui.in_use)
@@ -7369,7 +7407,7 @@ check_clipboard_option()
 #endif
     }
     else
-	vim_free(new_exclude_prog);
+	vim_regfree(new_exclude_prog);
 
     return errmsg;
 }
@@ -7405,7 +7443,7 @@ compile_cap_prog(synblock)
 	}
     }
 
-    vim_free(rp);
+    vim_regfree(rp);
     return NULL;
 }
 #endif
@@ -7571,6 +7609,15 @@ set_bool_option(opt_idx, varp, value, opt_flags)
 	    mf_close_file(curbuf, TRUE);	/* remove the swap file */
     }
 
+#ifdef FEAT_TRIGRAM_INDEX
+    /* when 'trigramindex' is reset free the index of every buffer */
+    else if ((int *)varp == &p_tgi)
+    {
+	if (!p_tgi)
+	    ml_tri_free_all();
+    }
+#endif
+
     /* when 'terse' is set change 'shortmess' */
     else if ((int *)varp == &p_terse)
     {
@@ -8304,6 +8351,34 @@ set_num_option(opt_idx, varp, value, errbuf, errbuflen, opt_flags)
 	}
     }
 #endif
+#ifdef FEAT_VIMGREP_THREADS
+    else if (pp == &p_vgt)
+    {
+	if (p_vgt < 0)
+	{
+	    errmsg = e_positive;
+	    p_vgt = 0;
+	}
+    }
+#endif
+#ifdef FEAT_SUBST_THREADS
+    else if (pp == &p_stt)
+    {
+	if (p_stt < 0)
+	{
+	    errmsg = e_positive;
+	    p_stt = 0;
+	}
+    }
+#endif
+    else if (pp == &p_re)
+    {
+	if (p_re < 0 || p_re > 2)
+	{
+	    errmsg = e_invarg;
+	    p_re = 0;
+	}
+    }
 #ifdef MZSCHEME_GUI_THREADS
     else if (pp == &p_mzq)
 	mzvim_reset_timer();
@@ -8495,6 +8570,13 @@ set_num_option(opt_idx, varp, value, errbuf, errbuflen, opt_flags)
 	errmsg = e_positive;
 	p_ut = 2000;
     }
+#ifdef FEAT_RELTIME
+    if (p_clt < 0)
+    {
+	errmsg = e_positive;
+	p_clt = 20;
+    }
+#endif
     if (p_ss < 0)
     {
 	errmsg = e_positive;
@@ -10109,6 +10191,53 @@ buf_copy_options(buf, flags)
 	(void)buf_init_chartab(buf, FALSE);
 }
 
+#if defined(FEAT_VIMGREP_THREADS) || defined(PROTO)
+/*
+ * Return TRUE when reading a file into a new buffer, which gets the global
+ * values of the buffer options, keeps its text as it is if the file has no
+ * CR, NUL or BOM and is valid UTF-8 when 'encoding' is "utf-8".  Used by
+ * ":vimgrep" to search files without loading them.
+ * "*same_isk" is set when the new buffer gets the 'iskeyword' of curbuf.
+ */
+    int
+plain_read_options(same_isk)
+    int		*same_isk;
+{
+# ifdef FEAT_MBYTE
+    char_u	*p;
+    char_u	*fenc;
+    int		same;
+# endif
+
+    *same_isk = STRCMP(curbuf->b_p_isk, p_isk) == 0;
+    if (p_bin || (*p_ffs == NUL ? *p_ff == 'm'
+				 : strstr((char *)p_ffs, "mac") != NULL))
+	return FALSE;
+# ifdef FEAT_MBYTE
+    /* The first of 'fileencodings' other than "ucs-bom" is tried first, it
+     * must be 'encoding'.  When there is none 'fileencoding' is used. */
+    fenc = p_fenc;
+    for (p = p_fencs; *p != NUL; )
+    {
+	copy_option_part(&p, NameBuff, MAXPATHL, ",");
+	if (STRCMP(NameBuff, "ucs-bom") != 0)
+	{
+	    fenc = NameBuff;
+	    break;
+	}
+    }
+    if (*fenc == NUL)
+	return TRUE;
+    fenc = enc_canonize(fenc);
+    same = fenc != NULL && STRCMP(fenc, p_enc) == 0;
+    vim_free(fenc);
+    return same;
+# else
+    return TRUE;
+# endif
+}
+#endif
+
 /*
  * Reset the 'modifiable' option and its default value.
  */
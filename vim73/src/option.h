@@ -380,6 +380,9 @@ EXTERN long	p_cwh;		/* 'cmdwinheight' */
 EXTERN char_u	*p_cb;		/* 'clipboard' */
 #endif
 EXTERN long	p_ch;		/* 'cmdheight' */
+#ifdef FEAT_RELTIME
+EXTERN long	p_clt;		/* 'collabtime' */
+#endif
 #if defined(FEAT_GUI_DIALOG) || defined(FEAT_CON_DIALOG)
 EXTERN int	p_confirm;	/* 'confirm' */
 #endif
@@ -646,6 +649,7 @@ EXTERN char_u	*p_cdpath;	/* 'cdpath' */
 #ifdef FEAT_RELTIME
 EXTERN long	p_rdt;		/* 'redrawtime' */
 #endif
+EXTERN long	p_re;		/* 'regexpengine' */
 EXTERN int	p_remap;	/* 'remap' */
 EXTERN long	p_report;	/* 'report' */
 #if defined(FEAT_WINDOWS) && defined(FEAT_QUICKFIX)
@@ -749,7 +753,13 @@ EXTERN char_u	*p_sps;		/* 'spellsuggest' */
 EXTERN int	p_spr;		/* 'splitright' */
 #endif
 EXTERN int	p_sol;		/* 'startofline' */
+#ifdef FEAT_SUBST_THREADS
+EXTERN long	p_stt;		/* 'substitutethreads' */
+#endif
 EXTERN char_u	*p_su;		/* 'suffixes' */
+#ifdef FEAT_SWAP_ASYNC
+EXTERN int	p_swa;		/* 'swapasync' */
+#endif
 EXTERN char_u	*p_sws;		/* 'swapsync' */
 EXTERN char_u	*p_swb;		/* 'switchbuf' */
 EXTERN unsigned	swb_flags;
@@ -785,6 +795,9 @@ EXTERN char_u	*p_titlestring;	/* 'titlestring' */
 #ifdef FEAT_INS_EXPAND
 EXTERN char_u	*p_tsr;		/* 'thesaurus' */
 #endif
+#ifdef FEAT_TRIGRAM_INDEX
+EXTERN int	p_tgi;		/* 'trigramindex' */
+#endif
 EXTERN int	p_ttimeout;	/* 'ttimeout' */
 EXTERN long	p_ttm;		/* 'ttimeoutlen' */
 EXTERN int	p_tbi;		/* 'ttybuiltin' */
@@ -833,6 +846,9 @@ EXTERN long	p_ut;		/* 'updatetime' */
 #if defined(FEAT_WINDOWS) || defined(FEAT_FOLDING)
 EXTERN char_u	*p_fcs;		/* 'fillchar' */
 #endif
+#ifdef FEAT_VIMGREP_THREADS
+EXTERN long	p_vgt;		/* 'vimgrepthreads' */
+#endif
 #ifdef FEAT_VIMINFO
 EXTERN char_u	*p_viminfo;	/* 'viminfo' */
 #endif
@@ -477,6 +477,32 @@ mch_char_avail()
     return WaitForChar(0L);
 }
 
+/*
+ * Return TRUE if typed characters are waiting to be read.  Unlike
+ * mch_char_avail() this does not look at the collaborative event pipe, so
+ * that pending remote edits can't be mistaken for typeahead.
+ */
+    int
+mch_input_avail()
+{
+#ifndef HAVE_SELECT
+    struct pollfd   fds;
+
+    fds.fd = read_cmd_fd;
+    fds.events = POLLIN;
+    return poll(&fds, 1, 0) > 0;
+#else
+    struct timeval  tv;
+    fd_set	    rfds;
+
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    FD_ZERO(&rfds);
+    FD_SET(read_cmd_fd, &rfds);
+    return select(read_cmd_fd + 1, &rfds, NULL, NULL, &tv) > 0;
+#endif
+}
+
 #if defined(HAVE_TOTAL_MEM) || defined(PROTO)
 # ifdef HAVE_SYS_RESOURCE_H
 #  include <sys/resource.h>
@@ -894,7 +920,7 @@ sig_alarm SIGDEFARG(sigarg)
 
 #if (defined(HAVE_SETJMP_H) \
 	&& ((defined(FEAT_X11) && defined(FEAT_XCLIPBOARD)) \
-	    || defined(FEAT_LIBCALL))) \
+	    || defined(FEAT_LIBCALL) || defined(FEAT_MMAP_VIEW))) \
     || defined(PROTO)
 /*
  * A simplistic version of setjmp() that only allows one level of using.
@@ -939,6 +965,18 @@ mch_didjmp()
      * otherwise catching the signal only works once. */
     init_signal_stack();
 # endif
+# if !defined(HAVE_SIGSETJMP) && defined(HAVE_SIGACTION) && defined(SIGHASARG)
+    /* longjmp() doesn't restore the signal mask, the signal that was caught
+     * is still blocked then.  The next one would kill Vim. */
+    if (lc_signal != 0)
+    {
+	sigset_t    set;
+
+	sigemptyset(&set);
+	sigaddset(&set, lc_signal);
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
+    }
+# endif
 }
 #endif
 
@@ -1,14 +1,25 @@
 /* collaborate.c */
 struct collabedit_S;
 struct editqueue_S;
+struct editring_S;
 
+void collab_freestrings __ARGS((struct collabedit_S *cedit));
+void collab_ring_init __ARGS((struct editring_S *ring));
+void collab_ring_push __ARGS((struct editring_S *ring, const struct collabedit_S *cedit));
+void collab_ring_pop __ARGS((struct editring_S *ring, struct collabedit_S *cedit));
+void collab_ring_done __ARGS((struct editring_S *ring, struct collabedit_S *cedit));
 void collab_init __ARGS((void));
 void collab_newbuf __ARGS((int buffer_id, char_u *fname));
 int collab_setbuf __ARGS((int buffer_id));
 int collab_get_id __ARGS((buf_T *buf));
+void collab_buffer_free __ARGS((buf_T *buf));
+void collab_set_snapshot_dir __ARGS((const char *dir));
 void collab_enqueue __ARGS((struct editqueue_S *queue, struct collabedit_S *ev));
 void collab_applyedits __ARGS((struct editqueue_S *queue));
+int collab_takeyield __ARGS((void));
+int collab_batch_changed __ARGS((linenr_T lnum, colnr_T col, linenr_T lnume, long xtra));
 int collab_inchar __ARGS((char_u *buf, int maxlen, struct editqueue_S *queue));
 int collab_pendingedits __ARGS((struct editqueue_S *queue));
 void collab_remoteapply __ARGS((struct collabedit_S *edit));
+void collab_idle __ARGS((void));
 void collab_cursorupdate __ARGS((void));
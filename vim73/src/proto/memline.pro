@@ -22,13 +22,27 @@ int ml_line_alloced __ARGS((void));
 int ml_append __ARGS((linenr_T lnum, char_u *line, colnr_T len, int newfile));
 int ml_append_collab __ARGS((linenr_T lnum, char_u *line, colnr_T len, int newfile, int fire_event));
 int ml_append_buf __ARGS((buf_T *buf, linenr_T lnum, char_u *line, colnr_T len, int newfile));
+void ml_bulk_begin __ARGS((buf_T *buf));
+void ml_bulk_end __ARGS((buf_T *buf));
+long ml_compact __ARGS((buf_T *buf));
+void ml_compact_idle __ARGS((void));
+int ml_tree_info __ARGS((buf_T *buf, long *datap, long *ptrp, int *depthp));
+int ml_mmap_open __ARGS((buf_T *buf, int fd, int *ffp, off_t *sizep, int *noeolp));
+int ml_mmap_promote __ARGS((buf_T *buf));
+int ml_mmap_changed __ARGS((buf_T *buf, struct stat *stp));
+void ml_mmap_drop __ARGS((buf_T *buf));
 int ml_replace __ARGS((linenr_T lnum, char_u *line, int copy));
 int ml_replace_collab __ARGS((linenr_T lnum, char_u *line, int copy, int fire_event));
 int ml_delete __ARGS((linenr_T lnum, int message));
 int ml_delete_collab __ARGS((linenr_T lnum, int message, int fire_event));
+int ml_delete_range __ARGS((linenr_T lnum, long count, int message));
+int ml_delete_range_collab __ARGS((linenr_T lnum, long count, int message, int fire_event));
 void ml_setmarked __ARGS((linenr_T lnum));
 linenr_T ml_firstmarked __ARGS((void));
 void ml_clearmarked __ARGS((void));
+void ml_tri_free_all __ARGS((void));
+int ml_tri_prepare __ARGS((buf_T *buf, regprog_T *prog, int ic, triquery_T *tq));
+linenr_T ml_tri_skip __ARGS((buf_T *buf, linenr_T lnum, int dir, triquery_T *tq));
 int resolve_symlink __ARGS((char_u *fname, char_u *buf));
 char_u *makeswapname __ARGS((char_u *fname, char_u *ffname, buf_T *buf, char_u *dir_name));
 char_u *get_file_in_dir __ARGS((char_u *fname, char_u *dname));
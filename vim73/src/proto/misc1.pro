@@ -40,6 +40,7 @@ void appended_lines_mark __ARGS((linenr_T lnum, long count));
 void deleted_lines __ARGS((linenr_T lnum, long count));
 void deleted_lines_mark __ARGS((linenr_T lnum, long count));
 void changed_lines __ARGS((linenr_T lnum, colnr_T col, linenr_T lnume, long xtra));
+void changed_lines_batch __ARGS((linenr_T lnum, colnr_T col, linenr_T lnume, long xtra));
 void unchanged __ARGS((buf_T *buf, int ff));
 void check_status __ARGS((buf_T *buf));
 void change_warning __ARGS((int col));
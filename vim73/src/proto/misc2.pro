@@ -46,6 +46,7 @@ int vim_stricmp __ARGS((char *s1, char *s2));
 int vim_strnicmp __ARGS((char *s1, char *s2, size_t len));
 char_u *vim_strchr __ARGS((char_u *string, int c));
 char_u *vim_strbyte __ARGS((char_u *string, int c));
+char_u *vim_strbyte2 __ARGS((char_u *string, int c1, int c2));
 char_u *vim_strrchr __ARGS((char_u *string, int c));
 int vim_isspace __ARGS((int x));
 void ga_clear __ARGS((garray_T *gap));
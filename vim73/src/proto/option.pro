@@ -40,6 +40,7 @@ void check_win_options __ARGS((win_T *win));
 void check_winopt __ARGS((winopt_T *wop));
 void clear_winopt __ARGS((winopt_T *wop));
 void buf_copy_options __ARGS((buf_T *buf, int flags));
+int plain_read_options __ARGS((int *same_isk));
 void reset_modifiable __ARGS((void));
 void set_iminsert_global __ARGS((void));
 void set_imsearch_global __ARGS((void));
@@ -1,17 +1,26 @@
 /* regexp.c */
 int re_multiline __ARGS((regprog_T *prog));
+int re_linelocal __ARGS((regprog_T *prog, int same_isk));
+char_u *re_musttext __ARGS((regprog_T *prog, int *icp, int *lenp));
+int re_progid __ARGS((regprog_T *prog));
 int re_lookbehind __ARGS((regprog_T *prog));
 char_u *skip_regexp __ARGS((char_u *startp, int dirc, int magic, char_u **newp));
 regprog_T *vim_regcomp __ARGS((char_u *expr, int re_flags));
 int vim_regcomp_had_eol __ARGS((void));
+void vim_regfree __ARGS((regprog_T *prog));
 void free_regexp_stuff __ARGS((void));
 int vim_regexec __ARGS((regmatch_T *rmp, char_u *line, colnr_T col));
 int vim_regexec_nl __ARGS((regmatch_T *rmp, char_u *line, colnr_T col));
 long vim_regexec_multi __ARGS((regmmatch_T *rmp, win_T *win, buf_T *buf, linenr_T lnum, colnr_T col, proftime_T *tm));
+regexec_T *vim_regexec_alloc __ARGS((volatile int *cancel));
+void vim_regexec_free __ARGS((regexec_T *rex));
+int vim_regexec_rex __ARGS((regexec_T *rex, regmatch_T *rmp, char_u *line, colnr_T col, int *failed));
 reg_extmatch_T *ref_extmatch __ARGS((reg_extmatch_T *em));
 void unref_extmatch __ARGS((reg_extmatch_T *em));
 char_u *regtilde __ARGS((char_u *source, int magic));
 int vim_regsub __ARGS((regmatch_T *rmp, char_u *source, char_u *dest, int copy, int magic, int backslash));
 int vim_regsub_multi __ARGS((regmmatch_T *rmp, linenr_T lnum, char_u *source, char_u *dest, int copy, int magic, int backslash));
 char_u *reg_submatch __ARGS((int no));
+void ex_regexpstats __ARGS((exarg_T *eap));
+void ex_regexptime __ARGS((exarg_T *eap));
 /* vim: set ft=c : */
@@ -26,6 +26,9 @@ void screen_putchar __ARGS((int c, int row, int col, int attr));
 void screen_getbytes __ARGS((int row, int col, char_u *bytes, int *attrp));
 void screen_puts __ARGS((char_u *text, int row, int col, int attr));
 void screen_puts_len __ARGS((char_u *text, int len, int row, int col, int attr));
+void hl_cache_changed __ARGS((buf_T *buf, linenr_T lnum, linenr_T lnume, long xtra));
+void hl_cache_clear_all __ARGS((void));
+void hl_cache_free __ARGS((win_T *wp));
 void screen_stop_highlight __ARGS((void));
 void reset_cterm_colors __ARGS((void));
 void screen_draw_rectangle __ARGS((int row, int col, int height, int width, int invert));
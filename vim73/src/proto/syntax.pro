@@ -10,6 +10,7 @@ void reset_synblock __ARGS((win_T *wp));
 void ex_syntax __ARGS((exarg_T *eap));
 void ex_ownsyntax __ARGS((exarg_T *eap));
 int syntax_present __ARGS((win_T *win));
+char_u *syn_regprog_name __ARGS((win_T *wp, regprog_T *prog));
 void reset_expand_highlight __ARGS((void));
 void set_context_in_echohl_cmd __ARGS((expand_T *xp, char_u *arg));
 void set_context_in_syntax_cmd __ARGS((expand_T *xp, char_u *arg));
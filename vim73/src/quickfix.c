@@ -845,7 +845,7 @@ qf_init_ok:
     for (fmt_ptr = fmt_first; fmt_ptr != NULL; fmt_ptr = fmt_first)
     {
 	fmt_first = fmt_ptr->next;
-	vim_free(fmt_ptr->prog);
+	vim_regfree(fmt_ptr->prog);
 	vim_free(fmt_ptr);
     }
     qf_clean_dir_stack(&dir_stack);
@@ -3016,6 +3016,496 @@ ex_cfile(eap)
     }
 }
 
+#ifdef FEAT_VIMGREP_THREADS
+# include <pthread.h>
+
+/*
+ * ":vimgrep" with 'vimgrepthreads' set: worker threads read the files ahead
+ * of the main thread.  A plain file, which would be read into a buffer
+ * without any change, is split into lines and the worker finds the matches,
+ * each worker with its own regexec_T.  The main thread adds the matches to
+ * the quickfix list in the order of the files, without loading the file into
+ * a buffer.  Other files are loaded into a buffer as before.
+ */
+typedef struct vgrfile_S
+{
+    char_u	*vf_fname;	/* full file name */
+    int		vf_done;	/* TRUE when a worker is done with the file */
+    char_u	*vf_text;	/* the lines of the file, NUL terminated; NULL
+				   when the file isn't plain */
+    long	vf_count;	/* number of matches */
+    char_u	**vf_lines;	/* line of each match */
+    linenr_T	*vf_lnums;	/* line number of each match */
+    colnr_T	*vf_cols;	/* column of each match */
+} vgrfile_T;
+
+typedef struct vgrpool_S vgrpool_T;
+
+typedef struct vgrthread_S
+{
+    pthread_t	    vt_thread;
+    vgrpool_T	    *vt_pool;
+    regexec_T	    *vt_rex;	/* for matching in this thread */
+} vgrthread_T;
+
+/* Only use vp_next, vp_done and vf_done while holding vp_mutex.  vp_stop is
+ * only set while holding it, the workers and their regexp contexts also check
+ * it without the mutex to stop halfway a file. */
+struct vgrpool_S
+{
+    pthread_mutex_t vp_mutex;
+    pthread_cond_t  vp_todo;	/* vp_done or vp_stop changed */
+    pthread_cond_t  vp_ready;	/* a file is done */
+    vgrfile_T	    *vp_files;
+    int		    vp_fcount;	/* number of items in vp_files[] */
+    int		    vp_next;	/* next file for a worker */
+    int		    vp_done;	/* the file the main thread waits for */
+    int		    vp_ahead;	/* max number of files read ahead */
+    volatile int    vp_stop;	/* TRUE when the workers must stop */
+    regprog_T	    *vp_prog;
+    int		    vp_ic;	/* 'ignorecase' */
+    int		    vp_global;	/* find all matches in a line */
+    long	    vp_tomatch;	/* max number of matches in a file */
+    int		    vp_utf8;	/* check that the text is valid UTF-8 */
+    int		    vp_nthreads; /* number of items in vp_threads[] */
+    vgrthread_T	    *vp_threads;
+};
+
+#define VGR_AHEAD	8		/* files read ahead per thread */
+#define VGR_MAXSIZE	(32L << 20)	/* larger files are loaded */
+#define VGR_WAIT_MSEC	100		/* check for CTRL-C this often */
+
+static vgrpool_T *vgr_start __ARGS((char_u **fnames, int fcount, char_u *dirname, regprog_T *prog, int flags, long tomatch));
+static void	vgr_stop __ARGS((vgrpool_T *vp));
+static void	*vgr_worker __ARGS((void *arg));
+static void	vgr_read __ARGS((vgrpool_T *vp, vgrfile_T *vf, regexec_T *rex));
+static int	vgr_add_match __ARGS((vgrfile_T *vf, long *lenp, char_u *line, linenr_T lnum, colnr_T col));
+static void	vgr_clear __ARGS((vgrfile_T *vf));
+static vgrfile_T *vgr_wait __ARGS((vgrpool_T *vp, int fi));
+# ifdef FEAT_AUTOCMD
+static int	vgr_has_autocmd __ARGS((char_u *fname));
+# endif
+static void	vgr_search __ARGS((qf_info_T *qi, qfline_T **prevp, vgrfile_T *vf, char_u *fname, long *tomatch));
+
+/*
+ * Start the worker threads for the "fcount" files in "fnames", relative to
+ * directory "dirname".  Returns NULL when that fails.
+ */
+    static vgrpool_T *
+vgr_start(fnames, fcount, dirname, prog, flags, tomatch)
+    char_u	**fnames;
+    int		fcount;
+    char_u	*dirname;
+    regprog_T	*prog;
+    int		flags;
+    long	tomatch;
+{
+    vgrpool_T	*vp;
+    vgrthread_T	*vt;
+    int		n;
+    int		i;
+
+    n = p_vgt < fcount ? (int)p_vgt : fcount;
+    vp = (vgrpool_T *)alloc_clear((unsigned)sizeof(vgrpool_T));
+    if (vp == NULL)
+	return NULL;
+    vp->vp_files = (vgrfile_T *)alloc_clear(
+					(unsigned)(fcount * sizeof(vgrfile_T)));
+    vp->vp_threads = (vgrthread_T *)alloc_clear(
+					  (unsigned)(n * sizeof(vgrthread_T)));
+    if (vp->vp_files == NULL || vp->vp_threads == NULL)
+    {
+	vim_free(vp->vp_files);
+	vim_free(vp->vp_threads);
+	vim_free(vp);
+	return NULL;
+    }
+
+    /* Autocommands may change directory while the workers are reading, give
+     * them full names.  When this fails the file is loaded. */
+    for (i = 0; i < fcount; ++i)
+	vp->vp_files[i].vf_fname = mch_isFullName(fnames[i])
+				? vim_strsave(fnames[i])
+				: concat_fnames(dirname, fnames[i], TRUE);
+
+    pthread_mutex_init(&vp->vp_mutex, NULL);
+    pthread_cond_init(&vp->vp_todo, NULL);
+    pthread_cond_init(&vp->vp_ready, NULL);
+    vp->vp_fcount = fcount;
+    vp->vp_ahead = n * VGR_AHEAD;
+    vp->vp_prog = prog;
+    vp->vp_ic = p_ic;
+    vp->vp_global = (flags & VGR_GLOBAL) != 0;
+    vp->vp_tomatch = tomatch;
+# ifdef FEAT_MBYTE
+    vp->vp_utf8 = enc_utf8;
+# endif
+    for (i = 0; i < n; ++i)
+    {
+	vt = &vp->vp_threads[vp->vp_nthreads];
+	vt->vt_pool = vp;
+	vt->vt_rex = vim_regexec_alloc(&vp->vp_stop);
+	if (vt->vt_rex == NULL)
+	    break;
+	if (pthread_create(&vt->vt_thread, NULL, vgr_worker, vt) != 0)
+	{
+	    vim_regexec_free(vt->vt_rex);
+	    break;
+	}
+	++vp->vp_nthreads;
+    }
+    if (vp->vp_nthreads == 0)
+    {
+	vgr_stop(vp);
+	return NULL;
+    }
+    return vp;
+}
+
+/*
+ * Stop the worker threads, wait for them to finish and free "vp".  A worker
+ * stops halfway a file and halfway matching a line, it doesn't take long.
+ */
+    static void
+vgr_stop(vp)
+    vgrpool_T	*vp;
+{
+    int		i;
+
+    pthread_mutex_lock(&vp->vp_mutex);
+    vp->vp_stop = TRUE;
+    pthread_cond_broadcast(&vp->vp_todo);
+    pthread_mutex_unlock(&vp->vp_mutex);
+    for (i = 0; i < vp->vp_nthreads; ++i)
+    {
+	pthread_join(vp->vp_threads[i].vt_thread, NULL);
+	vim_regexec_free(vp->vp_threads[i].vt_rex);
+    }
+
+    for (i = 0; i < vp->vp_fcount; ++i)
+    {
+	vgr_clear(&vp->vp_files[i]);
+	vim_free(vp->vp_files[i].vf_fname);
+    }
+    pthread_cond_destroy(&vp->vp_ready);
+    pthread_cond_destroy(&vp->vp_todo);
+    pthread_mutex_destroy(&vp->vp_mutex);
+    vim_free(vp->vp_files);
+    vim_free(vp->vp_threads);
+    vim_free(vp);
+}
+
+/*
+ * A worker thread: read the files in order, at most vp_ahead files ahead of
+ * the one the main thread is waiting for.
+ */
+    static void *
+vgr_worker(arg)
+    void	*arg;
+{
+    vgrthread_T	*vt = (vgrthread_T *)arg;
+    vgrpool_T	*vp = vt->vt_pool;
+    vgrfile_T	*vf;
+
+    pthread_mutex_lock(&vp->vp_mutex);
+    for (;;)
+    {
+	while (!vp->vp_stop && vp->vp_next < vp->vp_fcount
+			       && vp->vp_next >= vp->vp_done + vp->vp_ahead)
+	    pthread_cond_wait(&vp->vp_todo, &vp->vp_mutex);
+	if (vp->vp_stop || vp->vp_next >= vp->vp_fcount)
+	    break;
+	vf = &vp->vp_files[vp->vp_next++];
+	pthread_mutex_unlock(&vp->vp_mutex);
+
+	vgr_read(vp, vf, vt->vt_rex);
+
+	pthread_mutex_lock(&vp->vp_mutex);
+	vf->vf_done = TRUE;
+	pthread_cond_broadcast(&vp->vp_ready);
+    }
+    pthread_mutex_unlock(&vp->vp_mutex);
+    return NULL;
+}
+
+/*
+ * Read file "vf" in a worker thread.  When it is a plain file split it into
+ * lines and find the matches with "rex", like ex_vimgrep() does in a buffer.
+ * Otherwise, or when matching fails, vf_text stays NULL and the main thread
+ * loads the file into a buffer.
+ * Uses malloc() instead of alloc(), which may give a message or release
+ * memory.
+ */
+    static void
+vgr_read(vp, vf, rex)
+    vgrpool_T	*vp;
+    vgrfile_T	*vf;
+    regexec_T	*rex;
+{
+    struct stat	st;
+    int		fd;
+    char_u	*text;
+    char_u	*end;
+    char_u	*p;
+    char_u	*line;
+    long	len;
+    long	n;
+    linenr_T	lnum;
+    int		l;
+    regmatch_T	regmatch;
+    colnr_T	col;
+    long	size = 0;
+    int		failed = FALSE;
+
+    if (vf->vf_fname == NULL)
+	return;
+    fd = mch_open((char *)vf->vf_fname, O_RDONLY | O_EXTRA, 0);
+    if (fd < 0)
+	return;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)
+			     || st.st_size == 0 || st.st_size > VGR_MAXSIZE)
+    {
+	close(fd);
+	return;
+    }
+    len = (long)st.st_size;
+    text = (char_u *)malloc((size_t)len + 1);
+    for (n = 0; text != NULL && n < len; n += l)
+    {
+	l = (int)vim_read(fd, text + n, len - n);
+	if (l <= 0)
+	    break;
+    }
+    close(fd);
+    if (text == NULL || n != len)
+	goto notplain;
+    text[len] = NUL;
+    end = text + len;
+
+    /* A BOM or encryption changes the text, also the bytes that "fileformat"
+     * "dos" or a conversion would change. */
+    if ((len >= 2 && ((text[0] == 0xfe && text[1] == 0xff)
+				    || (text[0] == 0xff && text[1] == 0xfe)))
+	    || (len >= 3 && text[0] == 0xef && text[1] == 0xbb
+							 && text[2] == 0xbf)
+	    || (len >= 9 && STRNCMP(text, "VimCrypt~", 9) == 0))
+	goto notplain;
+    for (p = text; p < end; ++p)
+    {
+	if (*p == NUL || *p == CAR)
+	    goto notplain;
+# ifdef FEAT_MBYTE
+	else if (*p >= 0x80 && vp->vp_utf8)
+	{
+	    l = utf_ptr2len_len(p, (int)(end - p));
+	    if (l == 1 || l > end - p)
+		goto notplain;
+	    p += l - 1;
+	}
+# endif
+    }
+
+    regmatch.regprog = vp->vp_prog;
+    regmatch.rm_ic = vp->vp_ic;
+    lnum = 0;
+    for (line = text; line < end && vf->vf_count < vp->vp_tomatch;
+								 line = p + 1)
+    {
+	if (vp->vp_stop)
+	    goto notplain;
+	++lnum;
+	p = vim_strbyte(line, NL);
+	if (p == NULL)
+	    p = end;
+	*p = NUL;
+	col = 0;
+	while (vim_regexec_rex(rex, &regmatch, line, col, &failed))
+	{
+	    if (vgr_add_match(vf, &size, line, lnum,
+				       (colnr_T)(regmatch.startp[0] - line)) == FAIL
+		    || vf->vf_count == vp->vp_tomatch || !vp->vp_global)
+		break;
+	    col = (colnr_T)(regmatch.endp[0] - line)
+			      + (col == (colnr_T)(regmatch.endp[0] - line));
+	    if (col > (colnr_T)(p - line))
+		break;
+	}
+	if (failed)
+	    goto notplain;
+    }
+    vf->vf_text = text;
+    return;
+
+notplain:
+    free(text);
+    vgr_clear(vf);
+}
+
+/*
+ * Add a match at "lnum" and "col" in "line" to "vf".  "*lenp" is the number
+ * of matches there is room for.
+ * Returns FAIL when out of memory.
+ */
+    static int
+vgr_add_match(vf, lenp, line, lnum, col)
+    vgrfile_T	*vf;
+    long	*lenp;
+    char_u	*line;
+    linenr_T	lnum;
+    colnr_T	col;
+{
+    long	len;
+    void	*p;
+
+    if (vf->vf_count == *lenp)
+    {
+	len = *lenp == 0 ? 16 : *lenp * 2;
+	p = realloc(vf->vf_lines, (size_t)len * sizeof(char_u *));
+	if (p == NULL)
+	    return FAIL;
+	vf->vf_lines = (char_u **)p;
+	p = realloc(vf->vf_lnums, (size_t)len * sizeof(linenr_T));
+	if (p == NULL)
+	    return FAIL;
+	vf->vf_lnums = (linenr_T *)p;
+	p = realloc(vf->vf_cols, (size_t)len * sizeof(colnr_T));
+	if (p == NULL)
+	    return FAIL;
+	vf->vf_cols = (colnr_T *)p;
+	*lenp = len;
+    }
+    vf->vf_lines[vf->vf_count] = line;
+    vf->vf_lnums[vf->vf_count] = lnum;
+    vf->vf_cols[vf->vf_count] = col;
+    ++vf->vf_count;
+    return OK;
+}
+
+/*
+ * Free the text and the matches of file "vf".
+ */
+    static void
+vgr_clear(vf)
+    vgrfile_T	*vf;
+{
+    free(vf->vf_text);
+    free(vf->vf_lines);
+    free(vf->vf_lnums);
+    free(vf->vf_cols);
+    vf->vf_text = NULL;
+    vf->vf_lines = NULL;
+    vf->vf_lnums = NULL;
+    vf->vf_cols = NULL;
+    vf->vf_count = 0;
+}
+
+/*
+ * Called for the files in order: free the previous file, let the workers
+ * read ahead of file "fi" and wait until they are done with it.
+ * Returns NULL when interrupted with CTRL-C while waiting.
+ */
+    static vgrfile_T *
+vgr_wait(vp, fi)
+    vgrpool_T	*vp;
+    int		fi;
+{
+    vgrfile_T	*vf = &vp->vp_files[fi];
+    struct timeval  tv;
+    struct timespec ts;
+    long	usec;
+
+    if (fi > 0)
+	vgr_clear(&vp->vp_files[fi - 1]);
+    pthread_mutex_lock(&vp->vp_mutex);
+    vp->vp_done = fi;
+    pthread_cond_broadcast(&vp->vp_todo);
+    while (!vf->vf_done)
+    {
+	gettimeofday(&tv, NULL);
+	usec = tv.tv_usec + VGR_WAIT_MSEC * 1000L;
+	ts.tv_sec = tv.tv_sec + usec / 1000000L;
+	ts.tv_nsec = (usec % 1000000L) * 1000L;
+	pthread_cond_timedwait(&vp->vp_ready, &vp->vp_mutex, &ts);
+	if (vf->vf_done)
+	    break;
+	pthread_mutex_unlock(&vp->vp_mutex);
+	ui_breakcheck();
+	pthread_mutex_lock(&vp->vp_mutex);
+	if (got_int)
+	{
+	    pthread_mutex_unlock(&vp->vp_mutex);
+	    return NULL;
+	}
+    }
+    pthread_mutex_unlock(&vp->vp_mutex);
+    return vf;
+}
+
+# ifdef FEAT_AUTOCMD
+/* Events triggered by loading a file into a dummy buffer and wiping it out. */
+static event_T vgr_events[] = {EVENT_BUFREADCMD, EVENT_BUFREADPRE,
+			EVENT_BUFREADPOST, EVENT_BUFUNLOAD, EVENT_BUFDELETE,
+			EVENT_BUFWIPEOUT, EVENT_SWAPEXISTS};
+
+/*
+ * Return TRUE when loading "fname" into a buffer may trigger autocommands.
+ * Those of filetype detection are ignored, they only set 'filetype' and the
+ * FileType event isn't triggered for the dummy buffer.
+ */
+    static int
+vgr_has_autocmd(fname)
+    char_u	*fname;
+{
+    int		i;
+
+    for (i = 0; i < (int)(sizeof(vgr_events) / sizeof(event_T)); ++i)
+	if (has_autocmd_except(vgr_events[i], fname, NULL,
+					       (char_u *)"filetypedetect"))
+	    return TRUE;
+    return FALSE;
+}
+# endif
+
+/*
+ * Add the matches a worker found in file "vf" to the quickfix list.
+ */
+    static void
+vgr_search(qi, prevp, vf, fname, tomatch)
+    qf_info_T	*qi;
+    qfline_T	**prevp;
+    vgrfile_T	*vf;
+    char_u	*fname;
+    long	*tomatch;
+{
+    long	i;
+
+    for (i = 0; i < vf->vf_count && *tomatch > 0; ++i)
+    {
+	if (qf_add_entry(qi, prevp,
+		    NULL,       /* dir */
+		    fname,
+		    0,
+		    vf->vf_lines[i],
+		    (long)vf->vf_lnums[i],
+		    (int)vf->vf_cols[i] + 1,
+		    FALSE,      /* vis_col */
+		    NULL,	/* search pattern */
+		    0,		/* nr */
+		    0,		/* type */
+		    TRUE	/* valid */
+		    ) == FAIL)
+	{
+	    got_int = TRUE;
+	    break;
+	}
+	--*tomatch;
+	line_breakcheck();
+	if (got_int)
+	    break;
+    }
+}
+#endif
+
 /*
  * ":vimgrep {pattern} file(s)"
  * ":vimgrepadd {pattern} file(s)"
@@ -3054,6 +3544,15 @@ ex_vimgrep(eap)
     char_u	dirname_start[MAXPATHL];
     char_u	dirname_now[MAXPATHL];
     char_u	*target_dir = NULL;
+#ifdef FEAT_VIMGREP_THREADS
+    vgrpool_T	*pool = NULL;
+    vgrfile_T	*vf;
+    int		same_isk;
+#endif
+#ifdef FEAT_TRIGRAM_INDEX
+    triquery_T	tq;
+    int		use_tri;
+#endif
 #ifdef FEAT_AUTOCMD
     char_u	*au_name =  NULL;
 
@@ -3134,6 +3633,15 @@ ex_vimgrep(eap)
      * ":lcd %:p:h" changes the meaning of short path names. */
     mch_dirname(dirname_start, MAXPATHL);
 
+#ifdef FEAT_VIMGREP_THREADS
+    /* Without a buffer the lines are matched as strings, that only works
+     * when the pattern doesn't look beyond the line. */
+    if (p_vgt > 0 && plain_read_options(&same_isk)
+		  && re_linelocal(regmatch.regprog, same_isk))
+	pool = vgr_start(fnames, fcount, dirname_start, regmatch.regprog,
+							      flags, tomatch);
+#endif
+
     seconds = (time_t)0;
     for (fi = 0; fi < fcount && !got_int && tomatch > 0; ++fi)
     {
@@ -3160,6 +3668,24 @@ ex_vimgrep(eap)
 	}
 
 	buf = buflist_findname_exp(fnames[fi]);
+#ifdef FEAT_VIMGREP_THREADS
+	if (pool != NULL)
+	{
+	    if ((vf = vgr_wait(pool, fi)) == NULL)
+		break;			/* interrupted */
+	    if (vf->vf_text != NULL
+		    && (buf == NULL || buf->b_ml.ml_mfp == NULL)
+# ifdef FEAT_AUTOCMD
+		    && !vgr_has_autocmd(fname)
+# endif
+		    )
+	    {
+		/* A worker read the file, no need to load it. */
+		vgr_search(qi, &prevp, vf, fname, &tomatch);
+		continue;
+	    }
+	}
+#endif
 	if (buf == NULL || buf->b_ml.ml_mfp == NULL)
 	{
 	    /* Remember that a buffer with this name already exists. */
@@ -3211,9 +3737,21 @@ ex_vimgrep(eap)
 	    /* Try for a match in all lines of the buffer.
 	     * For ":1vimgrep" look for first match only. */
 	    found_match = FALSE;
+#ifdef FEAT_TRIGRAM_INDEX
+	    /* A buffer that was loaded before may have a trigram index, don't
+	     * build one for a dummy buffer. */
+	    use_tri = !using_dummy && ml_tri_prepare(buf, regmatch.regprog,
+						       regmatch.rmm_ic, &tq);
+#endif
 	    for (lnum = 1; lnum <= buf->b_ml.ml_line_count && tomatch > 0;
 								       ++lnum)
 	    {
+#ifdef FEAT_TRIGRAM_INDEX
+		/* Skip the lines that the trigram index excludes. */
+		if (use_tri && (lnum = ml_tri_skip(buf, (linenr_T)lnum,
+				FORWARD, &tq)) > buf->b_ml.ml_line_count)
+		    break;
+#endif
 		col = 0;
 		while (vim_regexec_multi(&regmatch, curwin, buf, lnum,
 							       col, NULL) > 0)
@@ -3312,6 +3850,10 @@ ex_vimgrep(eap)
 	}
     }
 
+#ifdef FEAT_VIMGREP_THREADS
+    if (pool != NULL)
+	vgr_stop(pool);
+#endif
     FreeWild(fcount, fnames);
 
     qi->qf_lists[qi->qf_curlist].qf_nonevalid = FALSE;
@@ -3367,7 +3909,7 @@ ex_vimgrep(eap)
 
 theend:
     vim_free(target_dir);
-    vim_free(regmatch.regprog);
+    vim_regfree(regmatch.regprog);
 }
 
 /*
@@ -3946,7 +4488,7 @@ ex_helpgrep(eap)
 		FreeWild(fcount, fnames);
 	    }
 	}
-	vim_free(regmatch.regprog);
+	vim_regfree(regmatch.regprog);
 
 	qi->qf_lists[qi->qf_curlist].qf_nonevalid = FALSE;
 	qi->qf_lists[qi->qf_curlist].qf_ptr =
@@ -52,14 +52,17 @@
  * reganch	is the match anchored (at beginning-of-line only)?
  * regmust	string (pointer into program) that match must include, or NULL
  * regmlen	length of regmust string
+ * regmrare	index of the byte in regmust that is looked for first, the one
+ *		that is least likely to appear in text
  * regflags	RF_ values or'ed together
  *
  * Regstart and reganch permit very fast decisions on suitable starting points
  * for a match, cutting down the work a lot.  Regmust permits fast rejection
- * of lines that cannot possibly match.  The regmust tests are costly enough
- * that vim_regcomp() supplies a regmust only if the r.e. contains something
- * potentially expensive (at present, the only such thing detected is * or +
- * at the start of the r.e., which can involve a lot of backup).  Regmlen is
+ * of lines that cannot possibly match.  The regmust test looks for the rarest
+ * byte first, 16 bytes at a time where possible, thus vim_regcomp() supplies
+ * a regmust of two or more bytes for any r.e. that isn't anchored, and one of
+ * any length if the r.e. contains something potentially expensive (* or + at
+ * the start of the r.e., which can involve a lot of backup).  Regmlen is
  * supplied because the test in vim_regexec() needs it and vim_regcomp() is
  * computing it anyway.
  */
@@ -232,6 +235,12 @@
 #define RE_MARK		207	/* mark cmp  Match mark position */
 #define RE_VISUAL	208	/*	Match Visual area */
 
+/* Items that match a character or a position, see reg_match_item(). */
+#define REG_ITEM(op)	((op) == BOL || (op) == EOL || (op) == EXACTLY \
+			    || (op) == BOW || (op) == EOW || (op) == NEWL \
+			    || ((op) >= ANY && (op) <= LAST_NL) \
+			    || ((op) >= MULTIBYTECODE && (op) <= RE_VISUAL))
+
 /*
  * Magic characters have a special meaning, they don't match literally.
  * Magic characters are negative.  This separates them from literal characters
@@ -333,8 +342,8 @@ toggle_Magic(x)
 #define MAX_LIMIT	(32767L << 16L)
 
 static int re_multi_type __ARGS((int));
-static int cstrncmp __ARGS((char_u *s1, char_u *s2, int *n));
-static char_u *cstrchr __ARGS((char_u *, int));
+static int cstrncmp __ARGS((regexec_T *rex, char_u *s1, char_u *s2, int *n));
+static char_u *cstrchr __ARGS((regexec_T *rex, char_u *, int));
 
 #ifdef DEBUG
 static void	regdump __ARGS((char_u *, regprog_T *));
@@ -568,6 +577,12 @@ init_class_tab()
 #define RF_HASNL    4	/* can match a NL */
 #define RF_ICOMBINE 8	/* ignore combining characters */
 #define RF_LOOKBH   16	/* uses "\@<=" or "\@<!" */
+#define RF_BACKTRACK 32	/* needs backtracking, can't use the NFA engine */
+#define RF_NODFA    64	/* can't use the DFA cache */
+#define RF_WORD	    128	/* DFA depends on 'iskeyword' */
+#define RF_BUFFER   256	/* uses the cursor, a mark, the Visual area, a line
+			   number or a virtual column */
+#define RF_ISK	    512	/* depends on 'iskeyword' */
 
 /*
  * Global work variables for vim_regcomp().
@@ -593,6 +608,7 @@ static int	brace_count[10]; /* Current counts for complex brace repeats */
 static int	had_eol;	/* TRUE when EOL found by vim_regcomp() */
 #endif
 static int	one_exactly = FALSE;	/* only do one char for EXACTLY */
+static int	reg_nocache;	/* program must not go in the cache */
 
 static int	reg_magic;	/* magicness of the pattern: */
 #define MAGIC_NONE	1	/* "\V" very unmagic */
@@ -661,7 +677,7 @@ static char_u	*regnode __ARGS((int));
 #ifdef FEAT_MBYTE
 static int	use_multibytecode __ARGS((int c));
 #endif
-static int	prog_magic_wrong __ARGS((void));
+static int	prog_magic_wrong __ARGS((regexec_T *rex));
 static char_u	*regnext __ARGS((char_u *));
 static void	regc __ARGS((int b));
 #ifdef FEAT_MBYTE
@@ -675,6 +691,9 @@ static char_u	*re_put_long __ARGS((char_u *pr, long_u val));
 static int	read_limits __ARGS((long *, long *));
 static void	regtail __ARGS((char_u *, char_u *));
 static void	regoptail __ARGS((char_u *, char_u *));
+static int	dfa_usable __ARGS((regprog_T *prog));
+static int	reg_rare_byte __ARGS((char_u *s, int len));
+static regprog_T *reg_compile __ARGS((char_u *expr, int re_flags));
 
 /*
  * Return TRUE if compiled regular expression "prog" can match a line break.
@@ -686,6 +705,60 @@ re_multiline(prog)
     return (prog->regflags & RF_HASNL);
 }
 
+/*
+ * Return TRUE when matching "prog" in a line of a buffer gives the same
+ * result as matching it against the text of that line as a string: it can't
+ * match a line break and doesn't use the cursor, marks, the Visual area, line
+ * numbers or virtual columns.  When "same_isk" is FALSE, because the buffer
+ * has another 'iskeyword' than the current one, it must not use keyword
+ * characters either.
+ */
+    int
+re_linelocal(prog, same_isk)
+    regprog_T	*prog;
+    int		same_isk;
+{
+    if (prog->regflags & (RF_HASNL | RF_BUFFER))
+	return FALSE;
+    return same_isk || !(prog->regflags & RF_ISK);
+}
+
+/*
+ * Return the text that every match of "prog" must contain, for an index of
+ * the lines.  Its length is stored in "*lenp".  "*icp" is the value for
+ * ignoring case to be used when matching, it is changed when "prog" has "\c"
+ * or "\C".  Returns NULL when there is no such text.
+ */
+    char_u *
+re_musttext(prog, icp, lenp)
+    regprog_T	*prog;
+    int		*icp;
+    int		*lenp;
+{
+    if (prog->regflags & RF_ICASE)
+	*icp = TRUE;
+    else if (prog->regflags & RF_NOICASE)
+	*icp = FALSE;
+#ifdef FEAT_MBYTE
+    /* With "\Z" composing characters in the text may be left out. */
+    if (prog->regflags & RF_ICOMBINE)
+	return NULL;
+#endif
+    *lenp = prog->regmlen;
+    return prog->regmust;
+}
+
+/*
+ * Return a number for "prog" that no other program compiled before or after
+ * it gets.  Results of matching can be remembered with it.
+ */
+    int
+re_progid(prog)
+    regprog_T	*prog;
+{
+    return prog->regid;
+}
+
 /*
  * Return TRUE if compiled regular expression "prog" looks before the start
  * position (pattern contains "\@<=" or "\@<!").
@@ -1009,7 +1082,156 @@ skip_regexp(startp, dirc, magic, newp)
 }
 
 /*
- * vim_regcomp() - compile a regular expression into internal code
+ * Cache of compiled programs.  The same patterns are compiled over and over
+ * again, e.g. for each ":s" or substitute() in a loop and for each search,
+ * and compiling takes longer than matching a short line.  When the pattern
+ * was compiled recently vim_regcomp() returns the same program again.  The
+ * users of a program are counted in "regrefcnt", the cache is one of them.
+ * vim_regfree() frees the program when the last one is gone, programs must
+ * never be freed with vim_free().
+ *
+ * The program depends on the pattern, "re_flags", the 'l' and '\' flags in
+ * 'cpoptions' and the encoding.  'ignorecase' is only used when executing.
+ * A pattern with "~" depends on the previous substitute string and one with
+ * "\z(" on "reg_do_extmatch", these are not cached.
+ */
+typedef struct
+{
+    char_u	*rc_pat;	/* the pattern, NULL when the entry is unused */
+    int		rc_flags;	/* "re_flags" and RC_CPO_ flags */
+    regprog_T	*rc_prog;	/* the compiled program */
+    int		rc_had_eol;	/* value for vim_regcomp_had_eol() */
+    long	rc_used;	/* "reg_cache_clock" when last used */
+} regcache_T;
+
+#define REG_CACHE_SIZE	32	/* number of programs in the cache */
+#define RC_CPO_LIT	0x100	/* 'cpoptions' contains 'l' */
+#define RC_CPO_BSL	0x200	/* 'cpoptions' contains '\' */
+
+static regcache_T reg_cache[REG_CACHE_SIZE];
+static long	reg_cache_clock = 0;
+#ifdef FEAT_MBYTE
+static char_u	*reg_cache_enc = NULL;	/* 'encoding' of the cached programs */
+#endif
+
+/* Counters for ":regexpstats". */
+static long	reg_cache_hits = 0;	/* programs found in the cache */
+static long	reg_cache_misses = 0;	/* programs compiled */
+
+static int	reg_lastid = 0;		/* last used "regid" */
+
+#ifdef FEAT_PROFILE
+/* For ":regexptime". */
+static regprog_T *regprof_first = NULL;	/* list of all programs */
+static int	regtime_on = FALSE;	/* measuring time */
+#endif
+
+static void	reg_cache_clear __ARGS((void));
+
+/*
+ * vim_regcomp() - get the compiled form of a regular expression
+ * Returns a program from the cache or a newly compiled one.  Returns NULL
+ * for an error.  Use vim_regfree() when done with it.
+ * "re_flags": RE_MAGIC and/or RE_STRING.
+ */
+    regprog_T *
+vim_regcomp(expr, re_flags)
+    char_u	*expr;
+    int		re_flags;
+{
+    regcache_T	*rc;
+    regprog_T	*prog;
+    int		flags = re_flags;
+    int		i;
+
+    if (expr == NULL)
+	EMSG_RET_NULL(_(e_null));
+
+#ifdef FEAT_SYN_HL
+    if (reg_do_extmatch != 0)
+	return reg_compile(expr, re_flags);
+#endif
+#ifdef FEAT_MBYTE
+    if (reg_cache_enc == NULL || STRCMP(reg_cache_enc, p_enc) != 0)
+    {
+	/* The cached programs are for another 'encoding'. */
+	reg_cache_clear();
+	reg_cache_enc = vim_strsave(p_enc);
+    }
+#endif
+    if (vim_strchr(p_cpo, CPO_LITERAL) != NULL)
+	flags |= RC_CPO_LIT;
+    if (vim_strchr(p_cpo, CPO_BACKSL) != NULL)
+	flags |= RC_CPO_BSL;
+
+    for (i = 0; i < REG_CACHE_SIZE; ++i)
+    {
+	rc = &reg_cache[i];
+	if (rc->rc_pat != NULL && rc->rc_flags == flags
+						&& STRCMP(rc->rc_pat, expr) == 0)
+	{
+	    ++reg_cache_hits;
+	    rc->rc_used = ++reg_cache_clock;
+	    ++rc->rc_prog->regrefcnt;
+#if defined(FEAT_SYN_HL) || defined(PROTO)
+	    had_eol = rc->rc_had_eol;
+#endif
+	    return rc->rc_prog;
+	}
+    }
+
+    ++reg_cache_misses;
+    reg_nocache = FALSE;
+    prog = reg_compile(expr, re_flags);
+    if (prog == NULL || reg_nocache)
+	return prog;
+
+    /* Use an unused entry or the one that was used least recently.  A
+     * program that is still being used is freed by its last user. */
+    rc = &reg_cache[0];
+    for (i = 1; i < REG_CACHE_SIZE && rc->rc_pat != NULL; ++i)
+	if (reg_cache[i].rc_pat == NULL
+				 || reg_cache[i].rc_used < rc->rc_used)
+	    rc = &reg_cache[i];
+    if (rc->rc_pat != NULL)
+    {
+	vim_free(rc->rc_pat);
+	vim_regfree(rc->rc_prog);
+    }
+    rc->rc_pat = vim_strsave(expr);
+    if (rc->rc_pat != NULL)
+    {
+	rc->rc_flags = flags;
+	rc->rc_prog = prog;
+	++prog->regrefcnt;
+#if defined(FEAT_SYN_HL) || defined(PROTO)
+	rc->rc_had_eol = had_eol;
+#endif
+	rc->rc_used = ++reg_cache_clock;
+    }
+    return prog;
+}
+
+/*
+ * Remove all programs from the cache.  Those still in use are freed by their
+ * last user.
+ */
+    static void
+reg_cache_clear()
+{
+    int		i;
+
+    for (i = 0; i < REG_CACHE_SIZE; ++i)
+	if (reg_cache[i].rc_pat != NULL)
+	{
+	    vim_free(reg_cache[i].rc_pat);
+	    reg_cache[i].rc_pat = NULL;
+	    vim_regfree(reg_cache[i].rc_prog);
+	}
+}
+
+/*
+ * reg_compile() - compile a regular expression into internal code
  * Returns the program in allocated space.  Returns NULL for an error.
  *
  * We can't allocate space until we know how big the compiled form will be,
@@ -1019,7 +1241,7 @@ skip_regexp(startp, dirc, magic, newp)
  * This also means that we don't allocate space until we are sure that the
  * thing really will compile successfully, and we never have to move the
  * code and thus invalidate pointers into it.  (Note that it has to be in
- * one piece because vim_free() must be able to free it all.)
+ * one piece because vim_regfree() must be able to free it all.)
  *
  * Whether upper/lower case is to be ignored is decided when executing the
  * program, it does not matter here.
@@ -1028,8 +1250,8 @@ skip_regexp(startp, dirc, magic, newp)
  * of the structure of the compiled regexp.
  * "re_flags": RE_MAGIC and/or RE_STRING.
  */
-    regprog_T *
-vim_regcomp(expr, re_flags)
+    static regprog_T *
+reg_compile(expr, re_flags)
     char_u	*expr;
     int		re_flags;
 {
@@ -1038,9 +1260,7 @@ vim_regcomp(expr, re_flags)
     char_u	*longest;
     int		len;
     int		flags;
-
-    if (expr == NULL)
-	EMSG_RET_NULL(_(e_null));
+    int		expensive;
 
     init_class_tab();
 
@@ -1060,7 +1280,13 @@ vim_regcomp(expr, re_flags)
 #endif
 
     /* Allocate space. */
+#ifdef FEAT_PROFILE
+    /* The pattern is kept after the program. */
+    r = (regprog_T *)lalloc(sizeof(regprog_T) + regsize
+					      + (long_u)STRLEN(expr) + 1, TRUE);
+#else
     r = (regprog_T *)lalloc(sizeof(regprog_T) + regsize, TRUE);
+#endif
     if (r == NULL)
 	return NULL;
 
@@ -1083,6 +1309,7 @@ vim_regcomp(expr, re_flags)
     r->reganch = 0;
     r->regmust = NULL;
     r->regmlen = 0;
+    r->regmrare = 0;
     r->regflags = regflags;
     if (flags & HASNL)
 	r->regflags |= RF_HASNL;
@@ -1092,6 +1319,25 @@ vim_regcomp(expr, re_flags)
     /* Remember whether this pattern has any \z specials in it. */
     r->reghasz = re_has_z;
 #endif
+    r->regdfa = NULL;
+    r->regexecs = 0;
+    r->regrefcnt = 1;
+    r->regid = ++reg_lastid;
+#ifdef FEAT_PROFILE
+    r->regsource = regcode;	/* just after the program */
+    STRCPY(r->regsource, expr);
+    r->regcount = 0;
+    r->regmatchcount = 0;
+    r->regmaxdepth = 0;
+    profile_zero(&r->regtotal);
+    r->regprof_prev = NULL;
+    r->regprof_next = regprof_first;
+    if (regprof_first != NULL)
+	regprof_first->regprof_prev = r;
+    regprof_first = r;
+#endif
+    if (!dfa_usable(r))
+	r->regflags |= RF_NODFA;
     scan = r->program + 1;	/* First BRANCH. */
     if (OP(regnext(scan)) == END)   /* Only one top-level choice. */
     {
@@ -1135,13 +1381,16 @@ vim_regcomp(expr, re_flags)
 	 * with the beginning of the r.e. and avoiding duplication
 	 * strengthens checking.  Not a strong reason, but sufficient in the
 	 * absence of others.
+	 * Looking for the regmust is cheap, thus for any r.e. that isn't
+	 * anchored use a string of two or more bytes.  Then the places where
+	 * regstart appears are only tried in lines that have it.
 	 */
 	/*
 	 * When the r.e. starts with BOW, it is faster to look for a regmust
 	 * first. Used a lot for "#" and "*" commands. (Added by mool).
 	 */
-	if ((flags & SPSTART || OP(scan) == BOW || OP(scan) == EOW)
-							  && !(flags & HASNL))
+	expensive = (flags & SPSTART || OP(scan) == BOW || OP(scan) == EOW);
+	if ((expensive || !r->reganch) && !(flags & HASNL))
 	{
 	    longest = NULL;
 	    len = 0;
@@ -1151,8 +1400,15 @@ vim_regcomp(expr, re_flags)
 		    longest = OPERAND(scan);
 		    len = (int)STRLEN(OPERAND(scan));
 		}
+	    if (!expensive && len < 2)
+	    {
+		longest = NULL;
+		len = 0;
+	    }
 	    r->regmust = longest;
 	    r->regmlen = len;
+	    if (longest != NULL)
+		r->regmrare = reg_rare_byte(longest, len);
 	}
     }
 #ifdef DEBUG
@@ -1161,6 +1417,38 @@ vim_regcomp(expr, re_flags)
     return r;
 }
 
+/*
+ * Return the index of the byte in "s[len]" that is least likely to appear in
+ * text.  Looking for it first finds fewer places where "s" doesn't match
+ * than looking for the first byte.
+ */
+    static int
+reg_rare_byte(s, len)
+    char_u	*s;
+    int		len;
+{
+    /* Bytes that are common in text and code, most common first. */
+    static char_u *common = (char_u *)
+	" etaoinsrhldcumfpgwybvkxjqz\t_,.;()=*/-\"'0123456789ETAOINSRHLDCUMFPGWYBVKXJQZ";
+    char_u	*p;
+    int		rank;
+    int		best_rank = -1;
+    int		best = 0;
+    int		i;
+
+    for (i = 0; i < len; ++i)
+    {
+	p = vim_strbyte(common, s[i]);
+	rank = p == NULL ? 256 : (int)(p - common);
+	if (rank > best_rank)
+	{
+	    best_rank = rank;
+	    best = i;
+	}
+    }
+    return best;
+}
+
 /*
  * Setup to parse the regexp.  Used once to get the length and once to do it.
  */
@@ -1361,6 +1649,7 @@ regbranch(flagp)
 	if (reg_toolong)
 	    break;
 	reginsert(MATCH, latest);
+	regflags |= RF_BACKTRACK;
 	chain = latest;
     }
 
@@ -1530,6 +1819,7 @@ regpiece(flagp)
 		if (lop == END)
 		    EMSG_M_RET_NULL(_("E59: invalid character after %s@"),
 						      reg_magic == MAGIC_ALL);
+		regflags |= RF_BACKTRACK;
 		/* Look behind must match with behind_pos. */
 		if (lop == BEHIND || lop == NOBEHIND)
 		{
@@ -1569,6 +1859,7 @@ regpiece(flagp)
 		regoptail(ret, ret);
 		reginsert_limits(BRACE_LIMITS, minval, maxval, ret);
 		++num_complex_braces;
+		regflags |= RF_BACKTRACK;
 	    }
 	    if (minval > 0 && maxval > 0)
 		*flagp = (HASWIDTH | (flags & (HASNL | HASLOOKBH)));
@@ -1637,10 +1928,12 @@ regatom(flagp)
 
       case Magic('<'):
 	ret = regnode(BOW);
+	regflags |= RF_ISK;
 	break;
 
       case Magic('>'):
 	ret = regnode(EOW);
+	regflags |= RF_ISK;
 	break;
 
       case Magic('_'):
@@ -1712,6 +2005,9 @@ regatom(flagp)
 	}
 #endif
 	ret = regnode(classcodes[p - classchars] + extra);
+	if (classcodes[p - classchars] == KWORD
+				       || classcodes[p - classchars] == SKWORD)
+	    regflags |= RF_ISK;
 	*flagp |= HASWIDTH | SIMPLE;
 	break;
 
@@ -1764,6 +2060,7 @@ regatom(flagp)
 	/* NOTREACHED */
 
       case Magic('~'):		/* previous substitute pattern */
+	    reg_nocache = TRUE;
 	    if (reg_prev_sub != NULL)
 	    {
 		char_u	    *lp;
@@ -1816,6 +2113,7 @@ regatom(flagp)
 			EMSG_RET_NULL(_("E65: Illegal back reference"));
 		}
 		ret = regnode(BACKREF + refnum);
+		regflags |= RF_BACKTRACK;
 	    }
 	    break;
 
@@ -1834,6 +2132,7 @@ regatom(flagp)
 			      return NULL;
 			  *flagp |= flags & (HASWIDTH|SPSTART|HASNL|HASLOOKBH);
 			  re_has_z = REX_SET;
+			  regflags |= RF_BACKTRACK;
 			  break;
 
 		case '1':
@@ -1848,6 +2147,7 @@ regatom(flagp)
 			      EMSG_RET_NULL(_("E67: \\z1 et al. not allowed here"));
 			  ret = regnode(ZREF + c - '0');
 			  re_has_z = REX_USE;
+			  regflags |= RF_BACKTRACK;
 			  break;
 #endif
 
@@ -1881,18 +2181,22 @@ regatom(flagp)
 		 * pattern -- regardless of whether or not it makes sense. */
 		case '^':
 		    ret = regnode(RE_BOF);
+		    regflags |= RF_BUFFER;
 		    break;
 
 		case '$':
 		    ret = regnode(RE_EOF);
+		    regflags |= RF_BUFFER;
 		    break;
 
 		case '#':
 		    ret = regnode(CURSOR);
+		    regflags |= RF_BUFFER;
 		    break;
 
 		case 'V':
 		    ret = regnode(RE_VISUAL);
+		    regflags |= RF_BUFFER;
 		    break;
 
 		/* \%[abc]: Emit as a list of branches, all ending at the last
@@ -2011,6 +2315,7 @@ regatom(flagp)
 				  /* "\%'m", "\%<'m" and "\%>'m": Mark */
 				  c = getchr();
 				  ret = regnode(RE_MARK);
+				  regflags |= RF_BUFFER;
 				  if (ret == JUST_CALC_SIZE)
 				      regsize += 2;
 				  else
@@ -2028,6 +2333,8 @@ regatom(flagp)
 				      ret = regnode(RE_COL);
 				  else
 				      ret = regnode(RE_VCOL);
+				  if (c != 'c')
+				      regflags |= RF_BUFFER;
 				  if (ret == JUST_CALC_SIZE)
 				      regsize += 5;
 				  else
@@ -3053,22 +3360,6 @@ read_limits(minval, maxval)
  * vim_regexec and friends
  */
 
-/*
- * Global work variables for vim_regexec().
- */
-
-/* The current match-position is remembered with these variables: */
-static linenr_T	reglnum;	/* line number, relative to first line */
-static char_u	*regline;	/* start of current line */
-static char_u	*reginput;	/* current input, points into "regline" */
-
-static int	need_clear_subexpr;	/* subexpressions still need to be
-					 * cleared */
-#ifdef FEAT_SYN_HL
-static int	need_clear_zsubexpr = FALSE;	/* extmatch subexpressions
-						 * still need to be cleared */
-#endif
-
 /*
  * Structure used to save the current input state, when it needs to be
  * restored after trying a match.  Used by reg_save() and reg_restore().
@@ -3104,25 +3395,45 @@ typedef struct regbehind_S
     save_se_T   save_end[NSUBEXP];
 } regbehind_T;
 
-static char_u	*reg_getline __ARGS((linenr_T lnum));
-static long	vim_regexec_both __ARGS((char_u *line, colnr_T col, proftime_T *tm));
-static long	regtry __ARGS((regprog_T *prog, colnr_T col));
-static void	cleanup_subexpr __ARGS((void));
+/* DFA cache of a regprog, see dfa_check() */
+typedef struct regdfa_S regdfa_T;
+
+static void	rex_clear __ARGS((regexec_T *rex));
+static char_u	*reg_getline __ARGS((regexec_T *rex, linenr_T lnum));
+static void	reg_emsg __ARGS((regexec_T *rex, char *s));
+static void	reg_breakcheck __ARGS((regexec_T *rex));
+static char_u	*reg_alloc_clear __ARGS((regexec_T *rex, unsigned size));
+static int	reg_ga_grow __ARGS((regexec_T *rex, garray_T *gap, int n));
+static int	reg_iswordc __ARGS((regexec_T *rex, int c));
+static int	reg_iswordp __ARGS((regexec_T *rex, char_u *p));
+#ifdef FEAT_MBYTE
+static int	reg_get_class __ARGS((regexec_T *rex, char_u *p));
+#endif
+static void	rex_init_string __ARGS((regexec_T *rex, regmatch_T *rmp, int line_lbr));
+static long	vim_regexec_both __ARGS((regexec_T *rex, char_u *line, colnr_T col, proftime_T *tm));
+static char_u	*reg_find_must __ARGS((regexec_T *rex, regprog_T *prog, char_u *s));
+static colnr_T	reg_start_col __ARGS((regexec_T *rex, regprog_T *prog, colnr_T col));
+static long	regtry __ARGS((regexec_T *rex, regprog_T *prog, colnr_T col));
+static long	nfa_regexec __ARGS((regexec_T *rex, regprog_T *prog, char_u *line, colnr_T col, proftime_T *tm));
+static int	dfa_check __ARGS((regexec_T *rex, regprog_T *prog, char_u *line, colnr_T col));
+static void	dfa_free __ARGS((regdfa_T *dfa));
+static void	cleanup_subexpr __ARGS((regexec_T *rex));
 #ifdef FEAT_SYN_HL
-static void	cleanup_zsubexpr __ARGS((void));
+static void	cleanup_zsubexpr __ARGS((regexec_T *rex));
 #endif
-static void	save_subexpr __ARGS((regbehind_T *bp));
-static void	restore_subexpr __ARGS((regbehind_T *bp));
-static void	reg_nextline __ARGS((void));
-static void	reg_save __ARGS((regsave_T *save, garray_T *gap));
-static void	reg_restore __ARGS((regsave_T *save, garray_T *gap));
-static int	reg_save_equal __ARGS((regsave_T *save));
-static void	save_se_multi __ARGS((save_se_T *savep, lpos_T *posp));
-static void	save_se_one __ARGS((save_se_T *savep, char_u **pp));
+static void	save_subexpr __ARGS((regexec_T *rex, regbehind_T *bp));
+static void	restore_subexpr __ARGS((regexec_T *rex, regbehind_T *bp));
+static void	reg_nextline __ARGS((regexec_T *rex));
+static void	reg_save __ARGS((regexec_T *rex, regsave_T *save, garray_T *gap));
+static void	reg_restore __ARGS((regexec_T *rex, regsave_T *save, garray_T *gap));
+static int	reg_save_equal __ARGS((regexec_T *rex, regsave_T *save));
+static void	save_se_multi __ARGS((regexec_T *rex, save_se_T *savep, lpos_T *posp));
+static void	save_se_one __ARGS((regexec_T *rex, save_se_T *savep, char_u **pp));
 
 /* Save the sub-expressions before attempting a match. */
 #define save_se(savep, posp, pp) \
-    REG_MULTI ? save_se_multi((savep), (posp)) : save_se_one((savep), (pp))
+    REG_MULTI ? save_se_multi(rex, (savep), (posp)) \
+	      : save_se_one(rex, (savep), (pp))
 
 /* After a failed match restore the sub-expressions. */
 #define restore_se(savep, posp, pp) { \
@@ -3132,70 +3443,26 @@ static void	save_se_one __ARGS((save_se_T *savep, char_u **pp));
 	*(pp) = (savep)->se_u.ptr; }
 
 static int	re_num_cmp __ARGS((long_u val, char_u *scan));
-static int	regmatch __ARGS((char_u *prog));
-static int	regrepeat __ARGS((char_u *p, long maxcount));
+static int	regmatch __ARGS((regexec_T *rex, char_u *prog));
+static int	reg_match_item __ARGS((regexec_T *rex, char_u *scan));
+static int	regrepeat __ARGS((regexec_T *rex, char_u *p, long maxcount));
 
 #ifdef DEBUG
 int		regnarrate = 0;
 #endif
 
-/*
- * Internal copy of 'ignorecase'.  It is set at each call to vim_regexec().
- * Normally it gets the value of "rm_ic" or "rmm_ic", but when the pattern
- * contains '\c' or '\C' the value is overruled.
- */
-static int	ireg_ic;
-
-#ifdef FEAT_MBYTE
-/*
- * Similar to ireg_ic, but only for 'combining' characters.  Set with \Z flag
- * in the regexp.  Defaults to false, always.
- */
-static int	ireg_icombine;
-#endif
-
-/*
- * Copy of "rmm_maxcol": maximum column to search for a match.  Zero when
- * there is no maximum.
- */
-static colnr_T	ireg_maxcol;
+/* When 'regexpengine' is zero regmatch() gives up after this many loops for
+ * one start position. */
+#define REG_BT_LIMIT	10000L
 
-/*
- * Sometimes need to save a copy of a line.  Since alloc()/free() is very
- * slow, we keep one allocated piece of memory and only re-allocate it when
- * it's too small.  It's freed in vim_regexec_both() when finished.
- */
-static char_u	*reg_tofree = NULL;
-static unsigned	reg_tofreelen;
+/* TRUE if using multi-line regexp. */
+#define REG_MULTI	(rex->reg_match == NULL)
 
-/*
- * These variables are set when executing a regexp to speed up the execution.
- * Which ones are set depends on whether a single-line or multi-line match is
- * done:
- *			single-line		multi-line
- * reg_match		&regmatch_T		NULL
- * reg_mmatch		NULL			&regmmatch_T
- * reg_startp		reg_match->startp	<invalid>
- * reg_endp		reg_match->endp		<invalid>
- * reg_startpos		<invalid>		reg_mmatch->startpos
- * reg_endpos		<invalid>		reg_mmatch->endpos
- * reg_win		NULL			window in which to search
- * reg_buf		<invalid>		buffer in which to search
- * reg_firstlnum	<invalid>		first line in which to search
- * reg_maxline		0			last line nr
- * reg_line_lbr		FALSE or TRUE		FALSE
- */
-static regmatch_T	*reg_match;
-static regmmatch_T	*reg_mmatch;
-static char_u		**reg_startp = NULL;
-static char_u		**reg_endp = NULL;
-static lpos_T		*reg_startpos = NULL;
-static lpos_T		*reg_endpos = NULL;
-static win_T		*reg_win;
-static buf_T		*reg_buf;
-static linenr_T		reg_firstlnum;
-static linenr_T		reg_maxline;
-static int		reg_line_lbr;	    /* "\n" in string is line break */
+/* The main thread checks for CTRL-C, a detached context checks the flag its
+ * owner sets to stop matching, see "reg_detached". */
+#define REG_GOT_INT	(rex->reg_detached \
+			    ? rex->reg_cancel != NULL && *rex->reg_cancel \
+			    : got_int)
 
 /* Values for rs_state in regitem_T. */
 typedef enum regstate_E
@@ -3236,8 +3503,8 @@ typedef struct regitem_S
     short	rs_no;		/* submatch nr or BEHIND/NOBEHIND */
 } regitem_T;
 
-static regitem_T *regstack_push __ARGS((regstate_T state, char_u *scan));
-static void regstack_pop __ARGS((char_u **scan));
+static regitem_T *regstack_push __ARGS((regexec_T *rex, regstate_T state, char_u *scan));
+static void regstack_pop __ARGS((regexec_T *rex, char_u **scan));
 
 /* used for STAR, PLUS and BRACE_SIMPLE matching */
 typedef struct regstar_S
@@ -3257,16 +3524,6 @@ typedef struct backpos_S
     regsave_T	bp_pos;		/* last input position */
 } backpos_T;
 
-/*
- * "regstack" and "backpos" are used by regmatch().  They are kept over calls
- * to avoid invoking malloc() and free() often.
- * "regstack" is a stack with regitem_T items, sometimes preceded by regstar_T
- * or regbehind_T.
- * "backpos_T" is a table with backpos_T for BACK
- */
-static garray_T	regstack = {0, 0, 0, 0, NULL};
-static garray_T	backpos = {0, 0, 0, 0, NULL};
-
 /*
  * Both for regstack and backpos tables we use the following strategy of
  * allocation (to reduce malloc/free calls):
@@ -3281,13 +3538,289 @@ static garray_T	backpos = {0, 0, 0, 0, NULL};
 #define REGSTACK_INITIAL	2048
 #define BACKPOS_INITIAL		64
 
+/*
+ * Used by the NFA engine, see nfa_regexec().
+ */
+typedef struct
+{
+    char_u	*nt_scan;		/* node to try next */
+    lpos_T	nt_pos;			/* text position */
+    long	nt_count;		/* STAR, PLUS or BRACE_SIMPLE count */
+    long	nt_minval;		/* BRACE_SIMPLE limits */
+    long	nt_maxval;
+    int		nt_more;		/* match the operand at "nt_scan" once
+					 * more */
+    lpos_T	nt_startpos[NSUBEXP];	/* \( and \zs positions */
+    lpos_T	nt_endpos[NSUBEXP];	/* \) and \ze positions */
+} nfathread_T;
+
+/* STAR, PLUS and BRACE_SIMPLE reached with another count are not the same
+ * thread, these are remembered in "nfa_counted" */
+typedef struct
+{
+    char_u	*nc_scan;
+    long	nc_count;
+} nfacount_T;
+
+#define NFA_LIST_INITIAL	64
+
+/*
+ * Everything that changes while executing a regexp.  One regprog_T can be
+ * executed with several of these at the same time, e.g. in other threads.
+ * vim_regexec(), vim_regexec_nl(), vim_regexec_multi() and vim_regsub() use
+ * "rex_main", vim_regexec_alloc() returns another one.
+ */
+struct regexec_S
+{
+    /* The current match-position. */
+    linenr_T	lnum;		/* line number, relative to first line */
+    char_u	*line;		/* start of current line */
+    char_u	*input;		/* current input, points into "line" */
+
+    int		need_clear_subexpr;	/* subexpressions still need to be
+					 * cleared */
+#ifdef FEAT_SYN_HL
+    int		need_clear_zsubexpr;	/* extmatch subexpressions still need
+					 * to be cleared */
+#endif
+
+    /*
+     * Internal copy of 'ignorecase'.  It is set at each call to
+     * vim_regexec().  Normally it gets the value of "rm_ic" or "rmm_ic", but
+     * when the pattern contains '\c' or '\C' the value is overruled.
+     */
+    int		reg_ic;
+#ifdef FEAT_MBYTE
+    /* Similar to "reg_ic", but only for 'combining' characters.  Set with
+     * \Z flag in the regexp.  Defaults to false, always. */
+    int		reg_icombine;
+#endif
+    /* Copy of "rmm_maxcol": maximum column to search for a match.  Zero when
+     * there is no maximum. */
+    colnr_T	reg_maxcol;
+
+    /* When 'regexpengine' is zero regmatch() gives up after "reg_bt_limit"
+     * loops for one start position and the NFA engine takes over,
+     * "reg_bt_gaveup" is set then.  When "reg_bt_limit" is zero there is no
+     * limit. */
+    long	reg_bt_limit;
+    long	reg_bt_count;
+    int		reg_bt_gaveup;
+
+    /* Sometimes need to save a copy of a line.  Since alloc()/free() is very
+     * slow, we keep one allocated piece of memory and only re-allocate it
+     * when it's too small.  It's freed in vim_regexec_both() when finished. */
+    char_u	*reg_tofree;
+    unsigned	reg_tofreelen;
+
+    /*
+     * These are set when executing a regexp to speed up the execution.
+     * Which ones are set depends on whether a single-line or multi-line match
+     * is done:
+     *			single-line		multi-line
+     * reg_match	&regmatch_T		NULL
+     * reg_mmatch	NULL			&regmmatch_T
+     * reg_startp	reg_match->startp	<invalid>
+     * reg_endp		reg_match->endp		<invalid>
+     * reg_startpos	<invalid>		reg_mmatch->startpos
+     * reg_endpos	<invalid>		reg_mmatch->endpos
+     * reg_win		NULL			window in which to search
+     * reg_buf		curbuf			buffer in which to search
+     * reg_firstlnum	<invalid>		first line in which to search
+     * reg_maxline	0			last line nr
+     * reg_line_lbr	FALSE or TRUE		FALSE
+     */
+    regmatch_T	*reg_match;
+    regmmatch_T	*reg_mmatch;
+    char_u	**reg_startp;
+    char_u	**reg_endp;
+    lpos_T	*reg_startpos;
+    lpos_T	*reg_endpos;
+    win_T	*reg_win;
+    buf_T	*reg_buf;
+    linenr_T	reg_firstlnum;
+    linenr_T	reg_maxline;
+    int		reg_line_lbr;	    /* "\n" in string is line break */
+
+    /* 'iskeyword' table: "b_chartab" of "reg_buf", or "reg_ownchartab". */
+    char_u	*reg_chartab;
+    char_u	reg_ownchartab[32];
+
+    /* Set by vim_regexec_alloc(): may be used outside of the main thread.
+     * Doesn't use the DFA cache or ":regexptime", doesn't export \z()
+     * matches, checks "*reg_cancel" instead of CTRL-C and instead of giving
+     * an error message sets "reg_failed". */
+    int		reg_detached;
+    int		reg_failed;
+    volatile int *reg_cancel;	    /* set to TRUE by the owner, may be NULL */
+
+    /*
+     * "regstack" and "backpos" are used by regmatch().  They are kept over
+     * calls to avoid invoking malloc() and free() often.
+     * "regstack" is a stack with regitem_T items, sometimes preceded by
+     * regstar_T or regbehind_T.
+     * "backpos_T" is a table with backpos_T for BACK
+     */
+    garray_T	regstack;
+    garray_T	backpos;
+#ifdef FEAT_PROFILE
+    long	regstack_depth;		/* items on "regstack" */
+    long	regstack_maxdepth;	/* largest "regstack_depth" */
+#endif
+
+    regsave_T	behind_pos;
+
+#ifdef FEAT_SYN_HL
+    char_u	*reg_startzp[NSUBEXP];	/* Workspace to mark beginning */
+    char_u	*reg_endzp[NSUBEXP];	/*   and end of \z(...\) matches */
+    lpos_T	reg_startzpos[NSUBEXP];	/* idem, beginning pos */
+    lpos_T	reg_endzpos[NSUBEXP];	/* idem, end pos */
+#endif
+
+    /*
+     * "nfa_list" has the threads for the current position and the positions
+     * after it, "nfa_next" gets the threads for the next step.  "nfa_stack"
+     * is used to try the alternatives of a thread in the right order.
+     * "nfa_visited" has the step number at which each byte of the program
+     * was last tried.  Like "regstack" they are kept over calls.
+     */
+    garray_T	nfa_list;
+    garray_T	nfa_next;
+    garray_T	nfa_stack;
+    garray_T	nfa_counted;
+    int		*nfa_visited;
+    int		nfa_visited_len;
+    int		nfa_step;
+};
+
+static regexec_T rex_main;
+
+/*
+ * Used by the DFA cache, see dfa_check().
+ * A state is the set of nodes that wait for a character: a character or class
+ * node, an EXACTLY node ("di_count" is the index in the string), a STAR or
+ * PLUS node or the BRACE_LIMITS before a BRACE_SIMPLE ("di_count" is the
+ * count), and EOL, BOW and EOW nodes, they wait for the next character.
+ */
+typedef struct
+{
+    char_u	*di_scan;
+    long	di_count;
+} dfaitem_T;
+
+typedef struct
+{
+    short	ds_next[256];	/* next state for each byte, DFA_NONE when not
+				   known yet */
+    char	ds_prev;	/* DFA_AT_BOL, DFA_AFTER_WORD or
+				   DFA_AFTER_OTHER */
+    char	ds_match;	/* END was reached */
+    char	ds_eolmatch;	/* END is reached at the end of the line, MAYBE
+				   when not known yet */
+    int		ds_len;		/* number of items in "ds_items" */
+    dfaitem_T	ds_items[1];	/* actually longer */
+} dfastate_T;
+
+struct regdfa_S
+{
+    regprog_T	*rd_prog;	/* program this is for, NULL when unused */
+    int		rd_ic;		/* "rex->reg_ic" the states are for */
+    char_u	rd_chartab[32];	/* "b_chartab" the states are for, when the
+				   program has RF_WORD */
+    garray_T	rd_states;	/* pointers to dfastate_T */
+    short	rd_start[3];	/* start state for each "ds_prev" */
+    long	rd_size;	/* bytes used for the states */
+    long	rd_used;	/* "dfa_clock" when last used */
+};
+
+#define DFA_CACHE_SIZE	128	/* number of programs that have a DFA */
+#define DFA_BUDGET	65536L	/* maximum number of bytes for one DFA */
+#define DFA_HOT		3	/* times a program runs before it gets a DFA */
+#define DFA_NONE	(-1)
+
+/* What is before the current position, "ds_prev". */
+#define DFA_AT_BOL	0	/* the start of the line */
+#define DFA_AFTER_WORD	1	/* a keyword character */
+#define DFA_AFTER_OTHER	2	/* another character */
+
+#define DFA_UNKNOWN	(-1)	/* next character for dfa_add() not known */
+
+static regdfa_T	dfa_cache[DFA_CACHE_SIZE];
+static long	dfa_clock = 0;
+static garray_T	dfa_items = {0, 0, 0, 0, NULL};
+static garray_T	dfa_stack = {0, 0, 0, 0, NULL};
+static garray_T	dfa_now = {0, 0, 0, 0, NULL};
+
+/* Counters for ":regexpstats". */
+static long	dfa_hits = 0;		/* transitions found in the cache */
+static long	dfa_misses = 0;		/* transitions added to the cache */
+static long	dfa_nomatch = 0;	/* lines the engine didn't try */
+static long	dfa_tried = 0;		/* lines the engine did try */
+static long	dfa_dropped = 0;	/* DFAs that went over DFA_BUDGET */
+
+/*
+ * Free a program returned by vim_regcomp(), when this was the last user.
+ * "prog" may be NULL.
+ */
+    void
+vim_regfree(prog)
+    regprog_T	*prog;
+{
+    if (prog == NULL || --prog->regrefcnt > 0)
+	return;
+#ifdef FEAT_PROFILE
+    if (prog->regprof_prev == NULL)
+	regprof_first = prog->regprof_next;
+    else
+	prog->regprof_prev->regprof_next = prog->regprof_next;
+    if (prog->regprof_next != NULL)
+	prog->regprof_next->regprof_prev = prog->regprof_prev;
+#endif
+    /* Release the DFA, another program may get the same address. */
+    if (prog->regdfa != NULL && prog->regdfa->rd_prog == prog)
+	dfa_free(prog->regdfa);
+    vim_free(prog);
+}
+
+/*
+ * Free the memory "rex" keeps over calls.
+ */
+    static void
+rex_clear(rex)
+    regexec_T	*rex;
+{
+    ga_clear(&rex->regstack);
+    ga_clear(&rex->backpos);
+    ga_clear(&rex->nfa_list);
+    ga_clear(&rex->nfa_next);
+    ga_clear(&rex->nfa_stack);
+    ga_clear(&rex->nfa_counted);
+    vim_free(rex->nfa_visited);
+    rex->nfa_visited = NULL;
+    rex->nfa_visited_len = 0;
+    vim_free(rex->reg_tofree);
+    rex->reg_tofree = NULL;
+    rex->reg_tofreelen = 0;
+}
+
 #if defined(EXITFREE) || defined(PROTO)
     void
 free_regexp_stuff()
 {
-    ga_clear(&regstack);
-    ga_clear(&backpos);
-    vim_free(reg_tofree);
+    rex_clear(&rex_main);
+    {
+	int	i;
+
+	for (i = 0; i < DFA_CACHE_SIZE; ++i)
+	    dfa_free(&dfa_cache[i]);
+    }
+    ga_clear(&dfa_items);
+    ga_clear(&dfa_stack);
+    ga_clear(&dfa_now);
+    reg_cache_clear();
+# ifdef FEAT_MBYTE
+    vim_free(reg_cache_enc);
+# endif
     vim_free(reg_prev_sub);
 }
 #endif
@@ -3296,87 +3829,231 @@ free_regexp_stuff()
  * Get pointer to the line "lnum", which is relative to "reg_firstlnum".
  */
     static char_u *
-reg_getline(lnum)
+reg_getline(rex, lnum)
+    regexec_T	*rex;
     linenr_T	lnum;
 {
     /* when looking behind for a match/no-match lnum is negative.  But we
      * can't go before line 1 */
-    if (reg_firstlnum + lnum < 1)
+    if (rex->reg_firstlnum + lnum < 1)
 	return NULL;
-    if (lnum > reg_maxline)
+    if (lnum > rex->reg_maxline)
 	/* Must have matched the "\n" in the last line. */
 	return (char_u *)"";
-    return ml_get_buf(reg_buf, reg_firstlnum + lnum, FALSE);
+    return ml_get_buf(rex->reg_buf, rex->reg_firstlnum + lnum, FALSE);
 }
 
-static regsave_T behind_pos;
-
-#ifdef FEAT_SYN_HL
-static char_u	*reg_startzp[NSUBEXP];	/* Workspace to mark beginning */
-static char_u	*reg_endzp[NSUBEXP];	/*   and end of \z(...\) matches */
-static lpos_T	reg_startzpos[NSUBEXP];	/* idem, beginning pos */
-static lpos_T	reg_endzpos[NSUBEXP];	/* idem, end pos */
-#endif
-
-/* TRUE if using multi-line regexp. */
-#define REG_MULTI	(reg_match == NULL)
+/*
+ * Give error message "s", for a detached context only remember that
+ * something went wrong.
+ */
+    static void
+reg_emsg(rex, s)
+    regexec_T	*rex;
+    char	*s;
+{
+    if (rex->reg_detached)
+	rex->reg_failed = TRUE;
+    else
+	EMSG(s);
+}
 
 /*
- * Match a regexp against a string.
- * "rmp->regprog" is a compiled regexp as returned by vim_regcomp().
- * Uses curbuf for line count and 'iskeyword'.
- *
- * Return TRUE if there is a match, FALSE if not.
+ * Check for CTRL-C, not in a detached context: there REG_GOT_INT only checks
+ * "reg_cancel".
  */
-    int
-vim_regexec(rmp, line, col)
-    regmatch_T	*rmp;
-    char_u	*line;	/* string to match against */
-    colnr_T	col;	/* column to start looking for match */
+    static void
+reg_breakcheck(rex)
+    regexec_T	*rex;
 {
-    reg_match = rmp;
-    reg_mmatch = NULL;
-    reg_maxline = 0;
-    reg_line_lbr = FALSE;
-    reg_win = NULL;
-    ireg_ic = rmp->rm_ic;
-#ifdef FEAT_MBYTE
-    ireg_icombine = FALSE;
-#endif
-    ireg_maxcol = 0;
-    return (vim_regexec_both(line, col, NULL) != 0);
+    if (!rex->reg_detached)
+	fast_breakcheck();
 }
 
-#if defined(FEAT_MODIFY_FNAME) || defined(FEAT_EVAL) \
-	|| defined(FIND_REPLACE_DIALOG) || defined(PROTO)
 /*
- * Like vim_regexec(), but consider a "\n" in "line" to be a line break.
+ * Like alloc_clear(), for memory used while matching with "rex".  A detached
+ * context may be used outside of the main thread, where alloc() must not try
+ * to release memory or give a message: use malloc() and set "reg_failed".
  */
-    int
-vim_regexec_nl(rmp, line, col)
-    regmatch_T	*rmp;
-    char_u	*line;	/* string to match against */
-    colnr_T	col;	/* column to start looking for match */
+    static char_u *
+reg_alloc_clear(rex, size)
+    regexec_T	*rex;
+    unsigned	size;
 {
-    reg_match = rmp;
-    reg_mmatch = NULL;
-    reg_maxline = 0;
-    reg_line_lbr = TRUE;
-    reg_win = NULL;
-    ireg_ic = rmp->rm_ic;
-#ifdef FEAT_MBYTE
-    ireg_icombine = FALSE;
+    char_u	*p;
+
+    if (!rex->reg_detached)
+	return alloc_clear(size);
+#ifdef MEM_PROFILE
+    /* vim_free() expects the size in front of the block */
+    p = lalloc((long_u)size, FALSE);
+#else
+    p = (char_u *)malloc((size_t)size);
 #endif
-    ireg_maxcol = 0;
-    return (vim_regexec_both(line, col, NULL) != 0);
+    if (p == NULL)
+	rex->reg_failed = TRUE;
+    else
+	vim_memset(p, 0, (size_t)size);
+    return p;
 }
-#endif
 
 /*
- * Match a regexp against multiple lines.
- * "rmp->regprog" is a compiled regexp as returned by vim_regcomp().
- * Uses curbuf for line count and 'iskeyword'.
- *
+ * Like ga_grow(), using reg_alloc_clear().
+ */
+    static int
+reg_ga_grow(rex, gap, n)
+    regexec_T	*rex;
+    garray_T	*gap;
+    int		n;
+{
+    char_u	*pp;
+
+    if (!rex->reg_detached)
+	return ga_grow(gap, n);
+    if (gap->ga_maxlen - gap->ga_len < n)
+    {
+	if (n < gap->ga_growsize)
+	    n = gap->ga_growsize;
+	pp = reg_alloc_clear(rex,
+			     (unsigned)(gap->ga_itemsize * (gap->ga_len + n)));
+	if (pp == NULL)
+	    return FAIL;
+	gap->ga_maxlen = gap->ga_len + n;
+	if (gap->ga_data != NULL)
+	{
+	    mch_memmove(pp, gap->ga_data,
+				      (size_t)(gap->ga_itemsize * gap->ga_len));
+	    vim_free(gap->ga_data);
+	}
+	gap->ga_data = pp;
+    }
+    return OK;
+}
+
+/* Like GET_CHARTAB() in charset.c, for the 'iskeyword' of "rex". */
+#define REG_CHARTAB(rex, c) \
+	((rex)->reg_chartab[(unsigned)(c) >> 3] & (1 << ((c) & 0x7)))
+
+/*
+ * Like vim_iswordc(), but using the 'iskeyword' of "rex".
+ */
+    static int
+reg_iswordc(rex, c)
+    regexec_T	*rex;
+    int		c;
+{
+#ifdef FEAT_MBYTE
+    if (c >= 0x100)
+    {
+	if (enc_dbcs != 0)
+	    return dbcs_class((unsigned)c >> 8, (unsigned)(c & 0xff)) >= 2;
+	if (enc_utf8)
+	    return utf_class(c) >= 2;
+    }
+#endif
+    return (c > 0 && c < 0x100 && REG_CHARTAB(rex, c) != 0);
+}
+
+/*
+ * Like vim_iswordp(), but using the 'iskeyword' of "rex".
+ */
+    static int
+reg_iswordp(rex, p)
+    regexec_T	*rex;
+    char_u	*p;
+{
+#ifdef FEAT_MBYTE
+    if (has_mbyte && MB_BYTE2LEN(*p) > 1)
+	return mb_get_class(p) >= 2;
+#endif
+    return REG_CHARTAB(rex, *p) != 0;
+}
+
+#ifdef FEAT_MBYTE
+/*
+ * Like mb_get_class(), but using the 'iskeyword' of "rex".
+ */
+    static int
+reg_get_class(rex, p)
+    regexec_T	*rex;
+    char_u	*p;
+{
+    if (MB_BYTE2LEN(p[0]) == 1)
+    {
+	if (p[0] == NUL || vim_iswhite(p[0]))
+	    return 0;
+	if (reg_iswordc(rex, p[0]))
+	    return 2;
+	return 1;
+    }
+    return mb_get_class(p);
+}
+#endif
+
+/*
+ * Set up "rex" for matching "rmp" against a string.
+ */
+    static void
+rex_init_string(rex, rmp, line_lbr)
+    regexec_T	*rex;
+    regmatch_T	*rmp;
+    int		line_lbr;
+{
+    rex->reg_match = rmp;
+    rex->reg_mmatch = NULL;
+    rex->reg_maxline = 0;
+    rex->reg_line_lbr = line_lbr;
+    rex->reg_win = NULL;
+    rex->reg_ic = rmp->rm_ic;
+#ifdef FEAT_MBYTE
+    rex->reg_icombine = FALSE;
+#endif
+    rex->reg_maxcol = 0;
+    if (!rex->reg_detached)
+    {
+	rex->reg_buf = curbuf;
+	rex->reg_chartab = curbuf->b_chartab;
+    }
+}
+
+/*
+ * Match a regexp against a string.
+ * "rmp->regprog" is a compiled regexp as returned by vim_regcomp().
+ * Uses curbuf for line count and 'iskeyword'.
+ *
+ * Return TRUE if there is a match, FALSE if not.
+ */
+    int
+vim_regexec(rmp, line, col)
+    regmatch_T	*rmp;
+    char_u	*line;	/* string to match against */
+    colnr_T	col;	/* column to start looking for match */
+{
+    rex_init_string(&rex_main, rmp, FALSE);
+    return (vim_regexec_both(&rex_main, line, col, NULL) != 0);
+}
+
+#if defined(FEAT_MODIFY_FNAME) || defined(FEAT_EVAL) \
+	|| defined(FIND_REPLACE_DIALOG) || defined(PROTO)
+/*
+ * Like vim_regexec(), but consider a "\n" in "line" to be a line break.
+ */
+    int
+vim_regexec_nl(rmp, line, col)
+    regmatch_T	*rmp;
+    char_u	*line;	/* string to match against */
+    colnr_T	col;	/* column to start looking for match */
+{
+    rex_init_string(&rex_main, rmp, TRUE);
+    return (vim_regexec_both(&rex_main, line, col, NULL) != 0);
+}
+#endif
+
+/*
+ * Match a regexp against multiple lines.
+ * "rmp->regprog" is a compiled regexp as returned by vim_regcomp().
+ * Uses curbuf for line count and 'iskeyword'.
+ *
  * Return zero if there is no match.  Return number of lines contained in the
  * match otherwise.
  */
@@ -3389,36 +4066,104 @@ vim_regexec_multi(rmp, win, buf, lnum, col, tm)
     colnr_T	col;		/* column to start looking for match */
     proftime_T	*tm;		/* timeout limit or NULL */
 {
+    regexec_T	*rex = &rex_main;
     long	r;
     buf_T	*save_curbuf = curbuf;
 
-    reg_match = NULL;
-    reg_mmatch = rmp;
-    reg_buf = buf;
-    reg_win = win;
-    reg_firstlnum = lnum;
-    reg_maxline = reg_buf->b_ml.ml_line_count - lnum;
-    reg_line_lbr = FALSE;
-    ireg_ic = rmp->rmm_ic;
+    rex->reg_match = NULL;
+    rex->reg_mmatch = rmp;
+    rex->reg_buf = buf;
+    rex->reg_chartab = buf->b_chartab;
+    rex->reg_win = win;
+    rex->reg_firstlnum = lnum;
+    rex->reg_maxline = rex->reg_buf->b_ml.ml_line_count - lnum;
+    rex->reg_line_lbr = FALSE;
+    rex->reg_ic = rmp->rmm_ic;
 #ifdef FEAT_MBYTE
-    ireg_icombine = FALSE;
+    rex->reg_icombine = FALSE;
 #endif
-    ireg_maxcol = rmp->rmm_maxcol;
+    rex->reg_maxcol = rmp->rmm_maxcol;
 
-    /* Need to switch to buffer "buf" to make vim_iswordc() work. */
+    /* Need to switch to buffer "buf" for marks and the Visual area. */
     curbuf = buf;
-    r = vim_regexec_both(NULL, col, tm);
+    r = vim_regexec_both(rex, NULL, col, tm);
     curbuf = save_curbuf;
 
     return r;
 }
 
+/*
+ * Allocate a context for executing regexps with vim_regexec_rex().  Unlike
+ * vim_regexec() it may be used in another thread, as long as every thread
+ * uses its own context.  Several threads can match the same regprog_T at the
+ * same time.  Uses the 'iskeyword' of curbuf at the time of this call.
+ * When "cancel" is not NULL matching stops soon after another thread set
+ * "*cancel" to TRUE, like for CTRL-C in the main thread.
+ * Returns NULL when out of memory.  Use vim_regexec_free() when done.
+ */
+    regexec_T *
+vim_regexec_alloc(cancel)
+    volatile int *cancel;
+{
+    regexec_T	*rex;
+
+    rex = (regexec_T *)alloc_clear((unsigned)sizeof(regexec_T));
+    if (rex != NULL)
+    {
+	rex->reg_detached = TRUE;
+	rex->reg_cancel = cancel;
+	mch_memmove(rex->reg_ownchartab, curbuf->b_chartab, 32);
+	rex->reg_chartab = rex->reg_ownchartab;
+    }
+    return rex;
+}
+
+/*
+ * Free a context returned by vim_regexec_alloc().  "rex" may be NULL.
+ */
+    void
+vim_regexec_free(rex)
+    regexec_T	*rex;
+{
+    if (rex != NULL)
+    {
+	rex_clear(rex);
+	vim_free(rex);
+    }
+}
+
+/*
+ * Like vim_regexec(), but using context "rex" from vim_regexec_alloc().
+ * The pattern must be usable for one line, see re_linelocal().  Does not
+ * give error messages: when the pattern could not be matched, e.g. because
+ * it needs too much memory or matching was cancelled, "*failed" is set to
+ * TRUE.
+ */
+    int
+vim_regexec_rex(rex, rmp, line, col, failed)
+    regexec_T	*rex;
+    regmatch_T	*rmp;
+    char_u	*line;	/* string to match against */
+    colnr_T	col;	/* column to start looking for match */
+    int		*failed;
+{
+    long	r;
+
+    rex_init_string(rex, rmp, FALSE);
+    rex->reg_failed = FALSE;
+    r = vim_regexec_both(rex, line, col, NULL);
+    if (rex->reg_failed || REG_GOT_INT)
+	*failed = TRUE;
+    return (r != 0);
+}
+
 /*
  * Match a regexp against a string ("line" points to the string) or multiple
  * lines ("line" is NULL, use reg_getline()).
  */
     static long
-vim_regexec_both(line, col, tm)
+vim_regexec_both(rex, line, col, tm)
+    regexec_T	*rex;
     char_u	*line;
     colnr_T	col;		/* column to start looking for match */
     proftime_T	*tm UNUSED;	/* timeout limit or NULL */
@@ -3426,118 +4171,147 @@ vim_regexec_both(line, col, tm)
     regprog_T	*prog;
     char_u	*s;
     long	retval = 0L;
+#ifdef FEAT_PROFILE
+    proftime_T	pt;
+#endif
 
     /* Create "regstack" and "backpos" if they are not allocated yet.
      * We allocate *_INITIAL amount of bytes first and then set the grow size
      * to much bigger value to avoid many malloc calls in case of deep regular
      * expressions.  */
-    if (regstack.ga_data == NULL)
+    if (rex->regstack.ga_data == NULL)
     {
 	/* Use an item size of 1 byte, since we push different things
 	 * onto the regstack. */
-	ga_init2(&regstack, 1, REGSTACK_INITIAL);
-	ga_grow(&regstack, REGSTACK_INITIAL);
-	regstack.ga_growsize = REGSTACK_INITIAL * 8;
+	ga_init2(&rex->regstack, 1, REGSTACK_INITIAL);
+	(void)reg_ga_grow(rex, &rex->regstack, REGSTACK_INITIAL);
+	rex->regstack.ga_growsize = REGSTACK_INITIAL * 8;
     }
 
-    if (backpos.ga_data == NULL)
+    if (rex->backpos.ga_data == NULL)
     {
-	ga_init2(&backpos, sizeof(backpos_T), BACKPOS_INITIAL);
-	ga_grow(&backpos, BACKPOS_INITIAL);
-	backpos.ga_growsize = BACKPOS_INITIAL * 8;
+	ga_init2(&rex->backpos, sizeof(backpos_T), BACKPOS_INITIAL);
+	(void)reg_ga_grow(rex, &rex->backpos, BACKPOS_INITIAL);
+	rex->backpos.ga_growsize = BACKPOS_INITIAL * 8;
     }
 
     if (REG_MULTI)
     {
-	prog = reg_mmatch->regprog;
-	line = reg_getline((linenr_T)0);
-	reg_startpos = reg_mmatch->startpos;
-	reg_endpos = reg_mmatch->endpos;
+	prog = rex->reg_mmatch->regprog;
+	line = reg_getline(rex, (linenr_T)0);
+	rex->reg_startpos = rex->reg_mmatch->startpos;
+	rex->reg_endpos = rex->reg_mmatch->endpos;
     }
     else
     {
-	prog = reg_match->regprog;
-	reg_startp = reg_match->startp;
-	reg_endp = reg_match->endp;
+	prog = rex->reg_match->regprog;
+	rex->reg_startp = rex->reg_match->startp;
+	rex->reg_endp = rex->reg_match->endp;
+    }
+
+#ifdef FEAT_PROFILE
+    if (!rex->reg_detached && regtime_on)
+    {
+	profile_start(&pt);
+	rex->regstack_maxdepth = 0;
     }
+#endif
 
     /* Be paranoid... */
     if (prog == NULL || line == NULL)
     {
-	EMSG(_(e_null));
+	reg_emsg(rex, _(e_null));
 	goto theend;
     }
 
     /* Check validity of program. */
-    if (prog_magic_wrong())
+    if (prog_magic_wrong(rex))
 	goto theend;
 
     /* If the start column is past the maximum column: no need to try. */
-    if (ireg_maxcol > 0 && col >= ireg_maxcol)
+    if (rex->reg_maxcol > 0 && col >= rex->reg_maxcol)
 	goto theend;
 
-    /* If pattern contains "\c" or "\C": overrule value of ireg_ic */
+    /* If pattern contains "\c" or "\C": overrule value of rex->reg_ic */
     if (prog->regflags & RF_ICASE)
-	ireg_ic = TRUE;
+	rex->reg_ic = TRUE;
     else if (prog->regflags & RF_NOICASE)
-	ireg_ic = FALSE;
+	rex->reg_ic = FALSE;
 
 #ifdef FEAT_MBYTE
-    /* If pattern contains "\Z" overrule value of ireg_icombine */
+    /* If pattern contains "\Z" overrule value of rex->reg_icombine */
     if (prog->regflags & RF_ICOMBINE)
-	ireg_icombine = TRUE;
+	rex->reg_icombine = TRUE;
 #endif
 
     /* If there is a "must appear" string, look for it. */
     if (prog->regmust != NULL)
     {
-	int c;
-
-#ifdef FEAT_MBYTE
-	if (has_mbyte)
-	    c = (*mb_ptr2char)(prog->regmust);
-	else
-#endif
-	    c = *prog->regmust;
 	s = line + col;
 
 	/*
 	 * This is used very often, esp. for ":global".  Use three versions of
 	 * the loop to avoid overhead of conditions.
 	 */
-	if (!ireg_ic
 #ifdef FEAT_MBYTE
-		&& !has_mbyte
+	if (!has_mbyte || (enc_utf8 && !rex->reg_ic))
 #endif
-		)
-	    while ((s = vim_strbyte(s, c)) != NULL)
-	    {
-		if (cstrncmp(s, prog->regmust, &prog->regmlen) == 0)
-		    break;		/* Found it. */
-		++s;
-	    }
+	    s = reg_find_must(rex, prog, s);
 #ifdef FEAT_MBYTE
-	else if (!ireg_ic || (!enc_utf8 && mb_char2len(c) > 1))
-	    while ((s = vim_strchr(s, c)) != NULL)
-	    {
-		if (cstrncmp(s, prog->regmust, &prog->regmlen) == 0)
-		    break;		/* Found it. */
-		mb_ptr_adv(s);
-	    }
-#endif
 	else
-	    while ((s = cstrchr(s, c)) != NULL)
-	    {
-		if (cstrncmp(s, prog->regmust, &prog->regmlen) == 0)
-		    break;		/* Found it. */
-		mb_ptr_adv(s);
-	    }
+	{
+	    int c = (*mb_ptr2char)(prog->regmust);
+	    int len = prog->regmlen;	/* "prog" may be shared, don't let
+					   cstrncmp() change it */
+
+	    if (!rex->reg_ic || (!enc_utf8 && mb_char2len(c) > 1))
+		while ((s = vim_strchr(s, c)) != NULL)
+		{
+		    if (cstrncmp(rex, s, prog->regmust, &len) == 0)
+			break;		/* Found it. */
+		    mb_ptr_adv(s);
+		}
+	    else
+		while ((s = cstrchr(rex, s, c)) != NULL)
+		{
+		    if (cstrncmp(rex, s, prog->regmust, &len) == 0)
+			break;		/* Found it. */
+		    mb_ptr_adv(s);
+		}
+	}
+#endif
 	if (s == NULL)		/* Not present. */
 	    goto theend;
     }
 
-    regline = line;
-    reglnum = 0;
+    rex->line = line;
+    rex->lnum = 0;
+
+    /* Skip to where the match can start.  When the DFA cache knows there is
+     * no match from there don't run the engine. */
+    if (!prog->reganch)
+    {
+	col = reg_start_col(rex, prog, col);
+	if (col == MAXCOL)
+	    goto theend;
+    }
+    if (!rex->reg_detached && !dfa_check(rex, prog, line, col))
+	goto theend;
+
+    /* Use the NFA engine, or let regmatch() give up when backtracking takes
+     * too long, when the pattern allows for it.  See 'regexpengine'. */
+    rex->reg_bt_limit = 0;
+    rex->reg_bt_gaveup = FALSE;
+    if (!(prog->regflags & RF_BACKTRACK))
+    {
+	if (p_re == 2)
+	{
+	    retval = nfa_regexec(rex, prog, line, col, tm);
+	    goto theend;
+	}
+	if (p_re == 0)
+	    rex->reg_bt_limit = REG_BT_LIMIT;
+    }
 
     /* Simplest case: Anchored match need be tried only once. */
     if (prog->reganch)
@@ -3546,19 +4320,19 @@ vim_regexec_both(line, col, tm)
 
 #ifdef FEAT_MBYTE
 	if (has_mbyte)
-	    c = (*mb_ptr2char)(regline + col);
+	    c = (*mb_ptr2char)(rex->line + col);
 	else
 #endif
-	    c = regline[col];
+	    c = rex->line[col];
 	if (prog->regstart == NUL
 		|| prog->regstart == c
-		|| (ireg_ic && ((
+		|| (rex->reg_ic && ((
 #ifdef FEAT_MBYTE
 			(enc_utf8 && utf_fold(prog->regstart) == utf_fold(c)))
 			|| (c < 255 && prog->regstart < 255 &&
 #endif
 			    MB_TOLOWER(prog->regstart) == MB_TOLOWER(c)))))
-	    retval = regtry(prog, col);
+	    retval = regtry(rex, prog, col);
 	else
 	    retval = 0;
     }
@@ -3568,50 +4342,51 @@ vim_regexec_both(line, col, tm)
 	int tm_count = 0;
 #endif
 	/* Messy cases:  unanchored match. */
-	while (!got_int)
+	while (!REG_GOT_INT)
 	{
 	    if (prog->regstart != NUL)
 	    {
 		/* Skip until the char we know it must start with.
 		 * Used often, do some work to avoid call overhead. */
-		if (!ireg_ic
+		if (!rex->reg_ic
 #ifdef FEAT_MBYTE
-			    && !has_mbyte
+			    && (!has_mbyte
+				|| (enc_utf8 && prog->regstart < 0x80))
 #endif
 			    )
-		    s = vim_strbyte(regline + col, prog->regstart);
+		    s = vim_strbyte(rex->line + col, prog->regstart);
 		else
-		    s = cstrchr(regline + col, prog->regstart);
+		    s = cstrchr(rex, rex->line + col, prog->regstart);
 		if (s == NULL)
 		{
 		    retval = 0;
 		    break;
 		}
-		col = (int)(s - regline);
+		col = (int)(s - rex->line);
 	    }
 
 	    /* Check for maximum column to try. */
-	    if (ireg_maxcol > 0 && col >= ireg_maxcol)
+	    if (rex->reg_maxcol > 0 && col >= rex->reg_maxcol)
 	    {
 		retval = 0;
 		break;
 	    }
 
-	    retval = regtry(prog, col);
-	    if (retval > 0)
+	    retval = regtry(rex, prog, col);
+	    if (retval > 0 || rex->reg_bt_gaveup)
 		break;
 
 	    /* if not currently on the first line, get it again */
-	    if (reglnum != 0)
+	    if (rex->lnum != 0)
 	    {
-		reglnum = 0;
-		regline = reg_getline((linenr_T)0);
+		rex->lnum = 0;
+		rex->line = reg_getline(rex, (linenr_T)0);
 	    }
-	    if (regline[col] == NUL)
+	    if (rex->line[col] == NUL)
 		break;
 #ifdef FEAT_MBYTE
 	    if (has_mbyte)
-		col += (*mb_ptr2len)(regline + col);
+		col += (*mb_ptr2len)(rex->line + col);
 	    else
 #endif
 		++col;
@@ -3627,22 +4402,106 @@ vim_regexec_both(line, col, tm)
 	}
     }
 
+    /* Backtracking took too long, start again at "col" with the NFA
+     * engine.  Columns before it didn't match. */
+    if (rex->reg_bt_gaveup)
+	retval = nfa_regexec(rex, prog, REG_MULTI
+			  ? reg_getline(rex, (linenr_T)0) : line, col, tm);
+
 theend:
+#ifdef FEAT_PROFILE
+    if (!rex->reg_detached && regtime_on && prog != NULL)
+    {
+	profile_end(&pt);
+	profile_add(&prog->regtotal, &pt);
+	++prog->regcount;
+	if (retval > 0)
+	    ++prog->regmatchcount;
+	if (rex->regstack_maxdepth > prog->regmaxdepth)
+	    prog->regmaxdepth = rex->regstack_maxdepth;
+    }
+#endif
     /* Free "reg_tofree" when it's a bit big.
      * Free regstack and backpos if they are bigger than their initial size. */
-    if (reg_tofreelen > 400)
+    if (rex->reg_tofreelen > 400)
     {
-	vim_free(reg_tofree);
-	reg_tofree = NULL;
+	vim_free(rex->reg_tofree);
+	rex->reg_tofree = NULL;
     }
-    if (regstack.ga_maxlen > REGSTACK_INITIAL)
-	ga_clear(&regstack);
-    if (backpos.ga_maxlen > BACKPOS_INITIAL)
-	ga_clear(&backpos);
+    if (rex->regstack.ga_maxlen > REGSTACK_INITIAL)
+	ga_clear(&rex->regstack);
+    if (rex->backpos.ga_maxlen > BACKPOS_INITIAL)
+	ga_clear(&rex->backpos);
 
     return retval;
 }
 
+/*
+ * Find "prog->regmust" in "s", looking for its rarest byte first.  Only used
+ * when that byte is always a character: without a multi-byte encoding or
+ * with UTF-8 when not ignoring case.
+ * Returns a pointer to where it starts in "s", NULL when it's not there.
+ */
+    static char_u *
+reg_find_must(rex, prog, s)
+    regexec_T	*rex;
+    regprog_T	*prog;
+    char_u	*s;
+{
+    int		idx = prog->regmrare;
+    int		len = prog->regmlen;
+    int		c1, c2;
+    char_u	*p;
+    int		i;
+
+    /* The byte can't be found before "s + idx". */
+    for (i = 0; i < idx; ++i)
+	if (s[i] == NUL)
+	    return NULL;
+    c1 = prog->regmust[idx];
+    c2 = c1;
+    if (rex->reg_ic)
+    {
+	c1 = MB_TOLOWER(c1);
+	c2 = MB_TOUPPER(c2);
+    }
+    for (p = s + idx; (p = vim_strbyte2(p, c1, c2)) != NULL; ++p)
+	if (cstrncmp(rex, p - idx, prog->regmust, &len) == 0)
+	    return p - idx;
+    return NULL;
+}
+
+/*
+ * Return the first column from "col" on in the first line where a match of
+ * "prog" may start, MAXCOL if there is none.
+ */
+    static colnr_T
+reg_start_col(rex, prog, col)
+    regexec_T	*rex;
+    regprog_T	*prog;
+    colnr_T	col;
+{
+    char_u	*s;
+
+    if (prog->regstart != NUL)
+    {
+	if (!rex->reg_ic
+#ifdef FEAT_MBYTE
+		    && (!has_mbyte || (enc_utf8 && prog->regstart < 0x80))
+#endif
+		    )
+	    s = vim_strbyte(rex->line + col, prog->regstart);
+	else
+	    s = cstrchr(rex, rex->line + col, prog->regstart);
+	if (s == NULL)
+	    return MAXCOL;
+	col = (int)(s - rex->line);
+    }
+    if (rex->reg_maxcol > 0 && col >= rex->reg_maxcol)
+	return MAXCOL;
+    return col;
+}
+
 #ifdef FEAT_SYN_HL
 static reg_extmatch_T *make_extmatch __ARGS((void));
 
@@ -3692,110 +4551,109 @@ unref_extmatch(em)
 #endif
 
 /*
- * regtry - try match of "prog" with at regline["col"].
+ * regtry - try match of "prog" with at rex->line["col"].
  * Returns 0 for failure, number of lines contained in the match otherwise.
  */
     static long
-regtry(prog, col)
+regtry(rex, prog, col)
+    regexec_T	*rex;
     regprog_T	*prog;
     colnr_T	col;
 {
-    reginput = regline + col;
-    need_clear_subexpr = TRUE;
+    rex->input = rex->line + col;
+    rex->need_clear_subexpr = TRUE;
 #ifdef FEAT_SYN_HL
     /* Clear the external match subpointers if necessary. */
     if (prog->reghasz == REX_SET)
-	need_clear_zsubexpr = TRUE;
+	rex->need_clear_zsubexpr = TRUE;
 #endif
 
-    if (regmatch(prog->program + 1) == 0)
+    if (regmatch(rex, prog->program + 1) == 0)
 	return 0;
 
-    cleanup_subexpr();
+    cleanup_subexpr(rex);
     if (REG_MULTI)
     {
-	if (reg_startpos[0].lnum < 0)
+	if (rex->reg_startpos[0].lnum < 0)
 	{
-	    reg_startpos[0].lnum = 0;
-	    reg_startpos[0].col = col;
+	    rex->reg_startpos[0].lnum = 0;
+	    rex->reg_startpos[0].col = col;
 	}
-	if (reg_endpos[0].lnum < 0)
+	if (rex->reg_endpos[0].lnum < 0)
 	{
-	    reg_endpos[0].lnum = reglnum;
-	    reg_endpos[0].col = (int)(reginput - regline);
+	    rex->reg_endpos[0].lnum = rex->lnum;
+	    rex->reg_endpos[0].col = (int)(rex->input - rex->line);
 	}
 	else
 	    /* Use line number of "\ze". */
-	    reglnum = reg_endpos[0].lnum;
+	    rex->lnum = rex->reg_endpos[0].lnum;
     }
     else
     {
-	if (reg_startp[0] == NULL)
-	    reg_startp[0] = regline + col;
-	if (reg_endp[0] == NULL)
-	    reg_endp[0] = reginput;
+	if (rex->reg_startp[0] == NULL)
+	    rex->reg_startp[0] = rex->line + col;
+	if (rex->reg_endp[0] == NULL)
+	    rex->reg_endp[0] = rex->input;
     }
 #ifdef FEAT_SYN_HL
     /* Package any found \z(...\) matches for export. Default is none. */
-    unref_extmatch(re_extmatch_out);
-    re_extmatch_out = NULL;
+    if (!rex->reg_detached)
+    {
+	unref_extmatch(re_extmatch_out);
+	re_extmatch_out = NULL;
+    }
 
-    if (prog->reghasz == REX_SET)
+    if (prog->reghasz == REX_SET && !rex->reg_detached)
     {
 	int		i;
 
-	cleanup_zsubexpr();
+	cleanup_zsubexpr(rex);
 	re_extmatch_out = make_extmatch();
 	for (i = 0; i < NSUBEXP; i++)
 	{
 	    if (REG_MULTI)
 	    {
 		/* Only accept single line matches. */
-		if (reg_startzpos[i].lnum >= 0
-			&& reg_endzpos[i].lnum == reg_startzpos[i].lnum)
-		    re_extmatch_out->matches[i] =
-			vim_strnsave(reg_getline(reg_startzpos[i].lnum)
-						       + reg_startzpos[i].col,
-				   reg_endzpos[i].col - reg_startzpos[i].col);
+		if (rex->reg_startzpos[i].lnum >= 0
+			&& rex->reg_endzpos[i].lnum
+					       == rex->reg_startzpos[i].lnum)
+		    re_extmatch_out->matches[i] = vim_strnsave(
+			    reg_getline(rex, rex->reg_startzpos[i].lnum)
+						  + rex->reg_startzpos[i].col,
+			    rex->reg_endzpos[i].col
+						  - rex->reg_startzpos[i].col);
 	    }
 	    else
 	    {
-		if (reg_startzp[i] != NULL && reg_endzp[i] != NULL)
+		if (rex->reg_startzp[i] != NULL && rex->reg_endzp[i] != NULL)
 		    re_extmatch_out->matches[i] =
-			    vim_strnsave(reg_startzp[i],
-					(int)(reg_endzp[i] - reg_startzp[i]));
+			    vim_strnsave(rex->reg_startzp[i], (int)
+				    (rex->reg_endzp[i] - rex->reg_startzp[i]));
 	    }
 	}
     }
 #endif
-    return 1 + reglnum;
+    return 1 + rex->lnum;
 }
 
 #ifdef FEAT_MBYTE
-static int reg_prev_class __ARGS((void));
+static int reg_prev_class __ARGS((regexec_T *rex));
 
 /*
  * Get class of previous character.
  */
     static int
-reg_prev_class()
+reg_prev_class(rex)
+    regexec_T	*rex;
 {
-    if (reginput > regline)
-	return mb_get_class(reginput - 1
-				     - (*mb_head_off)(regline, reginput - 1));
+    if (rex->input > rex->line)
+	return reg_get_class(rex, rex->input - 1
+			       - (*mb_head_off)(rex->line, rex->input - 1));
     return -1;
 }
 
 #endif
-#define ADVANCE_REGINPUT() mb_ptr_adv(reginput)
-
-/*
- * The arguments from BRACE_LIMITS are stored here.  They are actually local
- * to regmatch(), but they are here to reduce the amount of stack space used
- * (it can be called recursively many times).
- */
-static long	bl_minval;
-static long	bl_maxval;
+#define ADVANCE_REGINPUT() mb_ptr_adv(rex->input)
 
 /*
  * regmatch - main matching routine
@@ -3807,21 +4665,23 @@ static long	bl_maxval;
  * (that don't need to know whether the rest of the match failed) by a nested
  * loop.
  *
- * Returns TRUE when there is a match.  Leaves reginput and reglnum just after
- * the last matched character.
- * Returns FALSE when there is no match.  Leaves reginput and reglnum in an
+ * Returns TRUE when there is a match.  Leaves rex->input and rex->lnum just
+ * after the last matched character.
+ * Returns FALSE when there is no match.  Leaves rex->input and rex->lnum in an
  * undefined state!
  */
     static int
-regmatch(scan)
+regmatch(rex, scan)
+    regexec_T	*rex;
     char_u	*scan;		/* Current node. */
 {
   char_u	*next;		/* Next node. */
   int		op;
-  int		c;
   regitem_T	*rp;
   int		no;
   int		status;		/* one of the RA_ values: */
+  long		bl_minval = 0;	/* the arguments from BRACE_LIMITS */
+  long		bl_maxval = 0;
 #define RA_FAIL		1	/* something failed, abort */
 #define RA_CONT		2	/* continue in inner loop */
 #define RA_BREAK	3	/* break inner loop */
@@ -3830,8 +4690,12 @@ regmatch(scan)
 
   /* Make "regstack" and "backpos" empty.  They are allocated and freed in
    * vim_regexec_both() to reduce malloc()/free() calls. */
-  regstack.ga_len = 0;
-  backpos.ga_len = 0;
+  rex->regstack.ga_len = 0;
+  rex->backpos.ga_len = 0;
+  rex->reg_bt_count = 0;
+#ifdef FEAT_PROFILE
+  rex->regstack_depth = 0;
+#endif
 
   /*
    * Repeat until "regstack" is empty.
@@ -3840,7 +4704,14 @@ regmatch(scan)
   {
     /* Some patterns my cause a long time to match, even though they are not
      * illegal.  E.g., "\([a-z]\+\)\+Q".  Allow breaking them with CTRL-C. */
-    fast_breakcheck();
+    reg_breakcheck(rex);
+
+    if (rex->reg_bt_limit > 0 && ++rex->reg_bt_count > rex->reg_bt_limit)
+    {
+	/* Takes too long, let the NFA engine do it. */
+	rex->reg_bt_gaveup = TRUE;
+	return FALSE;
+    }
 
 #ifdef DEBUG
     if (scan != NULL && regnarrate)
@@ -3856,7 +4727,7 @@ regmatch(scan)
      */
     for (;;)
     {
-	if (got_int || scan == NULL)
+	if (REG_GOT_INT || scan == NULL)
 	{
 	    status = RA_FAIL;
 	    break;
@@ -3888,1934 +4759,3449 @@ regmatch(scan)
 	next = regnext(scan);
 
 	op = OP(scan);
-	/* Check for character class with NL added. */
-	if (!reg_line_lbr && WITH_NL(op) && REG_MULTI
-				&& *reginput == NUL && reglnum <= reg_maxline)
-	{
-	    reg_nextline();
-	}
-	else if (reg_line_lbr && WITH_NL(op) && *reginput == '\n')
-	{
-	    ADVANCE_REGINPUT();
-	}
+	if (REG_ITEM(op))
+	    /* A character, class or position, no need for the regstack. */
+	    status = reg_match_item(rex, scan);
 	else
 	{
-	  if (WITH_NL(op))
-	      op -= ADD_NL;
-#ifdef FEAT_MBYTE
-	  if (has_mbyte)
-	      c = (*mb_ptr2char)(reginput);
-	  else
-#endif
-	      c = *reginput;
 	  switch (op)
 	  {
-	  case BOL:
-	    if (reginput != regline)
-		status = RA_NOMATCH;
-	    break;
-
-	  case EOL:
-	    if (c != NUL)
-		status = RA_NOMATCH;
+	  case NOTHING:
 	    break;
 
-	  case RE_BOF:
-	    /* We're not at the beginning of the file when below the first
-	     * line where we started, not at the start of the line or we
-	     * didn't start at the first line of the buffer. */
-	    if (reglnum != 0 || reginput != regline
-					  || (REG_MULTI && reg_firstlnum > 1))
-		status = RA_NOMATCH;
-	    break;
+	  case BACK:
+	    {
+		int		i;
+		backpos_T	*bp;
 
-	  case RE_EOF:
-	    if (reglnum != reg_maxline || c != NUL)
-		status = RA_NOMATCH;
-	    break;
+		/*
+		 * When we run into BACK we need to check if we don't keep
+		 * looping without matching any input.  The second and later
+		 * times a BACK is encountered it fails if the input is still
+		 * at the same position as the previous time.
+		 * The positions are stored in "backpos" and found by the
+		 * current value of "scan", the position in the RE program.
+		 */
+		bp = (backpos_T *)rex->backpos.ga_data;
+		for (i = 0; i < rex->backpos.ga_len; ++i)
+		    if (bp[i].bp_scan == scan)
+			break;
+		if (i == rex->backpos.ga_len)
+		{
+		    /* First time at this BACK, make room to store the pos. */
+		    if (reg_ga_grow(rex, &rex->backpos, 1) == FAIL)
+			status = RA_FAIL;
+		    else
+		    {
+			/* get "ga_data" again, it may have changed */
+			bp = (backpos_T *)rex->backpos.ga_data;
+			bp[i].bp_scan = scan;
+			++rex->backpos.ga_len;
+		    }
+		}
+		else if (reg_save_equal(rex, &bp[i].bp_pos))
+		    /* Still at same position as last time, fail. */
+		    status = RA_NOMATCH;
 
-	  case CURSOR:
-	    /* Check if the buffer is in a window and compare the
-	     * reg_win->w_cursor position to the match position. */
-	    if (reg_win == NULL
-		    || (reglnum + reg_firstlnum != reg_win->w_cursor.lnum)
-		    || ((colnr_T)(reginput - regline) != reg_win->w_cursor.col))
-		status = RA_NOMATCH;
+		if (status != RA_FAIL && status != RA_NOMATCH)
+		    reg_save(rex, &bp[i].bp_pos, &rex->backpos);
+	    }
 	    break;
 
-	  case RE_MARK:
-	    /* Compare the mark position to the match position.  NOTE: Always
-	     * uses the current buffer. */
+	  case MOPEN + 0:   /* Match start: \zs */
+	  case MOPEN + 1:   /* \( */
+	  case MOPEN + 2:
+	  case MOPEN + 3:
+	  case MOPEN + 4:
+	  case MOPEN + 5:
+	  case MOPEN + 6:
+	  case MOPEN + 7:
+	  case MOPEN + 8:
+	  case MOPEN + 9:
 	    {
-		int	mark = OPERAND(scan)[0];
-		int	cmp = OPERAND(scan)[1];
-		pos_T	*pos;
+		no = op - MOPEN;
+		cleanup_subexpr(rex);
+		rp = regstack_push(rex, RS_MOPEN, scan);
+		if (rp == NULL)
+		    status = RA_FAIL;
+		else
+		{
+		    rp->rs_no = no;
+		    save_se(&rp->rs_un.sesave, &rex->reg_startpos[no],
+							&rex->reg_startp[no]);
+		    /* We simply continue and handle the result when done. */
+		}
+	    }
+	    break;
 
-		pos = getmark(mark, FALSE);
-		if (pos == NULL		     /* mark doesn't exist */
-			|| pos->lnum <= 0    /* mark isn't set (in curbuf) */
-			|| (pos->lnum == reglnum + reg_firstlnum
-				? (pos->col == (colnr_T)(reginput - regline)
-				    ? (cmp == '<' || cmp == '>')
-				    : (pos->col < (colnr_T)(reginput - regline)
-					? cmp != '>'
-					: cmp != '<'))
-				: (pos->lnum < reglnum + reg_firstlnum
-				    ? cmp != '>'
-				    : cmp != '<')))
-		    status = RA_NOMATCH;
+	  case NOPEN:	    /* \%( */
+	  case NCLOSE:	    /* \) after \%( */
+		if (regstack_push(rex, RS_NOPEN, scan) == NULL)
+		    status = RA_FAIL;
+		/* We simply continue and handle the result when done. */
+		break;
+
+#ifdef FEAT_SYN_HL
+	  case ZOPEN + 1:
+	  case ZOPEN + 2:
+	  case ZOPEN + 3:
+	  case ZOPEN + 4:
+	  case ZOPEN + 5:
+	  case ZOPEN + 6:
+	  case ZOPEN + 7:
+	  case ZOPEN + 8:
+	  case ZOPEN + 9:
+	    {
+		no = op - ZOPEN;
+		cleanup_zsubexpr(rex);
+		rp = regstack_push(rex, RS_ZOPEN, scan);
+		if (rp == NULL)
+		    status = RA_FAIL;
+		else
+		{
+		    rp->rs_no = no;
+		    save_se(&rp->rs_un.sesave, &rex->reg_startzpos[no],
+						       &rex->reg_startzp[no]);
+		    /* We simply continue and handle the result when done. */
+		}
 	    }
 	    break;
+#endif
 
-	  case RE_VISUAL:
-#ifdef FEAT_VISUAL
-	    /* Check if the buffer is the current buffer. and whether the
-	     * position is inside the Visual area. */
-	    if (reg_buf != curbuf || VIsual.lnum == 0)
-		status = RA_NOMATCH;
-	    else
+	  case MCLOSE + 0:  /* Match end: \ze */
+	  case MCLOSE + 1:  /* \) */
+	  case MCLOSE + 2:
+	  case MCLOSE + 3:
+	  case MCLOSE + 4:
+	  case MCLOSE + 5:
+	  case MCLOSE + 6:
+	  case MCLOSE + 7:
+	  case MCLOSE + 8:
+	  case MCLOSE + 9:
 	    {
-		pos_T	    top, bot;
-		linenr_T    lnum;
-		colnr_T	    col;
-		win_T	    *wp = reg_win == NULL ? curwin : reg_win;
-		int	    mode;
+		no = op - MCLOSE;
+		cleanup_subexpr(rex);
+		rp = regstack_push(rex, RS_MCLOSE, scan);
+		if (rp == NULL)
+		    status = RA_FAIL;
+		else
+		{
+		    rp->rs_no = no;
+		    save_se(&rp->rs_un.sesave, &rex->reg_endpos[no],
+							  &rex->reg_endp[no]);
+		    /* We simply continue and handle the result when done. */
+		}
+	    }
+	    break;
 
-		if (VIsual_active)
+#ifdef FEAT_SYN_HL
+	  case ZCLOSE + 1:  /* \) after \z( */
+	  case ZCLOSE + 2:
+	  case ZCLOSE + 3:
+	  case ZCLOSE + 4:
+	  case ZCLOSE + 5:
+	  case ZCLOSE + 6:
+	  case ZCLOSE + 7:
+	  case ZCLOSE + 8:
+	  case ZCLOSE + 9:
+	    {
+		no = op - ZCLOSE;
+		cleanup_zsubexpr(rex);
+		rp = regstack_push(rex, RS_ZCLOSE, scan);
+		if (rp == NULL)
+		    status = RA_FAIL;
+		else
 		{
-		    if (lt(VIsual, wp->w_cursor))
+		    rp->rs_no = no;
+		    save_se(&rp->rs_un.sesave, &rex->reg_endzpos[no],
+							 &rex->reg_endzp[no]);
+		    /* We simply continue and handle the result when done. */
+		}
+	    }
+	    break;
+#endif
+
+	  case BACKREF + 1:
+	  case BACKREF + 2:
+	  case BACKREF + 3:
+	  case BACKREF + 4:
+	  case BACKREF + 5:
+	  case BACKREF + 6:
+	  case BACKREF + 7:
+	  case BACKREF + 8:
+	  case BACKREF + 9:
+	    {
+		int		len;
+		linenr_T	clnum;
+		colnr_T		ccol;
+		char_u		*p;
+
+		no = op - BACKREF;
+		cleanup_subexpr(rex);
+		if (!REG_MULTI)		/* Single-line regexp */
+		{
+		    if (rex->reg_startp[no] == NULL
+					       || rex->reg_endp[no] == NULL)
 		    {
-			top = VIsual;
-			bot = wp->w_cursor;
+			/* Backref was not set: Match an empty string. */
+			len = 0;
 		    }
 		    else
 		    {
-			top = wp->w_cursor;
-			bot = VIsual;
+			/* Compare current input with back-ref in the same
+			 * line. */
+			len = (int)(rex->reg_endp[no] - rex->reg_startp[no]);
+			if (cstrncmp(rex, rex->reg_startp[no], rex->input,
+								 &len) != 0)
+			    status = RA_NOMATCH;
 		    }
-		    mode = VIsual_mode;
 		}
-		else
+		else				/* Multi-line regexp */
 		{
-		    if (lt(curbuf->b_visual.vi_start, curbuf->b_visual.vi_end))
+		    if (rex->reg_startpos[no].lnum < 0
+					    || rex->reg_endpos[no].lnum < 0)
 		    {
-			top = curbuf->b_visual.vi_start;
-			bot = curbuf->b_visual.vi_end;
+			/* Backref was not set: Match an empty string. */
+			len = 0;
 		    }
 		    else
 		    {
-			top = curbuf->b_visual.vi_end;
-			bot = curbuf->b_visual.vi_start;
+			if (rex->reg_startpos[no].lnum == rex->lnum
+				&& rex->reg_endpos[no].lnum == rex->lnum)
+			{
+			    /* Compare back-ref within the current line. */
+			    len = rex->reg_endpos[no].col
+						   - rex->reg_startpos[no].col;
+			    if (cstrncmp(rex,
+				       rex->line + rex->reg_startpos[no].col,
+						     rex->input, &len) != 0)
+				status = RA_NOMATCH;
+			}
+			else
+			{
+			    /* Messy situation: Need to compare between two
+			     * lines. */
+			    ccol = rex->reg_startpos[no].col;
+			    clnum = rex->reg_startpos[no].lnum;
+			    for (;;)
+			    {
+				/* Since getting one line may invalidate
+				 * the other, need to make copy.  Slow! */
+				if (rex->line != rex->reg_tofree)
+				{
+				    len = (int)STRLEN(rex->line);
+				    if (rex->reg_tofree == NULL
+					    || len >= (int)rex->reg_tofreelen)
+				    {
+					len += 50;	/* get some extra */
+					vim_free(rex->reg_tofree);
+					rex->reg_tofree = reg_alloc_clear(rex,
+								 (unsigned)len);
+					if (rex->reg_tofree == NULL)
+					{
+					    status = RA_FAIL; /* outof memory!*/
+					    break;
+					}
+					rex->reg_tofreelen = len;
+				    }
+				    STRCPY(rex->reg_tofree, rex->line);
+				    rex->input = rex->reg_tofree
+						  + (rex->input - rex->line);
+				    rex->line = rex->reg_tofree;
+				}
+
+				/* Get the line to compare with. */
+				p = reg_getline(rex, clnum);
+				if (clnum == rex->reg_endpos[no].lnum)
+				    len = rex->reg_endpos[no].col - ccol;
+				else
+				    len = (int)STRLEN(p + ccol);
+
+				if (cstrncmp(rex, p + ccol, rex->input,
+								 &len) != 0)
+				{
+				    status = RA_NOMATCH;  /* doesn't match */
+				    break;
+				}
+				if (clnum == rex->reg_endpos[no].lnum)
+				    break;		/* match and at end! */
+				if (rex->lnum >= rex->reg_maxline)
+				{
+				    status = RA_NOMATCH;  /* text too short */
+				    break;
+				}
+
+				/* Advance to next line. */
+				reg_nextline(rex);
+				++clnum;
+				ccol = 0;
+				if (REG_GOT_INT)
+				{
+				    status = RA_FAIL;
+				    break;
+				}
+			    }
+
+			    /* found a match!  Note that rex->line may now
+			     * point to a copy of the line, that should not
+			     * matter. */
+			}
 		    }
-		    mode = curbuf->b_visual.vi_mode;
 		}
-		lnum = reglnum + reg_firstlnum;
-		col = (colnr_T)(reginput - regline);
-		if (lnum < top.lnum || lnum > bot.lnum)
-		    status = RA_NOMATCH;
-		else if (mode == 'v')
+
+		/* Matched the backref, skip over it. */
+		rex->input += len;
+	    }
+	    break;
+
+#ifdef FEAT_SYN_HL
+	  case ZREF + 1:
+	  case ZREF + 2:
+	  case ZREF + 3:
+	  case ZREF + 4:
+	  case ZREF + 5:
+	  case ZREF + 6:
+	  case ZREF + 7:
+	  case ZREF + 8:
+	  case ZREF + 9:
+	    {
+		int	len;
+
+		cleanup_zsubexpr(rex);
+		no = op - ZREF;
+		if (re_extmatch_in != NULL
+			&& re_extmatch_in->matches[no] != NULL)
 		{
-		    if ((lnum == top.lnum && col < top.col)
-			    || (lnum == bot.lnum
-					 && col >= bot.col + (*p_sel != 'e')))
+		    len = (int)STRLEN(re_extmatch_in->matches[no]);
+		    if (cstrncmp(rex, re_extmatch_in->matches[no],
+						     rex->input, &len) != 0)
 			status = RA_NOMATCH;
+		    else
+			rex->input += len;
 		}
-		else if (mode == Ctrl_V)
+		else
 		{
-		    colnr_T	    start, end;
-		    colnr_T	    start2, end2;
-		    colnr_T	    cols;
-
-		    getvvcol(wp, &top, &start, NULL, &end);
-		    getvvcol(wp, &bot, &start2, NULL, &end2);
-		    if (start2 < start)
-			start = start2;
-		    if (end2 > end)
-			end = end2;
-		    if (top.col == MAXCOL || bot.col == MAXCOL)
-			end = MAXCOL;
-		    cols = win_linetabsize(wp,
-				      regline, (colnr_T)(reginput - regline));
-		    if (cols < start || cols > end - (*p_sel == 'e'))
-			status = RA_NOMATCH;
+		    /* Backref was not set: Match an empty string. */
 		}
 	    }
-#else
-	    status = RA_NOMATCH;
-#endif
-	    break;
-
-	  case RE_LNUM:
-	    if (!REG_MULTI || !re_num_cmp((long_u)(reglnum + reg_firstlnum),
-									scan))
-		status = RA_NOMATCH;
-	    break;
-
-	  case RE_COL:
-	    if (!re_num_cmp((long_u)(reginput - regline) + 1, scan))
-		status = RA_NOMATCH;
 	    break;
+#endif
 
-	  case RE_VCOL:
-	    if (!re_num_cmp((long_u)win_linetabsize(
-			    reg_win == NULL ? curwin : reg_win,
-			    regline, (colnr_T)(reginput - regline)) + 1, scan))
-		status = RA_NOMATCH;
+	  case BRANCH:
+	    {
+		if (OP(next) != BRANCH) /* No choice. */
+		    next = OPERAND(scan);	/* Avoid recursion. */
+		else
+		{
+		    rp = regstack_push(rex, RS_BRANCH, scan);
+		    if (rp == NULL)
+			status = RA_FAIL;
+		    else
+			status = RA_BREAK;	/* rest is below */
+		}
+	    }
 	    break;
 
-	  case BOW:	/* \<word; reginput points to w */
-	    if (c == NUL)	/* Can't match at end of line */
-		status = RA_NOMATCH;
-#ifdef FEAT_MBYTE
-	    else if (has_mbyte)
+	  case BRACE_LIMITS:
 	    {
-		int this_class;
+		if (OP(next) == BRACE_SIMPLE)
+		{
+		    bl_minval = OPERAND_MIN(scan);
+		    bl_maxval = OPERAND_MAX(scan);
+		}
+		else if (OP(next) >= BRACE_COMPLEX
+			&& OP(next) < BRACE_COMPLEX + 10)
+		{
+		    no = OP(next) - BRACE_COMPLEX;
+		    brace_min[no] = OPERAND_MIN(scan);
+		    brace_max[no] = OPERAND_MAX(scan);
+		    brace_count[no] = 0;
+		}
+		else
+		{
+		    reg_emsg(rex, _(e_internal));   /* Shouldn't happen */
 
-		/* Get class of current and previous char (if it exists). */
-		this_class = mb_get_class(reginput);
-		if (this_class <= 1)
-		    status = RA_NOMATCH;  /* not on a word at all */
-		else if (reg_prev_class() == this_class)
-		    status = RA_NOMATCH;  /* previous char is in same word */
+		    status = RA_FAIL;
+		}
 	    }
-#endif
-	    else
+	    break;
+
+	  case BRACE_COMPLEX + 0:
+	  case BRACE_COMPLEX + 1:
+	  case BRACE_COMPLEX + 2:
+	  case BRACE_COMPLEX + 3:
+	  case BRACE_COMPLEX + 4:
+	  case BRACE_COMPLEX + 5:
+	  case BRACE_COMPLEX + 6:
+	  case BRACE_COMPLEX + 7:
+	  case BRACE_COMPLEX + 8:
+	  case BRACE_COMPLEX + 9:
 	    {
-		if (!vim_iswordc(c)
-			|| (reginput > regline && vim_iswordc(reginput[-1])))
-		    status = RA_NOMATCH;
+		no = op - BRACE_COMPLEX;
+		++brace_count[no];
+
+		/* If not matched enough times yet, try one more */
+		if (brace_count[no] <= (brace_min[no] <= brace_max[no]
+					     ? brace_min[no] : brace_max[no]))
+		{
+		    rp = regstack_push(rex, RS_BRCPLX_MORE, scan);
+		    if (rp == NULL)
+			status = RA_FAIL;
+		    else
+		    {
+			rp->rs_no = no;
+			reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
+			next = OPERAND(scan);
+			/* We continue and handle the result when done. */
+		    }
+		    break;
+		}
+
+		/* If matched enough times, may try matching some more */
+		if (brace_min[no] <= brace_max[no])
+		{
+		    /* Range is the normal way around, use longest match */
+		    if (brace_count[no] <= brace_max[no])
+		    {
+			rp = regstack_push(rex, RS_BRCPLX_LONG, scan);
+			if (rp == NULL)
+			    status = RA_FAIL;
+			else
+			{
+			    rp->rs_no = no;
+			    reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
+			    next = OPERAND(scan);
+			    /* We continue and handle the result when done. */
+			}
+		    }
+		}
+		else
+		{
+		    /* Range is backwards, use shortest match first */
+		    if (brace_count[no] <= brace_min[no])
+		    {
+			rp = regstack_push(rex, RS_BRCPLX_SHORT, scan);
+			if (rp == NULL)
+			    status = RA_FAIL;
+			else
+			{
+			    reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
+			    /* We continue and handle the result when done. */
+			}
+		    }
+		}
 	    }
 	    break;
 
-	  case EOW:	/* word\>; reginput points after d */
-	    if (reginput == regline)    /* Can't match at start of line */
-		status = RA_NOMATCH;
-#ifdef FEAT_MBYTE
-	    else if (has_mbyte)
+	  case BRACE_SIMPLE:
+	  case STAR:
+	  case PLUS:
 	    {
-		int this_class, prev_class;
+		regstar_T	rst;
 
-		/* Get class of current and previous char (if it exists). */
-		this_class = mb_get_class(reginput);
-		prev_class = reg_prev_class();
-		if (this_class == prev_class
-			|| prev_class == 0 || prev_class == 1)
+		/*
+		 * Lookahead to avoid useless match attempts when we know
+		 * what character comes next.
+		 */
+		if (OP(next) == EXACTLY)
+		{
+		    rst.nextb = *OPERAND(next);
+		    if (rex->reg_ic)
+		    {
+			if (MB_ISUPPER(rst.nextb))
+			    rst.nextb_ic = MB_TOLOWER(rst.nextb);
+			else
+			    rst.nextb_ic = MB_TOUPPER(rst.nextb);
+		    }
+		    else
+			rst.nextb_ic = rst.nextb;
+		}
+		else
+		{
+		    rst.nextb = NUL;
+		    rst.nextb_ic = NUL;
+		}
+		if (op != BRACE_SIMPLE)
+		{
+		    rst.minval = (op == STAR) ? 0 : 1;
+		    rst.maxval = MAX_LIMIT;
+		}
+		else
+		{
+		    rst.minval = bl_minval;
+		    rst.maxval = bl_maxval;
+		}
+
+		/*
+		 * When maxval > minval, try matching as much as possible, up
+		 * to maxval.  When maxval < minval, try matching at least the
+		 * minimal number (since the range is backwards, that's also
+		 * maxval!).
+		 */
+		rst.count = regrepeat(rex, OPERAND(scan), rst.maxval);
+		if (REG_GOT_INT)
+		{
+		    status = RA_FAIL;
+		    break;
+		}
+		if (rst.minval <= rst.maxval
+			  ? rst.count >= rst.minval : rst.count >= rst.maxval)
+		{
+		    /* It could match.  Prepare for trying to match what
+		     * follows.  The code is below.  Parameters are stored in
+		     * a regstar_T on the regstack. */
+		    if ((long)((unsigned)rex->regstack.ga_len >> 10) >= p_mmp)
+		    {
+			reg_emsg(rex, _(e_maxmempat));
+			status = RA_FAIL;
+		    }
+		    else if (reg_ga_grow(rex, &rex->regstack,
+						   sizeof(regstar_T)) == FAIL)
+			status = RA_FAIL;
+		    else
+		    {
+			rex->regstack.ga_len += sizeof(regstar_T);
+			rp = regstack_push(rex, rst.minval <= rst.maxval
+					? RS_STAR_LONG : RS_STAR_SHORT, scan);
+			if (rp == NULL)
+			    status = RA_FAIL;
+			else
+			{
+			    *(((regstar_T *)rp) - 1) = rst;
+			    status = RA_BREAK;	    /* skip the restore bits */
+			}
+		    }
+		}
+		else
 		    status = RA_NOMATCH;
+
 	    }
-#endif
+	    break;
+
+	  case NOMATCH:
+	  case MATCH:
+	  case SUBPAT:
+	    rp = regstack_push(rex, RS_NOMATCH, scan);
+	    if (rp == NULL)
+		status = RA_FAIL;
 	    else
 	    {
-		if (!vim_iswordc(reginput[-1])
-			|| (reginput[0] != NUL && vim_iswordc(c)))
-		    status = RA_NOMATCH;
+		rp->rs_no = op;
+		reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
+		next = OPERAND(scan);
+		/* We continue and handle the result when done. */
 	    }
-	    break; /* Matched with EOW */
-
-	  case ANY:
-	    if (c == NUL)
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
 	    break;
 
-	  case IDENT:
-	    if (!vim_isIDc(c))
-		status = RA_NOMATCH;
+	  case BEHIND:
+	  case NOBEHIND:
+	    /* Need a bit of room to store extra positions. */
+	    if ((long)((unsigned)rex->regstack.ga_len >> 10) >= p_mmp)
+	    {
+		reg_emsg(rex, _(e_maxmempat));
+		status = RA_FAIL;
+	    }
+	    else if (reg_ga_grow(rex, &rex->regstack, sizeof(regbehind_T))
+								       == FAIL)
+		status = RA_FAIL;
 	    else
-		ADVANCE_REGINPUT();
+	    {
+		rex->regstack.ga_len += sizeof(regbehind_T);
+		rp = regstack_push(rex, RS_BEHIND1, scan);
+		if (rp == NULL)
+		    status = RA_FAIL;
+		else
+		{
+		    /* Need to save the subexpr to be able to restore them
+		     * when there is a match but we don't use it. */
+		    save_subexpr(rex, ((regbehind_T *)rp) - 1);
+
+		    rp->rs_no = op;
+		    reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
+		    /* First try if what follows matches.  If it does then we
+		     * check the behind match by looping. */
+		}
+	    }
 	    break;
 
-	  case SIDENT:
-	    if (VIM_ISDIGIT(*reginput) || !vim_isIDc(c))
+	  case BHPOS:
+	    if (REG_MULTI)
+	    {
+		if (rex->behind_pos.rs_u.pos.col
+				       != (colnr_T)(rex->input - rex->line)
+			|| rex->behind_pos.rs_u.pos.lnum != rex->lnum)
+		    status = RA_NOMATCH;
+	    }
+	    else if (rex->behind_pos.rs_u.ptr != rex->input)
 		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
 	    break;
 
-	  case KWORD:
-	    if (!vim_iswordp(reginput))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+	  case END:
+	    status = RA_MATCH;	/* Success! */
 	    break;
 
-	  case SKWORD:
-	    if (VIM_ISDIGIT(*reginput) || !vim_iswordp(reginput))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+	  default:
+	    reg_emsg(rex, _(e_re_corr));
+#ifdef DEBUG
+	    printf("Illegal op code %d\n", op);
+#endif
+	    status = RA_FAIL;
 	    break;
+	  }
+	}
 
-	  case FNAME:
-	    if (!vim_isfilec(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+	/* If we can't continue sequentially, break the inner loop. */
+	if (status != RA_CONT)
 	    break;
 
-	  case SFNAME:
-	    if (VIM_ISDIGIT(*reginput) || !vim_isfilec(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
-	    break;
-
-	  case PRINT:
-	    if (ptr2cells(reginput) != 1)
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
-	    break;
-
-	  case SPRINT:
-	    if (VIM_ISDIGIT(*reginput) || ptr2cells(reginput) != 1)
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
-	    break;
-
-	  case WHITE:
-	    if (!vim_iswhite(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
-	    break;
-
-	  case NWHITE:
-	    if (c == NUL || vim_iswhite(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
-	    break;
+	/* Continue in inner loop, advance to next item. */
+	scan = next;
 
-	  case DIGIT:
-	    if (!ri_digit(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
-	    break;
+    } /* end of inner loop */
 
-	  case NDIGIT:
-	    if (c == NUL || ri_digit(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+    /*
+     * If there is something on the regstack execute the code for the state.
+     * If the state is popped then loop and use the older state.
+     */
+    while (rex->regstack.ga_len > 0 && status != RA_FAIL)
+    {
+	rp = (regitem_T *)((char *)rex->regstack.ga_data
+						  + rex->regstack.ga_len) - 1;
+	switch (rp->rs_state)
+	{
+	  case RS_NOPEN:
+	    /* Result is passed on as-is, simply pop the state. */
+	    regstack_pop(rex, &scan);
 	    break;
 
-	  case HEX:
-	    if (!ri_hex(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+	  case RS_MOPEN:
+	    /* Pop the state.  Restore pointers when there is no match. */
+	    if (status == RA_NOMATCH)
+		restore_se(&rp->rs_un.sesave, &rex->reg_startpos[rp->rs_no],
+						  &rex->reg_startp[rp->rs_no]);
+	    regstack_pop(rex, &scan);
 	    break;
 
-	  case NHEX:
-	    if (c == NUL || ri_hex(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+#ifdef FEAT_SYN_HL
+	  case RS_ZOPEN:
+	    /* Pop the state.  Restore pointers when there is no match. */
+	    if (status == RA_NOMATCH)
+		restore_se(&rp->rs_un.sesave, &rex->reg_startzpos[rp->rs_no],
+						 &rex->reg_startzp[rp->rs_no]);
+	    regstack_pop(rex, &scan);
 	    break;
+#endif
 
-	  case OCTAL:
-	    if (!ri_octal(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+	  case RS_MCLOSE:
+	    /* Pop the state.  Restore pointers when there is no match. */
+	    if (status == RA_NOMATCH)
+		restore_se(&rp->rs_un.sesave, &rex->reg_endpos[rp->rs_no],
+						    &rex->reg_endp[rp->rs_no]);
+	    regstack_pop(rex, &scan);
 	    break;
 
-	  case NOCTAL:
-	    if (c == NUL || ri_octal(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+#ifdef FEAT_SYN_HL
+	  case RS_ZCLOSE:
+	    /* Pop the state.  Restore pointers when there is no match. */
+	    if (status == RA_NOMATCH)
+		restore_se(&rp->rs_un.sesave, &rex->reg_endzpos[rp->rs_no],
+						   &rex->reg_endzp[rp->rs_no]);
+	    regstack_pop(rex, &scan);
 	    break;
+#endif
 
-	  case WORD:
-	    if (!ri_word(c))
-		status = RA_NOMATCH;
+	  case RS_BRANCH:
+	    if (status == RA_MATCH)
+		/* this branch matched, use it */
+		regstack_pop(rex, &scan);
 	    else
-		ADVANCE_REGINPUT();
+	    {
+		if (status != RA_BREAK)
+		{
+		    /* After a non-matching branch: try next one. */
+		    reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+		    scan = rp->rs_scan;
+		}
+		if (scan == NULL || OP(scan) != BRANCH)
+		{
+		    /* no more branches, didn't find a match */
+		    status = RA_NOMATCH;
+		    regstack_pop(rex, &scan);
+		}
+		else
+		{
+		    /* Prepare to try a branch. */
+		    rp->rs_scan = regnext(scan);
+		    reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
+		    scan = OPERAND(scan);
+		}
+	    }
 	    break;
 
-	  case NWORD:
-	    if (c == NUL || ri_word(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+	  case RS_BRCPLX_MORE:
+	    /* Pop the state.  Restore pointers when there is no match. */
+	    if (status == RA_NOMATCH)
+	    {
+		reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+		--brace_count[rp->rs_no];	/* decrement match count */
+	    }
+	    regstack_pop(rex, &scan);
 	    break;
 
-	  case HEAD:
-	    if (!ri_head(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+	  case RS_BRCPLX_LONG:
+	    /* Pop the state.  Restore pointers when there is no match. */
+	    if (status == RA_NOMATCH)
+	    {
+		/* There was no match, but we did find enough matches. */
+		reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+		--brace_count[rp->rs_no];
+		/* continue with the items after "\{}" */
+		status = RA_CONT;
+	    }
+	    regstack_pop(rex, &scan);
+	    if (status == RA_CONT)
+		scan = regnext(scan);
 	    break;
 
-	  case NHEAD:
-	    if (c == NUL || ri_head(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+	  case RS_BRCPLX_SHORT:
+	    /* Pop the state.  Restore pointers when there is no match. */
+	    if (status == RA_NOMATCH)
+		/* There was no match, try to match one more item. */
+		reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+	    regstack_pop(rex, &scan);
+	    if (status == RA_NOMATCH)
+	    {
+		scan = OPERAND(scan);
+		status = RA_CONT;
+	    }
 	    break;
 
-	  case ALPHA:
-	    if (!ri_alpha(c))
+	  case RS_NOMATCH:
+	    /* Pop the state.  If the operand matches for NOMATCH or
+	     * doesn't match for MATCH/SUBPAT, we fail.  Otherwise backup,
+	     * except for SUBPAT, and continue with the next item. */
+	    if (status == (rp->rs_no == NOMATCH ? RA_MATCH : RA_NOMATCH))
 		status = RA_NOMATCH;
 	    else
-		ADVANCE_REGINPUT();
+	    {
+		status = RA_CONT;
+		if (rp->rs_no != SUBPAT)	/* zero-width */
+		    reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+	    }
+	    regstack_pop(rex, &scan);
+	    if (status == RA_CONT)
+		scan = regnext(scan);
 	    break;
 
-	  case NALPHA:
-	    if (c == NUL || ri_alpha(c))
-		status = RA_NOMATCH;
+	  case RS_BEHIND1:
+	    if (status == RA_NOMATCH)
+	    {
+		regstack_pop(rex, &scan);
+		rex->regstack.ga_len -= sizeof(regbehind_T);
+	    }
 	    else
-		ADVANCE_REGINPUT();
-	    break;
+	    {
+		/* The stuff after BEHIND/NOBEHIND matches.  Now try if
+		 * the behind part does (not) match before the current
+		 * position in the input.  This must be done at every
+		 * position in the input and checking if the match ends at
+		 * the current position. */
 
-	  case LOWER:
-	    if (!ri_lower(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
-	    break;
+		/* save the position after the found match for next */
+		reg_save(rex, &(((regbehind_T *)rp) - 1)->save_after,
+							       &rex->backpos);
 
-	  case NLOWER:
-	    if (c == NUL || ri_lower(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
-	    break;
+		/* start looking for a match with operand at the current
+		 * position.  Go back one character until we find the
+		 * result, hitting the start of the line or the previous
+		 * line (for multi-line matching).
+		 * Set behind_pos to where the match should end, BHPOS
+		 * will match it.  Save the current value. */
+		(((regbehind_T *)rp) - 1)->save_behind = rex->behind_pos;
+		rex->behind_pos = rp->rs_un.regsave;
 
-	  case UPPER:
-	    if (!ri_upper(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
-	    break;
+		rp->rs_state = RS_BEHIND2;
 
-	  case NUPPER:
-	    if (c == NUL || ri_upper(c))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
+		reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+		scan = OPERAND(rp->rs_scan);
+	    }
 	    break;
 
-	  case EXACTLY:
+	  case RS_BEHIND2:
+	    /*
+	     * Looping for BEHIND / NOBEHIND match.
+	     */
+	    if (status == RA_MATCH && reg_save_equal(rex, &rex->behind_pos))
 	    {
-		int	len;
-		char_u	*opnd;
-
-		opnd = OPERAND(scan);
-		/* Inline the first byte, for speed. */
-		if (*opnd != *reginput
-			&& (!ireg_ic || (
-#ifdef FEAT_MBYTE
-			    !enc_utf8 &&
-#endif
-			    MB_TOLOWER(*opnd) != MB_TOLOWER(*reginput))))
-		    status = RA_NOMATCH;
-		else if (*opnd == NUL)
+		/* found a match that ends where "next" started */
+		rex->behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
+		if (rp->rs_no == BEHIND)
+		    reg_restore(rex, &(((regbehind_T *)rp) - 1)->save_after,
+							       &rex->backpos);
+		else
 		{
-		    /* match empty string always works; happens when "~" is
-		     * empty. */
+		    /* But we didn't want a match.  Need to restore the
+		     * subexpr, because what follows matched, so they have
+		     * been set. */
+		    status = RA_NOMATCH;
+		    restore_subexpr(rex, ((regbehind_T *)rp) - 1);
 		}
-		else if (opnd[1] == NUL
-#ifdef FEAT_MBYTE
-			    && !(enc_utf8 && ireg_ic)
-#endif
-			)
-		    ++reginput;		/* matched a single char */
-		else
+		regstack_pop(rex, &scan);
+		rex->regstack.ga_len -= sizeof(regbehind_T);
+	    }
+	    else
+	    {
+		/* No match or a match that doesn't end where we want it: Go
+		 * back one character.  May go to previous line once. */
+		no = OK;
+		if (REG_MULTI)
 		{
-		    len = (int)STRLEN(opnd);
-		    /* Need to match first byte again for multi-byte. */
-		    if (cstrncmp(opnd, reginput, &len) != 0)
-			status = RA_NOMATCH;
-#ifdef FEAT_MBYTE
-		    /* Check for following composing character. */
-		    else if (enc_utf8
-			       && UTF_COMPOSINGLIKE(reginput, reginput + len))
+		    if (rp->rs_un.regsave.rs_u.pos.col == 0)
 		    {
-			/* raaron: This code makes a composing character get
-			 * ignored, which is the correct behavior (sometimes)
-			 * for voweled Hebrew texts. */
-			if (!ireg_icombine)
-			    status = RA_NOMATCH;
+			if (rp->rs_un.regsave.rs_u.pos.lnum
+					< rex->behind_pos.rs_u.pos.lnum
+				|| reg_getline(rex,
+					--rp->rs_un.regsave.rs_u.pos.lnum)
+								  == NULL)
+			    no = FAIL;
+			else
+			{
+			    reg_restore(rex, &rp->rs_un.regsave,
+							       &rex->backpos);
+			    rp->rs_un.regsave.rs_u.pos.col =
+						 (colnr_T)STRLEN(rex->line);
+			}
+		    }
+		    else
+			--rp->rs_un.regsave.rs_u.pos.col;
+		}
+		else
+		{
+		    if (rp->rs_un.regsave.rs_u.ptr == rex->line)
+			no = FAIL;
+		    else
+			--rp->rs_un.regsave.rs_u.ptr;
+		}
+		if (no == OK)
+		{
+		    /* Advanced, prepare for finding match again. */
+		    reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+		    scan = OPERAND(rp->rs_scan);
+		    if (status == RA_MATCH)
+		    {
+			/* We did match, so subexpr may have been changed,
+			 * need to restore them for the next try. */
+			status = RA_NOMATCH;
+			restore_subexpr(rex, ((regbehind_T *)rp) - 1);
+		    }
+		}
+		else
+		{
+		    /* Can't advance.  For NOBEHIND that's a match. */
+		    rex->behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
+		    if (rp->rs_no == NOBEHIND)
+		    {
+			reg_restore(rex,
+				   &(((regbehind_T *)rp) - 1)->save_after,
+							       &rex->backpos);
+			status = RA_MATCH;
 		    }
-#endif
 		    else
-			reginput += len;
+		    {
+			/* We do want a proper match.  Need to restore the
+			 * subexpr if we had a match, because they may have
+			 * been set. */
+			if (status == RA_MATCH)
+			{
+			    status = RA_NOMATCH;
+			    restore_subexpr(rex, ((regbehind_T *)rp) - 1);
+			}
+		    }
+		    regstack_pop(rex, &scan);
+		    rex->regstack.ga_len -= sizeof(regbehind_T);
 		}
 	    }
 	    break;
 
-	  case ANYOF:
-	  case ANYBUT:
-	    if (c == NUL)
-		status = RA_NOMATCH;
-	    else if ((cstrchr(OPERAND(scan), c) == NULL) == (op == ANYOF))
-		status = RA_NOMATCH;
-	    else
-		ADVANCE_REGINPUT();
-	    break;
-
-#ifdef FEAT_MBYTE
-	  case MULTIBYTECODE:
-	    if (has_mbyte)
+	  case RS_STAR_LONG:
+	  case RS_STAR_SHORT:
 	    {
-		int	i, len;
-		char_u	*opnd;
-		int	opndc = 0, inpc;
+		regstar_T	    *rst = ((regstar_T *)rp) - 1;
 
-		opnd = OPERAND(scan);
-		/* Safety check (just in case 'encoding' was changed since
-		 * compiling the program). */
-		if ((len = (*mb_ptr2len)(opnd)) < 2)
+		if (status == RA_MATCH)
 		{
-		    status = RA_NOMATCH;
+		    regstack_pop(rex, &scan);
+		    rex->regstack.ga_len -= sizeof(regstar_T);
 		    break;
 		}
-		if (enc_utf8)
-		    opndc = mb_ptr2char(opnd);
-		if (enc_utf8 && utf_iscomposing(opndc))
+
+		/* Tried once already, restore input pointers. */
+		if (status != RA_BREAK)
+		    reg_restore(rex, &rp->rs_un.regsave, &rex->backpos);
+
+		/* Repeat until we found a position where it could match. */
+		for (;;)
 		{
-		    /* When only a composing char is given match at any
-		     * position where that composing char appears. */
-		    status = RA_NOMATCH;
-		    for (i = 0; reginput[i] != NUL; i += utf_char2len(inpc))
+		    if (status != RA_BREAK)
 		    {
-			inpc = mb_ptr2char(reginput + i);
-			if (!utf_iscomposing(inpc))
+			/* Tried first position already, advance. */
+			if (rp->rs_state == RS_STAR_LONG)
 			{
-			    if (i > 0)
+			    /* Trying for longest match, but couldn't or
+			     * didn't match -- back up one char. */
+			    if (--rst->count < rst->minval)
 				break;
+			    if (rex->input == rex->line)
+			    {
+				/* backup to last char of previous line */
+				--rex->lnum;
+				rex->line = reg_getline(rex, rex->lnum);
+				/* Just in case regrepeat() didn't count
+				 * right. */
+				if (rex->line == NULL)
+				    break;
+				rex->input = rex->line + STRLEN(rex->line);
+				reg_breakcheck(rex);
+			    }
+			    else
+				mb_ptr_back(rex->line, rex->input);
 			}
-			else if (opndc == inpc)
+			else
 			{
-			    /* Include all following composing chars. */
-			    len = i + mb_ptr2len(reginput + i);
-			    status = RA_MATCH;
-			    break;
+			    /* Range is backwards, use shortest match first.
+			     * Careful: maxval and minval are exchanged!
+			     * Couldn't or didn't match: try advancing one
+			     * char. */
+			    if (rst->count == rst->minval || regrepeat(rex,
+					       OPERAND(rp->rs_scan), 1L) == 0)
+				break;
+			    ++rst->count;
 			}
+			if (REG_GOT_INT)
+			    break;
+		    }
+		    else
+			status = RA_NOMATCH;
+
+		    /* If it could match, try it. */
+		    if (rst->nextb == NUL || *rex->input == rst->nextb
+					     || *rex->input == rst->nextb_ic)
+		    {
+			reg_save(rex, &rp->rs_un.regsave, &rex->backpos);
+			scan = regnext(rp->rs_scan);
+			status = RA_CONT;
+			break;
 		    }
 		}
-		else
-		    for (i = 0; i < len; ++i)
-			if (opnd[i] != reginput[i])
-			{
-			    status = RA_NOMATCH;
-			    break;
-			}
-		reginput += len;
+		if (status != RA_CONT)
+		{
+		    /* Failed. */
+		    regstack_pop(rex, &scan);
+		    rex->regstack.ga_len -= sizeof(regstar_T);
+		    status = RA_NOMATCH;
+		}
 	    }
+	    break;
+	}
+
+	/* If we want to continue the inner loop or didn't pop a state
+	 * continue matching loop */
+	if (status == RA_CONT || rp == (regitem_T *)((char *)
+			rex->regstack.ga_data + rex->regstack.ga_len) - 1)
+	    break;
+    }
+
+    /* May need to continue with the inner loop, starting at "scan". */
+    if (status == RA_CONT)
+	continue;
+
+    /*
+     * If the regstack is empty or something failed we are done.
+     */
+    if (rex->regstack.ga_len == 0 || status == RA_FAIL)
+    {
+	if (scan == NULL)
+	{
+	    /*
+	     * We get here only if there's trouble -- normally "case END" is
+	     * the terminating point.
+	     */
+	    reg_emsg(rex, _(e_re_corr));
+#ifdef DEBUG
+	    printf("Premature EOL\n");
+#endif
+	}
+	if (status == RA_FAIL)
+	{
+	    if (rex->reg_detached)
+		rex->reg_failed = TRUE;
 	    else
+		got_int = TRUE;
+	}
+	return (status == RA_MATCH);
+    }
+
+  } /* End of loop until the regstack is empty. */
+
+  /* NOTREACHED */
+}
+
+/*
+ * Match the item "scan" at "rex->input": a character, character class or
+ * position, something that regmatch() can do without using the regstack.
+ * Advances "rex->input" (and "rex->lnum") over what was matched.
+ * Returns RA_CONT when it matches, RA_NOMATCH when it doesn't.
+ * Also used by the NFA engine.
+ */
+    static int
+reg_match_item(rex, scan)
+    regexec_T	*rex;
+    char_u	*scan;
+{
+    int		op = OP(scan);
+    int		c;
+    int		status = RA_CONT;
+
+    /* Check for character class with NL added. */
+    if (!rex->reg_line_lbr && WITH_NL(op) && REG_MULTI
+		       && *rex->input == NUL && rex->lnum <= rex->reg_maxline)
+    {
+	reg_nextline(rex);
+    }
+    else if (rex->reg_line_lbr && WITH_NL(op) && *rex->input == '\n')
+    {
+	ADVANCE_REGINPUT();
+    }
+    else
+    {
+	if (WITH_NL(op))
+	    op -= ADD_NL;
+#ifdef FEAT_MBYTE
+	if (has_mbyte)
+	    c = (*mb_ptr2char)(rex->input);
+	else
+#endif
+	    c = *rex->input;
+	switch (op)
+	{
+	  case BOL:
+	    if (rex->input != rex->line)
 		status = RA_NOMATCH;
 	    break;
-#endif
 
-	  case NOTHING:
+	  case EOL:
+	    if (c != NUL)
+		status = RA_NOMATCH;
 	    break;
 
-	  case BACK:
+	  case RE_BOF:
+	    /* We're not at the beginning of the file when below the first
+	     * line where we started, not at the start of the line or we
+	     * didn't start at the first line of the buffer. */
+	    if (rex->lnum != 0 || rex->input != rex->line
+				     || (REG_MULTI && rex->reg_firstlnum > 1))
+		status = RA_NOMATCH;
+	    break;
+
+	  case RE_EOF:
+	    if (rex->lnum != rex->reg_maxline || c != NUL)
+		status = RA_NOMATCH;
+	    break;
+
+	  case CURSOR:
+	    /* Check if the buffer is in a window and compare the
+	     * reg_win->w_cursor position to the match position. */
+	    if (rex->reg_win == NULL
+		    || (rex->lnum + rex->reg_firstlnum
+					       != rex->reg_win->w_cursor.lnum)
+		    || ((colnr_T)(rex->input - rex->line)
+						!= rex->reg_win->w_cursor.col))
+		status = RA_NOMATCH;
+	    break;
+
+	  case RE_MARK:
+	    /* Compare the mark position to the match position.  NOTE: Always
+	     * uses the current buffer. */
 	    {
-		int		i;
-		backpos_T	*bp;
+		int	mark = OPERAND(scan)[0];
+		int	cmp = OPERAND(scan)[1];
+		pos_T	*pos;
 
-		/*
-		 * When we run into BACK we need to check if we don't keep
-		 * looping without matching any input.  The second and later
-		 * times a BACK is encountered it fails if the input is still
-		 * at the same position as the previous time.
-		 * The positions are stored in "backpos" and found by the
-		 * current value of "scan", the position in the RE program.
-		 */
-		bp = (backpos_T *)backpos.ga_data;
-		for (i = 0; i < backpos.ga_len; ++i)
-		    if (bp[i].bp_scan == scan)
-			break;
-		if (i == backpos.ga_len)
-		{
-		    /* First time at this BACK, make room to store the pos. */
-		    if (ga_grow(&backpos, 1) == FAIL)
-			status = RA_FAIL;
-		    else
-		    {
-			/* get "ga_data" again, it may have changed */
-			bp = (backpos_T *)backpos.ga_data;
-			bp[i].bp_scan = scan;
-			++backpos.ga_len;
-		    }
-		}
-		else if (reg_save_equal(&bp[i].bp_pos))
-		    /* Still at same position as last time, fail. */
+		pos = getmark(mark, FALSE);
+		if (pos == NULL		     /* mark doesn't exist */
+			|| pos->lnum <= 0    /* mark isn't set (in curbuf) */
+			|| (pos->lnum == rex->lnum + rex->reg_firstlnum
+				? (pos->col
+				       == (colnr_T)(rex->input - rex->line)
+				    ? (cmp == '<' || cmp == '>')
+				    : (pos->col
+					< (colnr_T)(rex->input - rex->line)
+					? cmp != '>'
+					: cmp != '<'))
+				: (pos->lnum < rex->lnum + rex->reg_firstlnum
+				    ? cmp != '>'
+				    : cmp != '<')))
 		    status = RA_NOMATCH;
-
-		if (status != RA_FAIL && status != RA_NOMATCH)
-		    reg_save(&bp[i].bp_pos, &backpos);
 	    }
 	    break;
 
-	  case MOPEN + 0:   /* Match start: \zs */
-	  case MOPEN + 1:   /* \( */
-	  case MOPEN + 2:
-	  case MOPEN + 3:
-	  case MOPEN + 4:
-	  case MOPEN + 5:
-	  case MOPEN + 6:
-	  case MOPEN + 7:
-	  case MOPEN + 8:
-	  case MOPEN + 9:
-	    {
-		no = op - MOPEN;
-		cleanup_subexpr();
-		rp = regstack_push(RS_MOPEN, scan);
-		if (rp == NULL)
-		    status = RA_FAIL;
-		else
-		{
-		    rp->rs_no = no;
-		    save_se(&rp->rs_un.sesave, &reg_startpos[no],
-							     &reg_startp[no]);
-		    /* We simply continue and handle the result when done. */
-		}
-	    }
-	    break;
-
-	  case NOPEN:	    /* \%( */
-	  case NCLOSE:	    /* \) after \%( */
-		if (regstack_push(RS_NOPEN, scan) == NULL)
-		    status = RA_FAIL;
-		/* We simply continue and handle the result when done. */
-		break;
-
-#ifdef FEAT_SYN_HL
-	  case ZOPEN + 1:
-	  case ZOPEN + 2:
-	  case ZOPEN + 3:
-	  case ZOPEN + 4:
-	  case ZOPEN + 5:
-	  case ZOPEN + 6:
-	  case ZOPEN + 7:
-	  case ZOPEN + 8:
-	  case ZOPEN + 9:
-	    {
-		no = op - ZOPEN;
-		cleanup_zsubexpr();
-		rp = regstack_push(RS_ZOPEN, scan);
-		if (rp == NULL)
-		    status = RA_FAIL;
-		else
-		{
-		    rp->rs_no = no;
-		    save_se(&rp->rs_un.sesave, &reg_startzpos[no],
-							     &reg_startzp[no]);
-		    /* We simply continue and handle the result when done. */
-		}
-	    }
-	    break;
-#endif
-
-	  case MCLOSE + 0:  /* Match end: \ze */
-	  case MCLOSE + 1:  /* \) */
-	  case MCLOSE + 2:
-	  case MCLOSE + 3:
-	  case MCLOSE + 4:
-	  case MCLOSE + 5:
-	  case MCLOSE + 6:
-	  case MCLOSE + 7:
-	  case MCLOSE + 8:
-	  case MCLOSE + 9:
-	    {
-		no = op - MCLOSE;
-		cleanup_subexpr();
-		rp = regstack_push(RS_MCLOSE, scan);
-		if (rp == NULL)
-		    status = RA_FAIL;
-		else
-		{
-		    rp->rs_no = no;
-		    save_se(&rp->rs_un.sesave, &reg_endpos[no], &reg_endp[no]);
-		    /* We simply continue and handle the result when done. */
-		}
-	    }
-	    break;
-
-#ifdef FEAT_SYN_HL
-	  case ZCLOSE + 1:  /* \) after \z( */
-	  case ZCLOSE + 2:
-	  case ZCLOSE + 3:
-	  case ZCLOSE + 4:
-	  case ZCLOSE + 5:
-	  case ZCLOSE + 6:
-	  case ZCLOSE + 7:
-	  case ZCLOSE + 8:
-	  case ZCLOSE + 9:
-	    {
-		no = op - ZCLOSE;
-		cleanup_zsubexpr();
-		rp = regstack_push(RS_ZCLOSE, scan);
-		if (rp == NULL)
-		    status = RA_FAIL;
-		else
-		{
-		    rp->rs_no = no;
-		    save_se(&rp->rs_un.sesave, &reg_endzpos[no],
-							      &reg_endzp[no]);
-		    /* We simply continue and handle the result when done. */
-		}
-	    }
-	    break;
-#endif
-
-	  case BACKREF + 1:
-	  case BACKREF + 2:
-	  case BACKREF + 3:
-	  case BACKREF + 4:
-	  case BACKREF + 5:
-	  case BACKREF + 6:
-	  case BACKREF + 7:
-	  case BACKREF + 8:
-	  case BACKREF + 9:
+	  case RE_VISUAL:
+#ifdef FEAT_VISUAL
+	    /* Check if the buffer is the current buffer. and whether the
+	     * position is inside the Visual area. */
+	    if (rex->reg_buf != curbuf || VIsual.lnum == 0)
+		status = RA_NOMATCH;
+	    else
 	    {
-		int		len;
-		linenr_T	clnum;
-		colnr_T		ccol;
-		char_u		*p;
+		pos_T	    top, bot;
+		linenr_T    lnum;
+		colnr_T	    col;
+		win_T	    *wp = rex->reg_win == NULL ? curwin : rex->reg_win;
+		int	    mode;
 
-		no = op - BACKREF;
-		cleanup_subexpr();
-		if (!REG_MULTI)		/* Single-line regexp */
+		if (VIsual_active)
 		{
-		    if (reg_startp[no] == NULL || reg_endp[no] == NULL)
+		    if (lt(VIsual, wp->w_cursor))
 		    {
-			/* Backref was not set: Match an empty string. */
-			len = 0;
+			top = VIsual;
+			bot = wp->w_cursor;
 		    }
 		    else
 		    {
-			/* Compare current input with back-ref in the same
-			 * line. */
-			len = (int)(reg_endp[no] - reg_startp[no]);
-			if (cstrncmp(reg_startp[no], reginput, &len) != 0)
-			    status = RA_NOMATCH;
+			top = wp->w_cursor;
+			bot = VIsual;
 		    }
+		    mode = VIsual_mode;
 		}
-		else				/* Multi-line regexp */
+		else
 		{
-		    if (reg_startpos[no].lnum < 0 || reg_endpos[no].lnum < 0)
+		    if (lt(curbuf->b_visual.vi_start, curbuf->b_visual.vi_end))
 		    {
-			/* Backref was not set: Match an empty string. */
-			len = 0;
+			top = curbuf->b_visual.vi_start;
+			bot = curbuf->b_visual.vi_end;
 		    }
 		    else
 		    {
-			if (reg_startpos[no].lnum == reglnum
-				&& reg_endpos[no].lnum == reglnum)
-			{
-			    /* Compare back-ref within the current line. */
-			    len = reg_endpos[no].col - reg_startpos[no].col;
-			    if (cstrncmp(regline + reg_startpos[no].col,
-							  reginput, &len) != 0)
-				status = RA_NOMATCH;
-			}
-			else
-			{
-			    /* Messy situation: Need to compare between two
-			     * lines. */
-			    ccol = reg_startpos[no].col;
-			    clnum = reg_startpos[no].lnum;
-			    for (;;)
-			    {
-				/* Since getting one line may invalidate
-				 * the other, need to make copy.  Slow! */
-				if (regline != reg_tofree)
-				{
-				    len = (int)STRLEN(regline);
-				    if (reg_tofree == NULL
-						 || len >= (int)reg_tofreelen)
-				    {
-					len += 50;	/* get some extra */
-					vim_free(reg_tofree);
-					reg_tofree = alloc(len);
-					if (reg_tofree == NULL)
-					{
-					    status = RA_FAIL; /* outof memory!*/
-					    break;
-					}
-					reg_tofreelen = len;
-				    }
-				    STRCPY(reg_tofree, regline);
-				    reginput = reg_tofree
-						       + (reginput - regline);
-				    regline = reg_tofree;
-				}
-
-				/* Get the line to compare with. */
-				p = reg_getline(clnum);
-				if (clnum == reg_endpos[no].lnum)
-				    len = reg_endpos[no].col - ccol;
-				else
-				    len = (int)STRLEN(p + ccol);
-
-				if (cstrncmp(p + ccol, reginput, &len) != 0)
-				{
-				    status = RA_NOMATCH;  /* doesn't match */
-				    break;
-				}
-				if (clnum == reg_endpos[no].lnum)
-				    break;		/* match and at end! */
-				if (reglnum >= reg_maxline)
-				{
-				    status = RA_NOMATCH;  /* text too short */
-				    break;
-				}
-
-				/* Advance to next line. */
-				reg_nextline();
-				++clnum;
-				ccol = 0;
-				if (got_int)
-				{
-				    status = RA_FAIL;
-				    break;
-				}
-			    }
-
-			    /* found a match!  Note that regline may now point
-			     * to a copy of the line, that should not matter. */
-			}
+			top = curbuf->b_visual.vi_end;
+			bot = curbuf->b_visual.vi_start;
 		    }
+		    mode = curbuf->b_visual.vi_mode;
 		}
-
-		/* Matched the backref, skip over it. */
-		reginput += len;
-	    }
-	    break;
-
-#ifdef FEAT_SYN_HL
-	  case ZREF + 1:
-	  case ZREF + 2:
-	  case ZREF + 3:
-	  case ZREF + 4:
-	  case ZREF + 5:
-	  case ZREF + 6:
-	  case ZREF + 7:
-	  case ZREF + 8:
-	  case ZREF + 9:
-	    {
-		int	len;
-
-		cleanup_zsubexpr();
-		no = op - ZREF;
-		if (re_extmatch_in != NULL
-			&& re_extmatch_in->matches[no] != NULL)
+		lnum = rex->lnum + rex->reg_firstlnum;
+		col = (colnr_T)(rex->input - rex->line);
+		if (lnum < top.lnum || lnum > bot.lnum)
+		    status = RA_NOMATCH;
+		else if (mode == 'v')
 		{
-		    len = (int)STRLEN(re_extmatch_in->matches[no]);
-		    if (cstrncmp(re_extmatch_in->matches[no],
-							  reginput, &len) != 0)
+		    if ((lnum == top.lnum && col < top.col)
+			    || (lnum == bot.lnum
+					 && col >= bot.col + (*p_sel != 'e')))
 			status = RA_NOMATCH;
-		    else
-			reginput += len;
 		}
-		else
+		else if (mode == Ctrl_V)
 		{
-		    /* Backref was not set: Match an empty string. */
+		    colnr_T	    start, end;
+		    colnr_T	    start2, end2;
+		    colnr_T	    cols;
+
+		    getvvcol(wp, &top, &start, NULL, &end);
+		    getvvcol(wp, &bot, &start2, NULL, &end2);
+		    if (start2 < start)
+			start = start2;
+		    if (end2 > end)
+			end = end2;
+		    if (top.col == MAXCOL || bot.col == MAXCOL)
+			end = MAXCOL;
+		    cols = win_linetabsize(wp, rex->line,
+					 (colnr_T)(rex->input - rex->line));
+		    if (cols < start || cols > end - (*p_sel == 'e'))
+			status = RA_NOMATCH;
 		}
 	    }
-	    break;
+#else
+	    status = RA_NOMATCH;
 #endif
+	    break;
 
-	  case BRANCH:
-	    {
-		if (OP(next) != BRANCH) /* No choice. */
-		    next = OPERAND(scan);	/* Avoid recursion. */
-		else
-		{
-		    rp = regstack_push(RS_BRANCH, scan);
-		    if (rp == NULL)
-			status = RA_FAIL;
-		    else
-			status = RA_BREAK;	/* rest is below */
-		}
-	    }
+	  case RE_LNUM:
+	    if (!REG_MULTI || !re_num_cmp(
+			    (long_u)(rex->lnum + rex->reg_firstlnum), scan))
+		status = RA_NOMATCH;
 	    break;
 
-	  case BRACE_LIMITS:
-	    {
-		if (OP(next) == BRACE_SIMPLE)
-		{
-		    bl_minval = OPERAND_MIN(scan);
-		    bl_maxval = OPERAND_MAX(scan);
-		}
-		else if (OP(next) >= BRACE_COMPLEX
-			&& OP(next) < BRACE_COMPLEX + 10)
-		{
-		    no = OP(next) - BRACE_COMPLEX;
-		    brace_min[no] = OPERAND_MIN(scan);
-		    brace_max[no] = OPERAND_MAX(scan);
-		    brace_count[no] = 0;
-		}
-		else
-		{
-		    EMSG(_(e_internal));	    /* Shouldn't happen */
-		    status = RA_FAIL;
-		}
-	    }
+	  case RE_COL:
+	    if (!re_num_cmp((long_u)(rex->input - rex->line) + 1, scan))
+		status = RA_NOMATCH;
 	    break;
 
-	  case BRACE_COMPLEX + 0:
-	  case BRACE_COMPLEX + 1:
-	  case BRACE_COMPLEX + 2:
-	  case BRACE_COMPLEX + 3:
-	  case BRACE_COMPLEX + 4:
-	  case BRACE_COMPLEX + 5:
-	  case BRACE_COMPLEX + 6:
-	  case BRACE_COMPLEX + 7:
-	  case BRACE_COMPLEX + 8:
-	  case BRACE_COMPLEX + 9:
-	    {
-		no = op - BRACE_COMPLEX;
-		++brace_count[no];
-
-		/* If not matched enough times yet, try one more */
-		if (brace_count[no] <= (brace_min[no] <= brace_max[no]
-					     ? brace_min[no] : brace_max[no]))
-		{
-		    rp = regstack_push(RS_BRCPLX_MORE, scan);
-		    if (rp == NULL)
-			status = RA_FAIL;
-		    else
-		    {
-			rp->rs_no = no;
-			reg_save(&rp->rs_un.regsave, &backpos);
-			next = OPERAND(scan);
-			/* We continue and handle the result when done. */
-		    }
-		    break;
-		}
-
-		/* If matched enough times, may try matching some more */
-		if (brace_min[no] <= brace_max[no])
-		{
-		    /* Range is the normal way around, use longest match */
-		    if (brace_count[no] <= brace_max[no])
-		    {
-			rp = regstack_push(RS_BRCPLX_LONG, scan);
-			if (rp == NULL)
-			    status = RA_FAIL;
-			else
-			{
-			    rp->rs_no = no;
-			    reg_save(&rp->rs_un.regsave, &backpos);
-			    next = OPERAND(scan);
-			    /* We continue and handle the result when done. */
-			}
-		    }
-		}
-		else
-		{
-		    /* Range is backwards, use shortest match first */
-		    if (brace_count[no] <= brace_min[no])
-		    {
-			rp = regstack_push(RS_BRCPLX_SHORT, scan);
-			if (rp == NULL)
-			    status = RA_FAIL;
-			else
-			{
-			    reg_save(&rp->rs_un.regsave, &backpos);
-			    /* We continue and handle the result when done. */
-			}
-		    }
-		}
-	    }
+	  case RE_VCOL:
+	    if (!re_num_cmp((long_u)win_linetabsize(
+			    rex->reg_win == NULL ? curwin : rex->reg_win,
+			    rex->line, (colnr_T)(rex->input - rex->line)) + 1,
+									scan))
+		status = RA_NOMATCH;
 	    break;
 
-	  case BRACE_SIMPLE:
-	  case STAR:
-	  case PLUS:
+	  case BOW:	/* \<word; rex->input points to w */
+	    if (c == NUL)	/* Can't match at end of line */
+		status = RA_NOMATCH;
+#ifdef FEAT_MBYTE
+	    else if (has_mbyte)
 	    {
-		regstar_T	rst;
-
-		/*
-		 * Lookahead to avoid useless match attempts when we know
-		 * what character comes next.
-		 */
-		if (OP(next) == EXACTLY)
-		{
-		    rst.nextb = *OPERAND(next);
-		    if (ireg_ic)
-		    {
-			if (MB_ISUPPER(rst.nextb))
-			    rst.nextb_ic = MB_TOLOWER(rst.nextb);
-			else
-			    rst.nextb_ic = MB_TOUPPER(rst.nextb);
-		    }
-		    else
-			rst.nextb_ic = rst.nextb;
-		}
-		else
-		{
-		    rst.nextb = NUL;
-		    rst.nextb_ic = NUL;
-		}
-		if (op != BRACE_SIMPLE)
-		{
-		    rst.minval = (op == STAR) ? 0 : 1;
-		    rst.maxval = MAX_LIMIT;
-		}
-		else
-		{
-		    rst.minval = bl_minval;
-		    rst.maxval = bl_maxval;
-		}
-
-		/*
-		 * When maxval > minval, try matching as much as possible, up
-		 * to maxval.  When maxval < minval, try matching at least the
-		 * minimal number (since the range is backwards, that's also
-		 * maxval!).
-		 */
-		rst.count = regrepeat(OPERAND(scan), rst.maxval);
-		if (got_int)
-		{
-		    status = RA_FAIL;
-		    break;
-		}
-		if (rst.minval <= rst.maxval
-			  ? rst.count >= rst.minval : rst.count >= rst.maxval)
-		{
-		    /* It could match.  Prepare for trying to match what
-		     * follows.  The code is below.  Parameters are stored in
-		     * a regstar_T on the regstack. */
-		    if ((long)((unsigned)regstack.ga_len >> 10) >= p_mmp)
-		    {
-			EMSG(_(e_maxmempat));
-			status = RA_FAIL;
-		    }
-		    else if (ga_grow(&regstack, sizeof(regstar_T)) == FAIL)
-			status = RA_FAIL;
-		    else
-		    {
-			regstack.ga_len += sizeof(regstar_T);
-			rp = regstack_push(rst.minval <= rst.maxval
-					? RS_STAR_LONG : RS_STAR_SHORT, scan);
-			if (rp == NULL)
-			    status = RA_FAIL;
-			else
-			{
-			    *(((regstar_T *)rp) - 1) = rst;
-			    status = RA_BREAK;	    /* skip the restore bits */
-			}
-		    }
-		}
-		else
-		    status = RA_NOMATCH;
+		int this_class;
 
+		/* Get class of current and previous char (if it exists). */
+		this_class = reg_get_class(rex, rex->input);
+		if (this_class <= 1)
+		    status = RA_NOMATCH;  /* not on a word at all */
+		else if (reg_prev_class(rex) == this_class)
+		    status = RA_NOMATCH;  /* previous char is in same word */
 	    }
-	    break;
-
-	  case NOMATCH:
-	  case MATCH:
-	  case SUBPAT:
-	    rp = regstack_push(RS_NOMATCH, scan);
-	    if (rp == NULL)
-		status = RA_FAIL;
+#endif
 	    else
 	    {
-		rp->rs_no = op;
-		reg_save(&rp->rs_un.regsave, &backpos);
-		next = OPERAND(scan);
-		/* We continue and handle the result when done. */
+		if (!reg_iswordc(rex, c) || (rex->input > rex->line
+				       && reg_iswordc(rex, rex->input[-1])))
+		    status = RA_NOMATCH;
 	    }
 	    break;
 
-	  case BEHIND:
-	  case NOBEHIND:
-	    /* Need a bit of room to store extra positions. */
-	    if ((long)((unsigned)regstack.ga_len >> 10) >= p_mmp)
-	    {
-		EMSG(_(e_maxmempat));
-		status = RA_FAIL;
-	    }
-	    else if (ga_grow(&regstack, sizeof(regbehind_T)) == FAIL)
-		status = RA_FAIL;
-	    else
+	  case EOW:	/* word\>; rex->input points after d */
+	    if (rex->input == rex->line)    /* Can't match at start of line */
+		status = RA_NOMATCH;
+#ifdef FEAT_MBYTE
+	    else if (has_mbyte)
 	    {
-		regstack.ga_len += sizeof(regbehind_T);
-		rp = regstack_push(RS_BEHIND1, scan);
-		if (rp == NULL)
-		    status = RA_FAIL;
-		else
-		{
-		    /* Need to save the subexpr to be able to restore them
-		     * when there is a match but we don't use it. */
-		    save_subexpr(((regbehind_T *)rp) - 1);
+		int this_class, prev_class;
 
-		    rp->rs_no = op;
-		    reg_save(&rp->rs_un.regsave, &backpos);
-		    /* First try if what follows matches.  If it does then we
-		     * check the behind match by looping. */
-		}
+		/* Get class of current and previous char (if it exists). */
+		this_class = reg_get_class(rex, rex->input);
+		prev_class = reg_prev_class(rex);
+		if (this_class == prev_class
+			|| prev_class == 0 || prev_class == 1)
+		    status = RA_NOMATCH;
 	    }
-	    break;
-
-	  case BHPOS:
-	    if (REG_MULTI)
+#endif
+	    else
 	    {
-		if (behind_pos.rs_u.pos.col != (colnr_T)(reginput - regline)
-			|| behind_pos.rs_u.pos.lnum != reglnum)
+		if (!reg_iswordc(rex, rex->input[-1])
+			|| (rex->input[0] != NUL && reg_iswordc(rex, c)))
 		    status = RA_NOMATCH;
 	    }
-	    else if (behind_pos.rs_u.ptr != reginput)
+	    break; /* Matched with EOW */
+
+	  case ANY:
+	    if (c == NUL)
 		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
 	    break;
 
-	  case NEWL:
-	    if ((c != NUL || !REG_MULTI || reglnum > reg_maxline
-			     || reg_line_lbr) && (c != '\n' || !reg_line_lbr))
+	  case IDENT:
+	    if (!vim_isIDc(c))
 		status = RA_NOMATCH;
-	    else if (reg_line_lbr)
+	    else
 		ADVANCE_REGINPUT();
+	    break;
+
+	  case SIDENT:
+	    if (VIM_ISDIGIT(*rex->input) || !vim_isIDc(c))
+		status = RA_NOMATCH;
 	    else
-		reg_nextline();
+		ADVANCE_REGINPUT();
 	    break;
 
-	  case END:
-	    status = RA_MATCH;	/* Success! */
+	  case KWORD:
+	    if (!reg_iswordp(rex, rex->input))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
 	    break;
 
-	  default:
-	    EMSG(_(e_re_corr));
-#ifdef DEBUG
-	    printf("Illegal op code %d\n", op);
-#endif
-	    status = RA_FAIL;
+	  case SKWORD:
+	    if (VIM_ISDIGIT(*rex->input) || !reg_iswordp(rex, rex->input))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
 	    break;
-	  }
-	}
 
-	/* If we can't continue sequentially, break the inner loop. */
-	if (status != RA_CONT)
+	  case FNAME:
+	    if (!vim_isfilec(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
 	    break;
 
-	/* Continue in inner loop, advance to next item. */
-	scan = next;
+	  case SFNAME:
+	    if (VIM_ISDIGIT(*rex->input) || !vim_isfilec(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
 
-    } /* end of inner loop */
+	  case PRINT:
+	    if (ptr2cells(rex->input) != 1)
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
 
-    /*
-     * If there is something on the regstack execute the code for the state.
-     * If the state is popped then loop and use the older state.
-     */
-    while (regstack.ga_len > 0 && status != RA_FAIL)
-    {
-	rp = (regitem_T *)((char *)regstack.ga_data + regstack.ga_len) - 1;
-	switch (rp->rs_state)
-	{
-	  case RS_NOPEN:
-	    /* Result is passed on as-is, simply pop the state. */
-	    regstack_pop(&scan);
+	  case SPRINT:
+	    if (VIM_ISDIGIT(*rex->input) || ptr2cells(rex->input) != 1)
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
 	    break;
 
-	  case RS_MOPEN:
-	    /* Pop the state.  Restore pointers when there is no match. */
-	    if (status == RA_NOMATCH)
-		restore_se(&rp->rs_un.sesave, &reg_startpos[rp->rs_no],
-						  &reg_startp[rp->rs_no]);
-	    regstack_pop(&scan);
+	  case WHITE:
+	    if (!vim_iswhite(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
 	    break;
 
-#ifdef FEAT_SYN_HL
-	  case RS_ZOPEN:
-	    /* Pop the state.  Restore pointers when there is no match. */
-	    if (status == RA_NOMATCH)
-		restore_se(&rp->rs_un.sesave, &reg_startzpos[rp->rs_no],
-						 &reg_startzp[rp->rs_no]);
-	    regstack_pop(&scan);
+	  case NWHITE:
+	    if (c == NUL || vim_iswhite(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case DIGIT:
+	    if (!ri_digit(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case NDIGIT:
+	    if (c == NUL || ri_digit(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case HEX:
+	    if (!ri_hex(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case NHEX:
+	    if (c == NUL || ri_hex(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case OCTAL:
+	    if (!ri_octal(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case NOCTAL:
+	    if (c == NUL || ri_octal(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case WORD:
+	    if (!ri_word(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case NWORD:
+	    if (c == NUL || ri_word(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case HEAD:
+	    if (!ri_head(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case NHEAD:
+	    if (c == NUL || ri_head(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case ALPHA:
+	    if (!ri_alpha(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case NALPHA:
+	    if (c == NUL || ri_alpha(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case LOWER:
+	    if (!ri_lower(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case NLOWER:
+	    if (c == NUL || ri_lower(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case UPPER:
+	    if (!ri_upper(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
+	    break;
+
+	  case NUPPER:
+	    if (c == NUL || ri_upper(c))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
 	    break;
+
+	  case EXACTLY:
+	    {
+		int	len;
+		char_u	*opnd;
+
+		opnd = OPERAND(scan);
+		/* Inline the first byte, for speed. */
+		if (*opnd != *rex->input
+			&& (!rex->reg_ic || (
+#ifdef FEAT_MBYTE
+			    !enc_utf8 &&
+#endif
+			    MB_TOLOWER(*opnd) != MB_TOLOWER(*rex->input))))
+		    status = RA_NOMATCH;
+		else if (*opnd == NUL)
+		{
+		    /* match empty string always works; happens when "~" is
+		     * empty. */
+		}
+		else if (opnd[1] == NUL
+#ifdef FEAT_MBYTE
+			    && !(enc_utf8 && rex->reg_ic)
 #endif
+			)
+		    ++rex->input;		/* matched a single char */
+		else
+		{
+		    len = (int)STRLEN(opnd);
+		    /* Need to match first byte again for multi-byte. */
+		    if (cstrncmp(rex, opnd, rex->input, &len) != 0)
+			status = RA_NOMATCH;
+#ifdef FEAT_MBYTE
+		    /* Check for following composing character. */
+		    else if (enc_utf8 && UTF_COMPOSINGLIKE(rex->input,
+							   rex->input + len))
+		    {
+			/* raaron: This code makes a composing character get
+			 * ignored, which is the correct behavior (sometimes)
+			 * for voweled Hebrew texts. */
+			if (!rex->reg_icombine)
+			    status = RA_NOMATCH;
+		    }
+#endif
+		    else
+			rex->input += len;
+		}
+	    }
+	    break;
 
-	  case RS_MCLOSE:
-	    /* Pop the state.  Restore pointers when there is no match. */
-	    if (status == RA_NOMATCH)
-		restore_se(&rp->rs_un.sesave, &reg_endpos[rp->rs_no],
-						    &reg_endp[rp->rs_no]);
-	    regstack_pop(&scan);
+	  case ANYOF:
+	  case ANYBUT:
+	    if (c == NUL)
+		status = RA_NOMATCH;
+	    else if ((cstrchr(rex, OPERAND(scan), c) == NULL) == (op == ANYOF))
+		status = RA_NOMATCH;
+	    else
+		ADVANCE_REGINPUT();
 	    break;
 
-#ifdef FEAT_SYN_HL
-	  case RS_ZCLOSE:
-	    /* Pop the state.  Restore pointers when there is no match. */
-	    if (status == RA_NOMATCH)
-		restore_se(&rp->rs_un.sesave, &reg_endzpos[rp->rs_no],
-						   &reg_endzp[rp->rs_no]);
-	    regstack_pop(&scan);
-	    break;
-#endif
+#ifdef FEAT_MBYTE
+	  case MULTIBYTECODE:
+	    if (has_mbyte)
+	    {
+		int	i, len;
+		char_u	*opnd;
+		int	opndc = 0, inpc;
+
+		opnd = OPERAND(scan);
+		/* Safety check (just in case 'encoding' was changed since
+		 * compiling the program). */
+		if ((len = (*mb_ptr2len)(opnd)) < 2)
+		{
+		    status = RA_NOMATCH;
+		    break;
+		}
+		if (enc_utf8)
+		    opndc = mb_ptr2char(opnd);
+		if (enc_utf8 && utf_iscomposing(opndc))
+		{
+		    /* When only a composing char is given match at any
+		     * position where that composing char appears. */
+		    status = RA_NOMATCH;
+		    for (i = 0; rex->input[i] != NUL; i += utf_char2len(inpc))
+		    {
+			inpc = mb_ptr2char(rex->input + i);
+			if (!utf_iscomposing(inpc))
+			{
+			    if (i > 0)
+				break;
+			}
+			else if (opndc == inpc)
+			{
+			    /* Include all following composing chars. */
+			    len = i + mb_ptr2len(rex->input + i);
+			    status = RA_MATCH;
+			    break;
+			}
+		    }
+		}
+		else
+		    for (i = 0; i < len; ++i)
+			if (opnd[i] != rex->input[i])
+			{
+			    status = RA_NOMATCH;
+			    break;
+			}
+		rex->input += len;
+	    }
+	    else
+		status = RA_NOMATCH;
+	    break;
+#endif
+
+	  case NEWL:
+	    if ((c != NUL || !REG_MULTI || rex->lnum > rex->reg_maxline
+			     || rex->reg_line_lbr)
+			    && (c != '\n' || !rex->reg_line_lbr))
+		status = RA_NOMATCH;
+	    else if (rex->reg_line_lbr)
+		ADVANCE_REGINPUT();
+	    else
+		reg_nextline(rex);
+	    break;
+	}
+    }
+    return status;
+}
+
+/*
+ * Push an item onto the regstack.
+ * Returns pointer to new item.  Returns NULL when out of memory.
+ */
+    static regitem_T *
+regstack_push(rex, state, scan)
+    regexec_T	*rex;
+    regstate_T	state;
+    char_u	*scan;
+{
+    regitem_T	*rp;
+
+    if ((long)((unsigned)rex->regstack.ga_len >> 10) >= p_mmp)
+    {
+	reg_emsg(rex, _(e_maxmempat));
+	return NULL;
+    }
+    if (reg_ga_grow(rex, &rex->regstack, sizeof(regitem_T)) == FAIL)
+	return NULL;
+
+    rp = (regitem_T *)((char *)rex->regstack.ga_data + rex->regstack.ga_len);
+    rp->rs_state = state;
+    rp->rs_scan = scan;
+
+    rex->regstack.ga_len += sizeof(regitem_T);
+#ifdef FEAT_PROFILE
+    if (++rex->regstack_depth > rex->regstack_maxdepth)
+	rex->regstack_maxdepth = rex->regstack_depth;
+#endif
+    return rp;
+}
+
+/*
+ * Pop an item from the regstack.
+ */
+    static void
+regstack_pop(rex, scan)
+    regexec_T	*rex;
+    char_u	**scan;
+{
+    regitem_T	*rp;
+
+    rp = (regitem_T *)((char *)rex->regstack.ga_data
+						  + rex->regstack.ga_len) - 1;
+    *scan = rp->rs_scan;
+
+    rex->regstack.ga_len -= sizeof(regitem_T);
+#ifdef FEAT_PROFILE
+    --rex->regstack_depth;
+#endif
+}
+
+/*
+ * regrepeat - repeatedly match something simple, return how many.
+ * Advances rex->input (and rex->lnum) to just after the matched chars.
+ */
+    static int
+regrepeat(rex, p, maxcount)
+    regexec_T	*rex;
+    char_u	*p;
+    long	maxcount;   /* maximum number of matches allowed */
+{
+    long	count = 0;
+    char_u	*scan;
+    char_u	*opnd;
+    int		mask;
+    int		testval = 0;
+
+    scan = rex->input;	    /* Make local copy of rex->input for speed. */
+    opnd = OPERAND(p);
+    switch (OP(p))
+    {
+      case ANY:
+      case ANY + ADD_NL:
+	while (count < maxcount)
+	{
+	    /* Matching anything means we continue until end-of-line (or
+	     * end-of-file for ANY + ADD_NL), only limited by maxcount. */
+	    while (*scan != NUL && count < maxcount)
+	    {
+		++count;
+		mb_ptr_adv(scan);
+	    }
+	    if (!REG_MULTI || !WITH_NL(OP(p))
+		    || rex->lnum > rex->reg_maxline
+		    || rex->reg_line_lbr || count == maxcount)
+		break;
+	    ++count;		/* count the line-break */
+	    reg_nextline(rex);
+	    scan = rex->input;
+	    if (REG_GOT_INT)
+		break;
+	}
+	break;
+
+      case IDENT:
+      case IDENT + ADD_NL:
+	testval = TRUE;
+	/*FALLTHROUGH*/
+      case SIDENT:
+      case SIDENT + ADD_NL:
+	while (count < maxcount)
+	{
+	    if (vim_isIDc(*scan) && (testval || !VIM_ISDIGIT(*scan)))
+	    {
+		mb_ptr_adv(scan);
+	    }
+	    else if (*scan == NUL)
+	    {
+		if (!REG_MULTI || !WITH_NL(OP(p))
+			|| rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
+
+		    break;
+		reg_nextline(rex);
+		scan = rex->input;
+		if (REG_GOT_INT)
+		    break;
+	    }
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+		++scan;
+	    else
+		break;
+	    ++count;
+	}
+	break;
+
+      case KWORD:
+      case KWORD + ADD_NL:
+	testval = TRUE;
+	/*FALLTHROUGH*/
+      case SKWORD:
+      case SKWORD + ADD_NL:
+	while (count < maxcount)
+	{
+	    if (reg_iswordp(rex, scan) && (testval || !VIM_ISDIGIT(*scan)))
+	    {
+		mb_ptr_adv(scan);
+	    }
+	    else if (*scan == NUL)
+	    {
+		if (!REG_MULTI || !WITH_NL(OP(p))
+			|| rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
+
+		    break;
+		reg_nextline(rex);
+		scan = rex->input;
+		if (REG_GOT_INT)
+		    break;
+	    }
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+		++scan;
+	    else
+		break;
+	    ++count;
+	}
+	break;
+
+      case FNAME:
+      case FNAME + ADD_NL:
+	testval = TRUE;
+	/*FALLTHROUGH*/
+      case SFNAME:
+      case SFNAME + ADD_NL:
+	while (count < maxcount)
+	{
+	    if (vim_isfilec(*scan) && (testval || !VIM_ISDIGIT(*scan)))
+	    {
+		mb_ptr_adv(scan);
+	    }
+	    else if (*scan == NUL)
+	    {
+		if (!REG_MULTI || !WITH_NL(OP(p))
+			|| rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
+
+		    break;
+		reg_nextline(rex);
+		scan = rex->input;
+		if (REG_GOT_INT)
+		    break;
+	    }
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+		++scan;
+	    else
+		break;
+	    ++count;
+	}
+	break;
+
+      case PRINT:
+      case PRINT + ADD_NL:
+	testval = TRUE;
+	/*FALLTHROUGH*/
+      case SPRINT:
+      case SPRINT + ADD_NL:
+	while (count < maxcount)
+	{
+	    if (*scan == NUL)
+	    {
+		if (!REG_MULTI || !WITH_NL(OP(p))
+			|| rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
+
+		    break;
+		reg_nextline(rex);
+		scan = rex->input;
+		if (REG_GOT_INT)
+		    break;
+	    }
+	    else if (ptr2cells(scan) == 1 && (testval || !VIM_ISDIGIT(*scan)))
+	    {
+		mb_ptr_adv(scan);
+	    }
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+		++scan;
+	    else
+		break;
+	    ++count;
+	}
+	break;
+
+      case WHITE:
+      case WHITE + ADD_NL:
+	testval = mask = RI_WHITE;
+do_class:
+	while (count < maxcount)
+	{
+#ifdef FEAT_MBYTE
+	    int		l;
+#endif
+	    if (*scan == NUL)
+	    {
+		if (!REG_MULTI || !WITH_NL(OP(p))
+			|| rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
+
+		    break;
+		reg_nextline(rex);
+		scan = rex->input;
+		if (REG_GOT_INT)
+		    break;
+	    }
+#ifdef FEAT_MBYTE
+	    else if (has_mbyte && (l = (*mb_ptr2len)(scan)) > 1)
+	    {
+		if (testval != 0)
+		    break;
+		scan += l;
+	    }
+#endif
+	    else if ((class_tab[*scan] & mask) == testval)
+		++scan;
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+		++scan;
+	    else
+		break;
+	    ++count;
+	}
+	break;
+
+      case NWHITE:
+      case NWHITE + ADD_NL:
+	mask = RI_WHITE;
+	goto do_class;
+      case DIGIT:
+      case DIGIT + ADD_NL:
+	testval = mask = RI_DIGIT;
+	goto do_class;
+      case NDIGIT:
+      case NDIGIT + ADD_NL:
+	mask = RI_DIGIT;
+	goto do_class;
+      case HEX:
+      case HEX + ADD_NL:
+	testval = mask = RI_HEX;
+	goto do_class;
+      case NHEX:
+      case NHEX + ADD_NL:
+	mask = RI_HEX;
+	goto do_class;
+      case OCTAL:
+      case OCTAL + ADD_NL:
+	testval = mask = RI_OCTAL;
+	goto do_class;
+      case NOCTAL:
+      case NOCTAL + ADD_NL:
+	mask = RI_OCTAL;
+	goto do_class;
+      case WORD:
+      case WORD + ADD_NL:
+	testval = mask = RI_WORD;
+	goto do_class;
+      case NWORD:
+      case NWORD + ADD_NL:
+	mask = RI_WORD;
+	goto do_class;
+      case HEAD:
+      case HEAD + ADD_NL:
+	testval = mask = RI_HEAD;
+	goto do_class;
+      case NHEAD:
+      case NHEAD + ADD_NL:
+	mask = RI_HEAD;
+	goto do_class;
+      case ALPHA:
+      case ALPHA + ADD_NL:
+	testval = mask = RI_ALPHA;
+	goto do_class;
+      case NALPHA:
+      case NALPHA + ADD_NL:
+	mask = RI_ALPHA;
+	goto do_class;
+      case LOWER:
+      case LOWER + ADD_NL:
+	testval = mask = RI_LOWER;
+	goto do_class;
+      case NLOWER:
+      case NLOWER + ADD_NL:
+	mask = RI_LOWER;
+	goto do_class;
+      case UPPER:
+      case UPPER + ADD_NL:
+	testval = mask = RI_UPPER;
+	goto do_class;
+      case NUPPER:
+      case NUPPER + ADD_NL:
+	mask = RI_UPPER;
+	goto do_class;
+
+      case EXACTLY:
+	{
+	    int	    cu, cl;
 
-	  case RS_BRANCH:
-	    if (status == RA_MATCH)
-		/* this branch matched, use it */
-		regstack_pop(&scan);
-	    else
+	    /* This doesn't do a multi-byte character, because a MULTIBYTECODE
+	     * would have been used for it.  It does handle single-byte
+	     * characters, such as latin1. */
+	    if (rex->reg_ic)
 	    {
-		if (status != RA_BREAK)
-		{
-		    /* After a non-matching branch: try next one. */
-		    reg_restore(&rp->rs_un.regsave, &backpos);
-		    scan = rp->rs_scan;
-		}
-		if (scan == NULL || OP(scan) != BRANCH)
+		cu = MB_TOUPPER(*opnd);
+		cl = MB_TOLOWER(*opnd);
+		while (count < maxcount && (*scan == cu || *scan == cl))
 		{
-		    /* no more branches, didn't find a match */
-		    status = RA_NOMATCH;
-		    regstack_pop(&scan);
+		    count++;
+		    scan++;
 		}
-		else
+	    }
+	    else
+	    {
+		cu = *opnd;
+		while (count < maxcount && *scan == cu)
 		{
-		    /* Prepare to try a branch. */
-		    rp->rs_scan = regnext(scan);
-		    reg_save(&rp->rs_un.regsave, &backpos);
-		    scan = OPERAND(scan);
+		    count++;
+		    scan++;
 		}
 	    }
 	    break;
+	}
 
-	  case RS_BRCPLX_MORE:
-	    /* Pop the state.  Restore pointers when there is no match. */
-	    if (status == RA_NOMATCH)
+#ifdef FEAT_MBYTE
+      case MULTIBYTECODE:
+	{
+	    int		i, len, cf = 0;
+
+	    /* Safety check (just in case 'encoding' was changed since
+	     * compiling the program). */
+	    if ((len = (*mb_ptr2len)(opnd)) > 1)
 	    {
-		reg_restore(&rp->rs_un.regsave, &backpos);
-		--brace_count[rp->rs_no];	/* decrement match count */
+		if (rex->reg_ic && enc_utf8)
+		    cf = utf_fold(utf_ptr2char(opnd));
+		while (count < maxcount)
+		{
+		    for (i = 0; i < len; ++i)
+			if (opnd[i] != scan[i])
+			    break;
+		    if (i < len && (!rex->reg_ic || !enc_utf8
+					|| utf_fold(utf_ptr2char(scan)) != cf))
+			break;
+		    scan += len;
+		    ++count;
+		}
 	    }
-	    regstack_pop(&scan);
-	    break;
+	}
+	break;
+#endif
 
-	  case RS_BRCPLX_LONG:
-	    /* Pop the state.  Restore pointers when there is no match. */
-	    if (status == RA_NOMATCH)
+      case ANYOF:
+      case ANYOF + ADD_NL:
+	testval = TRUE;
+	/*FALLTHROUGH*/
+
+      case ANYBUT:
+      case ANYBUT + ADD_NL:
+	while (count < maxcount)
+	{
+#ifdef FEAT_MBYTE
+	    int len;
+#endif
+	    if (*scan == NUL)
 	    {
-		/* There was no match, but we did find enough matches. */
-		reg_restore(&rp->rs_un.regsave, &backpos);
-		--brace_count[rp->rs_no];
-		/* continue with the items after "\{}" */
-		status = RA_CONT;
-	    }
-	    regstack_pop(&scan);
-	    if (status == RA_CONT)
-		scan = regnext(scan);
-	    break;
+		if (!REG_MULTI || !WITH_NL(OP(p))
+			|| rex->lnum > rex->reg_maxline || rex->reg_line_lbr)
 
-	  case RS_BRCPLX_SHORT:
-	    /* Pop the state.  Restore pointers when there is no match. */
-	    if (status == RA_NOMATCH)
-		/* There was no match, try to match one more item. */
-		reg_restore(&rp->rs_un.regsave, &backpos);
-	    regstack_pop(&scan);
-	    if (status == RA_NOMATCH)
+		    break;
+		reg_nextline(rex);
+		scan = rex->input;
+		if (REG_GOT_INT)
+		    break;
+	    }
+	    else if (rex->reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
+		++scan;
+#ifdef FEAT_MBYTE
+	    else if (has_mbyte && (len = (*mb_ptr2len)(scan)) > 1)
 	    {
-		scan = OPERAND(scan);
-		status = RA_CONT;
+		if ((cstrchr(rex, opnd, (*mb_ptr2char)(scan)) == NULL)
+								    == testval)
+		    break;
+		scan += len;
 	    }
-	    break;
-
-	  case RS_NOMATCH:
-	    /* Pop the state.  If the operand matches for NOMATCH or
-	     * doesn't match for MATCH/SUBPAT, we fail.  Otherwise backup,
-	     * except for SUBPAT, and continue with the next item. */
-	    if (status == (rp->rs_no == NOMATCH ? RA_MATCH : RA_NOMATCH))
-		status = RA_NOMATCH;
+#endif
 	    else
 	    {
-		status = RA_CONT;
-		if (rp->rs_no != SUBPAT)	/* zero-width */
-		    reg_restore(&rp->rs_un.regsave, &backpos);
+		if ((cstrchr(rex, opnd, *scan) == NULL) == testval)
+		    break;
+		++scan;
 	    }
-	    regstack_pop(&scan);
-	    if (status == RA_CONT)
-		scan = regnext(scan);
-	    break;
+	    ++count;
+	}
+	break;
 
-	  case RS_BEHIND1:
-	    if (status == RA_NOMATCH)
-	    {
-		regstack_pop(&scan);
-		regstack.ga_len -= sizeof(regbehind_T);
-	    }
+      case NEWL:
+	while (count < maxcount
+		&& ((*scan == NUL && rex->lnum <= rex->reg_maxline
+					    && !rex->reg_line_lbr && REG_MULTI)
+		    || (*scan == '\n' && rex->reg_line_lbr)))
+	{
+	    count++;
+	    if (rex->reg_line_lbr)
+		ADVANCE_REGINPUT();
 	    else
-	    {
-		/* The stuff after BEHIND/NOBEHIND matches.  Now try if
-		 * the behind part does (not) match before the current
-		 * position in the input.  This must be done at every
-		 * position in the input and checking if the match ends at
-		 * the current position. */
+		reg_nextline(rex);
+	    scan = rex->input;
+	    if (REG_GOT_INT)
+		break;
+	}
+	break;
 
-		/* save the position after the found match for next */
-		reg_save(&(((regbehind_T *)rp) - 1)->save_after, &backpos);
+      default:			/* Oh dear.  Called inappropriately. */
+	reg_emsg(rex, _(e_re_corr));
+#ifdef DEBUG
+	printf("Called regrepeat with op code %d\n", OP(p));
+#endif
+	break;
+    }
 
-		/* start looking for a match with operand at the current
-		 * position.  Go back one character until we find the
-		 * result, hitting the start of the line or the previous
-		 * line (for multi-line matching).
-		 * Set behind_pos to where the match should end, BHPOS
-		 * will match it.  Save the current value. */
-		(((regbehind_T *)rp) - 1)->save_behind = behind_pos;
-		behind_pos = rp->rs_un.regsave;
+    rex->input = scan;
 
-		rp->rs_state = RS_BEHIND2;
+    return (int)count;
+}
 
-		reg_restore(&rp->rs_un.regsave, &backpos);
-		scan = OPERAND(rp->rs_scan);
-	    }
-	    break;
+/*
+ * The NFA engine.
+ *
+ * It runs the same program as regmatch(), but instead of trying one
+ * alternative after another it keeps a list of "threads": the places in the
+ * program that are being tried at the same time, each with its own position
+ * in the text (Pike's VM, after Thompson).  The text is walked once, from
+ * left to right.  At every position each node is only tried once: the thread
+ * that gets there first has the highest priority and any later one could
+ * only do the same thing.  That makes the time linear in the length of the
+ * text, where backtracking can be exponential for patterns like "\(a*\)*b".
+ *
+ * Threads are kept in the order regmatch() would try them, thus the match
+ * and the submatches are the same.  The exception is a loop that matches the
+ * empty string, regmatch() may set the submatches for one more (empty) time.
+ *
+ * Back references, look-ahead and look-behind, "\&", "\z(" and complex
+ * "\{n,m}" need backtracking, RF_BACKTRACK is set for those.
+ * Characters, classes and positions are matched with reg_match_item() and
+ * STAR, PLUS and BRACE_SIMPLE operands with regrepeat(), like regmatch()
+ * does.
+ */
+static void	nfa_init __ARGS((regexec_T *rex));
+static void	nfa_next_step __ARGS((regexec_T *rex));
+static void	nfa_set_input __ARGS((regexec_T *rex, lpos_T *pos));
+static lpos_T	nfa_get_pos __ARGS((regexec_T *rex));
+static int	nfa_add __ARGS((regexec_T *rex, garray_T *gap, nfathread_T *tp));
+static int	nfa_was_visited __ARGS((regexec_T *rex, regprog_T *prog, char_u *scan, long count));
+static int	nfa_step_thread __ARGS((regexec_T *rex, regprog_T *prog, nfathread_T *tp, lpos_T pos));
+
+#define NFA_POS_EQUAL(a, b) ((a).lnum == (b).lnum && (a).col == (b).col)
+#define NFA_POS_BEFORE(a, b) ((a).lnum < (b).lnum \
+			    || ((a).lnum == (b).lnum && (a).col < (b).col))
 
-	  case RS_BEHIND2:
-	    /*
-	     * Looping for BEHIND / NOBEHIND match.
-	     */
-	    if (status == RA_MATCH && reg_save_equal(&behind_pos))
-	    {
-		/* found a match that ends where "next" started */
-		behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
-		if (rp->rs_no == BEHIND)
-		    reg_restore(&(((regbehind_T *)rp) - 1)->save_after,
-								    &backpos);
-		else
-		{
-		    /* But we didn't want a match.  Need to restore the
-		     * subexpr, because what follows matched, so they have
-		     * been set. */
-		    status = RA_NOMATCH;
-		    restore_subexpr(((regbehind_T *)rp) - 1);
-		}
-		regstack_pop(&scan);
-		regstack.ga_len -= sizeof(regbehind_T);
-	    }
-	    else
+/*
+ * Initialize the lists, the first time or after free_regexp_stuff().
+ */
+    static void
+nfa_init(rex)
+    regexec_T	*rex;
+{
+    if (rex->nfa_counted.ga_itemsize == 0)
+    {
+	ga_init2(&rex->nfa_list, sizeof(nfathread_T), NFA_LIST_INITIAL);
+	ga_init2(&rex->nfa_next, sizeof(nfathread_T), NFA_LIST_INITIAL);
+	ga_init2(&rex->nfa_stack, sizeof(nfathread_T), NFA_LIST_INITIAL);
+	ga_init2(&rex->nfa_counted, sizeof(nfacount_T), NFA_LIST_INITIAL);
+    }
+}
+
+/*
+ * Use a new step number for nfa_was_visited(), all nodes are unvisited.
+ */
+    static void
+nfa_next_step(rex)
+    regexec_T	*rex;
+{
+    /* When the step number wraps around clear the visited flags. */
+    if (++rex->nfa_step <= 0)
+    {
+	if (rex->nfa_visited != NULL)
+	    vim_memset(rex->nfa_visited, 0,
+					  rex->nfa_visited_len * sizeof(int));
+	rex->nfa_step = 1;
+    }
+    rex->nfa_counted.ga_len = 0;
+}
+
+/*
+ * Make "rex->input" point to text position "pos".
+ */
+    static void
+nfa_set_input(rex, pos)
+    regexec_T	*rex;
+    lpos_T	*pos;
+{
+    if (rex->lnum != pos->lnum)
+    {
+	rex->lnum = pos->lnum;
+	rex->line = reg_getline(rex, rex->lnum);
+    }
+    rex->input = rex->line + pos->col;
+}
+
+/*
+ * Return the text position of "rex->input".
+ */
+    static lpos_T
+nfa_get_pos(rex)
+    regexec_T	*rex;
+{
+    lpos_T	pos;
+
+    pos.lnum = rex->lnum;
+    pos.col = (colnr_T)(rex->input - rex->line);
+    return pos;
+}
+
+/*
+ * Add thread "tp" to the end of garray "gap".
+ * Returns FAIL when out of memory.
+ */
+    static int
+nfa_add(rex, gap, tp)
+    regexec_T	*rex;
+    garray_T	*gap;
+    nfathread_T	*tp;
+{
+    if ((long)(((unsigned)gap->ga_len * sizeof(nfathread_T)) >> 10) >= p_mmp)
+    {
+	reg_emsg(rex, _(e_maxmempat));
+	return FAIL;
+    }
+    if (reg_ga_grow(rex, gap, 1) == FAIL)
+	return FAIL;
+    ((nfathread_T *)gap->ga_data)[gap->ga_len++] = *tp;
+    return OK;
+}
+
+/*
+ * Return TRUE when node "scan" was already tried at this position with count
+ * "count", otherwise remember that it is tried now.
+ */
+    static int
+nfa_was_visited(rex, prog, scan, count)
+    regexec_T	*rex;
+    regprog_T	*prog;
+    char_u	*scan;
+    long	count;
+{
+    int		op = OP(scan);
+    nfacount_T	*ncp;
+    int		i;
+
+    if (op == STAR || op == PLUS || op == BRACE_SIMPLE)
+    {
+	ncp = (nfacount_T *)rex->nfa_counted.ga_data;
+	for (i = 0; i < rex->nfa_counted.ga_len; ++i)
+	    if (ncp[i].nc_scan == scan && ncp[i].nc_count == count)
+		return TRUE;
+	if (reg_ga_grow(rex, &rex->nfa_counted, 1) == OK)
+	{
+	    ncp = (nfacount_T *)rex->nfa_counted.ga_data
+						   + rex->nfa_counted.ga_len++;
+	    ncp->nc_scan = scan;
+	    ncp->nc_count = count;
+	}
+	return FALSE;
+    }
+    i = (int)(scan - prog->program);
+    if (i >= rex->nfa_visited_len)
+    {
+	int	*p;
+	int	len = i + 100;
+
+	/* Out of memory: stop this thread, the match may be missed. */
+	p = (int *)reg_alloc_clear(rex, (unsigned)(len * sizeof(int)));
+	if (p == NULL)
+	    return TRUE;
+	if (rex->nfa_visited != NULL)
+	    mch_memmove(p, rex->nfa_visited,
+					  rex->nfa_visited_len * sizeof(int));
+	vim_free(rex->nfa_visited);
+	rex->nfa_visited = p;
+	rex->nfa_visited_len = len;
+    }
+    if (rex->nfa_visited[i] == rex->nfa_step)
+	return TRUE;
+    rex->nfa_visited[i] = rex->nfa_step;
+    return FALSE;
+}
+
+/*
+ * Try thread "tp", which is at text position "pos".  Nodes that don't use up
+ * text are followed here, the alternatives in order.  Threads that matched
+ * some text are added to "nfa_next".
+ * Returns OK when the end of the program was reached, "*tp" is then the
+ * matching thread.  Returns NOTDONE when there is no match (yet), FAIL when
+ * out of memory.
+ */
+    static int
+nfa_step_thread(rex, prog, tp, pos)
+    regexec_T	*rex;
+    regprog_T	*prog;
+    nfathread_T	*tp;
+    lpos_T	pos;
+{
+    nfathread_T	th;
+    nfathread_T	alt;
+    char_u	*scan;
+    char_u	*next;
+    int		op;
+    int		no;
+    long	lo, hi;
+    lpos_T	newpos;
+
+    rex->nfa_stack.ga_len = 0;
+    if (nfa_add(rex, &rex->nfa_stack, tp) == FAIL)
+	return FAIL;
+    while (rex->nfa_stack.ga_len > 0)
+    {
+	th = ((nfathread_T *)rex->nfa_stack.ga_data)[--rex->nfa_stack.ga_len];
+	for (;;)
+	{
+	    scan = th.nt_scan;
+	    op = OP(scan);
+
+	    if (th.nt_more)
 	    {
-		/* No match or a match that doesn't end where we want it: Go
-		 * back one character.  May go to previous line once. */
-		no = OK;
-		if (REG_MULTI)
+		/* Match the STAR, PLUS or BRACE_SIMPLE operand once. */
+		th.nt_more = FALSE;
+		nfa_set_input(rex, &pos);
+		if (regrepeat(rex, OPERAND(scan), 1L) != 1)
+		    break;
+		newpos = nfa_get_pos(rex);
+		if (op == BRACE_SIMPLE)
 		{
-		    if (rp->rs_un.regsave.rs_u.pos.col == 0)
-		    {
-			if (rp->rs_un.regsave.rs_u.pos.lnum
-					< behind_pos.rs_u.pos.lnum
-				|| reg_getline(
-					--rp->rs_un.regsave.rs_u.pos.lnum)
-								  == NULL)
-			    no = FAIL;
-			else
-			{
-			    reg_restore(&rp->rs_un.regsave, &backpos);
-			    rp->rs_un.regsave.rs_u.pos.col =
-						 (colnr_T)STRLEN(regline);
-			}
-		    }
-		    else
-			--rp->rs_un.regsave.rs_u.pos.col;
+		    lo = th.nt_minval <= th.nt_maxval
+					      ? th.nt_minval : th.nt_maxval;
+		    hi = th.nt_minval <= th.nt_maxval
+					      ? th.nt_maxval : th.nt_minval;
 		}
 		else
 		{
-		    if (rp->rs_un.regsave.rs_u.ptr == regline)
-			no = FAIL;
-		    else
-			--rp->rs_un.regsave.rs_u.ptr;
+		    lo = op == STAR ? 0 : 1;
+		    hi = MAX_LIMIT;
 		}
-		if (no == OK)
+		if (NFA_POS_EQUAL(newpos, pos))
 		{
-		    /* Advanced, prepare for finding match again. */
-		    reg_restore(&rp->rs_un.regsave, &backpos);
-		    scan = OPERAND(rp->rs_scan);
-		    if (status == RA_MATCH)
+		    /* Matched nothing, any count will do. */
+		    th.nt_count = hi;
+		    continue;
+		}
+		++th.nt_count;
+		/* Once there are enough any count is the same. */
+		if (hi == MAX_LIMIT && th.nt_count > lo)
+		    th.nt_count = lo;
+		th.nt_pos = newpos;
+		if (nfa_add(rex, &rex->nfa_next, &th) == FAIL)
+		    return FAIL;
+		break;
+	    }
+
+	    if (nfa_was_visited(rex, prog, scan, th.nt_count))
+		break;
+
+	    next = regnext(scan);
+	    if (REG_ITEM(op))
+	    {
+		nfa_set_input(rex, &pos);
+		if (reg_match_item(rex, scan) == RA_NOMATCH)
+		    break;
+		th.nt_scan = next;
+		newpos = nfa_get_pos(rex);
+		if (NFA_POS_EQUAL(newpos, pos))
+		    continue;
+		th.nt_pos = newpos;
+		if (nfa_add(rex, &rex->nfa_next, &th) == FAIL)
+		    return FAIL;
+		break;
+	    }
+
+	    switch (op)
+	    {
+		case END:
+		    *tp = th;
+		    return OK;
+
+		case BRANCH:
+		    if (OP(next) == BRANCH)
 		    {
-			/* We did match, so subexpr may have been changed,
-			 * need to restore them for the next try. */
-			status = RA_NOMATCH;
-			restore_subexpr(((regbehind_T *)rp) - 1);
+			/* Try the next alternative later. */
+			th.nt_scan = next;
+			if (nfa_add(rex, &rex->nfa_stack, &th) == FAIL)
+			    return FAIL;
 		    }
-		}
-		else
-		{
-		    /* Can't advance.  For NOBEHIND that's a match. */
-		    behind_pos = (((regbehind_T *)rp) - 1)->save_behind;
-		    if (rp->rs_no == NOBEHIND)
+		    th.nt_scan = OPERAND(scan);
+		    continue;
+
+		case NOTHING:
+		case BACK:
+		case NOPEN:
+		case NCLOSE:
+		    th.nt_scan = next;
+		    continue;
+
+		case MOPEN + 0:
+		case MOPEN + 1:
+		case MOPEN + 2:
+		case MOPEN + 3:
+		case MOPEN + 4:
+		case MOPEN + 5:
+		case MOPEN + 6:
+		case MOPEN + 7:
+		case MOPEN + 8:
+		case MOPEN + 9:
+		    no = op - MOPEN;
+		    th.nt_startpos[no] = pos;
+		    th.nt_scan = next;
+		    continue;
+
+		case MCLOSE + 0:
+		case MCLOSE + 1:
+		case MCLOSE + 2:
+		case MCLOSE + 3:
+		case MCLOSE + 4:
+		case MCLOSE + 5:
+		case MCLOSE + 6:
+		case MCLOSE + 7:
+		case MCLOSE + 8:
+		case MCLOSE + 9:
+		    no = op - MCLOSE;
+		    th.nt_endpos[no] = pos;
+		    th.nt_scan = next;
+		    continue;
+
+		case BRACE_LIMITS:
+		    th.nt_minval = OPERAND_MIN(scan);
+		    th.nt_maxval = OPERAND_MAX(scan);
+		    th.nt_count = 0;
+		    th.nt_scan = next;
+		    continue;
+
+		case STAR:
+		case PLUS:
+		case BRACE_SIMPLE:
+		    if (op == BRACE_SIMPLE)
 		    {
-			reg_restore(&(((regbehind_T *)rp) - 1)->save_after,
-								    &backpos);
-			status = RA_MATCH;
+			lo = th.nt_minval <= th.nt_maxval
+					      ? th.nt_minval : th.nt_maxval;
+			hi = th.nt_minval <= th.nt_maxval
+					      ? th.nt_maxval : th.nt_minval;
 		    }
 		    else
 		    {
-			/* We do want a proper match.  Need to restore the
-			 * subexpr if we had a match, because they may have
-			 * been set. */
-			if (status == RA_MATCH)
+			lo = op == STAR ? 0 : 1;
+			hi = MAX_LIMIT;
+		    }
+		    if (op != BRACE_SIMPLE || th.nt_minval <= th.nt_maxval)
+		    {
+			/* Longest match first: go on with what follows when
+			 * matching more fails. */
+			if (th.nt_count >= lo)
 			{
-			    status = RA_NOMATCH;
-			    restore_subexpr(((regbehind_T *)rp) - 1);
+			    alt = th;
+			    alt.nt_scan = next;
+			    alt.nt_count = 0;
+			    if (nfa_add(rex, &rex->nfa_stack, &alt) == FAIL)
+				return FAIL;
 			}
+			if (th.nt_count >= hi)
+			    break;
+			th.nt_more = TRUE;
+			continue;
 		    }
-		    regstack_pop(&scan);
-		    regstack.ga_len -= sizeof(regbehind_T);
-		}
+		    /* Shortest match first: match more when what follows
+		     * fails. */
+		    if (th.nt_count < hi)
+		    {
+			th.nt_more = TRUE;
+			if (nfa_add(rex, &rex->nfa_stack, &th) == FAIL)
+			    return FAIL;
+			th.nt_more = FALSE;
+		    }
+		    if (th.nt_count < lo)
+			break;
+		    th.nt_scan = next;
+		    th.nt_count = 0;
+		    continue;
+
+		default:
+		    reg_emsg(rex, _(e_re_corr));
+		    return FAIL;
 	    }
 	    break;
+	}
+    }
+    return NOTDONE;
+}
 
-	  case RS_STAR_LONG:
-	  case RS_STAR_SHORT:
-	    {
-		regstar_T	    *rst = ((regstar_T *)rp) - 1;
+/*
+ * Match "prog" against the text with the NFA engine, like the loop in
+ * vim_regexec_both() does with regtry().  "line" is the first line, a match
+ * must start at column "col" or later.
+ * Returns 0 for failure, the number of lines contained in the match
+ * otherwise.
+ */
+    static long
+nfa_regexec(rex, prog, line, col, tm)
+    regexec_T	*rex;
+    regprog_T	*prog;
+    char_u	*line;
+    colnr_T	col;
+    proftime_T	*tm UNUSED;	/* timeout limit or NULL */
+{
+    nfathread_T	th;
+    nfathread_T	*tp;
+    nfathread_T	found;
+    int		matched = FALSE;
+    lpos_T	pos;
+    colnr_T	startcol;
+    garray_T	ga;
+    int		i;
+    int		c;
+    int		r;
+    long	retval = 0L;
+#ifdef FEAT_RELTIME
+    int		tm_count = 0;
+#endif
 
-		if (status == RA_MATCH)
-		{
-		    regstack_pop(&scan);
-		    regstack.ga_len -= sizeof(regstar_T);
-		    break;
-		}
+    nfa_init(rex);
+    rex->nfa_list.ga_len = 0;
 
-		/* Tried once already, restore input pointers. */
-		if (status != RA_BREAK)
-		    reg_restore(&rp->rs_un.regsave, &backpos);
+    rex->line = line;
+    rex->lnum = 0;
+    if (prog->reganch)
+    {
+	/* Anchored match need be tried only once, see vim_regexec_both(). */
+#ifdef FEAT_MBYTE
+	if (has_mbyte)
+	    c = (*mb_ptr2char)(rex->line + col);
+	else
+#endif
+	    c = rex->line[col];
+	if (prog->regstart == NUL
+		|| prog->regstart == c
+		|| (rex->reg_ic && ((
+#ifdef FEAT_MBYTE
+			(enc_utf8 && utf_fold(prog->regstart) == utf_fold(c)))
+			|| (c < 255 && prog->regstart < 255 &&
+#endif
+			    MB_TOLOWER(prog->regstart) == MB_TOLOWER(c)))))
+	    startcol = col;
+	else
+	    startcol = MAXCOL;
+    }
+    else
+	startcol = reg_start_col(rex, prog, col);
+
+    /* "pos" is the text position of the threads being tried, "startcol"
+     * where the next match may start in the first line.  "pos.lnum" is -1
+     * when there is nothing to try. */
+    pos.lnum = startcol == MAXCOL ? -1 : 0;
+    pos.col = startcol;
+    while (pos.lnum >= 0 && !REG_GOT_INT)
+    {
+	nfa_next_step(rex);
 
-		/* Repeat until we found a position where it could match. */
-		for (;;)
-		{
-		    if (status != RA_BREAK)
-		    {
-			/* Tried first position already, advance. */
-			if (rp->rs_state == RS_STAR_LONG)
-			{
-			    /* Trying for longest match, but couldn't or
-			     * didn't match -- back up one char. */
-			    if (--rst->count < rst->minval)
-				break;
-			    if (reginput == regline)
-			    {
-				/* backup to last char of previous line */
-				--reglnum;
-				regline = reg_getline(reglnum);
-				/* Just in case regrepeat() didn't count
-				 * right. */
-				if (regline == NULL)
-				    break;
-				reginput = regline + STRLEN(regline);
-				fast_breakcheck();
-			    }
-			    else
-				mb_ptr_back(regline, reginput);
-			}
-			else
-			{
-			    /* Range is backwards, use shortest match first.
-			     * Careful: maxval and minval are exchanged!
-			     * Couldn't or didn't match: try advancing one
-			     * char. */
-			    if (rst->count == rst->minval
-				  || regrepeat(OPERAND(rp->rs_scan), 1L) == 0)
-				break;
-			    ++rst->count;
-			}
-			if (got_int)
-			    break;
-		    }
-		    else
-			status = RA_NOMATCH;
+	/* A match starting here has the lowest priority. */
+	if (!matched && pos.lnum == 0 && pos.col == startcol)
+	{
+	    th.nt_scan = prog->program + 1;
+	    th.nt_pos = pos;
+	    th.nt_count = 0;
+	    th.nt_minval = 0;
+	    th.nt_maxval = 0;
+	    th.nt_more = FALSE;
+	    vim_memset(th.nt_startpos, 0xff, sizeof(th.nt_startpos));
+	    vim_memset(th.nt_endpos, 0xff, sizeof(th.nt_endpos));
+	    th.nt_startpos[0] = pos;
+	    if (nfa_add(rex, &rex->nfa_list, &th) == FAIL)
+		break;
+	}
 
-		    /* If it could match, try it. */
-		    if (rst->nextb == NUL || *reginput == rst->nextb
-					     || *reginput == rst->nextb_ic)
-		    {
-			reg_save(&rp->rs_un.regsave, &backpos);
-			scan = regnext(rp->rs_scan);
-			status = RA_CONT;
-			break;
-		    }
-		}
-		if (status != RA_CONT)
+	/* Try the threads at "pos", keep the ones after it in the same
+	 * order.  When one matches the ones after it are dropped. */
+	rex->nfa_next.ga_len = 0;
+	r = OK;
+	for (i = 0; i < rex->nfa_list.ga_len; ++i)
+	{
+	    tp = (nfathread_T *)rex->nfa_list.ga_data + i;
+	    if (!NFA_POS_EQUAL(tp->nt_pos, pos))
+		r = nfa_add(rex, &rex->nfa_next, tp);
+	    else
+	    {
+		th = *tp;
+		r = nfa_step_thread(rex, prog, &th, pos);
+		if (r == OK)
 		{
-		    /* Failed. */
-		    regstack_pop(&scan);
-		    regstack.ga_len -= sizeof(regstar_T);
-		    status = RA_NOMATCH;
+		    found = th;
+		    found.nt_pos = pos;
+		    matched = TRUE;
+		    break;
 		}
 	    }
-	    break;
+	    if (r == FAIL)
+		break;
 	}
+	if (r == FAIL)
+	    break;
+	ga = rex->nfa_list;
+	rex->nfa_list = rex->nfa_next;
+	rex->nfa_next = ga;
 
-	/* If we want to continue the inner loop or didn't pop a state
-	 * continue matching loop */
-	if (status == RA_CONT || rp == (regitem_T *)
-			     ((char *)regstack.ga_data + regstack.ga_len) - 1)
+	/* Find the next position: the first one of a thread, or where the
+	 * next match may start. */
+	if (!matched && pos.lnum == 0 && pos.col == startcol)
+	{
+	    nfa_set_input(rex, &pos);
+	    if (prog->reganch || *rex->input == NUL)
+		startcol = MAXCOL;
+	    else
+	    {
+		mb_ptr_adv(rex->input);
+		startcol = reg_start_col(rex, prog,
+					   (colnr_T)(rex->input - rex->line));
+	    }
+	}
+	if (matched || startcol == MAXCOL)
+	    pos.lnum = -1;
+	else
+	{
+	    pos.lnum = 0;
+	    pos.col = startcol;
+	}
+	for (i = 0; i < rex->nfa_list.ga_len; ++i)
+	{
+	    tp = (nfathread_T *)rex->nfa_list.ga_data + i;
+	    if (pos.lnum < 0 || NFA_POS_BEFORE(tp->nt_pos, pos))
+		pos = tp->nt_pos;
+	}
+	if (pos.lnum < 0)
 	    break;
-    }
 
-    /* May need to continue with the inner loop, starting at "scan". */
-    if (status == RA_CONT)
-	continue;
+	reg_breakcheck(rex);
+#ifdef FEAT_RELTIME
+	/* Check for timeout once in a while to avoid overhead. */
+	if (tm != NULL && ++tm_count == 200)
+	{
+	    tm_count = 0;
+	    if (profile_passed_limit(tm))
+		break;
+	}
+#endif
+    }
 
-    /*
-     * If the regstack is empty or something failed we are done.
-     */
-    if (regstack.ga_len == 0 || status == RA_FAIL)
+    if (matched && !REG_GOT_INT)
     {
-	if (scan == NULL)
+	if (found.nt_endpos[0].lnum < 0)
+	    found.nt_endpos[0] = found.nt_pos;
+	if (REG_MULTI)
 	{
-	    /*
-	     * We get here only if there's trouble -- normally "case END" is
-	     * the terminating point.
-	     */
-	    EMSG(_(e_re_corr));
-#ifdef DEBUG
-	    printf("Premature EOL\n");
+	    for (i = 0; i < NSUBEXP; ++i)
+	    {
+		rex->reg_startpos[i] = found.nt_startpos[i];
+		rex->reg_endpos[i] = found.nt_endpos[i];
+	    }
+	}
+	else
+	{
+	    for (i = 0; i < NSUBEXP; ++i)
+	    {
+		rex->reg_startp[i] = found.nt_startpos[i].lnum < 0
+				  ? NULL : line + found.nt_startpos[i].col;
+		rex->reg_endp[i] = found.nt_endpos[i].lnum < 0
+				    ? NULL : line + found.nt_endpos[i].col;
+	    }
+	}
+#ifdef FEAT_SYN_HL
+	if (!rex->reg_detached)
+	{
+	    unref_extmatch(re_extmatch_out);
+	    re_extmatch_out = NULL;
+	}
+#endif
+	/* The line of the end of the match or "\ze". */
+	retval = 1 + found.nt_endpos[0].lnum;
+    }
+
+    /* Free the lists when they got big. */
+    if (rex->nfa_list.ga_maxlen > NFA_LIST_INITIAL)
+	ga_clear(&rex->nfa_list);
+    if (rex->nfa_next.ga_maxlen > NFA_LIST_INITIAL)
+	ga_clear(&rex->nfa_next);
+    if (rex->nfa_stack.ga_maxlen > NFA_LIST_INITIAL)
+	ga_clear(&rex->nfa_stack);
+    if (rex->nfa_counted.ga_maxlen > NFA_LIST_INITIAL)
+	ga_clear(&rex->nfa_counted);
+    return retval;
+}
+
+/*
+ * The DFA cache.
+ *
+ * Syntax highlighting and 'hlsearch' try the same patterns on every line that
+ * is displayed, and most lines don't match.  For a pattern that only uses
+ * characters, classes, "^", "$", "\<", "\>", alternatives and simple multis
+ * the sets of
+ * nodes the NFA engine can be in are the states of a DFA.  They are built
+ * lazily, one transition at a time, and kept with the program.  After that a
+ * line is checked with one table lookup for each byte.  "$", "\<" and "\>"
+ * look at the next character, they stay in the state until it is known.
+ *
+ * The DFA only tells whether a match may start at "col" or later, not where.
+ * When there is none the engine doesn't need to run, otherwise it finds the
+ * match and the submatches.  Thus "\(", "\zs" and "\ze" don't matter here.
+ *
+ * With a multi-byte 'encoding' only ASCII characters are in the DFA, for a
+ * line with other characters the engine always runs.  Literal characters in
+ * the pattern must be ASCII too: ignoring case a multi-byte character may
+ * match an ASCII one.  Of the classes that depend on options only "\k" and
+ * "\K" are used, the states are then only valid for the 'iskeyword' of one
+ * buffer.
+ *
+ * A program only gets a DFA when it has run DFA_HOT times, many are used only
+ * once.  The DFAs are kept in a table with DFA_CACHE_SIZE entries, "regdfa"
+ * in the program points into it, vim_regfree() releases the entry.  The
+ * entry that was used least recently is reused for another program.  When
+ * the states of a DFA take more than DFA_BUDGET bytes it is dropped and the
+ * program doesn't use the DFA cache again.
+ */
+static char_u	*dfa_loop __ARGS((char_u *scan, long *lop, long *hip));
+static int	dfa_char_match __ARGS((regexec_T *rex, char_u *scan, long idx, int c));
+static void	dfa_add_item __ARGS((char_u *scan, long count, int *matchp));
+static int	dfa_prev __ARGS((regprog_T *prog, int c));
+static void	dfa_add __ARGS((regexec_T *rex, regprog_T *prog, char_u *scan, long count, int prev, int nextc, int *matchp));
+static int
+#ifdef __BORLANDC__
+_RTLENTRYF
 #endif
+		dfa_item_cmp __ARGS((const void *s1, const void *s2));
+static int	dfa_find_state __ARGS((regprog_T *prog, regdfa_T *dfa, int prev, int match));
+static int	dfa_next_state __ARGS((regexec_T *rex, regprog_T *prog, regdfa_T *dfa, int from, int c));
+static int	dfa_eol_match __ARGS((regexec_T *rex, regprog_T *prog, dfastate_T *sp));
+static regdfa_T	*dfa_get __ARGS((regexec_T *rex, regprog_T *prog));
+static void	dfa_drop __ARGS((regprog_T *prog, regdfa_T *dfa));
+
+#define DFA_STATE(dfa, i) (((dfastate_T **)(dfa)->rd_states.ga_data)[i])
+
+/*
+ * Return TRUE when the DFA cache can be used for "prog": all nodes are
+ * handled by dfa_add() and literal characters are ASCII.  Sets RF_WORD when
+ * the states depend on 'iskeyword'.
+ */
+    static int
+dfa_usable(prog)
+    regprog_T	*prog;
+{
+    char_u	*s;
+    int		op;
+
+    if (prog->regflags & (RF_BACKTRACK | RF_HASNL))
+	return FALSE;
+    prog->regflags &= ~RF_WORD;
+    s = prog->program + 1;
+    for (;;)
+    {
+	op = OP(s);
+	if (op == END)
+	    return TRUE;
+	if (op == BOW || op == EOW || op == KWORD || op == SKWORD)
+	    prog->regflags |= RF_WORD;
+	else if (!(op == BOL || op == EOL || op == BRANCH || op == BACK
+		    || op == NOTHING || op == NOPEN || op == NCLOSE
+		    || (op >= MOPEN && op <= MOPEN + 9)
+		    || (op >= MCLOSE && op <= MCLOSE + 9)
+		    || op == STAR || op == PLUS || op == BRACE_SIMPLE
+		    || op == BRACE_LIMITS || op == EXACTLY
+		    || op == ANY || op == ANYOF || op == ANYBUT
+		    || (op >= WHITE && op <= NUPPER)))
+	    return FALSE;
+	s = OPERAND(s);
+	if (op == BRACE_LIMITS)
+	    s += 8;
+	else if (op == EXACTLY || op == ANYOF || op == ANYBUT)
+	{
+	    for ( ; *s != NUL; ++s)
+		if (*s >= 0x80)
+		    return FALSE;
+	    ++s;
 	}
-	if (status == RA_FAIL)
-	    got_int = TRUE;
-	return (status == RA_MATCH);
     }
+}
 
-  } /* End of loop until the regstack is empty. */
+/*
+ * Get the limits of the STAR, PLUS or BRACE_LIMITS node "scan" in "*lop" and
+ * "*hip".  Returns the node with the operand to repeat.
+ */
+    static char_u *
+dfa_loop(scan, lop, hip)
+    char_u	*scan;
+    long	*lop;
+    long	*hip;
+{
+    if (OP(scan) == BRACE_LIMITS)
+    {
+	/* For "\{-n,m}" the minimum is larger than the maximum. */
+	*lop = OPERAND_MIN(scan) <= OPERAND_MAX(scan)
+				       ? OPERAND_MIN(scan) : OPERAND_MAX(scan);
+	*hip = OPERAND_MIN(scan) <= OPERAND_MAX(scan)
+				       ? OPERAND_MAX(scan) : OPERAND_MIN(scan);
+	return regnext(scan);
+    }
+    *lop = OP(scan) == STAR ? 0 : 1;
+    *hip = MAX_LIMIT;
+    return scan;
+}
 
-  /* NOTREACHED */
+/*
+ * Return TRUE when character "c" matches node "scan", which waits for a
+ * character.  For EXACTLY "idx" is the index in the string.
+ */
+    static int
+dfa_char_match(rex, scan, idx, c)
+    regexec_T	*rex;
+    char_u	*scan;
+    long	idx;
+    int		c;
+{
+    char_u	buf[2];
+    int		len = 1;
+
+    buf[0] = c;
+    buf[1] = NUL;
+    if (OP(scan) == EXACTLY)
+	return cstrncmp(rex, OPERAND(scan) + idx, buf, &len) == 0;
+    rex->input = buf;
+    return reg_match_item(rex, scan) != RA_NOMATCH;
 }
 
 /*
- * Push an item onto the regstack.
- * Returns pointer to new item.  Returns NULL when out of memory.
+ * Add an item to "dfa_items".  When out of memory set "*matchp", the engine
+ * will then find out.
  */
-    static regitem_T *
-regstack_push(state, scan)
-    regstate_T	state;
+    static void
+dfa_add_item(scan, count, matchp)
     char_u	*scan;
+    long	count;
+    int		*matchp;
 {
-    regitem_T	*rp;
+    dfaitem_T	*dp;
 
-    if ((long)((unsigned)regstack.ga_len >> 10) >= p_mmp)
+    if (ga_grow(&dfa_items, 1) == FAIL)
     {
-	EMSG(_(e_maxmempat));
-	return NULL;
+	*matchp = TRUE;
+	return;
     }
-    if (ga_grow(&regstack, sizeof(regitem_T)) == FAIL)
-	return NULL;
-
-    rp = (regitem_T *)((char *)regstack.ga_data + regstack.ga_len);
-    rp->rs_state = state;
-    rp->rs_scan = scan;
-
-    regstack.ga_len += sizeof(regitem_T);
-    return rp;
+    dp = (dfaitem_T *)dfa_items.ga_data + dfa_items.ga_len++;
+    dp->di_scan = scan;
+    dp->di_count = count;
 }
 
 /*
- * Pop an item from the regstack.
+ * Return the "ds_prev" value for after character "c".
  */
-    static void
-regstack_pop(scan)
-    char_u	**scan;
+    static int
+dfa_prev(prog, c)
+    regprog_T	*prog;
+    int		c;
 {
-    regitem_T	*rp;
-
-    rp = (regitem_T *)((char *)regstack.ga_data + regstack.ga_len) - 1;
-    *scan = rp->rs_scan;
-
-    regstack.ga_len -= sizeof(regitem_T);
+    /* Without "\<", "\>" and "\k" it doesn't matter, don't make more
+     * states than needed. */
+    if ((prog->regflags & RF_WORD) && vim_iswordc(c))
+	return DFA_AFTER_WORD;
+    return DFA_AFTER_OTHER;
 }
 
 /*
- * regrepeat - repeatedly match something simple, return how many.
- * Advances reginput (and reglnum) to just after the matched chars.
+ * Add the nodes that wait for a character and can be reached from node
+ * "scan" without using up text to "dfa_items".  For EXACTLY "count" is the
+ * index in the string, for STAR, PLUS and BRACE_LIMITS it is the count.
+ * "prev" tells what is before the position, "nextc" is the character at it,
+ * NUL at the end of the line and DFA_UNKNOWN when not known yet.
+ * Sets "*matchp" when the END is reached.
  */
-    static int
-regrepeat(p, maxcount)
-    char_u	*p;
-    long	maxcount;   /* maximum number of matches allowed */
-{
-    long	count = 0;
+    static void
+dfa_add(rex, prog, scan, count, prev, nextc, matchp)
+    regexec_T	*rex;
+    regprog_T	*prog;
     char_u	*scan;
-    char_u	*opnd;
-    int		mask;
-    int		testval = 0;
+    long	count;
+    int		prev;
+    int		nextc;
+    int		*matchp;
+{
+    dfaitem_T	*dp;
+    char_u	*loop;
+    char_u	*next;
+    int		op;
+    long	lo, hi;
 
-    scan = reginput;	    /* Make local copy of reginput for speed. */
-    opnd = OPERAND(p);
-    switch (OP(p))
+    dfa_stack.ga_len = 0;
+    if (ga_grow(&dfa_stack, 1) == FAIL)
     {
-      case ANY:
-      case ANY + ADD_NL:
-	while (count < maxcount)
+	*matchp = TRUE;
+	return;
+    }
+    dp = (dfaitem_T *)dfa_stack.ga_data + dfa_stack.ga_len++;
+    dp->di_scan = scan;
+    dp->di_count = count;
+    while (dfa_stack.ga_len > 0)
+    {
+	dp = (dfaitem_T *)dfa_stack.ga_data + --dfa_stack.ga_len;
+	scan = dp->di_scan;
+	count = dp->di_count;
+	for (;;)
 	{
-	    /* Matching anything means we continue until end-of-line (or
-	     * end-of-file for ANY + ADD_NL), only limited by maxcount. */
-	    while (*scan != NUL && count < maxcount)
+	    op = OP(scan);
+	    next = regnext(scan);
+	    if (op == END)
 	    {
-		++count;
-		mb_ptr_adv(scan);
-	    }
-	    if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-					 || reg_line_lbr || count == maxcount)
-		break;
-	    ++count;		/* count the line-break */
-	    reg_nextline();
-	    scan = reginput;
-	    if (got_int)
+		*matchp = TRUE;
 		break;
-	}
-	break;
-
-      case IDENT:
-      case IDENT + ADD_NL:
-	testval = TRUE;
-	/*FALLTHROUGH*/
-      case SIDENT:
-      case SIDENT + ADD_NL:
-	while (count < maxcount)
-	{
-	    if (vim_isIDc(*scan) && (testval || !VIM_ISDIGIT(*scan)))
-	    {
-		mb_ptr_adv(scan);
 	    }
-	    else if (*scan == NUL)
+	    if (op == EXACTLY)
 	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
-		    break;
-		reg_nextline();
-		scan = reginput;
-		if (got_int)
+		if (OPERAND(scan)[count] != NUL)
+		{
+		    dfa_add_item(scan, count, matchp);
 		    break;
+		}
+		/* Matched the whole string. */
+		scan = next;
+		count = 0;
 	    }
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
-		++scan;
-	    else
-		break;
-	    ++count;
-	}
-	break;
-
-      case KWORD:
-      case KWORD + ADD_NL:
-	testval = TRUE;
-	/*FALLTHROUGH*/
-      case SKWORD:
-      case SKWORD + ADD_NL:
-	while (count < maxcount)
-	{
-	    if (vim_iswordp(scan) && (testval || !VIM_ISDIGIT(*scan)))
-	    {
-		mb_ptr_adv(scan);
-	    }
-	    else if (*scan == NUL)
+	    else if (op == STAR || op == PLUS || op == BRACE_LIMITS)
 	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
+		loop = dfa_loop(scan, &lo, &hi);
+		if (nfa_was_visited(rex, prog, loop, count))
 		    break;
-		reg_nextline();
-		scan = reginput;
-		if (got_int)
+		if (count < hi)
+		    dfa_add_item(scan, count, matchp);
+		if (count < lo)
 		    break;
+		scan = regnext(loop);
+		count = 0;
 	    }
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
-		++scan;
-	    else
-		break;
-	    ++count;
-	}
-	break;
-
-      case FNAME:
-      case FNAME + ADD_NL:
-	testval = TRUE;
-	/*FALLTHROUGH*/
-      case SFNAME:
-      case SFNAME + ADD_NL:
-	while (count < maxcount)
-	{
-	    if (vim_isfilec(*scan) && (testval || !VIM_ISDIGIT(*scan)))
-	    {
-		mb_ptr_adv(scan);
-	    }
-	    else if (*scan == NUL)
+	    else if (op == BOL)
 	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
-		    break;
-		reg_nextline();
-		scan = reginput;
-		if (got_int)
+		if (prev != DFA_AT_BOL)
 		    break;
+		scan = next;
 	    }
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
-		++scan;
-	    else
+	    else if ((op == BOW && (prev == DFA_AFTER_WORD || nextc == NUL))
+		    || (op == EOW && prev != DFA_AFTER_WORD)
+		    || (op == EOL && nextc != NUL && nextc != DFA_UNKNOWN))
 		break;
-	    ++count;
-	}
-	break;
-
-      case PRINT:
-      case PRINT + ADD_NL:
-	testval = TRUE;
-	/*FALLTHROUGH*/
-      case SPRINT:
-      case SPRINT + ADD_NL:
-	while (count < maxcount)
-	{
-	    if (*scan == NUL)
+	    else if (op == EOL || op == BOW || op == EOW)
 	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
-		    break;
-		reg_nextline();
-		scan = reginput;
-		if (got_int)
+		if (nextc == DFA_UNKNOWN)
+		{
+		    /* Wait for the next character. */
+		    dfa_add_item(scan, 0L, matchp);
 		    break;
-	    }
-	    else if (ptr2cells(scan) == 1 && (testval || !VIM_ISDIGIT(*scan)))
-	    {
-		mb_ptr_adv(scan);
-	    }
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
-		++scan;
-	    else
-		break;
-	    ++count;
-	}
-	break;
-
-      case WHITE:
-      case WHITE + ADD_NL:
-	testval = mask = RI_WHITE;
-do_class:
-	while (count < maxcount)
-	{
-#ifdef FEAT_MBYTE
-	    int		l;
-#endif
-	    if (*scan == NUL)
-	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
+		}
+		if (op == BOW && !vim_iswordc(nextc))
 		    break;
-		reg_nextline();
-		scan = reginput;
-		if (got_int)
+		if (op == EOW && nextc != NUL && vim_iswordc(nextc))
 		    break;
+		scan = next;
 	    }
-#ifdef FEAT_MBYTE
-	    else if (has_mbyte && (l = (*mb_ptr2len)(scan)) > 1)
+	    else if (op == BRANCH || op == NOTHING || op == BACK
+		    || op == NOPEN || op == NCLOSE
+		    || (op >= MOPEN && op <= MOPEN + 9)
+		    || (op >= MCLOSE && op <= MCLOSE + 9))
 	    {
-		if (testval != 0)
+		if (nfa_was_visited(rex, prog, scan, 0L))
 		    break;
-		scan += l;
-	    }
-#endif
-	    else if ((class_tab[*scan] & mask) == testval)
-		++scan;
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
-		++scan;
-	    else
-		break;
-	    ++count;
-	}
-	break;
-
-      case NWHITE:
-      case NWHITE + ADD_NL:
-	mask = RI_WHITE;
-	goto do_class;
-      case DIGIT:
-      case DIGIT + ADD_NL:
-	testval = mask = RI_DIGIT;
-	goto do_class;
-      case NDIGIT:
-      case NDIGIT + ADD_NL:
-	mask = RI_DIGIT;
-	goto do_class;
-      case HEX:
-      case HEX + ADD_NL:
-	testval = mask = RI_HEX;
-	goto do_class;
-      case NHEX:
-      case NHEX + ADD_NL:
-	mask = RI_HEX;
-	goto do_class;
-      case OCTAL:
-      case OCTAL + ADD_NL:
-	testval = mask = RI_OCTAL;
-	goto do_class;
-      case NOCTAL:
-      case NOCTAL + ADD_NL:
-	mask = RI_OCTAL;
-	goto do_class;
-      case WORD:
-      case WORD + ADD_NL:
-	testval = mask = RI_WORD;
-	goto do_class;
-      case NWORD:
-      case NWORD + ADD_NL:
-	mask = RI_WORD;
-	goto do_class;
-      case HEAD:
-      case HEAD + ADD_NL:
-	testval = mask = RI_HEAD;
-	goto do_class;
-      case NHEAD:
-      case NHEAD + ADD_NL:
-	mask = RI_HEAD;
-	goto do_class;
-      case ALPHA:
-      case ALPHA + ADD_NL:
-	testval = mask = RI_ALPHA;
-	goto do_class;
-      case NALPHA:
-      case NALPHA + ADD_NL:
-	mask = RI_ALPHA;
-	goto do_class;
-      case LOWER:
-      case LOWER + ADD_NL:
-	testval = mask = RI_LOWER;
-	goto do_class;
-      case NLOWER:
-      case NLOWER + ADD_NL:
-	mask = RI_LOWER;
-	goto do_class;
-      case UPPER:
-      case UPPER + ADD_NL:
-	testval = mask = RI_UPPER;
-	goto do_class;
-      case NUPPER:
-      case NUPPER + ADD_NL:
-	mask = RI_UPPER;
-	goto do_class;
-
-      case EXACTLY:
-	{
-	    int	    cu, cl;
-
-	    /* This doesn't do a multi-byte character, because a MULTIBYTECODE
-	     * would have been used for it.  It does handle single-byte
-	     * characters, such as latin1. */
-	    if (ireg_ic)
-	    {
-		cu = MB_TOUPPER(*opnd);
-		cl = MB_TOLOWER(*opnd);
-		while (count < maxcount && (*scan == cu || *scan == cl))
+		if (op == BRANCH)
 		{
-		    count++;
-		    scan++;
+		    if (OP(next) == BRANCH)
+		    {
+			/* Also try the next alternative. */
+			if (ga_grow(&dfa_stack, 1) == FAIL)
+			{
+			    *matchp = TRUE;
+			    break;
+			}
+			dp = (dfaitem_T *)dfa_stack.ga_data
+							 + dfa_stack.ga_len++;
+			dp->di_scan = next;
+			dp->di_count = 0;
+		    }
+		    next = OPERAND(scan);
 		}
+		scan = next;
 	    }
 	    else
 	    {
-		cu = *opnd;
-		while (count < maxcount && *scan == cu)
-		{
-		    count++;
-		    scan++;
-		}
+		/* A character or class. */
+		dfa_add_item(scan, 0L, matchp);
+		break;
 	    }
-	    break;
 	}
+    }
+}
 
-#ifdef FEAT_MBYTE
-      case MULTIBYTECODE:
+/*
+ * Sort function for the items of a DFA state.
+ */
+    static int
+#ifdef __BORLANDC__
+_RTLENTRYF
+#endif
+dfa_item_cmp(s1, s2)
+    const void	*s1;
+    const void	*s2;
+{
+    dfaitem_T	*p1 = (dfaitem_T *)s1;
+    dfaitem_T	*p2 = (dfaitem_T *)s2;
+
+    if (p1->di_scan != p2->di_scan)
+	return p1->di_scan < p2->di_scan ? -1 : 1;
+    if (p1->di_count != p2->di_count)
+	return p1->di_count < p2->di_count ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Find the state of "dfa" with the items in "dfa_items", add it when it
+ * doesn't exist yet.
+ * Returns the state number, DFA_NONE when the DFA was dropped.
+ */
+    static int
+dfa_find_state(prog, dfa, prev, match)
+    regprog_T	*prog;
+    regdfa_T	*dfa;
+    int		prev;
+    int		match;
+{
+    dfaitem_T	*dp = (dfaitem_T *)dfa_items.ga_data;
+    dfastate_T	*sp;
+    long	size;
+    int		len;
+    int		i, j;
+
+    /* Sort the items and remove duplicates, equal states then have equal
+     * items. */
+    if (dfa_items.ga_len > 1)
+    {
+	qsort(dp, (size_t)dfa_items.ga_len, sizeof(dfaitem_T), dfa_item_cmp);
+	len = 1;
+	for (i = 1; i < dfa_items.ga_len; ++i)
+	    if (dfa_item_cmp(&dp[i], &dp[len - 1]) != 0)
+		dp[len++] = dp[i];
+	dfa_items.ga_len = len;
+    }
+    len = dfa_items.ga_len;
+
+    for (i = 0; i < dfa->rd_states.ga_len; ++i)
+    {
+	sp = DFA_STATE(dfa, i);
+	if (sp->ds_prev != prev || sp->ds_match != match || sp->ds_len != len)
+	    continue;
+	for (j = 0; j < len; ++j)
+	    if (dfa_item_cmp(&sp->ds_items[j], &dp[j]) != 0)
+		break;
+	if (j == len)
+	    return i;
+    }
+
+    size = sizeof(dfastate_T) + (len > 0 ? len - 1 : 0) * sizeof(dfaitem_T);
+    if (dfa->rd_size + size > DFA_BUDGET
+	    || (sp = (dfastate_T *)alloc((unsigned)size)) == NULL)
+    {
+	dfa_drop(prog, dfa);
+	return DFA_NONE;
+    }
+    if (ga_grow(&dfa->rd_states, 1) == FAIL)
+    {
+	vim_free(sp);
+	dfa_drop(prog, dfa);
+	return DFA_NONE;
+    }
+    for (i = 0; i < 256; ++i)
+	sp->ds_next[i] = DFA_NONE;
+    sp->ds_prev = prev;
+    sp->ds_match = match;
+    sp->ds_eolmatch = MAYBE;
+    sp->ds_len = len;
+    if (len > 0)
+	mch_memmove(sp->ds_items, dp, len * sizeof(dfaitem_T));
+    DFA_STATE(dfa, dfa->rd_states.ga_len) = sp;
+    dfa->rd_size += size;
+    return dfa->rd_states.ga_len++;
+}
+
+/*
+ * Compute the state that state "from" goes to for character "c".
+ * Returns the state number, DFA_NONE when the DFA was dropped.
+ */
+    static int
+dfa_next_state(rex, prog, dfa, from, c)
+    regexec_T	*rex;
+    regprog_T	*prog;
+    regdfa_T	*dfa;
+    int		from;
+    int		c;
+{
+    dfastate_T	*sp = DFA_STATE(dfa, from);
+    dfaitem_T	*dp;
+    char_u	*loop;
+    int		match = FALSE;
+    int		prev = dfa_prev(prog, c);
+    long	count;
+    long	lo, hi;
+    int		op;
+    int		i;
+
+    /* Now that the next character is known, first find out where the nodes
+     * that were waiting for it go. */
+    dfa_items.ga_len = 0;
+    nfa_next_step(rex);
+    for (i = 0; i < sp->ds_len; ++i)
+    {
+	op = OP(sp->ds_items[i].di_scan);
+	if (op == EOL || op == BOW || op == EOW)
+	    dfa_add(rex, prog, sp->ds_items[i].di_scan, 0L, sp->ds_prev, c,
+									&match);
+    }
+    dfa_now.ga_len = 0;
+    if (dfa_items.ga_len > 0)
+    {
+	if (ga_grow(&dfa_now, dfa_items.ga_len) == FAIL)
+	    match = TRUE;
+	else
 	{
-	    int		i, len, cf = 0;
+	    mch_memmove(dfa_now.ga_data, dfa_items.ga_data,
+				     dfa_items.ga_len * sizeof(dfaitem_T));
+	    dfa_now.ga_len = dfa_items.ga_len;
+	}
+    }
 
-	    /* Safety check (just in case 'encoding' was changed since
-	     * compiling the program). */
-	    if ((len = (*mb_ptr2len)(opnd)) > 1)
-	    {
-		if (ireg_ic && enc_utf8)
-		    cf = utf_fold(utf_ptr2char(opnd));
-		while (count < maxcount)
-		{
-		    for (i = 0; i < len; ++i)
-			if (opnd[i] != scan[i])
-			    break;
-		    if (i < len && (!ireg_ic || !enc_utf8
-					|| utf_fold(utf_ptr2char(scan)) != cf))
-			break;
-		    scan += len;
-		    ++count;
-		}
-	    }
+    dfa_items.ga_len = 0;
+    nfa_next_step(rex);
+    for (i = 0; i < sp->ds_len + dfa_now.ga_len; ++i)
+    {
+	if (i < sp->ds_len)
+	    dp = &sp->ds_items[i];
+	else
+	    dp = (dfaitem_T *)dfa_now.ga_data + i - sp->ds_len;
+	op = OP(dp->di_scan);
+	if (op == EOL || op == BOW || op == EOW)
+	    continue;
+	if (op == STAR || op == PLUS || op == BRACE_LIMITS)
+	{
+	    loop = dfa_loop(dp->di_scan, &lo, &hi);
+	    if (!dfa_char_match(rex, OPERAND(loop), 0L, c))
+		continue;
+	    count = dp->di_count + 1;
+	    /* Once there are enough any count is the same. */
+	    if (hi == MAX_LIMIT && count > lo)
+		count = lo;
+	    dfa_add(rex, prog, dp->di_scan, count, prev, DFA_UNKNOWN, &match);
 	}
-	break;
-#endif
+	else if (dfa_char_match(rex, dp->di_scan, dp->di_count, c))
+	{
+	    if (op == EXACTLY)
+		dfa_add(rex, prog, dp->di_scan, dp->di_count + 1, prev,
+							  DFA_UNKNOWN, &match);
+	    else
+		dfa_add(rex, prog, regnext(dp->di_scan), 0L, prev, DFA_UNKNOWN,
+									&match);
+	}
+    }
 
-      case ANYOF:
-      case ANYOF + ADD_NL:
-	testval = TRUE;
-	/*FALLTHROUGH*/
+    /* A match may also start after this character. */
+    dfa_add(rex, prog, prog->program + 1, 0L, prev, DFA_UNKNOWN, &match);
+    return dfa_find_state(prog, dfa, prev, match);
+}
 
-      case ANYBUT:
-      case ANYBUT + ADD_NL:
-	while (count < maxcount)
-	{
+/*
+ * Return TRUE when state "sp" reaches the END at the end of the line.
+ */
+    static int
+dfa_eol_match(rex, prog, sp)
+    regexec_T	*rex;
+    regprog_T	*prog;
+    dfastate_T	*sp;
+{
+    int		match = FALSE;
+    int		i;
+
+    if (sp->ds_eolmatch == MAYBE)
+    {
+	dfa_items.ga_len = 0;
+	nfa_next_step(rex);
+	for (i = 0; i < sp->ds_len && !match; ++i)
+	    if (OP(sp->ds_items[i].di_scan) == EOL
+		    || OP(sp->ds_items[i].di_scan) == BOW
+		    || OP(sp->ds_items[i].di_scan) == EOW)
+		dfa_add(rex, prog, sp->ds_items[i].di_scan, 0L, sp->ds_prev,
+								  NUL, &match);
+	sp->ds_eolmatch = match;
+    }
+    return sp->ds_eolmatch;
+}
+
+/*
+ * Get the DFA of "prog", use a table entry for it when it has none.
+ */
+    static regdfa_T *
+dfa_get(rex, prog)
+    regexec_T	*rex;
+    regprog_T	*prog;
+{
+    regdfa_T	*dfa = prog->regdfa;
+    int		i;
+
+    if (dfa == NULL || dfa->rd_prog != prog)
+    {
+	/* Use an unused entry or the one that was used least recently. */
+	dfa = &dfa_cache[0];
+	for (i = 1; i < DFA_CACHE_SIZE && dfa->rd_prog != NULL; ++i)
+	    if (dfa_cache[i].rd_prog == NULL
+				       || dfa_cache[i].rd_used < dfa->rd_used)
+		dfa = &dfa_cache[i];
+	dfa_free(dfa);
+	prog->regdfa = dfa;
+    }
+    else if (dfa->rd_ic != rex->reg_ic || ((prog->regflags & RF_WORD)
+		&& vim_memcmp(dfa->rd_chartab, curbuf->b_chartab, 32) != 0))
+	/* The states are for another value of 'ignorecase' or
+	 * 'iskeyword'. */
+	dfa_free(dfa);
+    if (dfa->rd_prog == NULL)
+    {
+	dfa->rd_prog = prog;
+	dfa->rd_ic = rex->reg_ic;
+	mch_memmove(dfa->rd_chartab, curbuf->b_chartab, 32);
+    }
+    dfa->rd_used = ++dfa_clock;
+    return dfa;
+}
+
+/*
+ * Free the states of "dfa" and make the entry unused.
+ */
+    static void
+dfa_free(dfa)
+    regdfa_T	*dfa;
+{
+    int		i;
+
+    for (i = 0; i < dfa->rd_states.ga_len; ++i)
+	vim_free(DFA_STATE(dfa, i));
+    ga_clear(&dfa->rd_states);
+    ga_init2(&dfa->rd_states, (int)sizeof(dfastate_T *), 20);
+    for (i = 0; i < 3; ++i)
+	dfa->rd_start[i] = DFA_NONE;
+    dfa->rd_size = 0;
+    dfa->rd_prog = NULL;
+}
+
+/*
+ * Drop the DFA of "prog", it got too big.  Don't use the DFA cache for "prog"
+ * again.
+ */
+    static void
+dfa_drop(prog, dfa)
+    regprog_T	*prog;
+    regdfa_T	*dfa;
+{
+    prog->regexecs = -1;
+    prog->regdfa = NULL;
+    dfa_free(dfa);
+    ++dfa_dropped;
+}
+
+/*
+ * Check with the DFA of "prog" whether there may be a match in "line" that
+ * starts at column "col" or later.
+ * Returns FALSE when there is none, TRUE when there may be one.
+ */
+    static int
+dfa_check(rex, prog, line, col)
+    regexec_T	*rex;
+    regprog_T	*prog;
+    char_u	*line;
+    colnr_T	col;
+{
+    regdfa_T	*dfa;
+    dfastate_T	*sp;
+    char_u	*p;
+    int		prev;
+    int		match = FALSE;
+    int		si;
+    int		ni;
+
+    if ((prog->regflags & RF_NODFA) || p_re == 1)
+	return TRUE;
+    /* Building the DFA only pays off when the program is used often. */
+    if (prog->regdfa == NULL
+	    && (prog->regexecs < 0 || ++prog->regexecs < DFA_HOT))
+	return TRUE;
+    if (col == 0)
+	prev = DFA_AT_BOL;
+    else
+    {
 #ifdef FEAT_MBYTE
-	    int len;
+	if (has_mbyte && (line[col - 1] >= 0x80
+			       || (*mb_head_off)(line, line + col - 1) != 0))
+	    return TRUE;
 #endif
-	    if (*scan == NUL)
-	    {
-		if (!REG_MULTI || !WITH_NL(OP(p)) || reglnum > reg_maxline
-							      || reg_line_lbr)
-		    break;
-		reg_nextline();
-		scan = reginput;
-		if (got_int)
-		    break;
-	    }
-	    else if (reg_line_lbr && *scan == '\n' && WITH_NL(OP(p)))
-		++scan;
+	prev = dfa_prev(prog, line[col - 1]);
+    }
+    nfa_init(rex);
+    if (dfa_items.ga_itemsize == 0)
+    {
+	ga_init2(&dfa_items, (int)sizeof(dfaitem_T), NFA_LIST_INITIAL);
+	ga_init2(&dfa_stack, (int)sizeof(dfaitem_T), NFA_LIST_INITIAL);
+	ga_init2(&dfa_now, (int)sizeof(dfaitem_T), NFA_LIST_INITIAL);
+    }
+
+    dfa = dfa_get(rex, prog);
+    si = dfa->rd_start[prev];
+    if (si == DFA_NONE)
+    {
+	dfa_items.ga_len = 0;
+	nfa_next_step(rex);
+	dfa_add(rex, prog, prog->program + 1, 0L, prev, DFA_UNKNOWN, &match);
+	si = dfa_find_state(prog, dfa, prev, match);
+	if (si == DFA_NONE)
+	    return TRUE;
+	dfa->rd_start[prev] = si;
+    }
+
+    for (p = line + col; ; ++p)
+    {
+	sp = DFA_STATE(dfa, si);
+	if (sp->ds_match)
+	    break;
+	if (*p == NUL)
+	{
+	    if (dfa_eol_match(rex, prog, sp))
+		break;
+	    ++dfa_nomatch;
+	    return FALSE;
+	}
 #ifdef FEAT_MBYTE
-	    else if (has_mbyte && (len = (*mb_ptr2len)(scan)) > 1)
-	    {
-		if ((cstrchr(opnd, (*mb_ptr2char)(scan)) == NULL) == testval)
-		    break;
-		scan += len;
-	    }
+	/* Only ASCII characters are in the DFA. */
+	if (has_mbyte && *p >= 0x80)
+	    break;
 #endif
-	    else
-	    {
-		if ((cstrchr(opnd, *scan) == NULL) == testval)
-		    break;
-		++scan;
-	    }
-	    ++count;
+	ni = sp->ds_next[*p];
+	if (ni == DFA_NONE)
+	{
+	    ni = dfa_next_state(rex, prog, dfa, si, *p);
+	    if (ni == DFA_NONE)
+		break;
+	    sp->ds_next[*p] = ni;
+	    ++dfa_misses;
 	}
-	break;
+	else
+	    ++dfa_hits;
+	si = ni;
+    }
+    ++dfa_tried;
+    return TRUE;
+}
 
-      case NEWL:
-	while (count < maxcount
-		&& ((*scan == NUL && reglnum <= reg_maxline && !reg_line_lbr
-			    && REG_MULTI) || (*scan == '\n' && reg_line_lbr)))
+/*
+ * ":regexpstats": Show how well the DFA cache and the cache of compiled
+ * programs work.
+ * ":regexpstats clear": Reset the counters.
+ */
+    void
+ex_regexpstats(eap)
+    exarg_T	*eap;
+{
+    long	states = 0;
+    long	size = 0;
+    int		progs = 0;
+    long	total = dfa_hits + dfa_misses;
+    int		rate;
+    int		i;
+
+    if (STRCMP(eap->arg, "clear") == 0)
+    {
+	dfa_hits = 0;
+	dfa_misses = 0;
+	dfa_nomatch = 0;
+	dfa_tried = 0;
+	dfa_dropped = 0;
+	reg_cache_hits = 0;
+	reg_cache_misses = 0;
+	return;
+    }
+    if (*eap->arg != NUL)
+    {
+	EMSG2(_(e_invarg2), eap->arg);
+	return;
+    }
+
+    for (i = 0; i < DFA_CACHE_SIZE; ++i)
+	if (dfa_cache[i].rd_prog != NULL)
 	{
-	    count++;
-	    if (reg_line_lbr)
-		ADVANCE_REGINPUT();
-	    else
-		reg_nextline();
-	    scan = reginput;
-	    if (got_int)
-		break;
+	    ++progs;
+	    states += dfa_cache[i].rd_states.ga_len;
+	    size += dfa_cache[i].rd_size;
 	}
-	break;
+    /* Hit rate in tenths of a percent. */
+    rate = total == 0 ? 0 : (int)((double)dfa_hits * 1000.0 / total);
+
+    MSG_PUTS_TITLE(_("\n--- DFA cache ---"));
+    vim_snprintf((char *)IObuff, IOSIZE,
+	    _("\nprograms:    %d of %d, %ld states, %ld bytes"),
+	    progs, DFA_CACHE_SIZE, states, size);
+    msg_puts(IObuff);
+    vim_snprintf((char *)IObuff, IOSIZE,
+	    _("\ntransitions: %ld cached, %ld added, %d.%d%% hit rate"),
+	    dfa_hits, dfa_misses, rate / 10, rate % 10);
+    msg_puts(IObuff);
+    vim_snprintf((char *)IObuff, IOSIZE,
+	    _("\nlines:       %ld without a match, %ld tried"),
+	    dfa_nomatch, dfa_tried);
+    msg_puts(IObuff);
+    vim_snprintf((char *)IObuff, IOSIZE,
+	    _("\ndropped:     %ld, over %ld bytes"),
+	    dfa_dropped, DFA_BUDGET);
+    msg_puts(IObuff);
+    vim_snprintf((char *)IObuff, IOSIZE,
+	    _("\npatterns:    %ld from the cache, %ld compiled"),
+	    reg_cache_hits, reg_cache_misses);
+    msg_puts(IObuff);
+}
 
-      default:			/* Oh dear.  Called inappropriately. */
-	EMSG(_(e_re_corr));
-#ifdef DEBUG
-	printf("Called regrepeat with op code %d\n", OP(p));
-#endif
-	break;
+#if defined(FEAT_PROFILE) || defined(PROTO)
+static int
+# ifdef __BORLANDC__
+_RTLENTRYF
+# endif
+		regprof_cmp __ARGS((const void *s1, const void *s2));
+static void	regtime_report __ARGS((int names));
+
+/*
+ * ":regexptime on": Start measuring the time used by each pattern.
+ * ":regexptime off": Stop measuring.
+ * ":regexptime clear": Reset the counters.
+ * ":regexptime[!] report": Show the patterns, most time used first.  With
+ * [!] also the group a pattern is used for in the current window.
+ */
+    void
+ex_regexptime(eap)
+    exarg_T	*eap;
+{
+    regprog_T	*prog;
+
+    if (*eap->arg == NUL)
+	EMSG(_(e_argreq));
+    else if (STRCMP(eap->arg, "on") == 0)
+	regtime_on = TRUE;
+    else if (STRCMP(eap->arg, "off") == 0)
+	regtime_on = FALSE;
+    else if (STRCMP(eap->arg, "clear") == 0)
+    {
+	for (prog = regprof_first; prog != NULL; prog = prog->regprof_next)
+	{
+	    prog->regcount = 0;
+	    prog->regmatchcount = 0;
+	    prog->regmaxdepth = 0;
+	    profile_zero(&prog->regtotal);
+	}
     }
+    else if (STRCMP(eap->arg, "report") == 0)
+	regtime_report(eap->forceit);
+    else
+	EMSG2(_(e_invarg2), eap->arg);
+}
+
+/*
+ * Sort function for regtime_report(): most time used first.
+ */
+    static int
+# ifdef __BORLANDC__
+_RTLENTRYF
+# endif
+regprof_cmp(s1, s2)
+    const void	*s1;
+    const void	*s2;
+{
+    regprog_T	*p1 = *(regprog_T **)s1;
+    regprog_T	*p2 = *(regprog_T **)s2;
 
-    reginput = scan;
+    return profile_cmp(&p1->regtotal, &p2->regtotal);
+}
 
-    return (int)count;
+/*
+ * List the patterns that were executed.  When "names" is TRUE include the
+ * syntax group or highlight group of a match.
+ */
+    static void
+regtime_report(names)
+    int		names;
+{
+    garray_T	ga;
+    regprog_T	*prog;
+    char_u	*name;
+    int		len;
+    int		i;
+
+    ga_init2(&ga, (int)sizeof(regprog_T *), 50);
+    for (prog = regprof_first; prog != NULL; prog = prog->regprof_next)
+	if (prog->regcount > 0 && ga_grow(&ga, 1) == OK)
+	    ((regprog_T **)ga.ga_data)[ga.ga_len++] = prog;
+    if (ga.ga_len > 1)
+	qsort(ga.ga_data, (size_t)ga.ga_len, sizeof(regprog_T *),
+								 regprof_cmp);
+
+    if (names)
+	MSG_PUTS_TITLE(_("\n  TOTAL    COUNT  MATCH  DEPTH  NAME                PATTERN"));
+    else
+	MSG_PUTS_TITLE(_("\n  TOTAL    COUNT  MATCH  DEPTH  PATTERN"));
+    for (i = 0; i < ga.ga_len && !got_int; ++i)
+    {
+	prog = ((regprog_T **)ga.ga_data)[i];
+	msg_putchar('\n');
+	msg_puts((char_u *)profile_msg(&prog->regtotal));
+	msg_putchar(' ');	/* always a separating space */
+	msg_advance(11);
+	msg_outnum(prog->regcount);
+	msg_putchar(' ');
+	msg_advance(18);
+	msg_outnum(prog->regmatchcount);
+	msg_putchar(' ');
+	msg_advance(25);
+	msg_outnum(prog->regmaxdepth);
+	msg_putchar(' ');
+	msg_advance(32);
+	if (names)
+	{
+# ifdef FEAT_SYN_HL
+	    name = syn_regprog_name(curwin, prog);
+	    if (name != NULL)
+		msg_outtrans(name);
+# endif
+	    msg_putchar(' ');
+	    msg_advance(52);
+	}
+	/* Keep the pattern on one line. */
+	len = Columns - msg_col - 1;
+	if (len > (int)STRLEN(prog->regsource))
+	    len = (int)STRLEN(prog->regsource);
+	if (len > 0)
+	    msg_outtrans_len(prog->regsource, len);
+    }
+    ga_clear(&ga);
 }
+#endif
 
 /*
  * regnext - dig the "next" pointer out of a node
@@ -5846,13 +8232,14 @@ regnext(p)
  * Return TRUE if it's wrong.
  */
     static int
-prog_magic_wrong()
+prog_magic_wrong(rex)
+    regexec_T	*rex;
 {
     if (UCHARAT(REG_MULTI
-		? reg_mmatch->regprog->program
-		: reg_match->regprog->program) != REGMAGIC)
+		? rex->reg_mmatch->regprog->program
+		: rex->reg_match->regprog->program) != REGMAGIC)
     {
-	EMSG(_(e_re_corr));
+	reg_emsg(rex, _(e_re_corr));
 	return TRUE;
     }
     return FALSE;
@@ -5864,43 +8251,45 @@ prog_magic_wrong()
  * used (to increase speed).
  */
     static void
-cleanup_subexpr()
+cleanup_subexpr(rex)
+    regexec_T	*rex;
 {
-    if (need_clear_subexpr)
+    if (rex->need_clear_subexpr)
     {
 	if (REG_MULTI)
 	{
 	    /* Use 0xff to set lnum to -1 */
-	    vim_memset(reg_startpos, 0xff, sizeof(lpos_T) * NSUBEXP);
-	    vim_memset(reg_endpos, 0xff, sizeof(lpos_T) * NSUBEXP);
+	    vim_memset(rex->reg_startpos, 0xff, sizeof(lpos_T) * NSUBEXP);
+	    vim_memset(rex->reg_endpos, 0xff, sizeof(lpos_T) * NSUBEXP);
 	}
 	else
 	{
-	    vim_memset(reg_startp, 0, sizeof(char_u *) * NSUBEXP);
-	    vim_memset(reg_endp, 0, sizeof(char_u *) * NSUBEXP);
+	    vim_memset(rex->reg_startp, 0, sizeof(char_u *) * NSUBEXP);
+	    vim_memset(rex->reg_endp, 0, sizeof(char_u *) * NSUBEXP);
 	}
-	need_clear_subexpr = FALSE;
+	rex->need_clear_subexpr = FALSE;
     }
 }
 
 #ifdef FEAT_SYN_HL
     static void
-cleanup_zsubexpr()
+cleanup_zsubexpr(rex)
+    regexec_T	*rex;
 {
-    if (need_clear_zsubexpr)
+    if (rex->need_clear_zsubexpr)
     {
 	if (REG_MULTI)
 	{
 	    /* Use 0xff to set lnum to -1 */
-	    vim_memset(reg_startzpos, 0xff, sizeof(lpos_T) * NSUBEXP);
-	    vim_memset(reg_endzpos, 0xff, sizeof(lpos_T) * NSUBEXP);
+	    vim_memset(rex->reg_startzpos, 0xff, sizeof(lpos_T) * NSUBEXP);
+	    vim_memset(rex->reg_endzpos, 0xff, sizeof(lpos_T) * NSUBEXP);
 	}
 	else
 	{
-	    vim_memset(reg_startzp, 0, sizeof(char_u *) * NSUBEXP);
-	    vim_memset(reg_endzp, 0, sizeof(char_u *) * NSUBEXP);
+	    vim_memset(rex->reg_startzp, 0, sizeof(char_u *) * NSUBEXP);
+	    vim_memset(rex->reg_endzp, 0, sizeof(char_u *) * NSUBEXP);
 	}
-	need_clear_zsubexpr = FALSE;
+	rex->need_clear_zsubexpr = FALSE;
     }
 }
 #endif
@@ -5910,27 +8299,28 @@ cleanup_zsubexpr()
  * later by restore_subexpr().
  */
     static void
-save_subexpr(bp)
+save_subexpr(rex, bp)
+    regexec_T	*rex;
     regbehind_T *bp;
 {
     int i;
 
     /* When "need_clear_subexpr" is set we don't need to save the values, only
      * remember that this flag needs to be set again when restoring. */
-    bp->save_need_clear_subexpr = need_clear_subexpr;
-    if (!need_clear_subexpr)
+    bp->save_need_clear_subexpr = rex->need_clear_subexpr;
+    if (!rex->need_clear_subexpr)
     {
 	for (i = 0; i < NSUBEXP; ++i)
 	{
 	    if (REG_MULTI)
 	    {
-		bp->save_start[i].se_u.pos = reg_startpos[i];
-		bp->save_end[i].se_u.pos = reg_endpos[i];
+		bp->save_start[i].se_u.pos = rex->reg_startpos[i];
+		bp->save_end[i].se_u.pos = rex->reg_endpos[i];
 	    }
 	    else
 	    {
-		bp->save_start[i].se_u.ptr = reg_startp[i];
-		bp->save_end[i].se_u.ptr = reg_endp[i];
+		bp->save_start[i].se_u.ptr = rex->reg_startp[i];
+		bp->save_end[i].se_u.ptr = rex->reg_endp[i];
 	    }
 	}
     }
@@ -5940,57 +8330,60 @@ save_subexpr(bp)
  * Restore the subexpr from "bp".
  */
     static void
-restore_subexpr(bp)
+restore_subexpr(rex, bp)
+    regexec_T	*rex;
     regbehind_T *bp;
 {
     int i;
 
     /* Only need to restore saved values when they are not to be cleared. */
-    need_clear_subexpr = bp->save_need_clear_subexpr;
-    if (!need_clear_subexpr)
+    rex->need_clear_subexpr = bp->save_need_clear_subexpr;
+    if (!rex->need_clear_subexpr)
     {
 	for (i = 0; i < NSUBEXP; ++i)
 	{
 	    if (REG_MULTI)
 	    {
-		reg_startpos[i] = bp->save_start[i].se_u.pos;
-		reg_endpos[i] = bp->save_end[i].se_u.pos;
+		rex->reg_startpos[i] = bp->save_start[i].se_u.pos;
+		rex->reg_endpos[i] = bp->save_end[i].se_u.pos;
 	    }
 	    else
 	    {
-		reg_startp[i] = bp->save_start[i].se_u.ptr;
-		reg_endp[i] = bp->save_end[i].se_u.ptr;
+		rex->reg_startp[i] = bp->save_start[i].se_u.ptr;
+		rex->reg_endp[i] = bp->save_end[i].se_u.ptr;
 	    }
 	}
     }
 }
 
 /*
- * Advance reglnum, regline and reginput to the next line.
+ * Advance rex->lnum, rex->line and rex->input to the next line.
  */
     static void
-reg_nextline()
+reg_nextline(rex)
+    regexec_T	*rex;
 {
-    regline = reg_getline(++reglnum);
-    reginput = regline;
-    fast_breakcheck();
+    rex->line = reg_getline(rex, ++rex->lnum);
+    rex->input = rex->line;
+    reg_breakcheck(rex);
 }
 
 /*
  * Save the input line and position in a regsave_T.
  */
     static void
-reg_save(save, gap)
+reg_save(rex, save, gap)
+    regexec_T	*rex;
     regsave_T	*save;
     garray_T	*gap;
 {
     if (REG_MULTI)
     {
-	save->rs_u.pos.col = (colnr_T)(reginput - regline);
-	save->rs_u.pos.lnum = reglnum;
+	save->rs_u.pos.col = (colnr_T)(rex->input - rex->line);
+	save->rs_u.pos.lnum = rex->lnum;
     }
     else
-	save->rs_u.ptr = reginput;
+	save->rs_u.ptr = rex->input;
     save->rs_len = gap->ga_len;
 }
 
@@ -5998,23 +8391,24 @@ reg_save(save, gap)
  * Restore the input line and position from a regsave_T.
  */
     static void
-reg_restore(save, gap)
+reg_restore(rex, save, gap)
+    regexec_T	*rex;
     regsave_T	*save;
     garray_T	*gap;
 {
     if (REG_MULTI)
     {
-	if (reglnum != save->rs_u.pos.lnum)
+	if (rex->lnum != save->rs_u.pos.lnum)
 	{
 	    /* only call reg_getline() when the line number changed to save
 	     * a bit of time */
-	    reglnum = save->rs_u.pos.lnum;
-	    regline = reg_getline(reglnum);
+	    rex->lnum = save->rs_u.pos.lnum;
+	    rex->line = reg_getline(rex, rex->lnum);
 	}
-	reginput = regline + save->rs_u.pos.col;
+	rex->input = rex->line + save->rs_u.pos.col;
     }
     else
-	reginput = save->rs_u.ptr;
+	rex->input = save->rs_u.ptr;
     gap->ga_len = save->rs_len;
 }
 
@@ -6022,13 +8416,14 @@ reg_restore(save, gap)
  * Return TRUE if current position is equal to saved position.
  */
     static int
-reg_save_equal(save)
+reg_save_equal(rex, save)
+    regexec_T	*rex;
     regsave_T	*save;
 {
     if (REG_MULTI)
-	return reglnum == save->rs_u.pos.lnum
-				  && reginput == regline + save->rs_u.pos.col;
-    return reginput == save->rs_u.ptr;
+	return rex->lnum == save->rs_u.pos.lnum
+			     && rex->input == rex->line + save->rs_u.pos.col;
+    return rex->input == save->rs_u.ptr;
 }
 
 /*
@@ -6039,22 +8434,24 @@ reg_save_equal(save)
  * depending on REG_MULTI.
  */
     static void
-save_se_multi(savep, posp)
+save_se_multi(rex, savep, posp)
+    regexec_T	*rex;
     save_se_T	*savep;
     lpos_T	*posp;
 {
     savep->se_u.pos = *posp;
-    posp->lnum = reglnum;
-    posp->col = (colnr_T)(reginput - regline);
+    posp->lnum = rex->lnum;
+    posp->col = (colnr_T)(rex->input - rex->line);
 }
 
     static void
-save_se_one(savep, pp)
+save_se_one(rex, savep, pp)
+    regexec_T	*rex;
     save_se_T	*savep;
     char_u	**pp;
 {
     savep->se_u.ptr = *pp;
-    *pp = reginput;
+    *pp = rex->input;
 }
 
 /*
@@ -6607,25 +9004,26 @@ mb_decompose(c, c1, c2, c3)
 #endif
 
 /*
- * Compare two strings, ignore case if ireg_ic set.
+ * Compare two strings, ignore case if rex->reg_ic set.
  * Return 0 if strings match, non-zero otherwise.
  * Correct the length "*n" when composing characters are ignored.
  */
     static int
-cstrncmp(s1, s2, n)
+cstrncmp(rex, s1, s2, n)
+    regexec_T	*rex;
     char_u	*s1, *s2;
     int		*n;
 {
     int		result;
 
-    if (!ireg_ic)
+    if (!rex->reg_ic)
 	result = STRNCMP(s1, s2, *n);
     else
 	result = MB_STRNICMP(s1, s2, *n);
 
 #ifdef FEAT_MBYTE
     /* if it failed and it's utf8 and we want to combineignore: */
-    if (result != 0 && enc_utf8 && ireg_icombine)
+    if (result != 0 && enc_utf8 && rex->reg_icombine)
     {
 	char_u	*str1, *str2;
 	int	c1, c2, c11, c12;
@@ -6644,14 +9042,15 @@ cstrncmp(s1, s2, n)
 	    /* decompose the character if necessary, into 'base' characters
 	     * because I don't care about Arabic, I will hard-code the Hebrew
 	     * which I *do* care about!  So sue me... */
-	    if (c1 != c2 && (!ireg_ic || utf_fold(c1) != utf_fold(c2)))
+	    if (c1 != c2 && (!rex->reg_ic || utf_fold(c1) != utf_fold(c2)))
 	    {
 		/* decomposition necessary? */
 		mb_decompose(c1, &c11, &junk, &junk);
 		mb_decompose(c2, &c12, &junk, &junk);
 		c1 = c11;
 		c2 = c12;
-		if (c11 != c12 && (!ireg_ic || utf_fold(c11) != utf_fold(c12)))
+		if (c11 != c12
+			  && (!rex->reg_ic || utf_fold(c11) != utf_fold(c12)))
 		    break;
 	    }
 	}
@@ -6668,14 +9067,14 @@ cstrncmp(s1, s2, n)
  * cstrchr: This function is used a lot for simple searches, keep it fast!
  */
     static char_u *
-cstrchr(s, c)
+cstrchr(rex, s, c)
+    regexec_T	*rex;
     char_u	*s;
     int		c;
 {
-    char_u	*p;
     int		cc;
 
-    if (!ireg_ic
+    if (!rex->reg_ic
 #ifdef FEAT_MBYTE
 	    || (!enc_utf8 && mb_char2len(c) > 1)
 #endif
@@ -6698,8 +9097,11 @@ cstrchr(s, c)
 	return vim_strchr(s, c);
 
 #ifdef FEAT_MBYTE
-    if (has_mbyte)
+    /* In UTF-8 an ASCII byte is always a character. */
+    if (has_mbyte && !(enc_utf8 && c < 0x80))
     {
+	char_u	*p;
+
 	for (p = s; *p != NUL; p += (*mb_ptr2len)(p))
 	{
 	    if (enc_utf8 && c > 0x80)
@@ -6710,15 +9112,11 @@ cstrchr(s, c)
 	    else if (*p == c || *p == cc)
 		return p;
 	}
+	return NULL;
     }
-    else
 #endif
-	/* Faster version for when there are no multi-byte characters. */
-	for (p = s; *p != NUL; ++p)
-	    if (*p == c || *p == cc)
-		return p;
-
-    return NULL;
+    /* Faster version for when there are no multi-byte characters. */
+    return vim_strbyte2(s, c, cc);
 }
 
 /***************************************************************
@@ -6901,9 +9299,11 @@ vim_regsub(rmp, source, dest, copy, magic, backslash)
     int		magic;
     int		backslash;
 {
-    reg_match = rmp;
-    reg_mmatch = NULL;
-    reg_maxline = 0;
+    regexec_T	*rex = &rex_main;
+
+    rex->reg_match = rmp;
+    rex->reg_mmatch = NULL;
+    rex->reg_maxline = 0;
     return vim_regsub_both(source, dest, copy, magic, backslash);
 }
 #endif
@@ -6918,11 +9318,13 @@ vim_regsub_multi(rmp, lnum, source, dest, copy, magic, backslash)
     int		magic;
     int		backslash;
 {
-    reg_match = NULL;
-    reg_mmatch = rmp;
-    reg_buf = curbuf;		/* always works on the current buffer! */
-    reg_firstlnum = lnum;
-    reg_maxline = curbuf->b_ml.ml_line_count - lnum;
+    regexec_T	*rex = &rex_main;
+
+    rex->reg_match = NULL;
+    rex->reg_mmatch = rmp;
+    rex->reg_buf = curbuf;	/* always works on the current buffer! */
+    rex->reg_firstlnum = lnum;
+    rex->reg_maxline = curbuf->b_ml.ml_line_count - lnum;
     return vim_regsub_both(source, dest, copy, magic, backslash);
 }
 
@@ -6934,6 +9336,7 @@ vim_regsub_both(source, dest, copy, magic, backslash)
     int		magic;
     int		backslash;
 {
+    regexec_T	*rex = &rex_main;
     char_u	*src;
     char_u	*dst;
     char_u	*s;
@@ -6953,7 +9356,7 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 	EMSG(_(e_null));
 	return 0;
     }
-    if (prog_magic_wrong())
+    if (prog_magic_wrong(rex))
 	return 0;
     src = source;
     dst = dest;
@@ -6993,12 +9396,12 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 	     * recursively.  Make sure submatch() gets the text from the first
 	     * level.  Don't need to save "reg_buf", because
 	     * vim_regexec_multi() can't be called recursively. */
-	    submatch_match = reg_match;
-	    submatch_mmatch = reg_mmatch;
-	    submatch_firstlnum = reg_firstlnum;
-	    submatch_maxline = reg_maxline;
-	    save_reg_win = reg_win;
-	    save_ireg_ic = ireg_ic;
+	    submatch_match = rex->reg_match;
+	    submatch_mmatch = rex->reg_mmatch;
+	    submatch_firstlnum = rex->reg_firstlnum;
+	    submatch_maxline = rex->reg_maxline;
+	    save_reg_win = rex->reg_win;
+	    save_ireg_ic = rex->reg_ic;
 	    can_f_submatch = TRUE;
 
 	    eval_result = eval_to_string(source + 2, NULL, TRUE);
@@ -7039,12 +9442,12 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 		dst += STRLEN(eval_result);
 	    }
 
-	    reg_match = submatch_match;
-	    reg_mmatch = submatch_mmatch;
-	    reg_firstlnum = submatch_firstlnum;
-	    reg_maxline = submatch_maxline;
-	    reg_win = save_reg_win;
-	    ireg_ic = save_ireg_ic;
+	    rex->reg_match = submatch_match;
+	    rex->reg_mmatch = submatch_mmatch;
+	    rex->reg_firstlnum = submatch_firstlnum;
+	    rex->reg_maxline = submatch_maxline;
+	    rex->reg_win = save_reg_win;
+	    rex->reg_ic = save_ireg_ic;
 	    can_f_submatch = FALSE;
 	}
 #endif
@@ -7171,26 +9574,28 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 	{
 	    if (REG_MULTI)
 	    {
-		clnum = reg_mmatch->startpos[no].lnum;
-		if (clnum < 0 || reg_mmatch->endpos[no].lnum < 0)
+		clnum = rex->reg_mmatch->startpos[no].lnum;
+		if (clnum < 0 || rex->reg_mmatch->endpos[no].lnum < 0)
 		    s = NULL;
 		else
 		{
-		    s = reg_getline(clnum) + reg_mmatch->startpos[no].col;
-		    if (reg_mmatch->endpos[no].lnum == clnum)
-			len = reg_mmatch->endpos[no].col
-					       - reg_mmatch->startpos[no].col;
+		    s = reg_getline(rex, clnum)
+					   + rex->reg_mmatch->startpos[no].col;
+		    if (rex->reg_mmatch->endpos[no].lnum == clnum)
+			len = rex->reg_mmatch->endpos[no].col
+					   - rex->reg_mmatch->startpos[no].col;
+
 		    else
 			len = (int)STRLEN(s);
 		}
 	    }
 	    else
 	    {
-		s = reg_match->startp[no];
-		if (reg_match->endp[no] == NULL)
+		s = rex->reg_match->startp[no];
+		if (rex->reg_match->endp[no] == NULL)
 		    s = NULL;
 		else
-		    len = (int)(reg_match->endp[no] - s);
+		    len = (int)(rex->reg_match->endp[no] - s);
 	    }
 	    if (s != NULL)
 	    {
@@ -7200,14 +9605,14 @@ vim_regsub_both(source, dest, copy, magic, backslash)
 		    {
 			if (REG_MULTI)
 			{
-			    if (reg_mmatch->endpos[no].lnum == clnum)
+			    if (rex->reg_mmatch->endpos[no].lnum == clnum)
 				break;
 			    if (copy)
 				*dst = CAR;
 			    ++dst;
-			    s = reg_getline(++clnum);
-			    if (reg_mmatch->endpos[no].lnum == clnum)
-				len = reg_mmatch->endpos[no].col;
+			    s = reg_getline(rex, ++clnum);
+			    if (rex->reg_mmatch->endpos[no].lnum == clnum)
+				len = rex->reg_mmatch->endpos[no].col;
 			    else
 				len = (int)STRLEN(s);
 			}
@@ -7304,17 +9709,18 @@ static char_u *reg_getline_submatch __ARGS((linenr_T lnum));
 reg_getline_submatch(lnum)
     linenr_T	lnum;
 {
+    regexec_T *rex = &rex_main;
     char_u *s;
-    linenr_T save_first = reg_firstlnum;
-    linenr_T save_max = reg_maxline;
+    linenr_T save_first = rex->reg_firstlnum;
+    linenr_T save_max = rex->reg_maxline;
 
-    reg_firstlnum = submatch_firstlnum;
-    reg_maxline = submatch_maxline;
+    rex->reg_firstlnum = submatch_firstlnum;
+    rex->reg_maxline = submatch_maxline;
 
-    s = reg_getline(lnum);
+    s = reg_getline(rex, lnum);
 
-    reg_firstlnum = save_first;
-    reg_maxline = save_max;
+    rex->reg_firstlnum = save_first;
+    rex->reg_maxline = save_max;
     return s;
 }
 
@@ -26,16 +26,34 @@
  * These fields are only to be used in regexp.c!
  * See regep.c for an explanation.
  */
-typedef struct
+typedef struct regprog_S regprog_T;
+
+struct regprog_S
 {
     int			regstart;
     char_u		reganch;
     char_u		*regmust;
     int			regmlen;
+    int			regmrare;
     unsigned		regflags;
     char_u		reghasz;
+    struct regdfa_S	*regdfa;		/* DFA cache or NULL */
+    int			regexecs;		/* times run, until it has a DFA,
+						   -1 when it was dropped */
+    int			regrefcnt;		/* users, see vim_regfree() */
+    int			regid;			/* see re_progid() */
+#ifdef FEAT_PROFILE
+    /* For ":regexptime". */
+    char_u		*regsource;		/* the pattern */
+    regprog_T		*regprof_next;		/* list of all programs */
+    regprog_T		*regprof_prev;
+    long		regcount;		/* times executed */
+    long		regmatchcount;		/* times it matched */
+    long		regmaxdepth;		/* largest backtracking depth */
+    proftime_T		regtotal;		/* time used */
+#endif
     char_u		program[1];		/* actually longer.. */
-} regprog_T;
+};
 
 /*
  * Structure to be used for single-line matching.
@@ -67,6 +85,12 @@ typedef struct
     colnr_T		rmm_maxcol;	/* when not zero: maximum column */
 } regmmatch_T;
 
+/*
+ * State of executing a regexp, see vim_regexec_alloc().
+ * Only to be used in regexp.c.
+ */
+typedef struct regexec_S regexec_T;
+
 /*
  * Structure used to store external references: "\z\(\)" to "\z\1".
  * Use a reference count to avoid the need to copy this around.  When it goes
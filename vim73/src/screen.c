@@ -142,6 +142,48 @@ static void end_search_hl __ARGS((void));
 static void init_search_hl __ARGS((win_T *wp));
 static void prepare_search_hl __ARGS((win_T *wp, linenr_T lnum));
 static void next_search_hl __ARGS((win_T *win, match_T *shl, linenr_T lnum, colnr_T mincol));
+
+/*
+ * Cache of the matches next_search_hl() found in the lines of a window, so
+ * that drawing a line again doesn't require matching the pattern again.  For
+ * each line and pattern the result of matching at each start column that was
+ * tried is kept.  An entry is only valid when its "he_tick" is the
+ * b_changedtick of the buffer; hl_cache_changed() keeps the entries for the
+ * lines that a change didn't touch.  Only used for patterns for which
+ * re_linelocal() is TRUE.
+ */
+#define HLC_SIZE	256	/* number of entries, must be a power of two */
+#define HLC_MAXSPANS	500	/* maximum number of spans for one line */
+#define HLC_HASH(lnum, id) \
+	    (((unsigned)(lnum) * 31 + (unsigned)(id)) & (HLC_SIZE - 1))
+
+typedef struct
+{
+    colnr_T	hs_col;		/* column where matching started */
+    colnr_T	hs_start;	/* start of the match, MAXCOL for no match */
+    colnr_T	hs_end;		/* end of the match */
+} hlspan_T;
+
+typedef struct
+{
+    linenr_T	he_lnum;	/* line number, zero when not used */
+    int		he_tick;	/* b_changedtick of the spans */
+    int		he_id;		/* re_progid() of the pattern */
+    int		he_ic;		/* "rmm_ic" used for matching */
+    garray_T	he_spans;	/* hlspan_T items */
+} hlentry_T;
+
+struct hlcache_S
+{
+    int		hc_fnum;	/* b_fnum of the buffer */
+    hlentry_T	hc_entries[HLC_SIZE];
+};
+
+static hlentry_T *hl_cache_entry __ARGS((win_T *wp, match_T *shl, linenr_T lnum, int add));
+static hlspan_T *hl_cache_find __ARGS((win_T *wp, match_T *shl, linenr_T lnum, colnr_T col));
+static void hl_cache_add __ARGS((win_T *wp, match_T *shl, linenr_T lnum, colnr_T col, long nmatched));
+static void hl_cache_move __ARGS((win_T *wp, linenr_T lnum, linenr_T lnume, long xtra));
+static void hl_cache_clear __ARGS((hlcache_T *hc));
 #endif
 static void screen_start_highlight __ARGS((int attr));
 static void screen_char __ARGS((unsigned off, int row, int col));
@@ -6994,7 +7036,7 @@ end_search_hl()
 {
     if (search_hl.rm.regprog != NULL)
     {
-	vim_free(search_hl.rm.regprog);
+	vim_regfree(search_hl.rm.regprog);
 	search_hl.rm.regprog = NULL;
     }
 }
@@ -7120,6 +7162,7 @@ next_search_hl(win, shl, lnum, mincol)
     linenr_T	l;
     colnr_T	matchcol;
     long	nmatched;
+    hlspan_T	*hs;
 
     if (shl->lnum != 0)
     {
@@ -7183,20 +7226,41 @@ next_search_hl(win, shl, lnum, mincol)
 	    matchcol = shl->rm.endpos[0].col;
 
 	shl->lnum = lnum;
-	nmatched = vim_regexec_multi(&shl->rm, win, shl->buf, lnum, matchcol,
+	hs = hl_cache_find(win, shl, lnum, matchcol);
+	if (hs != NULL)
+	{
+	    /* Matched at this column before, the line didn't change since. */
+	    nmatched = (hs->hs_start != MAXCOL);
+	    shl->rm.startpos[0].lnum = 0;
+	    shl->rm.startpos[0].col = hs->hs_start;
+	    shl->rm.endpos[0].lnum = 0;
+	    shl->rm.endpos[0].col = hs->hs_end;
+	}
+	else
+	{
+	    nmatched = vim_regexec_multi(&shl->rm, win, shl->buf, lnum,
+								    matchcol,
 #ifdef FEAT_RELTIME
-		&(shl->tm)
+		    &(shl->tm)
 #else
-		NULL
+		    NULL
 #endif
-		);
+		    );
+	    /* Don't remember a failure caused by the time limit. */
+	    if (!called_emsg && !got_int
+#ifdef FEAT_RELTIME
+		    && !profile_passed_limit(&(shl->tm))
+#endif
+		    )
+		hl_cache_add(win, shl, lnum, matchcol, nmatched);
+	}
 	if (called_emsg || got_int)
 	{
 	    /* Error while handling regexp: stop using this regexp. */
 	    if (shl == &search_hl)
 	    {
 		/* don't free regprog in the match list, it's a copy */
-		vim_free(shl->rm.regprog);
+		vim_regfree(shl->rm.regprog);
 		no_hlsearch = TRUE;
 	    }
 	    shl->rm.regprog = NULL;
@@ -7219,6 +7283,262 @@ next_search_hl(win, shl, lnum, mincol)
 	}
     }
 }
+
+/*
+ * Return the entry in the match cache of window "wp" for line "lnum" and the
+ * pattern of "shl".  Returns NULL when the pattern can't use the cache or,
+ * when "add" is FALSE, when there is no such entry.  When "add" is TRUE an
+ * empty entry is made when needed, replacing what was there.
+ */
+    static hlentry_T *
+hl_cache_entry(wp, shl, lnum, add)
+    win_T	*wp;
+    match_T	*shl;
+    linenr_T	lnum;
+    int		add;
+{
+    hlcache_T	*hc = wp->w_hlcache;
+    hlentry_T	*he;
+    int		id;
+
+    if (shl->rm.regprog == NULL || !re_linelocal(shl->rm.regprog, TRUE))
+	return NULL;
+    if (hc == NULL || hc->hc_fnum != shl->buf->b_fnum)
+    {
+	if (!add)
+	    return NULL;
+	if (hc == NULL)
+	{
+	    hc = (hlcache_T *)alloc_clear((unsigned)sizeof(hlcache_T));
+	    if (hc == NULL)
+		return NULL;
+	    wp->w_hlcache = hc;
+	}
+	else
+	    hl_cache_clear(hc);
+	hc->hc_fnum = shl->buf->b_fnum;
+    }
+
+    id = re_progid(shl->rm.regprog);
+    he = &hc->hc_entries[HLC_HASH(lnum, id)];
+    if (he->he_lnum == lnum && he->he_id == id
+	    && he->he_ic == shl->rm.rmm_ic
+	    && he->he_tick == shl->buf->b_changedtick)
+	return he;
+    if (!add)
+	return NULL;
+
+    if (he->he_lnum == 0)
+	ga_init2(&he->he_spans, (int)sizeof(hlspan_T), 4);
+    else
+	he->he_spans.ga_len = 0;
+    he->he_lnum = lnum;
+    he->he_tick = shl->buf->b_changedtick;
+    he->he_id = id;
+    he->he_ic = shl->rm.rmm_ic;
+    return he;
+}
+
+/*
+ * Find the result of matching the pattern of "shl" at column "col" of line
+ * "lnum" in the match cache of window "wp".  Returns NULL when not found.
+ */
+    static hlspan_T *
+hl_cache_find(wp, shl, lnum, col)
+    win_T	*wp;
+    match_T	*shl;
+    linenr_T	lnum;
+    colnr_T	col;
+{
+    hlentry_T	*he;
+    hlspan_T	*hs;
+    int		i;
+
+    he = hl_cache_entry(wp, shl, lnum, FALSE);
+    if (he == NULL)
+	return NULL;
+    hs = (hlspan_T *)he->he_spans.ga_data;
+    for (i = 0; i < he->he_spans.ga_len; ++i)
+	if (hs[i].hs_col == col)
+	    return &hs[i];
+    return NULL;
+}
+
+/*
+ * Remember the result of matching the pattern of "shl" at column "col" of
+ * line "lnum", which returned "nmatched", in the match cache of window "wp".
+ */
+    static void
+hl_cache_add(wp, shl, lnum, col, nmatched)
+    win_T	*wp;
+    match_T	*shl;
+    linenr_T	lnum;
+    colnr_T	col;
+    long	nmatched;
+{
+    hlentry_T	*he;
+    hlspan_T	*hs;
+
+    if (nmatched > 1 || (nmatched == 1 && (shl->rm.startpos[0].lnum != 0
+					   || shl->rm.endpos[0].lnum != 0)))
+	return;
+    he = hl_cache_entry(wp, shl, lnum, TRUE);
+    if (he == NULL || he->he_spans.ga_len >= HLC_MAXSPANS
+				       || ga_grow(&he->he_spans, 1) == FAIL)
+	return;
+    hs = (hlspan_T *)he->he_spans.ga_data + he->he_spans.ga_len;
+    hs->hs_col = col;
+    if (nmatched == 0)
+    {
+	hs->hs_start = MAXCOL;
+	hs->hs_end = MAXCOL;
+    }
+    else
+    {
+	hs->hs_start = shl->rm.startpos[0].col;
+	hs->hs_end = shl->rm.endpos[0].col;
+    }
+    ++he->he_spans.ga_len;
+}
+
+/*
+ * Called after b_changedtick of "buf" was incremented for changing lines
+ * "lnum" up to "lnume" (exclusive) and inserting "xtra" lines (negative when
+ * deleting).  Keeps the matches cached for the other lines, at their new
+ * line number.
+ */
+    void
+hl_cache_changed(buf, lnum, lnume, xtra)
+    buf_T	*buf;
+    linenr_T	lnum;
+    linenr_T	lnume;
+    long	xtra;
+{
+    win_T	*wp;
+#ifdef FEAT_WINDOWS
+    tabpage_T	*tp;
+#endif
+
+    FOR_ALL_TAB_WINDOWS(tp, wp)
+	if (wp->w_buffer == buf && wp->w_hlcache != NULL)
+	{
+	    if (wp->w_hlcache->hc_fnum == buf->b_fnum)
+		hl_cache_move(wp, lnum, lnume, xtra);
+	    else
+		hl_cache_clear(wp->w_hlcache);
+	}
+}
+
+/*
+ * Drop the entries of the match cache of window "wp" for lines "lnum" up to
+ * "lnume" (exclusive) and the ones that were already invalid, add "xtra" to
+ * the line number of entries below "lnume".
+ */
+    static void
+hl_cache_move(wp, lnum, lnume, xtra)
+    win_T	*wp;
+    linenr_T	lnum;
+    linenr_T	lnume;
+    long	xtra;
+{
+    hlcache_T	*hc = wp->w_hlcache;
+    hlcache_T	*nhc = hc;
+    hlentry_T	*he;
+    hlentry_T	*nhe;
+    int		tick = wp->w_buffer->b_changedtick;
+    int		i;
+
+    if (xtra != 0)
+    {
+	/* Entries move to another slot, fill a new table. */
+	nhc = (hlcache_T *)alloc_clear((unsigned)sizeof(hlcache_T));
+	if (nhc == NULL)
+	{
+	    hl_cache_clear(hc);
+	    return;
+	}
+	nhc->hc_fnum = hc->hc_fnum;
+    }
+
+    for (i = 0; i < HLC_SIZE; ++i)
+    {
+	he = &hc->hc_entries[i];
+	if (he->he_lnum == 0)
+	    continue;
+	if ((he->he_tick != tick && he->he_tick != tick - 1)
+		|| (he->he_lnum >= lnum && he->he_lnum < lnume))
+	{
+	    ga_clear(&he->he_spans);
+	    he->he_lnum = 0;
+	    continue;
+	}
+	he->he_tick = tick;
+	if (xtra == 0)
+	    continue;
+
+	if (he->he_lnum >= lnume)
+	    he->he_lnum += xtra;
+	nhe = &nhc->hc_entries[HLC_HASH(he->he_lnum, he->he_id)];
+	if (nhe->he_lnum != 0)
+	    ga_clear(&nhe->he_spans);
+	*nhe = *he;
+	he->he_lnum = 0;
+    }
+
+    if (xtra != 0)
+    {
+	vim_free(hc);
+	wp->w_hlcache = nhc;
+    }
+}
+
+/*
+ * Drop all entries of match cache "hc".
+ */
+    static void
+hl_cache_clear(hc)
+    hlcache_T	*hc;
+{
+    int		i;
+
+    for (i = 0; i < HLC_SIZE; ++i)
+	if (hc->hc_entries[i].he_lnum != 0)
+	{
+	    ga_clear(&hc->hc_entries[i].he_spans);
+	    hc->hc_entries[i].he_lnum = 0;
+	}
+}
+
+/*
+ * Drop the cached matches of all windows, e.g. because 'iskeyword' changed.
+ */
+    void
+hl_cache_clear_all()
+{
+    win_T	*wp;
+#ifdef FEAT_WINDOWS
+    tabpage_T	*tp;
+#endif
+
+    FOR_ALL_TAB_WINDOWS(tp, wp)
+	if (wp->w_hlcache != NULL)
+	    hl_cache_clear(wp->w_hlcache);
+}
+
+/*
+ * Free the match cache of window "wp".
+ */
+    void
+hl_cache_free(wp)
+    win_T	*wp;
+{
+    if (wp->w_hlcache != NULL)
+    {
+	hl_cache_clear(wp->w_hlcache);
+	vim_free(wp->w_hlcache);
+	wp->w_hlcache = NULL;
+    }
+}
 #endif
 
       static void
@@ -556,6 +556,11 @@ searchit(win, buf, pos, dir, pat, count, options, pat_use, stop_lnum, tm)
 #ifdef FEAT_SEARCH_EXTRA
     int		break_loop = FALSE;
 #endif
+#ifdef FEAT_TRIGRAM_INDEX
+    triquery_T	tq;
+    int		use_tri;
+    linenr_T	next;
+#endif
 
     if (search_regcomp(pat, RE_SEARCH, pat_use,
 		   (options & (SEARCH_HIS + SEARCH_KEEP)), &regmatch) == FAIL)
@@ -564,6 +569,9 @@ searchit(win, buf, pos, dir, pat, count, options, pat_use, stop_lnum, tm)
 	    EMSG2(_("E383: Invalid search string: %s"), mr_pattern);
 	return FAIL;
     }
+#ifdef FEAT_TRIGRAM_INDEX
+    use_tri = ml_tri_prepare(buf, regmatch.regprog, regmatch.rmm_ic, &tq);
+#endif
 
     /* When not accepting a match at the start position set "extra_col" to a
      * non-zero value.  Don't do that when starting at MAXCOL, since MAXCOL +
@@ -622,6 +630,21 @@ searchit(win, buf, pos, dir, pat, count, options, pat_use, stop_lnum, tm)
 	    for ( ; lnum > 0 && lnum <= buf->b_ml.ml_line_count;
 					   lnum += dir, at_first_line = FALSE)
 	    {
+#ifdef FEAT_TRIGRAM_INDEX
+		/* Skip the lines that the trigram index excludes.  In the
+		 * second loop don't go past where the search started. */
+		if (use_tri
+			&& (next = ml_tri_skip(buf, lnum, dir, &tq)) != lnum)
+		{
+		    if (loop && (dir == FORWARD ? next > start_pos.lnum
+						: next < start_pos.lnum))
+			next = start_pos.lnum;
+		    lnum = next;
+		    at_first_line = FALSE;
+		    if (lnum < 1 || lnum > buf->b_ml.ml_line_count)
+			break;
+		}
+#endif
 		/* Stop after checking "stop_lnum", if it's set. */
 		if (stop_lnum != 0 && (dir == FORWARD
 				       ? lnum > stop_lnum : lnum < stop_lnum))
@@ -969,7 +992,7 @@ searchit(win, buf, pos, dir, pat, count, options, pat_use, stop_lnum, tm)
     }
     while (--count > 0 && found);   /* stop after count matches or no match */
 
-    vim_free(regmatch.regprog);
+    vim_regfree(regmatch.regprog);
 
     called_emsg |= save_called_emsg;
 
@@ -5219,9 +5242,9 @@ exit_matched:
 
 fpip_end:
     vim_free(file_line);
-    vim_free(regmatch.regprog);
-    vim_free(incl_regmatch.regprog);
-    vim_free(def_regmatch.regprog);
+    vim_regfree(regmatch.regprog);
+    vim_regfree(incl_regmatch.regprog);
+    vim_regfree(def_regmatch.regprog);
 
 #ifdef RISCOS
    /* Restore previous file munging state. */
@@ -72,6 +72,7 @@ typedef struct window_S		win_T;
 typedef struct wininfo_S	wininfo_T;
 typedef struct frame_S		frame_T;
 typedef int			scid_T;		/* script ID */
+typedef struct hlcache_S	hlcache_T;	/* defined in screen.c */
 
 /*
  * This is here because gui.h needs the pos_T and win_T, and win_T needs gui.h
@@ -392,34 +393,67 @@ typedef long		    blocknr_T;
  *	the contents of the block in the file (if any) is irrelevant.
  */
 
+/*
+ * An item in a mf_hashtab_T, the key is a block number.  Structs that are put
+ * in a hash table start with a mf_hashitem_T.
+ */
+typedef struct mf_hashitem_S mf_hashitem_T;
+
+struct mf_hashitem_S
+{
+    mf_hashitem_T   *mhi_next;	    /* next item in the bucket */
+    mf_hashitem_T   *mhi_prev;	    /* previous item in the bucket */
+    blocknr_T	    mhi_key;	    /* block number */
+};
+
+#define MHT_INIT_SIZE   64
+
+/*
+ * Hash table of mf_hashitem_T, keyed on the block number.  The number of
+ * buckets is a power of two and grows with the number of items, so that the
+ * lists stay short for large memfiles.
+ */
+typedef struct mf_hashtab_S
+{
+    long_u	    mht_mask;	    /* mask used for the hash value, the
+				       number of buckets is "mht_mask" + 1 */
+    long_u	    mht_count;	    /* number of items in the table */
+    mf_hashitem_T   **mht_buckets;  /* mht_small_buckets or allocated */
+    mf_hashitem_T   *mht_small_buckets[MHT_INIT_SIZE];	/* initial buckets */
+    char	    mht_fixed;	    /* non-zero when growing failed */
+} mf_hashtab_T;
+
 struct block_hdr
 {
+    mf_hashitem_T bh_hashitem;	    /* header for hash table and key */
+#define bh_bnum bh_hashitem.mhi_key /* block number, part of bh_hashitem */
+
     bhdr_T	*bh_next;	    /* next block_hdr in free or used list */
     bhdr_T	*bh_prev;	    /* previous block_hdr in used list */
-    bhdr_T	*bh_hash_next;	    /* next block_hdr in hash list */
-    bhdr_T	*bh_hash_prev;	    /* previous block_hdr in hash list */
-    blocknr_T	bh_bnum;	    /* block number */
     char_u	*bh_data;	    /* pointer to memory (for used block) */
     int		bh_page_count;	    /* number of pages in this block */
 
 #define BH_DIRTY    1
 #define BH_LOCKED   2
-    char	bh_flags;	    /* BH_DIRTY or BH_LOCKED */
+#define BH_ASYNC    4	/* copy is being written in the background */
+#define BH_COMPRESSED 8	/* bh_data holds the block compressed */
+#define BH_NOCOMP   16	/* didn't compress, not changed since then */
+    char	bh_flags;	    /* BH_DIRTY, BH_LOCKED, etc. */
 };
 
 /*
  * when a block with a negative number is flushed to the file, it gets
  * a positive number. Because the reference to the block is still the negative
  * number, we remember the translation to the new positive number in the
- * double linked trans lists. The structure is the same as the hash lists.
+ * trans hash table, keyed on the old number.
  */
 typedef struct nr_trans NR_TRANS;
 
 struct nr_trans
 {
-    NR_TRANS	*nt_next;		/* next nr_trans in hash list */
-    NR_TRANS	*nt_prev;		/* previous nr_trans in hash list */
-    blocknr_T	nt_old_bnum;		/* old, negative, number */
+    mf_hashitem_T nt_hashitem;		/* header for hash table and key */
+#define nt_old_bnum nt_hashitem.mhi_key	/* old, negative, number */
+
     blocknr_T	nt_new_bnum;		/* new, positive, number */
 };
 
@@ -499,12 +533,6 @@ typedef struct
 
 typedef struct file_buffer buf_T;  /* forward declaration */
 
-/*
- * Simplistic hashing scheme to quickly locate the blocks in the used list.
- * 64 blocks are found directly (64 * 4K = 256K, most files are smaller).
- */
-#define MEMHASHSIZE	64
-#define MEMHASH(nr)	((nr) & (MEMHASHSIZE - 1))
 #define MF_SEED_LEN	8
 
 struct memfile
@@ -517,14 +545,30 @@ struct memfile
     bhdr_T	*mf_used_last;		/* lru block_hdr in used list */
     unsigned	mf_used_count;		/* number of pages in used list */
     unsigned	mf_used_count_max;	/* maximum number of pages in memory */
-    bhdr_T	*mf_hash[MEMHASHSIZE];	/* array of hash lists */
-    NR_TRANS	*mf_trans[MEMHASHSIZE];	/* array of trans lists */
+    mf_hashtab_T mf_hash;		/* hash table of blocks in the used
+					   list, to quickly find them */
+    mf_hashtab_T mf_trans;		/* hash table of NR_TRANS */
     blocknr_T	mf_blocknr_max;		/* highest positive block number + 1*/
     blocknr_T	mf_blocknr_min;		/* lowest negative block number - 1 */
     blocknr_T	mf_neg_count;		/* number of negative blocks numbers */
     blocknr_T	mf_infile_count;	/* number of pages in the file */
     unsigned	mf_page_size;		/* number of bytes in a page */
     int		mf_dirty;		/* TRUE if there are dirty blocks */
+#ifdef FEAT_SWAP_ASYNC
+    int		mf_async_count;		/* number of jobs not handled yet */
+#endif
+#ifdef FEAT_MF_COMPRESS
+    bhdr_T	*mf_comp_first;		/* list of compressed blocks, they
+					   are not in the used list */
+    unsigned	mf_comp_count;		/* number of pages compressed */
+    long_u	mf_comp_bytes;		/* memory used for compressed pages */
+#endif
+#ifdef FEAT_MF_INCORE
+    int		mf_incore;		/* TRUE when the blocks are only kept
+					   in memory, there is no file */
+    garray_T	mf_core_chunks;		/* chunks of MF_CORE_PAGES pages */
+    char_u	*mf_core_free;		/* list of unused pages in the chunks */
+#endif
 #ifdef FEAT_CRYPT
     buf_T	*mf_buffer;		/* bufer this memfile is for */
     char_u	mf_seed[MF_SEED_LEN];	/* seed for encryption */
@@ -570,6 +614,19 @@ typedef struct ml_chunksize
 /*
  * the memline structure holds all the information about a memline
  */
+/*
+ * A data block that ml_find_line() used before and keeps locked, so that
+ * getting one of its lines again doesn't need a search in the tree.
+ */
+typedef struct mlparked_S
+{
+    bhdr_T	*mp_hp;		/* the locked data block */
+    linenr_T	mp_low;		/* first line in the block */
+    linenr_T	mp_high;	/* last line in the block */
+} mlparked_T;
+
+#define ML_PARKED_MAX	4	/* max nr of data blocks kept locked */
+
 typedef struct memline
 {
     linenr_T	ml_line_count;	/* number of lines in the buffer */
@@ -593,13 +650,47 @@ typedef struct memline
     linenr_T	ml_locked_low;	/* first line in ml_locked */
     linenr_T	ml_locked_high;	/* last line in ml_locked */
     int		ml_locked_lineadd;  /* number of lines inserted in ml_locked */
+
+    mlparked_T	ml_parked[ML_PARKED_MAX]; /* unchanged blocks used before
+					     ml_locked, most recent first */
+    int		ml_parked_count; /* number of entries in ml_parked */
+    long	ml_sparse_count; /* number of data blocks that became less
+				    than a quarter full, see ml_compact() */
+    linenr_T	ml_compact_lnum; /* where ml_compact_idle() continues, 0 when
+				    not busy */
+#ifdef FEAT_MMAP_VIEW
+    struct mlmmap_S *ml_mmap;	/* mapped file the lines are taken from,
+				   see ml_mmap_open() */
+#endif
+#ifdef FEAT_TRIGRAM_INDEX
+    struct mltri_S *ml_tri;	/* trigram index, see ml_tri_skip() */
+#endif
 #ifdef FEAT_BYTEOFF
     chunksize_T *ml_chunksize;
     int		ml_numchunks;
     int		ml_usedchunks;
+    chunksize_T *ml_chunktree;	/* Fenwick tree over ml_chunksize, entry 0
+				   unused */
+    int		ml_chunktree_len; /* number of chunks in ml_chunktree, zero
+				     when it must be rebuilt */
+    int		ml_chunktree_max; /* number of entries allocated */
 #endif
 } memline_T;
 
+/*
+ * Trigrams of the text that a line must contain to match a pattern, see
+ * ml_tri_prepare().  The buffer must not change while it is used.
+ */
+#define TRIQ_MAX	8	/* max number of trigrams used */
+
+typedef struct
+{
+    int		tq_count;	    /* number of trigrams in tq_hash */
+    int		tq_hash[TRIQ_MAX];  /* hashes of the trigrams */
+    linenr_T	tq_low;		    /* lines tq_low to tq_high are in a */
+    linenr_T	tq_high;	    /* chunk that may contain them */
+} triquery_T;
+
 #if defined(FEAT_SIGNS) || defined(PROTO)
 typedef struct signlist signlist_T;
 
@@ -2067,6 +2158,8 @@ struct window_S
 #ifdef FEAT_SEARCH_EXTRA
     matchitem_T	*w_match_head;		/* head of match list */
     int		w_next_match_id;	/* next match ID */
+    hlcache_T	*w_hlcache;		/* matches found for highlighting,
+					   see hl_cache_entry() */
 #endif
 
     /*
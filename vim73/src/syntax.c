@@ -3431,7 +3431,7 @@ syntax_clear(block)
     block->b_syn_sync_maxlines = 0;
     block->b_syn_sync_linebreaks = 0;
 
-    vim_free(block->b_syn_linecont_prog);
+    vim_regfree(block->b_syn_linecont_prog);
     block->b_syn_linecont_prog = NULL;
     vim_free(block->b_syn_linecont_pat);
     block->b_syn_linecont_pat = NULL;
@@ -3477,7 +3477,7 @@ syntax_sync_clear()
     curwin->w_s->b_syn_sync_maxlines = 0;
     curwin->w_s->b_syn_sync_linebreaks = 0;
 
-    vim_free(curwin->w_s->b_syn_linecont_prog);
+    vim_regfree(curwin->w_s->b_syn_linecont_prog);
     curwin->w_s->b_syn_linecont_prog = NULL;
     vim_free(curwin->w_s->b_syn_linecont_pat);
     curwin->w_s->b_syn_linecont_pat = NULL;
@@ -3516,7 +3516,7 @@ syn_clear_pattern(block, i)
     int		i;
 {
     vim_free(SYN_ITEMS(block)[i].sp_pattern);
-    vim_free(SYN_ITEMS(block)[i].sp_prog);
+    vim_regfree(SYN_ITEMS(block)[i].sp_prog);
     /* Only free sp_cont_list and sp_next_list of first start pattern */
     if (i == 0 || SYN_ITEMS(block)[i - 1].sp_type != SPTYPE_START)
     {
@@ -4910,7 +4910,7 @@ syn_cmd_match(eap, syncing)
     /*
      * Something failed, free the allocated memory.
      */
-    vim_free(item.sp_prog);
+    vim_regfree(item.sp_prog);
     vim_free(item.sp_pattern);
     vim_free(syn_opt_arg.cont_list);
     vim_free(syn_opt_arg.cont_in_list);
@@ -5166,7 +5166,7 @@ syn_cmd_region(eap, syncing)
 	{
 	    if (!success)
 	    {
-		vim_free(ppp->pp_synp->sp_prog);
+		vim_regfree(ppp->pp_synp->sp_prog);
 		vim_free(ppp->pp_synp->sp_pattern);
 	    }
 	    vim_free(ppp->pp_synp);
@@ -5925,7 +5925,7 @@ get_id_list(arg, keylen, list)
 			    id = -1;	    /* remember that we found one */
 			}
 		    }
-		    vim_free(regmatch.regprog);
+		    vim_regfree(regmatch.regprog);
 		}
 	    }
 	    vim_free(name);
@@ -6198,7 +6198,7 @@ ex_ownsyntax(eap)
 	curwin->w_p_spell = FALSE;	/* No spell checking */
 	clear_string_option(&curwin->w_s->b_p_spc);
 	clear_string_option(&curwin->w_s->b_p_spf);
-	vim_free(curwin->w_s->b_cap_prog);
+	vim_regfree(curwin->w_s->b_cap_prog);
 	curwin->w_s->b_cap_prog = NULL;
 	clear_string_option(&curwin->w_s->b_p_spl);
 #endif
@@ -6238,6 +6238,41 @@ syntax_present(win)
 	    || win->w_s->b_keywtab_ic.ht_used > 0);
 }
 
+#if defined(FEAT_PROFILE) || defined(PROTO)
+/*
+ * Return the name of the group that regexp program "prog" is used for in
+ * window "wp", by a syntax item or a match.  Returns NULL when it isn't used
+ * there.
+ */
+    char_u *
+syn_regprog_name(wp, prog)
+    win_T	*wp;
+    regprog_T	*prog;
+{
+    synpat_T	*spp;
+    int		idx;
+    int		id = 0;
+# ifdef FEAT_SEARCH_EXTRA
+    matchitem_T	*cur;
+# endif
+
+    for (idx = 0; idx < wp->w_s->b_syn_patterns.ga_len && id == 0; ++idx)
+    {
+	spp = &(SYN_ITEMS(wp->w_s)[idx]);
+	if (spp->sp_prog == prog)
+	    id = spp->sp_syn.id;
+    }
+# ifdef FEAT_SEARCH_EXTRA
+    for (cur = wp->w_match_head; cur != NULL && id == 0; cur = cur->next)
+	if (cur->match.regprog == prog)
+	    id = cur->hlg_id;
+# endif
+    if (id <= 0 || id > highlight_ga.ga_len)
+	return NULL;
+    return HL_TABLE()[id - 1].sg_name;
+}
+#endif
+
 #if defined(FEAT_CMDL_COMPL) || defined(PROTO)
 
 static enum
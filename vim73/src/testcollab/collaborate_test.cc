@@ -38,6 +38,10 @@ class CollaborativeEditQueue : public testing::Test {
   virtual void SetUp() {
     win_alloc_first();
     check_win_options(curwin);
+    // Without a valid 'foldmethod' the fold code reads past its value when
+    // buffers are entered.  Set the global value too, a buffer that is
+    // entered gets the window options from it.
+    set_option_value((char_u *)"fdm", 0L, (char_u *)"manual", 0);
   }
 
   // Clears the collaborative queue of edits.
@@ -137,6 +141,31 @@ TEST_F(CollaborativeEditQueue, applies_remove_line) {
   ASSERT_EQ(NULL, collab_dequeue(&collab_queue));
 }
 
+// Tests that removing a range of lines spanning several data blocks is
+// applied as one edit.
+TEST_F(CollaborativeEditQueue, applies_remove_lines) {
+  // Start with enough text in the buffer to fill a few blocks.
+  for (int i = 0; i < 2000; ++i) {
+    std::string line = "line " + std::to_string(i + 1);
+    ml_append_collab(i, malloc_literal(line.c_str()), 0, FALSE, FALSE);
+  }
+  appended_lines_mark(1, 2000);
+  linenr_T old_count = curbuf->b_ml.ml_line_count;
+
+  collabedit_T *edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_REMOVE_LINES;
+  edit->buf_id = 0;
+  edit->remove_lines.line = 10;
+  edit->remove_lines.count = 1980;
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+
+  ASSERT_EQ(old_count - 1980, curbuf->b_ml.ml_line_count);
+  ASSERT_STREQ("line 9", reinterpret_cast<char *>(ml_get(9)));
+  ASSERT_STREQ("line 1990", reinterpret_cast<char *>(ml_get(10)));
+  ASSERT_STREQ("line 2000", reinterpret_cast<char *>(ml_get(20)));
+}
+
 // Tests that a single collabedit_T insert text is applied.
 TEST_F(CollaborativeEditQueue, applies_insert_text) {
   // Start with some text in the buffer.
@@ -493,3 +522,452 @@ TEST_F(CollaborativeEditQueue, cursor_adjusted_to_delete_text) {
   ASSERT_EQ(1, curwin->w_cursor.lnum);
   ASSERT_EQ(1, curwin->w_cursor.col);
 }
+
+// Number of times stub_timeup reports time left before the slice runs out.
+static int checks_left = 0;
+
+// Replaces collab_timeup: the clock advances by one check each call.
+static int stub_timeup(proftime_T *tm) {
+  return --checks_left < 0;
+}
+
+// Tests that each call of collab_applyedits stops when its time slice runs
+// out, and that the edits left over are applied in order by later calls.
+TEST_F(CollaborativeEditQueue, applies_edits_across_time_slices) {
+  const int kNumEdits = 5000;
+  const int kEditsPerSlice = 64;
+  // Enqueue many appends, each adding a line to the end of the buffer.
+  for (int i = 0; i < kNumEdits; ++i) {
+    collabedit_T *edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+    edit->type = COLLAB_APPEND_LINE;
+    edit->buf_id = 0;
+    edit->append_line.line = i;
+    edit->append_line.text = malloc_literal(std::to_string(i));
+    collab_enqueue(&collab_queue, edit);
+  }
+
+  // The time runs out after kEditsPerSlice edits in every slice.
+  collab_timeup = stub_timeup;
+  p_clt = 1;
+  int slices = 0;
+  int applied = 0;
+  while (collab_pendingedits(&collab_queue) && slices < kNumEdits) {
+    checks_left = kEditsPerSlice - 1;
+    linenr_T before = curbuf->b_ml.ml_line_count;
+    collab_applyedits(&collab_queue);
+    int count = curbuf->b_ml.ml_line_count - before;
+    ASSERT_EQ(std::min(kEditsPerSlice, kNumEdits - applied), count);
+    // Typed keys get the next turn only when edits were left over.
+    ASSERT_EQ(static_cast<int>(applied + count < kNumEdits),
+              collab_takeyield());
+    applied += count;
+    ++slices;
+  }
+  p_clt = 0;
+  collab_timeup = profile_passed_limit;
+
+  ASSERT_EQ((kNumEdits + kEditsPerSlice - 1) / kEditsPerSlice, slices);
+  ASSERT_GT(slices, 1);
+  // Every edit should have been applied exactly once, in order.
+  ASSERT_FALSE(collab_pendingedits(&collab_queue));
+  for (int i = 0; i < kNumEdits; ++i) {
+    ASSERT_STREQ(std::to_string(i).c_str(),
+                 reinterpret_cast<char *>(ml_get(i + 1)));
+  }
+}
+
+// Tests that the changes of a batch of edits are marked for redraw as one
+// range with the net number of added lines.
+TEST_F(CollaborativeEditQueue, marks_batch_for_redraw_once) {
+  ml_append_collab(0, malloc_literal("one"), 0, FALSE, FALSE);
+  ml_append_collab(1, malloc_literal("two"), 0, FALSE, FALSE);
+  ml_append_collab(2, malloc_literal("three"), 0, FALSE, FALSE);
+  appended_lines_mark(0, 3);
+  curbuf->b_mod_set = FALSE;
+
+  // Append after line 1, insert text into line 3 and remove line 4.
+  collabedit_T *edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_APPEND_LINE;
+  edit->buf_id = 0;
+  edit->append_line.line = 1;
+  edit->append_line.text = malloc_literal("one and a half");
+  collab_enqueue(&collab_queue, edit);
+
+  edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_INSERT_TEXT;
+  edit->buf_id = 0;
+  edit->insert_text.line = 3;
+  edit->insert_text.index = 3;
+  edit->insert_text.text = malloc_literal("!");
+  collab_enqueue(&collab_queue, edit);
+
+  edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_REMOVE_LINE;
+  edit->buf_id = 0;
+  edit->remove_line.line = 4;
+  collab_enqueue(&collab_queue, edit);
+
+  collab_applyedits(&collab_queue);
+
+  ASSERT_STREQ("one", reinterpret_cast<char *>(ml_get(1)));
+  ASSERT_STREQ("one and a half", reinterpret_cast<char *>(ml_get(2)));
+  ASSERT_STREQ("two!", reinterpret_cast<char *>(ml_get(3)));
+
+  // The redraw range covers all three edits and nothing above them.
+  ASSERT_TRUE(curbuf->b_mod_set);
+  ASSERT_EQ(2, curbuf->b_mod_top);
+  ASSERT_GE(curbuf->b_mod_bot, 4);
+  ASSERT_EQ(0, curbuf->b_mod_xlines);
+}
+
+// Tests that a snapshot written for a synced document is shown when the
+// document is opened in another buffer, until the model confirms it.
+TEST_F(CollaborativeEditQueue, shows_cached_snapshot) {
+  char snapshot_dir[] = "/tmp/collabsnapXXXXXX";
+  ASSERT_TRUE(mkdtemp(snapshot_dir) != NULL);
+  collab_set_snapshot_dir(snapshot_dir);
+
+  // Sync a new buffer with a document.
+  int synced_bid = 1;
+  while (collab_setbuf(synced_bid))
+    ++synced_bid;
+  buf_T *oldbuf = curbuf;
+  collabedit_T *edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_BUFFER_SYNC;
+  edit->buf_id = synced_bid;
+  edit->buffer_sync.filename = NULL;
+  edit->buffer_sync.doc_id = malloc_literal("doc");
+  edit->buffer_sync.revision = malloc_literal("41");
+  edit->buffer_sync.nlines = 2;
+  edit->buffer_sync.lines = (char_u **) malloc(2 * sizeof(char_u *));
+  edit->buffer_sync.lines[0] = malloc_literal("cached one");
+  edit->buffer_sync.lines[1] = malloc_literal("cached two");
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+
+  // Once idle a snapshot is requested, the reply writes it.
+  collab_idle();
+  edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_SNAPSHOT;
+  edit->buf_id = synced_bid;
+  edit->snapshot.revision = malloc_literal("42");
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+
+  // Open the same document in a new buffer.
+  int bid = synced_bid + 1;
+  edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_BUFFER_OPEN;
+  edit->buf_id = bid;
+  edit->buffer_open.doc_id = malloc_literal("doc");
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+
+  ASSERT_TRUE(collab_setbuf(bid));
+  ASSERT_EQ(2, curbuf->b_ml.ml_line_count);
+  ASSERT_STREQ("cached one", reinterpret_cast<char *>(ml_get(1)));
+  ASSERT_STREQ("cached two", reinterpret_cast<char *>(ml_get(2)));
+  ASSERT_FALSE(curbuf->b_p_ma);
+
+  // The model is at the cached revision, so no lines are sent.
+  edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_BUFFER_SYNC;
+  edit->buf_id = bid;
+  edit->buffer_sync.filename = NULL;
+  edit->buffer_sync.doc_id = NULL;
+  edit->buffer_sync.revision = malloc_literal("42");
+  edit->buffer_sync.nlines = -1;
+  edit->buffer_sync.lines = NULL;
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+
+  ASSERT_STREQ("cached two", reinterpret_cast<char *>(ml_get(2)));
+  ASSERT_TRUE(curbuf->b_p_ma);
+
+  set_curbuf(oldbuf, DOBUF_GOTO);
+  collab_set_snapshot_dir(NULL);
+  std::string path = std::string(snapshot_dir) + "/doc";
+  unlink(path.c_str());
+  rmdir(snapshot_dir);
+}
+
+// Tests that a revision of any length is read back from a snapshot and that
+// a damaged snapshot with a huge line count is ignored.
+TEST_F(CollaborativeEditQueue, reads_only_sound_snapshots) {
+  char snapshot_dir[] = "/tmp/collabsnapXXXXXX";
+  ASSERT_TRUE(mkdtemp(snapshot_dir) != NULL);
+  collab_set_snapshot_dir(snapshot_dir);
+  const std::string kMagic = "VimCollabSnapshot 1\n";
+  const std::string kRevision(150, '7');
+  std::string good = std::string(snapshot_dir) + "/good";
+  std::string bad = std::string(snapshot_dir) + "/bad";
+  FILE *fd = fopen(good.c_str(), "w");
+  fputs((kMagic + kRevision + "\n2\n3 one\n3 two\n").c_str(), fd);
+  fclose(fd);
+  fd = fopen(bad.c_str(), "w");
+  fputs((kMagic + "1\n999999999999\n3 one\n").c_str(), fd);
+  fclose(fd);
+
+  buf_T *oldbuf = curbuf;
+  int bid = 1;
+  while (collab_setbuf(bid))
+    ++bid;
+  collabedit_T *edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_BUFFER_OPEN;
+  edit->buf_id = bid;
+  edit->buffer_open.doc_id = malloc_literal("bad");
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+
+  // The damaged snapshot isn't shown.
+  ASSERT_TRUE(collab_setbuf(bid));
+  ASSERT_TRUE(curbuf->b_ml.ml_flags & ML_EMPTY);
+
+  ++bid;
+  edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_BUFFER_OPEN;
+  edit->buf_id = bid;
+  edit->buffer_open.doc_id = malloc_literal("good");
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+
+  ASSERT_TRUE(collab_setbuf(bid));
+  ASSERT_EQ(2, curbuf->b_ml.ml_line_count);
+  ASSERT_STREQ("two", reinterpret_cast<char *>(ml_get(2)));
+  ASSERT_FALSE(curbuf->b_p_ma);
+
+  // The whole revision was read: the model at it confirms the snapshot.
+  edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_BUFFER_SYNC;
+  edit->buf_id = bid;
+  edit->buffer_sync.filename = NULL;
+  edit->buffer_sync.doc_id = NULL;
+  edit->buffer_sync.revision = malloc_literal(kRevision);
+  edit->buffer_sync.nlines = -1;
+  edit->buffer_sync.lines = NULL;
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+
+  ASSERT_STREQ("two", reinterpret_cast<char *>(ml_get(2)));
+  ASSERT_TRUE(curbuf->b_p_ma);
+
+  set_curbuf(oldbuf, DOBUF_GOTO);
+  collab_set_snapshot_dir(NULL);
+  unlink(good.c_str());
+  unlink(bad.c_str());
+  rmdir(snapshot_dir);
+}
+
+// Tests that wiping a collaborative buffer drops late edits for its ID and
+// that opening a new document reuses the ID.
+TEST_F(CollaborativeEditQueue, reuses_id_of_wiped_buffer) {
+  buf_T *oldbuf = curbuf;
+  int bid = 1;
+  while (collab_setbuf(bid))
+    ++bid;
+  collab_newbuf(bid, NULL);
+  ASSERT_TRUE(collab_setbuf(bid));
+  buf_T *wiped = curbuf;
+  set_curbuf(oldbuf, DOBUF_GOTO);
+
+  close_buffer(NULL, wiped, DOBUF_WIPE);
+  ASSERT_EQ(-1, collab_get_id(wiped));
+  ASSERT_FALSE(collab_setbuf(bid));
+
+  // An edit sent before JS knew about the wipe is dropped.
+  collabedit_T *edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_APPEND_LINE;
+  edit->buf_id = bid;
+  edit->append_line.line = 0;
+  edit->append_line.text = malloc_literal("Hello wiped buffer!");
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+  ASSERT_EQ(oldbuf, curbuf);
+  ASSERT_STREQ("", reinterpret_cast<char *>(ml_get(1)));
+
+  // Opening another document gets a new buffer with the same ID.
+  edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_BUFFER_OPEN;
+  edit->buf_id = bid;
+  edit->buffer_open.doc_id = malloc_literal("another doc");
+  collab_enqueue(&collab_queue, edit);
+  edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_APPEND_LINE;
+  edit->buf_id = bid;
+  edit->append_line.line = 0;
+  edit->append_line.text = malloc_literal("Hello new buffer!");
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+
+  ASSERT_TRUE(collab_setbuf(bid));
+  ASSERT_STREQ("Hello new buffer!", reinterpret_cast<char *>(ml_get(1)));
+  set_curbuf(oldbuf, DOBUF_GOTO);
+}
+
+// Tests that syncing a document into an empty buffer loads enough lines in
+// bulk to need more than one level of pointer blocks, and that the buffer can
+// be edited afterwards.
+TEST_F(CollaborativeEditQueue, syncs_large_document_in_bulk) {
+  const int nlines = 100000;
+  buf_T *oldbuf = curbuf;
+  int bid = 1;
+  while (collab_setbuf(bid))
+    ++bid;
+  collabedit_T *edit = (collabedit_T*) malloc(sizeof(collabedit_T));
+  edit->type = COLLAB_BUFFER_SYNC;
+  edit->buf_id = bid;
+  edit->buffer_sync.filename = NULL;
+  edit->buffer_sync.doc_id = malloc_literal("large doc");
+  edit->buffer_sync.revision = malloc_literal("1");
+  edit->buffer_sync.nlines = nlines;
+  edit->buffer_sync.lines = (char_u **) malloc(nlines * sizeof(char_u *));
+  for (int i = 0; i < nlines; ++i) {
+    std::string line = "line " + std::to_string(i + 1);
+    edit->buffer_sync.lines[i] = malloc_literal(line.c_str());
+  }
+  collab_enqueue(&collab_queue, edit);
+  collab_applyedits(&collab_queue);
+
+  ASSERT_TRUE(collab_setbuf(bid));
+  ASSERT_EQ(nlines, curbuf->b_ml.ml_line_count);
+  ASSERT_STREQ("line 1", reinterpret_cast<char *>(ml_get(1)));
+  ASSERT_STREQ("line 54321", reinterpret_cast<char *>(ml_get(54321)));
+  ASSERT_STREQ("line 100000", reinterpret_cast<char *>(ml_get(nlines)));
+
+  ml_append(50000, (char_u *)"inserted", 0, FALSE);
+  ASSERT_EQ(nlines + 1, curbuf->b_ml.ml_line_count);
+  ASSERT_STREQ("line 50000", reinterpret_cast<char *>(ml_get(50000)));
+  ASSERT_STREQ("inserted", reinterpret_cast<char *>(ml_get(50001)));
+  ASSERT_STREQ("line 50001", reinterpret_cast<char *>(ml_get(50002)));
+  set_curbuf(oldbuf, DOBUF_GOTO);
+}
+
+// Tests that pushing an edit onto a ring copies its strings and that edits are
+// popped in order when the ring wraps around.
+TEST(CollaborativeEditRing, pops_copies_in_order) {
+  editring_T *ring = new editring_T;
+  collab_ring_init(ring);
+
+  char_u text[] = "Hello ring!";
+  for (int i = 0; i < 2 * EDITRING_SIZE + 3; ++i) {
+    collabedit_T edit = {};
+    edit.type = COLLAB_APPEND_LINE;
+    edit.buf_id = 0;
+    edit.append_line.line = i;
+    edit.append_line.text = text;
+    collab_ring_push(ring, &edit);
+    // The caller still owns its string and may change it.
+    text[0] = 'J';
+
+    collabedit_T popped;
+    collab_ring_pop(ring, &popped);
+    ASSERT_EQ(COLLAB_APPEND_LINE, popped.type);
+    ASSERT_EQ(i, popped.append_line.line);
+    ASSERT_STREQ("Hello ring!",
+                 reinterpret_cast<char *>(popped.append_line.text));
+    collab_ring_done(ring, &popped);
+    text[0] = 'H';
+  }
+  delete ring;
+}
+
+// Pushes edits with line numbers from 'first' to 'last' and a 'len' bytes
+// text onto 'ring'.
+static void push_edits(editring_T *ring, int first, int last, size_t len) {
+  for (int i = first; i <= last; ++i) {
+    std::string text(len, 'a' + i % 26);
+    collabedit_T edit = {};
+    edit.type = COLLAB_REPLACE_LINE;
+    edit.buf_id = 0;
+    edit.replace_line.line = i;
+    edit.replace_line.text = reinterpret_cast<char_u *>(&text[0]);
+    collab_ring_push(ring, &edit);
+  }
+}
+
+// Pops edits from 'ring' and checks they were pushed by push_edits().
+static void pop_edits_of(editring_T *ring, int first, int last, size_t len) {
+  for (int i = first; i <= last; ++i) {
+    collabedit_T popped;
+    collab_ring_pop(ring, &popped);
+    ASSERT_EQ(i, popped.replace_line.line);
+    ASSERT_STREQ(std::string(len, 'a' + i % 26).c_str(),
+                 reinterpret_cast<char *>(popped.replace_line.text));
+    collab_ring_done(ring, &popped);
+  }
+}
+
+// Tests that pushing never waits: when the ring or its text is full, and for
+// a long line, edits go to the overflow list and are still popped in order.
+TEST(CollaborativeEditRing, spills_without_waiting) {
+  editring_T *ring = new editring_T;
+  collab_ring_init(ring);
+
+  // Without a consumer, push more edits than fit in the ring.
+  push_edits(ring, 0, EDITRING_SIZE + 99, 10);
+  ASSERT_TRUE(ring->overflowing);
+  // Edits pushed while the overflow list isn't empty go there too.
+  pop_edits_of(ring, 0, 9, 10);
+  push_edits(ring, EDITRING_SIZE + 100, EDITRING_SIZE + 199, 10);
+  pop_edits_of(ring, 10, EDITRING_SIZE + 199, 10);
+  ASSERT_FALSE(ring->overflowing);
+  ASSERT_EQ(ring->head, ring->tail);
+
+  // More text than fits.
+  push_edits(ring, 0, 999, EDITRING_TEXTSIZE / 100);
+  ASSERT_TRUE(ring->overflowing);
+  ASSERT_LT(ring->tail - ring->head, 1000u);
+  pop_edits_of(ring, 0, 999, EDITRING_TEXTSIZE / 100);
+
+  // A long line, before and after edits in the ring.
+  push_edits(ring, 0, 0, 5);
+  push_edits(ring, 1, 1, EDITRING_TEXTSIZE);
+  push_edits(ring, 2, 2, 5);
+  pop_edits_of(ring, 0, 0, 5);
+  pop_edits_of(ring, 1, 1, EDITRING_TEXTSIZE);
+  pop_edits_of(ring, 2, 2, 5);
+  ASSERT_FALSE(ring->overflowing);
+  delete ring;
+}
+
+// Pops edits from the ring passed in 'arg' and checks their order and text.
+static void *pop_edits(void *arg) {
+  editring_T *ring = static_cast<editring_T *>(arg);
+  for (long i = 0; i < 10 * EDITRING_SIZE; ++i) {
+    collabedit_T popped;
+    collab_ring_pop(ring, &popped);
+    std::string text = std::to_string(i);
+    if (popped.append_line.line != i ||
+        text != reinterpret_cast<char *>(popped.append_line.text))
+      return reinterpret_cast<void *>(1);
+    collab_ring_done(ring, &popped);
+  }
+  return NULL;
+}
+
+// Tests that edits pushed from one thread all arrive at another thread in
+// order, including when the consumer has to wait for the producer and when
+// the producer runs ahead.
+TEST(CollaborativeEditRing, passes_edits_between_threads) {
+  editring_T *ring = new editring_T;
+  collab_ring_init(ring);
+  pthread_t consumer;
+  pthread_create(&consumer, NULL, &pop_edits, ring);
+
+  for (long i = 0; i < 10 * EDITRING_SIZE; ++i) {
+    std::string text = std::to_string(i);
+    collabedit_T edit = {};
+    edit.type = COLLAB_APPEND_LINE;
+    edit.buf_id = 0;
+    edit.append_line.line = i;
+    edit.append_line.text = reinterpret_cast<char_u *>(&text[0]);
+    collab_ring_push(ring, &edit);
+    // Now and then let the consumer catch up and go to sleep.
+    if (i % 1000 == 0)
+      usleep(1000);
+  }
+  void *result;
+  pthread_join(consumer, &result);
+  ASSERT_EQ(NULL, result);
+  delete ring;
+}
@@ -0,0 +1,35 @@
+" Benchmark, to be run as:  make bench_byteoff.out
+" Changes lines all over a buffer of 1000000 lines and asks for byte offsets
+" of lines far apart.  Writes the times to benchmark.out.
+
+let s:lines = []
+for s:i in range(1000000)
+  call add(s:lines, printf('%07d line of the byte offset benchmark', s:i))
+endfor
+call writefile(s:lines, 'Xbench')
+e! Xbench
+let s:size = line2byte(line('$') + 1)
+
+let s:out = []
+let s:seed = 5
+let s:start = reltime()
+for s:i in range(20000)
+  " Numbers must fit in 32 bits.
+  let s:seed = (s:seed * 1103 + 12345) % 65521
+  let s:lnum = s:seed * 15 + 1
+  call setline(s:lnum, getline(s:lnum) . 'x')
+  call append(s:lnum, 'added')
+  exe (s:lnum + 1) . 'd'
+endfor
+call add(s:out, 'changes:     20000 in ' . reltimestr(reltime(s:start)) . ' sec')
+
+let s:start = reltime()
+for s:i in range(20000)
+  let s:seed = (s:seed * 1103 + 12345) % 65521
+  call line2byte(s:seed * 15 + 1)
+  call byte2line(s:size - s:seed * 600)
+endfor
+call add(s:out, 'offsets:     20000 in ' . reltimestr(reltime(s:start)) . ' sec')
+
+call writefile(s:out, 'benchmark.out')
+call delete('Xbench')
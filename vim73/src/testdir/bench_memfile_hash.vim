@@ -0,0 +1,34 @@
+" Benchmark, to be run as:  make bench_memfile_hash.out
+" Gets lines in random order from a buffer of two million lines and writes
+" the times to benchmark.out.
+
+call writefile(map(range(1, 2000000), '"line " . v:val . " of the memfile hash benchmark"'), 'Xbench')
+set maxmem=2000000 maxmemtot=2000000
+e! Xbench
+
+let s:seed = 1
+let s:lnums = []
+for s:i in range(200000)
+  " Two draws of a small generator, numbers must fit in 32 bits.
+  let s:seed = (s:seed * 1103 + 12345) % 65521
+  let s:hi = s:seed % 2048
+  let s:seed = (s:seed * 1103 + 12345) % 65521
+  call add(s:lnums, (s:hi * 2048 + s:seed % 2048) % 2000000 + 1)
+endfor
+
+let s:out = []
+" Getting the same line again shows the time not spent in the memfile.
+let s:start = reltime()
+for s:lnum in s:lnums
+  call getline(1)
+endfor
+call add(s:out, 'same line:    ' . len(s:lnums) . ' times in ' . reltimestr(reltime(s:start)) . ' sec')
+
+let s:start = reltime()
+for s:lnum in s:lnums
+  call getline(s:lnum)
+endfor
+call add(s:out, 'random lines: ' . len(s:lnums) . ' of ' . line('$') . ' in ' . reltimestr(reltime(s:start)) . ' sec')
+
+call writefile(s:out, 'benchmark.out')
+call delete('Xbench')
@@ -0,0 +1,30 @@
+" Benchmark, to be run as:  make bench_memline_get.out
+" Sorts a buffer of 300000 lines in random order and gets pairs of lines that
+" are in different blocks.  Writes the times to benchmark.out.
+
+let s:seed = 5
+let s:lines = []
+for s:i in range(300000)
+  " Two draws of a small generator, numbers must fit in 32 bits.
+  let s:seed = (s:seed * 1103 + 12345) % 65521
+  let s:hi = s:seed % 2048
+  let s:seed = (s:seed * 1103 + 12345) % 65521
+  call add(s:lines, printf('%07d line of the memline get benchmark', s:hi * 2048 + s:seed % 2048))
+endfor
+call writefile(s:lines, 'Xbench')
+e! Xbench
+
+let s:out = []
+let s:start = reltime()
+sort
+call add(s:out, 'sort:        ' . line('$') . ' lines in ' . reltimestr(reltime(s:start)) . ' sec')
+
+let s:start = reltime()
+for s:lnum in range(1, 150000)
+  call getline(s:lnum)
+  call getline(s:lnum + 150000)
+endfor
+call add(s:out, 'line pairs:  150000 in ' . reltimestr(reltime(s:start)) . ' sec')
+
+call writefile(s:out, 'benchmark.out')
+call delete('Xbench')
@@ -0,0 +1,22 @@
+" Benchmark, to be run as:  make bench_memline_load.out
+" Loads the same million lines through both ways of filling a buffer and
+" writes the times to benchmark.out.
+
+let s:lines = map(range(1, 1000000), '"line " . v:val . " of the memline load benchmark"')
+call writefile(s:lines, 'Xbench')
+let s:out = []
+
+" Reading the file into an empty buffer uses the bulk loader.
+let s:start = reltime()
+e! Xbench
+call add(s:out, 'read:   ' . line('$') . ' lines in ' . reltimestr(reltime(s:start)) . ' sec')
+
+" Appending to an empty buffer adds the lines one at a time.
+enew!
+let s:start = reltime()
+call append(0, s:lines)
+$d
+call add(s:out, 'append: ' . line('$') . ' lines in ' . reltimestr(reltime(s:start)) . ' sec')
+
+call writefile(s:out, 'benchmark.out')
+call delete('Xbench')
@@ -0,0 +1,53 @@
+" Benchmark, to be run as:  make bench_regexp.out
+" Finds the syntax items in all lines of ../eval.c, runs ":g" over it, uses
+" one pattern many times and matches patterns that need a lot of
+" backtracking, once for each value of 'regexpengine'.  Writes the times to
+" benchmark.out.
+
+let $VIMRUNTIME = fnamemodify('../../runtime', ':p')
+let &rtp = $VIMRUNTIME
+set nocp nowrapscan
+syntax on
+
+let s:out = []
+for s:re in [1, 2, 0]
+  exe 'set re=' . s:re
+  e! ../eval.c
+  syntax sync fromstart
+  let s:start = reltime()
+  for s:lnum in range(1, line('$'))
+    call synID(s:lnum, strlen(getline(s:lnum)), 1)
+  endfor
+  call add(s:out, 're=' . s:re . ' syntax:   ' . line('$') . ' lines in ' . reltimestr(reltime(s:start)) . ' sec')
+
+  " Most lines don't match, the DFA cache skips them.
+  let s:start = reltime()
+  for s:i in range(20)
+    g/\<TODO\>\|^\s*#\s*if\s\+defined\|\s\+$/let s:n = 1
+  endfor
+  call add(s:out, 're=' . s:re . ' global:   20 in ' . reltimestr(reltime(s:start)) . ' sec')
+
+  let s:start = reltime()
+  for s:i in range(20)
+    call match(repeat('x=', 40), '.*.*=.*[yz]')
+  endfor
+  call add(s:out, 're=' . s:re . ' dotstar:  20 in ' . reltimestr(reltime(s:start)) . ' sec')
+
+  " The same pattern again and again, compiled only once.
+  let s:start = reltime()
+  for s:i in range(20000)
+    call substitute('int foo = bar;', '\<\(\h\w*\)\s*=\s*\(\h\w*\);', '\2 = \1;', '')
+  endfor
+  call add(s:out, 're=' . s:re . ' compile:  20000 in ' . reltimestr(reltime(s:start)) . ' sec')
+
+  " The backtracking engine runs into 'maxmempattern' with a long text.
+  let s:start = reltime()
+  for s:i in range(20)
+    call match(repeat('a', 24) . 'x', '\(a\|aa\)*[bc]')
+  endfor
+  call add(s:out, 're=' . s:re . ' nested:   20 in ' . reltimestr(reltime(s:start)) . ' sec')
+  bwipe!
+endfor
+
+syntax off
+call writefile(s:out, 'benchmark.out')
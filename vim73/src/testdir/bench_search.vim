@@ -0,0 +1,60 @@
+" Benchmark, to be run as:  make bench_search.out
+" Writes a file made of copies of ../eval.c with one line at the end that
+" matches, edits it and searches for that line with several kinds of
+" patterns.  Then does that again with every 100 lines joined, when lines are
+" long looking for the text of the pattern takes most of the time.  Both
+" without and with 'trigramindex'.
+" The file is $BENCH_MB Mbyte, 64 when not set; for a 1 Gbyte file use:
+"	BENCH_MB=1024 make bench_search.out
+" Writes the times to benchmark.out.
+
+set nocp nowrapscan
+let s:mb = empty($BENCH_MB) ? 64 : str2nr($BENCH_MB)
+
+" Double the copies of eval.c until another doubling would be too much, then
+" copy the lines that are still missing.
+e! ../eval.c
+let s:size = s:mb * 1024 * 1024
+while 2 * line2byte(line('$') + 1) <= s:size
+  silent %t$
+endwhile
+exe 'silent 1,' . byte2line(s:size - line2byte(line('$') + 1)) . 't$'
+$put ='    needle_in_the_haystack(Q);'
+silent w! Xbench
+bwipe!
+
+let s:out = []
+let s:start = reltime()
+e Xbench
+call add(s:out, 'load:         ' . s:mb . ' Mbyte in ' . reltimestr(reltime(s:start)) . ' sec')
+
+for s:joined in [0, 1]
+  if s:joined
+    silent! g/^/.,+99j!
+  endif
+  " "\<" and ".*" make the text that must appear be looked for first, "\c"
+  " looks for the first character in both cases.
+  for s:pat in ['needle_in', '\<needle_in', '.*haystack(Q', '\cNEEDLE_IN']
+    call cursor(1, 1)
+    let s:start = reltime()
+    let s:lnum = search(s:pat, 'W')
+    call add(s:out, printf('%-13s line %d in %s sec', s:pat, s:lnum, reltimestr(reltime(s:start))))
+  endfor
+
+  " With 'trigramindex' the first search builds the bitmaps of the chunks,
+  " the second one skips the chunks without the trigrams of the pattern.
+  set tgi
+  for s:pass in ['build', 'use']
+    for s:pat in ['needle_in', '.*haystack(Q', '\cNEEDLE_IN']
+      call cursor(1, 1)
+      let s:start = reltime()
+      let s:lnum = search(s:pat, 'W')
+      call add(s:out, printf('%-13s line %d in %s sec, tgi %s', s:pat, s:lnum, reltimestr(reltime(s:start)), s:pass))
+    endfor
+  endfor
+  set notgi
+endfor
+
+call writefile(s:out, 'benchmark.out')
+bwipe!
+call delete('Xbench')
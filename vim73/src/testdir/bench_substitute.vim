@@ -0,0 +1,23 @@
+" Benchmark, to be run as:  make bench_substitute.out
+" Substitutes in ten copies of ../eval.c with 'substitutethreads' set to zero,
+" which matches one line after the other, and with worker threads.  Writes
+" the times to benchmark.out.
+
+set nocp
+
+let s:lines = readfile('../eval.c')
+let s:out = []
+for s:stt in [0, 1, 4]
+  let &stt = s:stt
+  for s:pat in ['/\s\+$//e', '/\<\(\h\w*\) = \1\>/&/e', '/\(\a\)\1\@!x/&/ge']
+    enew!
+    for s:i in range(10)
+      call append('$', s:lines)
+    endfor
+    let s:start = reltime()
+    exe 'silent %s' . s:pat
+    call add(s:out, 'stt=' . s:stt . ' ' . s:pat . ': ' . line('$') . ' lines in ' . reltimestr(reltime(s:start)) . ' sec')
+  endfor
+endfor
+
+call writefile(s:out, 'benchmark.out')
@@ -0,0 +1,20 @@
+" Benchmark, to be run as:  make bench_vimgrep.out
+" Greps all the source files in ".." ten times with 'vimgrepthreads' set to
+" zero, which loads every file into a buffer, and with worker threads.
+" Writes the times to benchmark.out.
+
+set nocp
+
+let s:out = []
+for s:vgt in [0, 1, 4]
+  let &vgt = s:vgt
+  for s:pat in ['/\<TODO\>/j', '/^\s*#\s*ifdef\s\+FEAT_/gj']
+    let s:start = reltime()
+    for s:i in range(10)
+      exe 'silent vimgrep ' . s:pat . ' ../*.[ch]'
+    endfor
+    call add(s:out, 'vgt=' . s:vgt . ' ' . s:pat . ': ' . len(getqflist()) . ' matches, 10 in ' . reltimestr(reltime(s:start)) . ' sec')
+  endfor
+endfor
+
+call writefile(s:out, 'benchmark.out')
@@ -1638,9 +1638,14 @@ read_from_input_buf(buf, maxlen)
     char_u  *buf;
     long    maxlen;
 {
-    // If there are pending collaborative edits, get an event key sequence here
-    int c_keys = collab_inchar(buf, maxlen, &collab_queue);
-    if (c_keys) return c_keys;
+    // If there are pending collaborative edits, get an event key sequence here.
+    // When the last batch of edits ran out of its time slice, typed keys that
+    // are already waiting are read first.
+    if (!collab_takeyield() || (inbufcount == 0 && !mch_input_avail()))
+    {
+	int c_keys = collab_inchar(buf, maxlen, &collab_queue);
+	if (c_keys) return c_keys;
+    }
 
     if (inbufcount == 0)	/* if the buffer is empty, fill it */
 	fill_input_buf(TRUE);
@@ -323,6 +323,16 @@ static char *(features[]) =
 #else
 	"-lua",
 #endif
+#ifdef FEAT_MF_COMPRESS
+	"+memfile_compress",
+#else
+	"-memfile_compress",
+#endif
+#ifdef FEAT_MF_INCORE
+	"+memfile_incore",
+#else
+	"-memfile_incore",
+#endif
 #ifdef FEAT_MENU
 	"+menu",
 #else
@@ -333,6 +343,11 @@ static char *(features[]) =
 #else
 	"-mksession",
 #endif
+#ifdef FEAT_MMAP_VIEW
+	"+mmap_view",
+#else
+	"-mmap_view",
+#endif
 #ifdef FEAT_MODIFY_FNAME
 	"+modify_fname",
 #else
@@ -537,11 +552,21 @@ static char *(features[]) =
 #else
 	"-statusline",
 #endif
+#ifdef FEAT_SUBST_THREADS
+	"+substitute_threads",
+#else
+	"-substitute_threads",
+#endif
 #ifdef FEAT_SUN_WORKSHOP
 	"+sun_workshop",
 #else
 	"-sun_workshop",
 #endif
+#ifdef FEAT_SWAP_ASYNC
+	"+swap_async",
+#else
+	"-swap_async",
+#endif
 #ifdef FEAT_SYN_HL
 	"+syntax",
 #else
@@ -609,6 +634,11 @@ static char *(features[]) =
 #else
 	"-toolbar",
 #endif
+#ifdef FEAT_TRIGRAM_INDEX
+	"+trigram_index",
+#else
+	"-trigram_index",
+#endif
 #ifdef FEAT_USR_CMDS
 	"+user_commands",
 #else
@@ -619,6 +649,11 @@ static char *(features[]) =
 #else
 	"-vertsplit",
 #endif
+#ifdef FEAT_VIMGREP_THREADS
+	"+vimgrep_threads",
+#else
+	"-vimgrep_threads",
+#endif
 #ifdef FEAT_VIRTUALEDIT
 	"+virtualedit",
 #else
@@ -1037,6 +1037,7 @@ extern char *(*dyn_libintl_textdomain)(const char *domainname);
 #define MFS_STOP	2	/* stop syncing when a character is available */
 #define MFS_FLUSH	4	/* flushed file to disk */
 #define MFS_ZERO	8	/* only write block 0 */
+#define MFS_ASYNC	16	/* may write in the background, 'swapasync' */
 
 /* flags for buf_copy_options() */
 #define BCO_ENTER	1	/* going to enter the buffer */
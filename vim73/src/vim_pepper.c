@@ -13,12 +13,15 @@
 // limitations under the License.
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <libtar.h>
 #include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
 
 #include "ppapi/c/ppb_messaging.h"
 #include "ppapi/c/ppb_var.h"
@@ -53,10 +56,14 @@ static PP_Instance pp_ins;
 static struct PP_Var type_append_line;
 static struct PP_Var type_insert_text;
 static struct PP_Var type_remove_line;
+static struct PP_Var type_remove_lines;
 static struct PP_Var type_delete_text;
 static struct PP_Var type_buffer_sync;
 static struct PP_Var type_cursor_move;
 static struct PP_Var type_replace_line;
+static struct PP_Var type_buffer_open;
+static struct PP_Var type_snapshot;
+static struct PP_Var type_buffer_close;
 static struct PP_Var type_key;
 static struct PP_Var buf_id_key;
 static struct PP_Var line_key;
@@ -67,6 +74,14 @@ static struct PP_Var filename_key;
 static struct PP_Var lines_key;
 static struct PP_Var user_id_key;
 static struct PP_Var column_key;
+static struct PP_Var doc_id_key;
+static struct PP_Var revision_key;
+
+/*
+ * The directory on the persistent HTML5 filesystem that holds cached
+ * snapshots of documents.
+ */
+#define SNAPSHOT_DIR "/persistent/collab"
 
 /*
  * Sets up a nacl_io filesystem for vim's runtime files, such as the vimrc and
@@ -117,6 +132,31 @@ static char_u* var_to_cstr(struct PP_Var str_var) {
   return (char_u *)cstr;
 }
 
+/*
+ * Like var_to_cstr(), but returns NULL if 'dict' has no string for 'key'.
+ */
+static char_u* dict_get_cstr(struct PP_Var dict, struct PP_Var key) {
+  if (!ppb_dict->HasKey(dict, key))
+    return NULL;
+  struct PP_Var str_var = ppb_dict->Get(dict, key);
+  if (str_var.type != PP_VARTYPE_STRING) {
+    ppb_var->Release(str_var);
+    return NULL;
+  }
+  return var_to_cstr(str_var);
+}
+
+/*
+ * Sets 'key' in 'dict' to the C string 'str', if it isn't NULL.
+ */
+static void dict_set_cstr(struct PP_Var dict, struct PP_Var key, char_u *str) {
+  if (str == NULL)
+    return;
+  struct PP_Var str_var = UTF8_TO_VAR((char *)str);
+  ppb_dict->Set(dict, key, str_var);
+  ppb_var->Release(str_var);
+}
+
 /*
  * Just like strcmp, but functions on two PP_Vars.
  * Caller's responsibility to ensure v1 and v2 are strings.
@@ -136,7 +176,7 @@ static int pp_strcmp(const struct PP_Var v1, const struct PP_Var v2) {
 struct PP_Var ppvar_from_collabedit(const collabedit_T *edit) {
   struct PP_Var dict = ppb_dict->Create();
   // This temporary PP_Var will be Release'd after the switch cases.
-  struct PP_Var text_var;
+  struct PP_Var text_var = PP_MakeUndefined();
   ppb_dict->Set(dict, buf_id_key, PP_MakeInt32(edit->buf_id));
   switch (edit->type) {
     case COLLAB_CURSOR_MOVE:
@@ -161,6 +201,11 @@ struct PP_Var ppvar_from_collabedit(const collabedit_T *edit) {
       ppb_dict->Set(dict, type_key, type_remove_line);
       ppb_dict->Set(dict, line_key, PP_MakeInt32(edit->remove_line.line));
       break;
+    case COLLAB_REMOVE_LINES:
+      ppb_dict->Set(dict, type_key, type_remove_lines);
+      ppb_dict->Set(dict, line_key, PP_MakeInt32(edit->remove_lines.line));
+      ppb_dict->Set(dict, length_key, PP_MakeInt32(edit->remove_lines.count));
+      break;
     case COLLAB_DELETE_TEXT:
       ppb_dict->Set(dict, type_key, type_delete_text);
       ppb_dict->Set(dict, line_key, PP_MakeInt32(edit->delete_text.line));
@@ -175,6 +220,15 @@ struct PP_Var ppvar_from_collabedit(const collabedit_T *edit) {
       break;
     case COLLAB_BUFFER_SYNC:
       ppb_dict->Set(dict, type_key, type_buffer_sync);
+      // The revision of the cached snapshot shown in the buffer, if any.
+      dict_set_cstr(dict, revision_key, edit->buffer_sync.revision);
+      break;
+    case COLLAB_SNAPSHOT:
+      ppb_dict->Set(dict, type_key, type_snapshot);
+      // Outgoing message has no other information.
+      break;
+    case COLLAB_BUFFER_CLOSE:
+      ppb_dict->Set(dict, type_key, type_buffer_close);
       // Outgoing message has no other information.
       break;
   }
@@ -222,6 +276,11 @@ collabedit_T * collabedit_from_ppvar(struct PP_Var dict) {
     edit->type = COLLAB_REMOVE_LINE;
     edit->remove_line.line = ppb_dict->Get(dict, line_key).value.as_int;
 
+  } else if (pp_strcmp(var_type, type_remove_lines) == 0) {
+    edit->type = COLLAB_REMOVE_LINES;
+    edit->remove_lines.line = ppb_dict->Get(dict, line_key).value.as_int;
+    edit->remove_lines.count = ppb_dict->Get(dict, length_key).value.as_int;
+
   } else if (pp_strcmp(var_type, type_delete_text) == 0) {
     edit->type = COLLAB_DELETE_TEXT;
     edit->delete_text.line = ppb_dict->Get(dict, line_key).value.as_int;
@@ -235,17 +294,38 @@ collabedit_T * collabedit_from_ppvar(struct PP_Var dict) {
 
   } else if (pp_strcmp(var_type, type_buffer_sync) == 0) {
     edit->type = COLLAB_BUFFER_SYNC;
-    edit->buffer_sync.filename = var_to_cstr(ppb_dict->Get(dict, text_key));
-
-    struct PP_Var line_list = ppb_dict->Get(dict, lines_key);
-    edit->buffer_sync.nlines = ppb_array->GetLength(line_list);
-    edit->buffer_sync.lines = calloc(edit->buffer_sync.nlines, sizeof(char_u*));
+    edit->buffer_sync.filename = var_to_cstr(ppb_dict->Get(dict, filename_key));
+    edit->buffer_sync.doc_id = dict_get_cstr(dict, doc_id_key);
+    edit->buffer_sync.revision = dict_get_cstr(dict, revision_key);
+
+    if (!ppb_dict->HasKey(dict, lines_key)) {
+      // The cached snapshot is already at this revision.
+      edit->buffer_sync.nlines = -1;
+      edit->buffer_sync.lines = NULL;
+    } else {
+      struct PP_Var line_list = ppb_dict->Get(dict, lines_key);
+      edit->buffer_sync.nlines = ppb_array->GetLength(line_list);
+      edit->buffer_sync.lines = calloc(edit->buffer_sync.nlines, sizeof(char_u*));
+
+      for (uint32_t lnum = 0; lnum < edit->buffer_sync.nlines; ++lnum) {
+        char_u *line = var_to_cstr(ppb_array->Get(line_list, lnum));
+        edit->buffer_sync.lines[lnum] = line;
+      }
+      ppb_var->Release(line_list);
+    }
 
-    for (uint32_t lnum = 0; lnum < edit->buffer_sync.nlines; ++lnum) {
-      char_u *line = var_to_cstr(ppb_array->Get(line_list, lnum));
-      edit->buffer_sync.lines[lnum] = line;
+  } else if (pp_strcmp(var_type, type_buffer_open) == 0) {
+    edit->type = COLLAB_BUFFER_OPEN;
+    edit->buffer_open.doc_id = dict_get_cstr(dict, doc_id_key);
+    if (edit->buffer_open.doc_id == NULL) {
+      free(edit);
+      edit = NULL;
     }
-    ppb_var->Release(line_list);
+
+  } else if (pp_strcmp(var_type, type_snapshot) == 0) {
+    edit->type = COLLAB_SNAPSHOT;
+    // No revision when the model has changes that aren't saved yet.
+    edit->snapshot.revision = dict_get_cstr(dict, revision_key);
 
   } else {
     // Unknown collabtype_T
@@ -255,6 +335,32 @@ collabedit_T * collabedit_from_ppvar(struct PP_Var dict) {
   return edit;
 }
 
+/*
+ * Edits from vim's main thread waiting to be sent to JS.
+ */
+static editring_T outbound_ring;
+
+/*
+ * Sends all NaCL -> JS edits. Building the messages here keeps their cost off
+ * vim's main thread, which only pushes edits onto 'outbound_ring'.
+ * Unused parameter so this function can be used with pthreads.
+ */
+static void* js_sendloop(void *unused) {
+  collabedit_T edit;
+  while (1) {
+    collab_ring_pop(&outbound_ring, &edit);
+    // Turn edit into a PP_Var.
+    struct PP_Var dict = ppvar_from_collabedit(&edit);
+    // Send the message to JS.
+    ppb_msg->PostMessage(pp_ins, dict);
+    // Clean up leftovers.
+    ppb_var->Release(dict);
+    collab_ring_done(&outbound_ring, &edit);
+  }
+  // Never reached.
+  return NULL;
+}
+
 /*
  * Waits for and handles all JS -> NaCL messages.
  * Unused parameter so this function can be used with pthreads. It seems that
@@ -285,12 +391,8 @@ static void* js_msgloop(void *unused) {
  * model via Pepper messaging.
  */
 void collab_remoteapply(collabedit_T *edit) {
-  // Turn edit into a PP_Var.
-  struct PP_Var dict = ppvar_from_collabedit(edit);
-  // Send the message to JS.
-  ppb_msg->PostMessage(pp_ins, dict);
-  // Clean up leftovers.
-  ppb_var->Release(dict);
+  // The sender thread turns the edit into a message, see js_sendloop().
+  collab_ring_push(&outbound_ring, edit);
 }
 
 int ppb_var_init() {
@@ -310,10 +412,14 @@ int ppb_var_init() {
   type_append_line = UTF8_TO_VAR("append_line");
   type_insert_text = UTF8_TO_VAR("insert_text");
   type_remove_line = UTF8_TO_VAR("remove_line");
+  type_remove_lines = UTF8_TO_VAR("remove_lines");
   type_delete_text = UTF8_TO_VAR("delete_text");
   type_buffer_sync = UTF8_TO_VAR("buffer_sync");
   type_cursor_move = UTF8_TO_VAR("cursor_move");
   type_replace_line = UTF8_TO_VAR("replace_line");
+  type_buffer_open = UTF8_TO_VAR("buffer_open");
+  type_snapshot = UTF8_TO_VAR("snapshot");
+  type_buffer_close = UTF8_TO_VAR("buffer_close");
   type_key = UTF8_TO_VAR("collabedit_type");
   buf_id_key = UTF8_TO_VAR("buf_id");
   line_key = UTF8_TO_VAR("line");
@@ -324,6 +430,8 @@ int ppb_var_init() {
   lines_key = UTF8_TO_VAR("lines");
   user_id_key = UTF8_TO_VAR("user_id");
   column_key = UTF8_TO_VAR("column");
+  doc_id_key = UTF8_TO_VAR("doc_id");
+  revision_key = UTF8_TO_VAR("revision");
 
   return 0;
 }
@@ -338,10 +446,21 @@ int nacl_main(int argc, char* argv[]) {
   if (ppb_var_init())
     return 2;
 
+  // Cached snapshots of documents are kept on the persistent filesystem.
+  // Without it documents are simply loaded from Realtime every time.
+  if (mount("", "/persistent", "html5fs", 0, "type=PERSISTENT") == 0 &&
+      (mkdir(SNAPSHOT_DIR, 0777) == 0 || errno == EEXIST))
+    collab_set_snapshot_dir(SNAPSHOT_DIR);
+
   // Start up message handler loop
   pthread_t looper;
   pthread_create(&looper, NULL, &js_msgloop, NULL);
 
+  // Start up the thread sending edits to JS.
+  collab_ring_init(&outbound_ring);
+  pthread_t sender;
+  pthread_create(&sender, NULL, &js_sendloop, NULL);
+
   // Tell JS and Realtime that Vim is ready to receive the init file.
   collabedit_T sync = { .type = COLLAB_BUFFER_SYNC, .buf_id = 0 };
   collab_remoteapply(&sync);
@@ -281,8 +281,10 @@ rtclient.RealtimeLoader = function(options) {
  * Redirects the browser back to the current page with an appropriate file ID.
  * @param fileIds {Array.} the IDs of the files to open.
  * @param userId {string} the ID of the user.
+ * @param opt_loadIds {Array.} the IDs of the files to load, if only some of
+ *    'fileIds' aren't loaded yet. Defaults to all of 'fileIds'.
  */
-rtclient.RealtimeLoader.prototype.redirectTo = function(fileIds, userId) {
+rtclient.RealtimeLoader.prototype.redirectTo = function(fileIds, userId, opt_loadIds) {
   var params = [];
   if (fileIds) {
     params.push('fileIds=' + fileIds.join(','));
@@ -301,12 +303,25 @@ rtclient.RealtimeLoader.prototype.redirectTo = function(fileIds, userId) {
   }
   // We are still here that means the page didn't reload.
   rtclient.params = rtclient.getParams();
-  for (var index in fileIds) {
-    gapi.drive.realtime.load(fileIds[index], this.onFileLoaded, this.initializeModel, this.handleErrors.bind(this));
+  var loadIds = opt_loadIds || fileIds;
+  for (var index in loadIds) {
+    this.loadFile(loadIds[index]);
   }
 }
 
 
+/**
+ * Loads a Realtime file. The "onFileLoaded" callback is passed the document
+ * and 'fileId'.
+ * @param fileId {string} the ID of the file to load.
+ */
+rtclient.RealtimeLoader.prototype.loadFile = function(fileId) {
+  var onFileLoaded = this.onFileLoaded;
+  gapi.drive.realtime.load(fileId, function(doc) { onFileLoaded(doc, fileId); },
+      this.initializeModel, this.handleErrors.bind(this));
+}
+
+
 /**
  * Starts the loader by authorizing.
  */
@@ -360,7 +375,7 @@ rtclient.RealtimeLoader.prototype.load = function() {
   // We have file IDs in the query parameters, so we will use them to load a file.
   if (fileIds) {
     for (var index in fileIds) {
-      gapi.drive.realtime.load(fileIds[index], this.onFileLoaded, this.initializeModel, this.handleErrors.bind(this));
+      this.loadFile(fileIds[index]);
     }
     return;
   }
@@ -115,10 +115,14 @@ var rtvim =  rtvim || {};
 var TYPE_APPEND_LINE = 'append_line';
 var TYPE_INSERT_TEXT = 'insert_text';
 var TYPE_REMOVE_LINE = 'remove_line';
+var TYPE_REMOVE_LINES = 'remove_lines';
 var TYPE_DELETE_TEXT = 'delete_text';
 var TYPE_BUFFER_SYNC = 'buffer_sync';
 var TYPE_CURSOR_MOVE = 'cursor_move';
 var TYPE_REPLACE_LINE = 'replace_line';
+var TYPE_BUFFER_OPEN = 'buffer_open';
+var TYPE_SNAPSHOT = 'snapshot';
+var TYPE_BUFFER_CLOSE = 'buffer_close';
 var TYPE_KEY = 'collabedit_type';
 var BUF_ID_KEY = 'buf_id';
 var LINE_KEY = 'line';
@@ -129,12 +133,8 @@ var LENGTH_KEY = 'length';
 var FILENAME_KEY = 'filename';
 var LINES_KEY = 'lines';
 var USER_ID_KEY = 'user_id';
-
-/**
- * The index cache for tracking recently used lines.
- * @type {IndexCache}
- */
-rtvim.lcache = null;
+var DOC_ID_KEY = 'doc_id';
+var REVISION_KEY = 'revision';
 
 /**
  * The Realtime client.
@@ -143,18 +143,160 @@ rtvim.lcache = null;
 rtvim.realtimeLoader = null;
 
 /**
- * The Realtime document.
- * @type {gapi.drive.realtime.Document}
+ * A Realtime document and the sync state of the Vim buffer it is shown in.
+ * @param {number} bufId The ID of the Vim buffer.
+ * @param {string} docId The Drive file ID of the document.
+ * @constructor
  */
-rtvim.doc = null;
+rtvim.Buffer = function(bufId, docId) {
+  /**
+   * The ID of the Vim buffer, used as the buf_id of collabedit messages.
+   * @type {number}
+   */
+  this.bufId = bufId;
+
+  /**
+   * The Drive file ID of the document.
+   * @type {string}
+   */
+  this.docId = docId;
+
+  /**
+   * The Realtime document, or null while it is loading.
+   * @type {gapi.drive.realtime.Document}
+   */
+  this.doc = null;
+
+  /**
+   * The index cache for tracking recently used lines.
+   * @type {IndexCache}
+   */
+  this.lcache = null;
+
+  /**
+   * A flag indicating if Vim needs a file sync message. It is not certain
+   * whether the Realtime document or the Vim buffer will be ready to
+   * send/receive data first.
+   * @type {boolean}
+   */
+  this.needSync = false;
+
+  /**
+   * The model revision of the cached snapshot Vim shows for the document, or
+   * null if Vim has no snapshot.
+   * @type {?string}
+   */
+  this.cachedRevision = null;
+
+  /**
+   * A flag indicating if the Realtime model has changes that aren't saved yet.
+   * @type {boolean}
+   */
+  this.savePending = false;
+}
 
 /**
- * A flag indicating if Vim needs a file sync message. It is not certain whether
- * the Realtime document or Vim will be ready to send/receive data first. See
- * where this variable is set for further explanation.
+ * Creates a collabedit message for this buffer.
+ * @param {string} type The collabedit type.
+ * @return {object} The message.
+ */
+rtvim.Buffer.prototype.newCollabedit = function(type) {
+  var collabedit = {};
+  collabedit[TYPE_KEY] = type;
+  collabedit[BUF_ID_KEY] = this.bufId;
+  return collabedit;
+}
+
+/**
+ * The open documents, indexed by the ID of their Vim buffer. The IDs of
+ * closed documents are null until they are reused.
+ * @type {Array.<rtvim.Buffer>}
+ */
+rtvim.buffers = [];
+
+/**
+ * A flag indicating if Vim is ready to receive documents.
  * @type {boolean}
  */
-rtvim.needSync = false;
+rtvim.vimReady = false;
+
+/**
+ * The ID of the buffer the local user's cursor was last seen in.
+ * @type {number}
+ */
+rtvim.activeBufId = 0;
+
+/**
+ * Returns the buffer showing the document 'docId', creating one with the
+ * lowest free buffer ID if the document isn't open yet.
+ * @param {string} docId The Drive file ID of the document.
+ * @return {rtvim.Buffer}
+ */
+rtvim.openBuffer = function(docId) {
+  var freeId = rtvim.buffers.length;
+  for (var i = rtvim.buffers.length - 1; i >= 0; --i) {
+    if (!rtvim.buffers[i])
+      freeId = i;
+    else if (rtvim.buffers[i].docId == docId)
+      return rtvim.buffers[i];
+  }
+  var buffer = new rtvim.Buffer(freeId, docId);
+  rtvim.buffers[freeId] = buffer;
+  if (rtvim.vimReady)
+    rtvim.sendOpen(buffer);
+  return buffer;
+}
+
+/**
+ * Tells Vim about a document being opened, so that it can show a cached
+ * snapshot of the document while it loads.
+ * @param {rtvim.Buffer} buffer The buffer of the document.
+ */
+rtvim.sendOpen = function(buffer) {
+  var collabedit = buffer.newCollabedit(TYPE_BUFFER_OPEN);
+  collabedit[DOC_ID_KEY] = buffer.docId;
+  rtvim.postMessage(collabedit);
+}
+
+/**
+ * Closes the document of a buffer Vim has wiped, freeing its buffer ID.
+ * @param {number} bufId The ID of the wiped buffer.
+ */
+rtvim.closeBuffer = function(bufId) {
+  var buffer = rtvim.buffers[bufId];
+  if (!buffer)
+    return;
+  if (buffer.doc)
+    buffer.doc.close();
+  rtvim.buffers[bufId] = null;
+  // Keep only the documents still open in the URL.
+  var fileIds = rtvim.getDocIds().filter(function(id) {
+    return id != buffer.docId;
+  });
+  rtvim.realtimeLoader.redirectTo(fileIds,
+      rtvim.realtimeLoader.authorizer.userId, []);
+}
+
+/**
+ * Returns the Drive file IDs of all documents in the URL.
+ * @return {Array.<string>}
+ */
+rtvim.getDocIds = function() {
+  var fileIds = rtclient.params['fileIds'];
+  return fileIds ? fileIds.split(',') : [];
+}
+
+/**
+ * Returns the buffer that the user is working in, or null if no document is
+ * open.
+ * @return {rtvim.Buffer}
+ */
+rtvim.activeBuffer = function() {
+  var buffer = rtvim.buffers[rtvim.activeBufId];
+  for (var i = 0; !buffer && i < rtvim.buffers.length; ++i)
+    buffer = rtvim.buffers[i];
+  return buffer || null;
+}
 
 /**
  * Prompt the user for a new filename. Creates and then opens the new file.
@@ -168,7 +310,8 @@ rtvim.createInDrive = function() {
 }
 
 /**
- * Opens a Drive Realtime file.
+ * Opens a Drive Realtime file in a new Vim buffer. Documents that are open
+ * already stay open.
  * @param {object} opt_file A file to open in Vim. If not provided, a Drive
  *    dialog will be presented to the user to select a file.
  */
@@ -190,28 +333,33 @@ rtvim.openFromDrive = function(opt_file) {
     picker.setVisible(true);
     return;
   }
-  // Disable buttons for opening files
-  document.getElementById('createButton').disabled = true;
-  document.getElementById('openButton').disabled = true;
   // Enable sharing button
   document.getElementById('shareButton').disabled = false;
 
-  rtvim.realtimeLoader.redirectTo([opt_file.id],
-      rtvim.realtimeLoader.authorizer.userId);
+  var fileIds = rtvim.getDocIds();
+  if (fileIds.indexOf(opt_file.id) >= 0)
+    return;
+  rtvim.openBuffer(opt_file.id);
+  fileIds.push(opt_file.id);
+  rtvim.realtimeLoader.redirectTo(fileIds,
+      rtvim.realtimeLoader.authorizer.userId, [opt_file.id]);
 }
 
 /**
- * Presents the Drive sharing dialog to the user.
+ * Presents the Drive sharing dialog to the user for the document being
+ * worked on.
  */
 rtvim.shareDocument = function () {
+  var buffer = rtvim.activeBuffer();
+  if (!buffer)
+    return;
   var shareClient = new gapi.drive.share.ShareClient(rtvim.rtOptions.appId);
-  shareClient.setItemIds(rtclient.params['fileIds'].split(','));
+  shareClient.setItemIds([buffer.docId]);
   shareClient.showSettingsDialog();
 }
 
 /**
- * Handles incoming messages from NaCl. The 'this' variable refers to the
- * Realtime document.
+ * Handles incoming messages from NaCl.
  * @param {object} msg A NaCl message.
  * @return {boolean} True if the message was consumed, otherwise false.
  */
@@ -219,26 +367,58 @@ rtvim.applyLocalEdit = function(msg) {
   // Skip anything that doesn't look like a collabedit message.
   if (!msg.data || !msg.data[TYPE_KEY]) return false;
   var collabedit = msg.data;
+  var buffer = rtvim.buffers[collabedit[BUF_ID_KEY]];
   if (collabedit[TYPE_KEY] == TYPE_BUFFER_SYNC) {
+    if (!rtvim.vimReady) {
+      // The first sync request tells that Vim has started. Open the documents
+      // that were registered in the meantime.
+      rtvim.vimReady = true;
+      for (var i = 0; i < rtvim.buffers.length; ++i) {
+        if (rtvim.buffers[i])
+          rtvim.sendOpen(rtvim.buffers[i]);
+      }
+      return true;
+    }
+    if (!buffer) return true;
     // Only sync if the Realtime Document has been loaded. If Realtime
     // isn't yet ready, it will sync once the file loads.
-    rtvim.needSync = true;
-    if (rtvim.doc) rtvim.syncModel(rtvim.doc);
+    buffer.needSync = true;
+    buffer.cachedRevision = collabedit[REVISION_KEY] || null;
+    if (buffer.doc) rtvim.syncModel(buffer);
+    return true;
+  }
+  if (collabedit[TYPE_KEY] == TYPE_BUFFER_CLOSE) {
+    rtvim.closeBuffer(collabedit[BUF_ID_KEY]);
+    return true;
+  }
+  if (collabedit[TYPE_KEY] == TYPE_SNAPSHOT) {
+    // Vim may only cache the buffer when it matches a saved revision.
+    var reply = {};
+    reply[TYPE_KEY] = TYPE_SNAPSHOT;
+    reply[BUF_ID_KEY] = collabedit[BUF_ID_KEY];
+    if (buffer && buffer.doc && !buffer.savePending)
+      reply[REVISION_KEY] = rtvim.getRevision(buffer.doc);
+    rtvim.postMessage(reply);
     return true;
   }
   // Skip processing if document hasn't been loaded yet.
-  if (!rtvim.doc) return true;
-  var rtLines = this.getModel().getRoot().get('vimlines');
+  if (!buffer || !buffer.doc) return true;
+  var doc = buffer.doc;
+  var rtLines = doc.getModel().getRoot().get('vimlines');
   // Modify the realtime model on behalf of the vim user.
   // Remember, collabedit line numbers start at 1, NOT 0!
   if (collabedit[TYPE_KEY] == TYPE_CURSOR_MOVE) {
+    if (rtvim.activeBufId != buffer.bufId) {
+      rtvim.activeBufId = buffer.bufId;
+      rtvim.updateUi();
+    }
     // Update local user's cursor position for collaborators.
-    var cursors = this.getModel().getRoot().get('cursors');
+    var cursors = doc.getModel().getRoot().get('cursors');
     var userId = '';
     // Find local user's user ID.
-    for (var i = 0; i < this.getCollaborators().length; i++) {
-      if (this.getCollaborators()[i].isMe) {
-        userId = this.getCollaborators()[i].userId;
+    for (var i = 0; i < doc.getCollaborators().length; i++) {
+      if (doc.getCollaborators()[i].isMe) {
+        userId = doc.getCollaborators()[i].userId;
         break;
       }
     }
@@ -249,16 +429,17 @@ rtvim.applyLocalEdit = function(msg) {
 
   } else if (collabedit[TYPE_KEY] == TYPE_APPEND_LINE) {
     // Create new collaborative string and assign event listeners.
-    var lineString = this.getModel().createString(collabedit[TEXT_KEY]);
-    lineString.addEventListener(gapi.drive.realtime.EventType.TEXT_INSERTED,
-      rtvim.onTextInserted.bind(lineString));
-    lineString.addEventListener(gapi.drive.realtime.EventType.TEXT_DELETED,
-      rtvim.onTextDeleted.bind(lineString));
+    var lineString = doc.getModel().createString(collabedit[TEXT_KEY]);
+    rtvim.addLineListeners(buffer, lineString);
     rtLines.insert(collabedit[LINE_KEY], lineString);
 
   } else if (collabedit[TYPE_KEY] == TYPE_REMOVE_LINE) {
     rtLines.remove(collabedit[LINE_KEY] - 1);
 
+  } else if (collabedit[TYPE_KEY] == TYPE_REMOVE_LINES) {
+    var start = collabedit[LINE_KEY] - 1;
+    rtLines.removeRange(start, start + collabedit[LENGTH_KEY]);
+
   } else if (collabedit[TYPE_KEY] == TYPE_INSERT_TEXT) {
     rtLines.get(collabedit[LINE_KEY] - 1)
        .insertString(collabedit[INDEX_KEY], collabedit[TEXT_KEY]);
@@ -297,45 +478,68 @@ rtvim.initializeModel = function(model) {
 }
 
 /**
- * Called when the Realtime file has been loaded. Initializes event handlers.
+ * Listens for text edits of a line of a document.
+ * @param {rtvim.Buffer} buffer The buffer of the document.
+ * @param {gapi.drive.realtime.CollaborativeString} line The line.
+ */
+rtvim.addLineListeners = function(buffer, line) {
+  line.addEventListener(gapi.drive.realtime.EventType.TEXT_INSERTED,
+    rtvim.onTextInserted.bind(line, buffer));
+  line.addEventListener(gapi.drive.realtime.EventType.TEXT_DELETED,
+    rtvim.onTextDeleted.bind(line, buffer));
+}
+
+/**
+ * Called when a Realtime file has been loaded. Initializes event handlers.
  * @param doc {gapi.drive.realtime.Document} the Realtime document.
+ * @param fileId {string} the Drive file ID of the document.
  */
-rtvim.onFileLoaded = function(doc) {
-  rtvim.doc = doc;
+rtvim.onFileLoaded = function(doc, fileId) {
+  // The buffer may have been wiped in Vim while the document was loading.
+  if (rtvim.getDocIds().indexOf(fileId) < 0) {
+    doc.close();
+    return;
+  }
+  var buffer = rtvim.openBuffer(fileId);
+  buffer.doc = doc;
   // Enable the share button
   document.getElementById('shareButton').disabled = false;
   // Set up model event listeners
   var lines = doc.getModel().getRoot().get('vimlines');
-  lines.addEventListener(gapi.drive.realtime.EventType.VALUES_ADDED, rtvim.onLineAdded);
-  lines.addEventListener(gapi.drive.realtime.EventType.VALUES_REMOVED, rtvim.onLineRemoved);
+  lines.addEventListener(gapi.drive.realtime.EventType.VALUES_ADDED,
+    rtvim.onLineAdded.bind(null, buffer));
+  lines.addEventListener(gapi.drive.realtime.EventType.VALUES_REMOVED,
+    rtvim.onLineRemoved.bind(null, buffer));
   var cursors = doc.getModel().getRoot().get('cursors');
-  cursors.addEventListener(gapi.drive.realtime.EventType.VALUE_CHANGED, rtvim.onCursorChanged);
+  cursors.addEventListener(gapi.drive.realtime.EventType.VALUE_CHANGED,
+    rtvim.onCursorChanged.bind(null, buffer));
+  doc.addEventListener(gapi.drive.realtime.EventType.DOCUMENT_SAVE_STATE_CHANGED,
+    function(ev) { buffer.savePending = ev.isPending || ev.isSaving; });
   // Make sure there is at least one line in the doc. In Vim, an empty file has
   // one empty line.
   if (lines.length == 0) {
     doc.getModel().getRoot().get('vimlines').push(doc.getModel().createString(''));
   }
   for (var i = 0; i < lines.length; i++) {
-    var line = lines.get(i);
-    line.addEventListener(gapi.drive.realtime.EventType.TEXT_INSERTED,
-      rtvim.onTextInserted.bind(line));
-    line.addEventListener(gapi.drive.realtime.EventType.TEXT_DELETED,
-      rtvim.onTextDeleted.bind(line));
+    rtvim.addLineListeners(buffer, lines.get(i));
   }
   // Set up cache for line numbers
-  rtvim.lcache = new IndexCache(lines);
-  if (rtvim.needSync)
-    rtvim.syncModel(doc);
+  buffer.lcache = new IndexCache(lines);
+  if (buffer.needSync)
+    rtvim.syncModel(buffer);
   // Set up UI listeners
   doc.addEventListener(gapi.drive.realtime.EventType.COLLABORATOR_JOINED, rtvim.updateUi);
   doc.addEventListener(gapi.drive.realtime.EventType.COLLABORATOR_LEFT, rtvim.updateUi);
+  rtvim.updateUi();
 }
 
 /**
- * Updates icons for all connected collaborators.
+ * Updates icons for all collaborators connected to the document being worked
+ * on.
  */
 rtvim.updateUi = function() {
-  var collaborators = rtvim.doc.getCollaborators();
+  var buffer = rtvim.activeBuffer();
+  var collaborators = buffer && buffer.doc ? buffer.doc.getCollaborators() : [];
   var collabDiv = document.getElementById('collaborators');
   // Clear existing display images.
   collabDiv.innerHTML = '';
@@ -360,15 +564,33 @@ rtvim.postMessage = function(msg) {
   foreground_process.postMessage(msg);
 }
 
+/**
+ * Returns the server revision of the Realtime model as a string.
+ * @param {gapi.drive.realtime.Document} rtdoc The Realtime Document.
+ * @return {string}
+ */
+rtvim.getRevision = function(rtdoc) {
+  return String(rtdoc.getModel().serverRevision);
+}
+
 /**
  * Sends messages to Vim to sync the Realtime model with the file buffer.
- * @param {gapi.drive.realtime.Document} rtdoc The Realtime Document to sync.
+ * When Vim already shows a cached snapshot at the current revision the lines
+ * are left out.
+ * @param {rtvim.Buffer} buffer The buffer whose document to sync.
  */
-rtvim.syncModel = function(rtdoc) {
-  var collabedit = {};
-  collabedit[TYPE_KEY] = TYPE_BUFFER_SYNC;
-  collabedit[BUF_ID_KEY] = 0;
-  collabedit[FILENAME_KEY] = 'Collaborative File';
+rtvim.syncModel = function(buffer) {
+  var rtdoc = buffer.doc;
+  var collabedit = buffer.newCollabedit(TYPE_BUFFER_SYNC);
+  collabedit[FILENAME_KEY] = 'Collaborative File ' + buffer.bufId;
+  collabedit[DOC_ID_KEY] = buffer.docId;
+  var revision = rtvim.getRevision(rtdoc);
+  collabedit[REVISION_KEY] = revision;
+  if (revision == buffer.cachedRevision && !buffer.savePending) {
+    rtvim.postMessage(collabedit);
+    buffer.needSync = false;
+    return;
+  }
 
   var doc_lines = rtdoc.getModel().getRoot().get('vimlines');
   var lines = new Array(doc_lines.length);
@@ -377,20 +599,19 @@ rtvim.syncModel = function(rtdoc) {
   }
   collabedit[LINES_KEY] = lines;
   rtvim.postMessage(collabedit);
-  rtvim.needSync = false;
+  buffer.needSync = false;
 }
 
 /**
  * Sends an updated collaborator cursor position to Vim.
+ * @param {rtvim.Buffer} buffer The buffer of the document.
  * @param {gapi.drive.realtime.ValueChangedEvent} ev The event setting the new
  *   cursor position.
  */
-rtvim.onCursorChanged = function(ev) {
+rtvim.onCursorChanged = function(buffer, ev) {
   if (ev.isLocal)
     return;
-  var collabedit = {};
-  collabedit[TYPE_KEY] = TYPE_CURSOR_MOVE;
-  collabedit[BUF_ID_KEY] = 0;
+  var collabedit = buffer.newCollabedit(TYPE_CURSOR_MOVE);
   collabedit[USER_ID_KEY] = ev.property;
   var pos = ev.newValue.split(',');
   collabedit[LINE_KEY] = parseInt(pos[0]);
@@ -401,28 +622,24 @@ rtvim.onCursorChanged = function(ev) {
 
 /**
  * Sends an append line event to Vim.
+ * @param {rtvim.Buffer} buffer The buffer of the document.
  * @param {gapi.drive.realtime.ValuesAddedEvent} ev The Realtime to send.
  */
-rtvim.onLineAdded = function(ev) {
+rtvim.onLineAdded = function(buffer, ev) {
   // This event may contain more than 1 added line
   var lines = ev.values;
   var lnum = ev.index;
   // Update the indices of cached lines
-  rtvim.lcache.shiftFrom(lnum, lines.length);
+  buffer.lcache.shiftFrom(lnum, lines.length);
   // Don't send events to Vim that are caused by its own edits
   if (ev.isLocal)
     return;
   // Construct collabedit messages to pass to Vim
   for (var i = 0; i < lines.length; i++) {
     // Add event listeners to the new line's CollaborativeString
-    lines[i].addEventListener(gapi.drive.realtime.EventType.TEXT_INSERTED,
-      rtvim.onTextInserted.bind(lines[i]));
-    lines[i].addEventListener(gapi.drive.realtime.EventType.TEXT_DELETED,
-      rtvim.onTextDeleted.bind(lines[i]));
-
-    var collabedit = {};
-    collabedit[TYPE_KEY] = TYPE_APPEND_LINE;
-    collabedit[BUF_ID_KEY] = 0;
+    rtvim.addLineListeners(buffer, lines[i]);
+
+    var collabedit = buffer.newCollabedit(TYPE_APPEND_LINE);
     collabedit[LINE_KEY] = lnum + i;
     collabedit[TEXT_KEY] = lines[i].toString();
     // Let Vim know about the update
@@ -432,41 +649,42 @@ rtvim.onLineAdded = function(ev) {
 
 /**
  * Sends a remove line event to Vim.
+ * @param {rtvim.Buffer} buffer The buffer of the document.
  * @param {gapi.drive.realtime.ValuesRemovedEvent} ev The Realtime to send.
  */
-rtvim.onLineRemoved = function(ev) {
+rtvim.onLineRemoved = function(buffer, ev) {
   // This event may contain more than 1 removed line
   var lnum = ev.index;
   // Update the indices of cached lines
-  rtvim.lcache.shiftFrom(lnum, -ev.values.length);
+  buffer.lcache.shiftFrom(lnum, -ev.values.length);
   // Don't send events to Vim that are caused by its own edits
   if (ev.isLocal)
     return;
-  // Construct collabedit messages to pass to Vim
-  for (var i = 0; i < ev.values.length; i++) {
-    var collabedit = {};
-    collabedit[TYPE_KEY] = TYPE_REMOVE_LINE;
-    collabedit[BUF_ID_KEY] = 0;
-    collabedit[LINE_KEY] = lnum + 1;
-    // Let Vim know about the update
-    rtvim.postMessage(collabedit);
+  // Let Vim know about the update, with one message for all lines
+  var collabedit;
+  if (ev.values.length == 1) {
+    collabedit = buffer.newCollabedit(TYPE_REMOVE_LINE);
+  } else {
+    collabedit = buffer.newCollabedit(TYPE_REMOVE_LINES);
+    collabedit[LENGTH_KEY] = ev.values.length;
   }
+  collabedit[LINE_KEY] = lnum + 1;
+  rtvim.postMessage(collabedit);
 }
 
 /**
  * Sends an insert text event to Vim. The 'this' var refers to the
  * CollaborativeString that was modified.
+ * @param {rtvim.Buffer} buffer The buffer of the document.
  * @param {gapi.drive.realtime.TextInsertedEvent} ev The Realtime to send.
  */
-rtvim.onTextInserted = function(ev) {
+rtvim.onTextInserted = function(buffer, ev) {
   // Ignore local events caused by our own edits
   if (ev.isLocal)
     return;
-  var lnum = rtvim.lcache.indexOf(this);
+  var lnum = buffer.lcache.indexOf(this);
   // Construct collabedit messages to pass to Vim
-  var collabedit = {};
-  collabedit[TYPE_KEY] = TYPE_INSERT_TEXT;
-  collabedit[BUF_ID_KEY] = 0;
+  var collabedit = buffer.newCollabedit(TYPE_INSERT_TEXT);
   collabedit[LINE_KEY] = lnum + 1;
   collabedit[INDEX_KEY] = ev.index;
   collabedit[TEXT_KEY] = ev.text;
@@ -477,17 +695,16 @@ rtvim.onTextInserted = function(ev) {
 /**
  * Sends a delete text event to Vim. The 'this' var refers to the
  * CollaborativeString that was modified.
+ * @param {rtvim.Buffer} buffer The buffer of the document.
  * @param {gapi.drive.realtime.TextInsertedEvent} ev The Realtime to send.
  */
-rtvim.onTextDeleted = function(ev) {
+rtvim.onTextDeleted = function(buffer, ev) {
   // Ignore local events caused by our own edits
   if (ev.isLocal)
     return;
-  var lnum = rtvim.lcache.indexOf(this);
+  var lnum = buffer.lcache.indexOf(this);
   // Construct collabedit messages to pass to Vim
-  var collabedit = {};
-  collabedit[TYPE_KEY] = TYPE_DELETE_TEXT;
-  collabedit[BUF_ID_KEY] = 0;
+  var collabedit = buffer.newCollabedit(TYPE_DELETE_TEXT);
   collabedit[LINE_KEY] = lnum + 1;
   collabedit[INDEX_KEY] = ev.index;
   collabedit[LENGTH_KEY] = ev.text.length;
@@ -562,11 +779,17 @@ document.addEventListener('DOMContentLoaded', function(event) {
   var termHandleMessage = NaClTerm.prototype.handleMessage_;
   NaClTerm.prototype.handleMessage_= function(e) {
     // Attempt processing the message as a collaborative edit.
-    var processed = rtvim.applyLocalEdit.apply(rtvim.doc, arguments);
+    var processed = rtvim.applyLocalEdit.apply(null, arguments);
     // If message wasn't recognised by this code, send to NaClTerm.
     if (!processed) termHandleMessage.apply(this, arguments);
   };
 
+  // Give the documents in the URL their buffers before they load, so that Vim
+  // can show cached snapshots of them.
+  var fileIds = rtvim.getDocIds();
+  for (var i = 0; i < fileIds.length; ++i)
+    rtvim.openBuffer(fileIds[i]);
+
   // Start realtime.
   rtvim.startRealtime();
 